@@ -3,6 +3,7 @@
 cbuffer cbLightInfo : register( b1 )
 {
     uint light_idx;
+    uint cascade_idx;
 }
 
 #define PER_PASS_CB_BINDING b2
@@ -22,22 +23,19 @@ struct GSOutput
 };
 
 
-[maxvertexcount(3 * MAX_CASCADE_SIZE)]
+[maxvertexcount(3)]
 void main( triangle GSInput input[3], 
            inout TriangleStream<GSOutput> output )
 {
+    // casters are culled per cascade on cpu, so every draw goes to a single slice
     ParallelLight light = pass_params.parallel_lights[light_idx];
-    for ( int split_idx = 0; split_idx < light.csm_num_split_positions + 1; ++split_idx )
+    float4x4 shadow_mat = light.shadow_map_mat[cascade_idx];
+    for (uint i = 0; i < 3; i++)
     {
-        float4x4 shadow_mat = light.shadow_map_mat[split_idx];
-        output.RestartStrip();
-        for (uint i = 0; i < 3; i++)
-        {
-            GSOutput element;
-            element.pos = mul( input[i].pos_v, shadow_mat ); 
-            element.uv = input[i].uv;
-            element.split_idx = split_idx;
-            output.Append(element);
-        }
+        GSOutput element;
+        element.pos = mul( input[i].pos_v, shadow_mat ); 
+        element.uv = input[i].uv;
+        element.split_idx = cascade_idx;
+        output.Append(element);
     }
 }
\ No newline at end of file
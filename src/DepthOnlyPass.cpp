@@ -69,14 +69,15 @@ void DepthOnlyPass::Draw( const Context& context )
     m_cmd_list->OMSetRenderTargets( 0, nullptr, false, &context.depth_stencil_view );
     m_cmd_list->SetGraphicsRootConstantBufferView( 2, context.pass_cbv );
 
+    m_cmd_list->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+
     for ( const auto& render_item : context.renderitems )
     {
-        m_cmd_list->SetGraphicsRootConstantBufferView( 0, render_item.tf_addr );
-        m_cmd_list->SetGraphicsRootDescriptorTable( 1, render_item.mat_table );
+        m_draw_state.SetGraphicsRootConstantBufferView( 0, render_item.tf_addr );
+        m_draw_state.SetGraphicsRootDescriptorTable( 1, render_item.mat_table );
 
-        m_cmd_list->IASetVertexBuffers( 0, 1, &render_item.vbv );
-        m_cmd_list->IASetIndexBuffer( &render_item.ibv );
-        m_cmd_list->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+        m_draw_state.IASetVertexBuffer( render_item.vbv );
+        m_draw_state.IASetIndexBuffer( render_item.ibv );
         m_cmd_list->DrawIndexedInstanced( render_item.index_count, 1, render_item.index_offset, render_item.vertex_offset, 0 );
     }
 }
@@ -68,6 +68,8 @@ public:
         m_pass.End();
     }
 
+    DrawStateCache::Stats TakeDrawStateStats() noexcept { return m_pass.TakeDrawStateStats(); }
+
 private:
     DepthOnlyPass m_pass;
     DepthOnlyPass::RenderStateID m_state;
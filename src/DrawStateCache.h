@@ -0,0 +1,131 @@
+#pragma once
+
+#include <d3d12.h>
+
+#include <cstdint>
+
+// Filters redundant per-draw bindings while a render pass records its items
+// A root argument or buffer view is emitted only if it differs from the last one set through the cache,
+// so consecutive items sharing a mesh or a material bind them once
+//
+// The cache knows nothing about commands recorded past it, Reset() must be called whenever
+// the command list or the root signature changes (setting a root signature invalidates all root arguments)
+
+class DrawStateCache
+{
+public:
+    static constexpr UINT MaxRootParameters = 16;
+
+    struct Stats
+    {
+        uint32_t emitted = 0;
+        uint32_t skipped = 0;
+
+        Stats& operator+=( const Stats& rhs ) noexcept { emitted += rhs.emitted; skipped += rhs.skipped; return *this; }
+    };
+
+    // forgets all bindings, stats are kept
+    void Reset( ID3D12GraphicsCommandList& cmd_list ) noexcept;
+
+    void SetGraphicsRootConstantBufferView( UINT root_parameter, D3D12_GPU_VIRTUAL_ADDRESS address ) noexcept;
+    void SetGraphicsRootDescriptorTable( UINT root_parameter, D3D12_GPU_DESCRIPTOR_HANDLE table ) noexcept;
+    // slot 0 only, items have a single vertex stream
+    void IASetVertexBuffer( const D3D12_VERTEX_BUFFER_VIEW& vbv ) noexcept;
+    void IASetIndexBuffer( const D3D12_INDEX_BUFFER_VIEW& ibv ) noexcept;
+
+    // returns calls counted since the previous TakeStats and starts counting anew
+    Stats TakeStats() noexcept { const Stats res = m_stats; m_stats = Stats(); return res; }
+
+private:
+    // returns true if the root argument has to be emitted
+    bool UpdateRootArgument( UINT root_parameter, uint64_t value ) noexcept;
+
+    ID3D12GraphicsCommandList* m_cmd_list = nullptr;
+
+    uint64_t m_root_arguments[MaxRootParameters] = {};
+    uint32_t m_bound_root_arguments = 0; // bit i is set if m_root_arguments[i] is bound
+
+    D3D12_VERTEX_BUFFER_VIEW m_vbv = {};
+    D3D12_INDEX_BUFFER_VIEW m_ibv = {};
+    bool m_is_vbv_bound = false;
+    bool m_is_ibv_bound = false;
+
+    Stats m_stats;
+};
+
+
+inline void DrawStateCache::Reset( ID3D12GraphicsCommandList& cmd_list ) noexcept
+{
+    m_cmd_list = &cmd_list;
+    m_bound_root_arguments = 0;
+    m_is_vbv_bound = false;
+    m_is_ibv_bound = false;
+}
+
+
+inline bool DrawStateCache::UpdateRootArgument( UINT root_parameter, uint64_t value ) noexcept
+{
+    assert( root_parameter < MaxRootParameters );
+
+    const uint32_t bit = 1u << root_parameter;
+    if ( ( m_bound_root_arguments & bit ) && m_root_arguments[root_parameter] == value )
+    {
+        m_stats.skipped++;
+        return false;
+    }
+
+    m_root_arguments[root_parameter] = value;
+    m_bound_root_arguments |= bit;
+    m_stats.emitted++;
+    return true;
+}
+
+
+inline void DrawStateCache::SetGraphicsRootConstantBufferView( UINT root_parameter, D3D12_GPU_VIRTUAL_ADDRESS address ) noexcept
+{
+    assert( m_cmd_list );
+    if ( UpdateRootArgument( root_parameter, address ) )
+        m_cmd_list->SetGraphicsRootConstantBufferView( root_parameter, address );
+}
+
+
+inline void DrawStateCache::SetGraphicsRootDescriptorTable( UINT root_parameter, D3D12_GPU_DESCRIPTOR_HANDLE table ) noexcept
+{
+    assert( m_cmd_list );
+    if ( UpdateRootArgument( root_parameter, table.ptr ) )
+        m_cmd_list->SetGraphicsRootDescriptorTable( root_parameter, table );
+}
+
+
+inline void DrawStateCache::IASetVertexBuffer( const D3D12_VERTEX_BUFFER_VIEW& vbv ) noexcept
+{
+    assert( m_cmd_list );
+    if ( m_is_vbv_bound && m_vbv.BufferLocation == vbv.BufferLocation
+         && m_vbv.SizeInBytes == vbv.SizeInBytes && m_vbv.StrideInBytes == vbv.StrideInBytes )
+    {
+        m_stats.skipped++;
+        return;
+    }
+
+    m_vbv = vbv;
+    m_is_vbv_bound = true;
+    m_stats.emitted++;
+    m_cmd_list->IASetVertexBuffers( 0, 1, &vbv );
+}
+
+
+inline void DrawStateCache::IASetIndexBuffer( const D3D12_INDEX_BUFFER_VIEW& ibv ) noexcept
+{
+    assert( m_cmd_list );
+    if ( m_is_ibv_bound && m_ibv.BufferLocation == ibv.BufferLocation
+         && m_ibv.SizeInBytes == ibv.SizeInBytes && m_ibv.Format == ibv.Format )
+    {
+        m_stats.skipped++;
+        return;
+    }
+
+    m_ibv = ibv;
+    m_is_ibv_bound = true;
+    m_stats.emitted++;
+    m_cmd_list->IASetIndexBuffer( &ibv );
+}
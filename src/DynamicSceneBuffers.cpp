@@ -9,6 +9,8 @@
 #include "RenderUtils.h"
 #include "Scene.h"
 
+#include "utils/worker_pool.h"
+
 
 DynamicSceneBuffers::DynamicSceneBuffers( Microsoft::WRL::ComPtr<ID3D12Device> device, Scene* scene, size_t num_bufferized_frames ) noexcept
     : m_device( std::move( device ) ), m_buffers( num_bufferized_frames ), m_scene( scene )
@@ -18,6 +20,8 @@ DynamicSceneBuffers::DynamicSceneBuffers( Microsoft::WRL::ComPtr<ID3D12Device> d
 
 void DynamicSceneBuffers::Update()
 {
+    CollectModifiedItems();
+
     if ( NeedToRebuildBuffer() )
     {
         RebuildBuffer( CurrentBuffer() );
@@ -28,6 +32,9 @@ void DynamicSceneBuffers::Update()
         UpdateBufferContents( CurrentBuffer() );
     }
 
+    const BufferInstance& buffer = CurrentBuffer();
+    m_gpu_address = buffer.gpu_res ? buffer.gpu_res->GetGPUVirtualAddress() : 0;
+
     m_cur_buffer_idx = ( m_cur_buffer_idx + 1 ) % m_buffers.size();
 }
 
@@ -35,6 +42,7 @@ void DynamicSceneBuffers::Update()
 void DynamicSceneBuffers::AddTransform( TransformID id ) noexcept
 {
     InvalidateAllBuffers();
+    SetItemSlot( m_transform_slots, id, m_transforms.size() );
     m_transforms.push_back( TransformData{ id, BufferData{} } );
     m_buffer_size += Utils::CalcConstantBufferByteSize( sizeof( ObjectConstants ) );
 }
@@ -43,6 +51,7 @@ void DynamicSceneBuffers::AddTransform( TransformID id ) noexcept
 void DynamicSceneBuffers::AddMaterial( MaterialID id ) noexcept
 {
     InvalidateAllBuffers();
+    SetItemSlot( m_material_slots, id, m_materials.size() );
     m_materials.push_back( MaterialData{ id, BufferData{} } );
     m_buffer_size += Utils::CalcConstantBufferByteSize( sizeof( MaterialConstants ) );
 }
@@ -54,6 +63,23 @@ void DynamicSceneBuffers::InvalidateAllBuffers() noexcept
 }
 
 
+void DynamicSceneBuffers::CollectModifiedItems()
+{
+    // every buffer has to receive the modification once, when it becomes current
+    const auto modified_tfs = m_scene->ModifiedTransforms();
+    const auto modified_materials = m_scene->ModifiedMaterials();
+    for ( auto& buffer : m_buffers )
+    {
+        buffer.modified_tfs.insert( buffer.modified_tfs.end(), modified_tfs.begin(), modified_tfs.end() );
+        buffer.modified_materials.insert( buffer.modified_materials.end(), modified_materials.begin(), modified_materials.end() );
+    }
+
+    // removed items are dropped on rebuild, which also moves the remaining ones, so all buffers have to be rebuilt
+    if ( ! m_scene->RemovedTransforms().empty() || ! m_scene->RemovedMaterials().empty() )
+        InvalidateAllBuffers();
+}
+
+
 bool DynamicSceneBuffers::NeedToRebuildBuffer() const noexcept
 {
     return m_dirty_buffers_cnt > 0;
@@ -93,13 +119,8 @@ void DynamicSceneBuffers::RebuildBuffer( BufferInstance& buffer )
     }
 
     size_t cur_offset = 0;
-    auto update_tf = [this, &buffer, &cur_offset]( TransformData& transform_data, ObjectTransform& tf )
+    auto update_tf = [this, &buffer, &cur_offset]( TransformData& transform_data, const ObjectTransform& tf )
     {
-        if ( tf.IsDirty() )
-            transform_data.data.dirty_buffers_cnt = m_buffers.size();
-        if ( transform_data.data.dirty_buffers_cnt > 0 )
-            transform_data.data.dirty_buffers_cnt--;
-
         transform_data.data.offset = cur_offset;
 
         constexpr size_t tf_gpu_size = Utils::CalcConstantBufferByteSize( sizeof( ObjectConstants ) );
@@ -109,13 +130,8 @@ void DynamicSceneBuffers::RebuildBuffer( BufferInstance& buffer )
         CopyToBuffer( buffer, transform_data.data, src_data );
     };
 
-    auto update_material = [this, &buffer, &cur_offset]( MaterialData& material_data, MaterialPBR& mat )
+    auto update_material = [this, &buffer, &cur_offset]( MaterialData& material_data, const MaterialPBR& mat )
     {
-        if ( mat.IsDirty() )
-            material_data.data.dirty_buffers_cnt = m_buffers.size();
-        if ( material_data.data.dirty_buffers_cnt > 0 )
-            material_data.data.dirty_buffers_cnt--;
-
         material_data.data.offset = cur_offset;
 
         constexpr size_t material_gpu_size = Utils::CalcConstantBufferByteSize( sizeof( MaterialConstants ) );
@@ -126,39 +142,40 @@ void DynamicSceneBuffers::RebuildBuffer( BufferInstance& buffer )
 
     };
 
-    UpdateAllItems( buffer, update_tf, update_material );
+    UpdateAllItems( update_tf, update_material );
+
+    // whole buffer has just been rewritten
+    buffer.modified_tfs.clear();
+    buffer.modified_materials.clear();
 }
 
 
 void DynamicSceneBuffers::UpdateBufferContents( BufferInstance& buffer )
 {
-    auto update_tf = [this, &buffer]( TransformData& transform_data, ObjectTransform& tf )
+    // a transform modified in several frames is listed several times, and tasks must not write to the same place
+    std::sort( buffer.modified_tfs.begin(), buffer.modified_tfs.end(),
+               []( TransformID lhs, TransformID rhs ) { return std::tie( lhs.idx, lhs.inner_id ) < std::tie( rhs.idx, rhs.inner_id ); } );
+    buffer.modified_tfs.erase( std::unique( buffer.modified_tfs.begin(), buffer.modified_tfs.end() ), buffer.modified_tfs.end() );
+
+    const Scene& scene = *m_scene;
+    constexpr size_t tfs_per_task = 512;
+    parallel_for_each( make_span( std::as_const( buffer.modified_tfs ) ), tfs_per_task, [&]( TransformID tf_id )
     {
-        if ( tf.IsDirty() )
-            transform_data.data.dirty_buffers_cnt = m_buffers.size();
-
-        if ( transform_data.data.dirty_buffers_cnt > 0 )
-        {
-            ObjectConstants src_data = CreateTransformGPUData( tf );
-            CopyToBuffer( buffer, transform_data.data, src_data );
-            transform_data.data.dirty_buffers_cnt--;
-        }
-    };
-
-    auto update_material = [this, &buffer]( MaterialData& material_data, MaterialPBR& mat )
+        const ObjectTransform* tf = scene.AllTransforms().try_get<ObjectTransform>( tf_id );
+        const TransformData* transform_data = FindItemData( m_transforms, m_transform_slots, tf_id );
+        if ( tf && transform_data )
+            CopyToBuffer( buffer, transform_data->data, CreateTransformGPUData( *tf ) );
+    } );
+    buffer.modified_tfs.clear();
+
+    for ( MaterialID mat_id : buffer.modified_materials )
     {
-        if ( mat.IsDirty() )
-            material_data.data.dirty_buffers_cnt = m_buffers.size();
-
-        if ( material_data.data.dirty_buffers_cnt > 0 )
-        {
-            MaterialConstants src_data = CreateMaterialGPUData( mat );
-            CopyToBuffer( buffer, material_data.data, src_data );
-            material_data.data.dirty_buffers_cnt--;
-        }
-    };
-
-    UpdateAllItems( buffer, update_tf, update_material );
+        const MaterialPBR* mat = m_scene->AllMaterials().try_get( mat_id );
+        const MaterialData* material_data = FindItemData( m_materials, m_material_slots, mat_id );
+        if ( mat && material_data )
+            CopyToBuffer( buffer, material_data->data, CreateMaterialGPUData( *mat ) );
+    }
+    buffer.modified_materials.clear();
 }
 
 
@@ -188,17 +205,44 @@ void DynamicSceneBuffers::CopyToBuffer( BufferInstance& buffer, const BufferData
 }
 
 
+template<typename ID>
+void DynamicSceneBuffers::SetItemSlot( std::vector<uint32_t>& item_slots, ID id, size_t item_idx )
+{
+    if ( item_slots.size() <= id.idx )
+        item_slots.resize( id.idx + 1, std::numeric_limits<uint32_t>::max() );
+    item_slots[id.idx] = uint32_t( item_idx );
+}
+
+
+template<typename ItemData, typename ID>
+const ItemData* DynamicSceneBuffers::FindItemData( const std::vector<ItemData>& items, const std::vector<uint32_t>& item_slots, ID id ) noexcept
+{
+    if ( id.idx >= item_slots.size() )
+        return nullptr;
+
+    const uint32_t item_idx = item_slots[id.idx];
+    if ( item_idx >= items.size() || items[item_idx].id != id )
+        return nullptr;
+
+    return &items[item_idx];
+}
+
+
 template<typename fnUseTransform, typename fnUseMaterial>
-void DynamicSceneBuffers::UpdateAllItems( const BufferInstance& buffer, const fnUseTransform& fn_tf, const fnUseMaterial& fn_mat )
+void DynamicSceneBuffers::UpdateAllItems( const fnUseTransform& fn_tf, const fnUseMaterial& fn_mat )
 {
     for ( size_t mat_idx = 0; mat_idx < m_materials.size(); )
     {
         auto& material_data = m_materials[mat_idx];
-        MaterialPBR* mat = m_scene->TryModifyMaterial( material_data.id );
+        // existence checks go through const lookups, only changed offsets are written back
+        const MaterialPBR* mat = m_scene->AllMaterials().try_get( material_data.id );
         if ( ! mat )
         {
             if ( ( mat_idx + 1 ) != m_materials.size() )
+            {
                 material_data = std::move( m_materials.back() );
+                SetItemSlot( m_material_slots, material_data.id, mat_idx );
+            }
             m_materials.pop_back();
             m_buffer_size -= Utils::CalcConstantBufferByteSize( sizeof( MaterialConstants ) );
         }
@@ -206,18 +250,22 @@ void DynamicSceneBuffers::UpdateAllItems( const BufferInstance& buffer, const fn
         {
             mat_idx++;
             fn_mat( material_data, *mat );
-            mat->GPUConstantBuffer() = buffer.gpu_res->GetGPUVirtualAddress() + material_data.data.offset;
+            if ( mat->GPUConstantBuffer() != material_data.data.offset )
+                m_scene->TryModifyMaterial( material_data.id )->GPUConstantBuffer() = material_data.data.offset;
         }
     }
 
     for ( size_t tf_idx = 0; tf_idx < m_transforms.size(); )
     {
         auto& transform_data = m_transforms[tf_idx];
-        ObjectTransform* tf = m_scene->TryModifyTransform( transform_data.id );
+        const ObjectTransform* tf = m_scene->AllTransforms().try_get<ObjectTransform>( transform_data.id );
         if ( ! tf )
         {
             if ( ( tf_idx + 1 ) != m_transforms.size() )
+            {
                 transform_data = std::move( m_transforms.back() );
+                SetItemSlot( m_transform_slots, transform_data.id, tf_idx );
+            }
             m_transforms.pop_back();
             m_buffer_size -= Utils::CalcConstantBufferByteSize( sizeof( ObjectConstants ) );
         }
@@ -225,7 +273,8 @@ void DynamicSceneBuffers::UpdateAllItems( const BufferInstance& buffer, const fn
         {
             tf_idx++;
             fn_tf( transform_data, *tf );
-            tf->GPUView() = buffer.gpu_res->GetGPUVirtualAddress() + transform_data.data.offset;
+            if ( m_scene->AllTransforms().get<D3D12_GPU_VIRTUAL_ADDRESS>( transform_data.id ) != transform_data.data.offset )
+                *m_scene->TryModifyTransformGPUView( transform_data.id ) = transform_data.data.offset;
         }
     }	
 }
@@ -13,6 +13,10 @@ public:
 
     void Update();
 
+    // address of the buffer filled by the last Update, scene items store offsets of their constants in it
+    // every buffer instance has the same layout, so the offsets stay valid when the current buffer changes
+    D3D12_GPU_VIRTUAL_ADDRESS GetGPUAddress() const noexcept { return m_gpu_address; }
+
     void AddTransform( TransformID id ) noexcept;
     void AddMaterial( MaterialID id ) noexcept;
 
@@ -21,7 +25,6 @@ private:
     struct BufferData
     {
         size_t offset;
-        size_t dirty_buffers_cnt;
     };
 
     struct TransformData
@@ -41,18 +44,24 @@ private:
         Microsoft::WRL::ComPtr<ID3D12Resource> gpu_res;
         uint8_t* mapped_data = nullptr;
         size_t capacity = 0;
+
+        // items modified since this buffer has been updated last time
+        std::vector<TransformID> modified_tfs;
+        std::vector<MaterialID> modified_materials;
     };
 
     void InvalidateAllBuffers() noexcept;
+    void CollectModifiedItems();
     bool NeedToRebuildBuffer() const noexcept;
     BufferInstance& CurrentBuffer() noexcept;
 
     void RebuildBuffer( BufferInstance& buffer );
     void UpdateBufferContents( BufferInstance& buffer );
 
-    // fnUse_Item is a functor with void( Item_Data&, Item& ) signature
+    // drops removed items, then calls fn for every item and writes its offset to the scene if it has changed
+    // fnUse_Item is a functor with void( Item_Data&, const Item& ) signature
     template<typename fnUseTransform, typename fnUseMaterial>
-    void UpdateAllItems( const BufferInstance& buffer, const fnUseTransform& fn_tf, const fnUseMaterial& fn_mat );
+    void UpdateAllItems( const fnUseTransform& fn_tf, const fnUseMaterial& fn_mat );
 
     ObjectConstants CreateTransformGPUData( const ObjectTransform& cpu_data ) const noexcept;
     MaterialConstants CreateMaterialGPUData( const MaterialPBR& cpu_data ) const noexcept;
@@ -60,13 +69,22 @@ private:
     template<typename Data>
     void CopyToBuffer( BufferInstance& buffer, const BufferData& dst, const Data& src ) const noexcept;
 
+    // item_slots maps ID::idx to the position of the item data in items
+    template<typename ID>
+    static void SetItemSlot( std::vector<uint32_t>& item_slots, ID id, size_t item_idx );
+    template<typename ItemData, typename ID>
+    static const ItemData* FindItemData( const std::vector<ItemData>& items, const std::vector<uint32_t>& item_slots, ID id ) noexcept;
+
     std::vector<TransformData> m_transforms;
     std::vector<MaterialData> m_materials;
+    std::vector<uint32_t> m_transform_slots;
+    std::vector<uint32_t> m_material_slots;
     
     std::vector<BufferInstance> m_buffers;
     size_t m_buffer_size = 0;
     size_t m_dirty_buffers_cnt = 0;
     size_t m_cur_buffer_idx = 0;
+    D3D12_GPU_VIRTUAL_ADDRESS m_gpu_address = 0;
 
     Microsoft::WRL::ComPtr<ID3D12Device> m_device;
     Scene* m_scene;
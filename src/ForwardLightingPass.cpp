@@ -100,11 +100,11 @@ void ForwardLightingPass::Draw( const Context& context ) noexcept
 
     for ( const auto& render_item : context.renderitems )
     {
-        m_cmd_list->SetGraphicsRootConstantBufferView( 0, render_item.tf_addr );
-        m_cmd_list->SetGraphicsRootConstantBufferView( 1, render_item.mat_cb );
-        m_cmd_list->SetGraphicsRootDescriptorTable( 2, render_item.mat_table );
-        m_cmd_list->IASetVertexBuffers( 0, 1, &render_item.vbv );
-        m_cmd_list->IASetIndexBuffer( &render_item.ibv );
+        m_draw_state.SetGraphicsRootConstantBufferView( 0, render_item.tf_addr );
+        m_draw_state.SetGraphicsRootConstantBufferView( 1, render_item.mat_cb );
+        m_draw_state.SetGraphicsRootDescriptorTable( 2, render_item.mat_table );
+        m_draw_state.IASetVertexBuffer( render_item.vbv );
+        m_draw_state.IASetIndexBuffer( render_item.ibv );
         m_cmd_list->DrawIndexedInstanced( render_item.index_count, 1, render_item.index_offset, render_item.vertex_offset, 0 );
     }
 }
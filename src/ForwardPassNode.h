@@ -47,6 +47,8 @@ public:
 
     virtual void Run( Framegraph& framegraph, ID3D12GraphicsCommandList& cmd_list ) override;
 
+    DrawStateCache::Stats TakeDrawStateStats() noexcept { return m_pass.TakeDrawStateStats(); }
+
 private:
     ForwardLightingPass m_pass;
 
@@ -38,7 +38,7 @@ void MaterialTableBaker::UpdateStagingDescriptors()
     for ( size_t i = 0; i < m_materials.size(); )
     {
         auto& material_data = m_materials[i];
-        MaterialPBR* mat = m_scene->TryModifyMaterial( material_data.material_id );
+        const MaterialPBR* mat = m_scene->AllMaterials().try_get( material_data.material_id );
         if ( ! mat )
         {
             m_tables->EraseTable( material_data.table_id );
@@ -56,7 +56,7 @@ void MaterialTableBaker::UpdateStagingDescriptors()
     for ( size_t i = 0; i < m_envmaps.size(); )
     {
         auto& material_data = m_envmaps[i];
-        EnviromentMap* mat = m_scene->TryModifyEnvMap( material_data.env_map_id );
+        const EnviromentMap* mat = m_scene->AllEnviromentMaps().try_get( material_data.env_map_id );
         if ( ! mat )
         {
             m_tables->EraseTable( material_data.table_id );
@@ -82,7 +82,9 @@ void MaterialTableBaker::UpdateGPUDescriptors()
         auto table = m_tables->GetTable( material_data.table_id );
         assert( table.has_value() );
 
-        m_scene->TryModifyMaterial( material_data.material_id )->DescriptorTable() = table->gpu_handle;
+        // tables keep their place between bakes, so most frames write nothing
+        if ( m_scene->AllMaterials()[material_data.material_id].DescriptorTable().ptr != table->gpu_handle.ptr )
+            m_scene->TryModifyMaterial( material_data.material_id )->DescriptorTable() = table->gpu_handle;
     }
 
     for ( const auto& material_data : m_envmaps )
@@ -91,7 +93,8 @@ void MaterialTableBaker::UpdateGPUDescriptors()
         auto table = m_tables->GetTable( material_data.table_id );
         assert( table.has_value() );
 
-        m_scene->TryModifyEnvMap( material_data.env_map_id )->SetSRV() = table->gpu_handle;
+        if ( m_scene->AllEnviromentMaps()[material_data.env_map_id].GetSRV().ptr != table->gpu_handle.ptr )
+            m_scene->TryModifyEnvMap( material_data.env_map_id )->SetSRV() = table->gpu_handle;
     }
 }
 
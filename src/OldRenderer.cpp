@@ -134,6 +134,7 @@ void OldRenderer::Draw()
     scene_ctx.ibl_table = m_ibl_table;
     scene_ctx.main_camera = m_main_camera_id;
     scene_ctx.scene = &m_scene_manager->GetScene_Unsafe();
+    scene_ctx.dynamic_buffer = m_scene_manager->GetDynamicBuffers().GetGPUAddress();
 
     SceneRenderer::FrameContext frame_ctx;
     frame_ctx.cmd_list_pool = m_cmd_lists.get();
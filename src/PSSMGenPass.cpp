@@ -44,6 +44,8 @@ PSSMGenPass::RenderStateID PSSMGenPass::BuildRenderState( DXGI_FORMAT dsv_format
 
     pso_desc.RasterizerState = CD3DX12_RASTERIZER_DESC( D3D12_DEFAULT );
     pso_desc.RasterizerState.ConservativeRaster = D3D12_CONSERVATIVE_RASTERIZATION_MODE_ON;
+    // casters between the light and the near plane are culled in (see make_shadow_caster_volume), their depth is clamped to 0
+    pso_desc.RasterizerState.DepthClipEnable = false;
     if ( bias > 0 )
     {
         pso_desc.RasterizerState.DepthBias = bias;
@@ -75,17 +77,19 @@ void PSSMGenPass::Draw( const Context& context ) noexcept
     m_cmd_list->OMSetRenderTargets( 0, nullptr, false, &context.depth_stencil_view );
 
     m_cmd_list->SetGraphicsRoot32BitConstant( 2, context.light_idx, 0 );
+    m_cmd_list->SetGraphicsRoot32BitConstant( 2, context.cascade_idx, 1 );
     m_cmd_list->SetGraphicsRootConstantBufferView( 3, context.pass_cbv );
 
     m_cmd_list->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
 
-    for ( const auto& render_item : context.renderitems )
+    for ( uint32_t item_idx : context.item_indices )
     {
-        m_cmd_list->SetGraphicsRootConstantBufferView( 0, render_item.tf_addr );
-        m_cmd_list->SetGraphicsRootDescriptorTable( 1, render_item.mat_table );
+        const RenderItem& render_item = context.renderitems[item_idx];
+        m_draw_state.SetGraphicsRootConstantBufferView( 0, render_item.tf_addr );
+        m_draw_state.SetGraphicsRootDescriptorTable( 1, render_item.mat_table );
 
-        m_cmd_list->IASetVertexBuffers( 0, 1, &render_item.vbv );
-        m_cmd_list->IASetIndexBuffer( &render_item.ibv );
+        m_draw_state.IASetVertexBuffer( render_item.vbv );
+        m_draw_state.IASetIndexBuffer( render_item.ibv );
         m_cmd_list->DrawIndexedInstanced( render_item.index_count, 1, render_item.index_offset, render_item.vertex_offset, 0 );
     }
 }
@@ -97,12 +101,12 @@ ComPtr<ID3D12RootSignature> PSSMGenPass::BuildRootSignature( ID3D12Device& devic
         pssm generation pass root sig
          0 - object cbv
          1 - base color map
-         2 - light index
+         2 - light index, cascade index
          3 - pass cbv
 
          Shader register bindings
          b0 - object cbv
-         b1 - light index
+         b1 - light index, cascade index
          b2 - pass cbv
 
          t0 - base color
@@ -119,7 +123,7 @@ ComPtr<ID3D12RootSignature> PSSMGenPass::BuildRootSignature( ID3D12Device& devic
     desc_table.Init( D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC );
     slot_root_parameter[1].InitAsDescriptorTable( 1, &desc_table, D3D12_SHADER_VISIBILITY_PIXEL );
 
-    slot_root_parameter[2].InitAsConstants( 1, 1, D3D12_SHADER_VISIBILITY_GEOMETRY );
+    slot_root_parameter[2].InitAsConstants( 2, 1, D3D12_SHADER_VISIBILITY_GEOMETRY );
     slot_root_parameter[3].InitAsConstantBufferView( 2, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC );
 
     const CD3DX12_STATIC_SAMPLER_DESC anisotropicWrap(
@@ -16,9 +16,11 @@ public:
     struct Context
     {
         span<const RenderItem> renderitems;
+        span<const uint32_t> item_indices; // items to draw
         D3D12_CPU_DESCRIPTOR_HANDLE depth_stencil_view;
         D3D12_GPU_VIRTUAL_ADDRESS pass_cbv;
         uint32_t light_idx;
+        uint32_t cascade_idx;
     };
 
     void Draw( const Context& context ) noexcept;
@@ -63,19 +63,27 @@ public:
             }
             cmd_list.RSSetScissorRects( 1, &sm_scissor );
 
-            PSSMGenPass::Context ctx;
+            // every cascade gets only the casters inside its volume
+            for ( uint32_t cascade_idx = 0; cascade_idx < producer.ncascades; ++cascade_idx )
             {
-                ctx.depth_stencil_view = shadow_cascade->dsv;
-                ctx.pass_cbv = pass_cb->pass_cb;
-                ctx.renderitems = make_span( producer.casters );
-                ctx.light_idx = producer.light_idx_in_cb;
+                PSSMGenPass::Context ctx;
+                {
+                    ctx.depth_stencil_view = shadow_cascade->dsv;
+                    ctx.pass_cbv = pass_cb->pass_cb;
+                    ctx.renderitems = producer.items;
+                    ctx.item_indices = producer.CascadeCasters( cascade_idx );
+                    ctx.light_idx = producer.light_idx_in_cb;
+                    ctx.cascade_idx = cascade_idx;
+                }
+                m_pass.Draw( ctx );
             }
-            m_pass.Draw( ctx );
         }
 
         m_pass.End();
     }
 
+    DrawStateCache::Stats TakeDrawStateStats() noexcept { return m_pass.TakeDrawStateStats(); }
+
 private:
     PSSMGenPass m_pass;
     PSSMGenPass::RenderStateID m_state;
@@ -461,23 +461,35 @@ void RenderApp::BuildRenderItems( const ImportedScene& ext_scene )
 {
     auto& scene = m_renderer->GetScene();
 
+    std::vector<TransformID> node_transforms;
+    node_transforms.reserve( ext_scene.nodes.size() );
+    for ( const auto& ext_node : ext_scene.nodes )
+    {
+        const TransformID parent = ext_node.parent_idx >= 0 ? node_transforms[ext_node.parent_idx] : TransformID::nullid;
+        node_transforms.push_back( scene.AddTransform( ext_node.local2parent, parent ) );
+    }
+
+    std::vector<Scene::StaticMeshInstanceDesc> instances;
+    instances.reserve( ext_scene.submeshes.size() );
     for ( const auto& ext_submesh : ext_scene.submeshes )
     {
         StaticSubmeshID submesh_id = scene.AddSubmesh( ext_scene.mesh_id,
                                                        StaticSubmesh::Data{ uint32_t( ext_submesh.nindices ),
                                                                             uint32_t( ext_submesh.index_offset ),
                                                                             0 } );
-        RenderItem item;
 
         const int material_idx = ext_submesh.material_idx;
         if ( material_idx < 0 )
             throw SnowEngineException( "no material!" );
 
         MaterialID mat = ext_scene.materials[material_idx].second.material_id;
-        TransformID tf = scene.AddTransform( ext_submesh.transform );
+        TransformID tf = node_transforms[ext_submesh.node_idx];
 
-        MeshInstanceID mesh_instance = scene.AddMeshInstance( submesh_id, tf, mat );
+        instances.push_back( Scene::StaticMeshInstanceDesc{ tf, submesh_id, mat } );
     }
+
+    std::vector<MeshInstanceID> instance_ids( instances.size() );
+    scene.AddMeshInstances( make_span( instances ), make_span( instance_ids ) );
 }
 
 
@@ -486,11 +498,13 @@ void RenderApp::ReleaseIntermediateSceneMemory()
     m_imported_scene.indices.clear();
     m_imported_scene.materials.clear();
     m_imported_scene.submeshes.clear();
+    m_imported_scene.nodes.clear();
     m_imported_scene.textures.clear();
     m_imported_scene.vertices.clear();
 
     m_imported_scene.indices.shrink_to_fit();
     m_imported_scene.materials.shrink_to_fit();
+    m_imported_scene.nodes.shrink_to_fit();
     m_imported_scene.submeshes.shrink_to_fit();
     m_imported_scene.textures.shrink_to_fit();
     m_imported_scene.vertices.shrink_to_fit();
@@ -530,7 +544,7 @@ void RenderApp::LoadingScreen::Enable( SceneClientView& scene, OldRenderer& rend
         throw SnowEngineException( "light not found!" );
     light->IsEnabled() = true;
 
-    StaticMeshInstance* cube = scene.ModifyInstance( m_cube );
+    StaticMeshInstanceFlags* cube = scene.ModifyInstanceFlags( m_cube );
     if ( ! cube )
         throw SnowEngineException( "cube not found!" );
     cube->IsEnabled() = true;
@@ -544,7 +558,7 @@ void RenderApp::LoadingScreen::Disable( SceneClientView& scene, OldRenderer& ren
         throw SnowEngineException( "light not found!" );
     light->IsEnabled() = false;
 
-    StaticMeshInstance* cube = scene.ModifyInstance( m_cube );
+    StaticMeshInstanceFlags* cube = scene.ModifyInstanceFlags( m_cube );
     if ( ! cube )
         throw SnowEngineException( "cube not found!" );
     cube->IsEnabled() = false;
@@ -559,7 +573,7 @@ void RenderApp::LoadingScreen::Update( SceneClientView& scene, float screen_widt
     auto& cam_data = cam->ModifyData();
     cam_data.aspect_ratio = screen_width / screen_height;
 
-    StaticMeshInstance* cube = scene.ModifyInstance( m_cube );
+    const StaticMeshInstance* cube = scene.GetInstance( m_cube );
     if ( ! cube )
         throw SnowEngineException( "cube not found!" );
     ObjectTransform* tf = scene.ModifyTransform( cube->GetTransform() );
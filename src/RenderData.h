@@ -4,6 +4,8 @@
 
 #include <DirectXCollision.h>
 
+#include <memory_resource>
+
 #include "DescriptorHeap.h"
 
 #include "DescriptorTableBakery.h"
@@ -61,14 +63,25 @@ struct ShadowMapGenData
 struct ShadowProducer
 {
     ShadowMapGenData map_data;
-    std::vector<RenderItem> casters;
+    std::pmr::vector<RenderItem> casters;
 };
 
+constexpr uint32_t MAX_CASCADE_SIZE = 4;
+
 struct ShadowCascadeProducer
 {
     D3D12_VIEWPORT viewport;
     uint32_t light_idx_in_cb;
-    std::vector<RenderItem> casters;
+    uint32_t ncascades;
+    span<const RenderItem> items; // shared by all cascade producers of the frame
+    std::pmr::vector<uint32_t> casters; // indices into items, grouped by cascade
+    std::array<uint32_t, MAX_CASCADE_SIZE + 1> cascade_begin; // casters of cascade i are [cascade_begin[i], cascade_begin[i + 1])
+
+    span<const uint32_t> CascadeCasters( uint32_t cascade_idx ) const noexcept
+    {
+        assert( cascade_idx < ncascades );
+        return span<const uint32_t>( casters.data() + cascade_begin[cascade_idx], casters.data() + cascade_begin[cascade_idx + 1] );
+    }
 };
 
 struct ObjectConstants
@@ -94,9 +107,6 @@ struct LightConstants
     float spot_power; // spotlight only
 };
 
-constexpr uint32_t MAX_CASCADE_SIZE = 4;
-
-
 struct ParallelLightConstants
 {
     DirectX::XMFLOAT4X4 shadow_map_matrix[MAX_CASCADE_SIZE];
@@ -11,6 +11,8 @@ void RenderPass::Begin( RenderStateID state, ID3D12GraphicsCommandList& command_
     command_list.SetPipelineState( m_pso_cache[state].Get() );
     m_cmd_list = &command_list;
     BeginDerived( state );
+    // derived passes set their root signature in BeginDerived, which drops all root arguments
+    m_draw_state.Reset( command_list );
 }
 
 
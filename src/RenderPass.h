@@ -4,6 +4,7 @@
 #include <boost/container/small_vector.hpp>
 
 #include "Ptr.h"
+#include "DrawStateCache.h"
 
 #include "utils/packed_freelist.h"
 
@@ -13,7 +14,7 @@
 // 1. Derive from it
 // 2. Create neccessary render states with a derived class
 // 3. Begin( state, cmd_list )
-// 4. Record some commands with a derived class
+// 4. Record some commands with a derived class, per-item bindings go through m_draw_state
 // 5. End()
 
 class RenderPass
@@ -34,11 +35,15 @@ public:
 
     void DeleteState( RenderStateID state ) noexcept;
 
+    // bindings emitted and filtered out since the previous call
+    DrawStateCache::Stats TakeDrawStateStats() noexcept { return m_draw_state.TakeStats(); }
+
 protected:
 
     virtual void BeginDerived( RenderStateID state ) noexcept = 0;
 
     ID3D12GraphicsCommandList* m_cmd_list = nullptr;
+    DrawStateCache m_draw_state;
 
     RenderStates m_pso_cache;
 };
\ No newline at end of file
@@ -4,6 +4,10 @@
 
 #include "Scene.h"
 
+#include "SceneCommandBuffer.h"
+
+#include "utils/worker_pool.h"
+
 // StaticMesh
 
 void StaticMesh::Load( const D3D12_VERTEX_BUFFER_VIEW& vbv, const D3D12_INDEX_BUFFER_VIEW& ibv ) noexcept
@@ -16,46 +20,42 @@ void StaticMesh::Load( const D3D12_VERTEX_BUFFER_VIEW& vbv, const D3D12_INDEX_BU
 // Scene
 
 // template helpers
-template<> struct Scene::ID2Obj<TransformID>
-{
-    using type = ObjectTransform;
-};
-
 template<> struct Scene::ID2Obj<StaticMeshID>
 {
     using type = StaticMesh;
+    static constexpr Column column = Column::StaticMeshes;
 };
 
 template<> struct Scene::ID2Obj<StaticSubmeshID>
 {
     using type = StaticSubmesh;
+    static constexpr Column column = Column::StaticSubmeshes;
 };
 
 template<> struct Scene::ID2Obj<TextureID>
 {
     using type = Texture;
+    static constexpr Column column = Column::Textures;
 };
 
 template<> struct Scene::ID2Obj<CubemapID>
 {
     using type = Cubemap;
+    static constexpr Column column = Column::Cubemaps;
 };
 
 template<> struct Scene::ID2Obj<MaterialID>
 {
     using type = MaterialPBR;
+    static constexpr Column column = Column::Materials;
 };
 
 template<> struct Scene::ID2Obj<EnvMapID>
 {
     using type = EnviromentMap;
+    static constexpr Column column = Column::EnviromentMaps;
 };
 
-template<> Scene::freelist_from_id<TransformID>& Scene::GetStorage<TransformID>() noexcept
-{
-    return m_obj_tfs;
-}
-
 template<> Scene::freelist_from_id<StaticMeshID>& Scene::GetStorage<StaticMeshID>() noexcept
 {
     return m_static_meshes;
@@ -98,26 +98,214 @@ bool Scene::Remove( IDType obj_id ) noexcept
         return false;
 
     GetStorage<IDType>().erase( obj_id );
+    Touch( ID2Obj<IDType>::column );
     return true;
 }
 
+template<typename ID>
+void Scene::AttachJournal( ChangeTracker<ID>& item, ID item_id, std::vector<ID>& journal ) noexcept
+{
+    item.m_journal = &journal;
+    item.m_id = item_id;
+}
+
+template<typename ID, typename Item>
+void Scene::CleanJournaledItems( std::vector<ID>& journal, Item* ( Scene::*try_modify )( ID ) noexcept ) noexcept
+{
+    for ( ID id : journal )
+        if ( Item* item = ( this->*try_modify )( id ) )
+            item->Clean();
+
+    journal.clear();
+}
+
 
 // Transforms
 
 TransformID Scene::AddTransform( ) noexcept
 {
     ObjectTransform tf;
-    return m_obj_tfs.insert( std::move( tf ) );
+    tf.m_local2parent = Identity4x4;
+    tf.m_obj2world = Identity4x4;
+    TransformID id = m_obj_tfs.insert( std::move( tf ), D3D12_GPU_VIRTUAL_ADDRESS( 0 ), RefCounter(), TransformHierarchyNode() );
+    AttachJournal( m_obj_tfs.get<ObjectTransform>( id ), id, m_modified_tfs );
+    Touch( Column::TransformLayout );
+
+    // new transform has no parent and is placed after all others, it breaks the order unless the hierarchy is flat
+    if ( m_tf_order_is_valid && m_tf_level_offsets.size() <= 2 )
+        m_tf_level_offsets = { 0, uint32_t( m_obj_tfs.size() ) };
+    else
+        m_tf_order_is_valid = false;
+
+    return id;
+}
+
+span<TransformID> Scene::AddTransforms( size_t n, span<TransformID> ids_storage ) noexcept
+{
+    assert( ids_storage.size() >= n );
+
+    m_obj_tfs.reserve( uint32_t( m_obj_tfs.size() + n ) );
+    for ( size_t i = 0; i < n; ++i )
+        ids_storage[i] = AddTransform();
+
+    return span<TransformID>( ids_storage.begin(), ids_storage.begin() + n );
 }
 
 bool Scene::RemoveTransform( TransformID id ) noexcept
 {
-    return Remove( id );
+    const RefCounter* refs = m_obj_tfs.try_get<RefCounter>( id );
+    if ( ! refs )
+        return true;
+
+    if ( refs->GetRefCount() != 0 )
+        return false;
+
+    RefCounter* parent_refs = m_obj_tfs.try_get<RefCounter>( m_obj_tfs.get<TransformHierarchyNode>( id ).GetParent() );
+    if ( parent_refs )
+        parent_refs->ReleaseRef();
+
+    m_obj_tfs.erase( id );
+    m_removed_tfs.push_back( id );
+    Touch( Column::TransformLayout );
+
+    // erase moves the last transform into the freed place
+    if ( m_tf_order_is_valid && m_tf_level_offsets.size() == 2 )
+        m_tf_level_offsets.back()--;
+    else
+        m_tf_order_is_valid = false;
+
+    return true;
+}
+
+void Scene::SetTransformParent( TransformID id, TransformID parent )
+{
+    TransformHierarchyNode* node = m_obj_tfs.try_get<TransformHierarchyNode>( id );
+    if ( ! node )
+        throw SnowEngineException( "referenced transform does not exist" );
+
+    if ( parent != TransformID::nullid )
+    {
+        if ( ! m_obj_tfs.has( parent ) )
+            throw SnowEngineException( "referenced parent transform does not exist" );
+
+        for ( TransformID ancestor = parent; ancestor != TransformID::nullid; ancestor = m_obj_tfs.get<TransformHierarchyNode>( ancestor ).GetParent() )
+            if ( ancestor == id )
+                throw SnowEngineException( "transform hierarchy can't have cycles" );
+
+        m_obj_tfs.get<RefCounter>( parent ).AddRef();
+    }
+
+    RefCounter* old_parent_refs = m_obj_tfs.try_get<RefCounter>( node->m_parent );
+    if ( old_parent_refs )
+        old_parent_refs->ReleaseRef();
+
+    node->m_parent = parent;
+    Touch( Column::TransformHierarchy );
+
+    // world matrix depends on the parent
+    m_obj_tfs.get<ObjectTransform>( id ).MarkDirty();
+    m_tf_order_is_valid = false;
+}
+
+void Scene::UpdateTransformHierarchy()
+{
+    if ( ! m_tf_order_is_valid )
+        SortTransformsByDepth();
+
+    if ( m_modified_tfs.empty() )
+        return;
+
+    Touch( Column::Transforms );
+    Touch( Column::TransformHierarchy );
+
+    const auto tfs = m_obj_tfs.get_column<ObjectTransform>();
+    const auto nodes = m_obj_tfs.get_column<TransformHierarchyNode>();
+
+    // a level only reads world matrices of the previous one, so transforms inside a level are independent
+    constexpr size_t tfs_per_task = 512;
+    for ( size_t level = 0; level + 1 < m_tf_level_offsets.size(); ++level )
+    {
+        const auto level_nodes = make_span( nodes.begin() + m_tf_level_offsets[level], nodes.begin() + m_tf_level_offsets[level + 1] );
+        parallel_for_each( level_nodes, tfs_per_task, [&tfs, &nodes]( TransformHierarchyNode& node )
+        {
+            ObjectTransform& tf = tfs[&node - nodes.begin()];
+            const bool has_parent = node.m_parent != TransformID::nullid;
+
+            node.m_world_changed = tf.IsDirty() || ( has_parent && nodes[node.m_parent_packed_idx].m_world_changed );
+            if ( ! node.m_world_changed )
+                return;
+
+            if ( has_parent )
+                DirectX::XMStoreFloat4x4( &tf.m_obj2world,
+                                          DirectX::XMMatrixMultiply( DirectX::XMLoadFloat4x4( &tf.m_local2parent ),
+                                                                     DirectX::XMLoadFloat4x4( &tfs[node.m_parent_packed_idx].m_obj2world ) ) );
+            else
+                tf.m_obj2world = tf.m_local2parent;
+        } );
+    }
+
+    // descendants of modified transforms got new world matrices, so they have to be journaled too
+    // roots change only by direct modification, they are already in the journal
+    const size_t first_child_idx = m_tf_level_offsets.size() > 2 ? m_tf_level_offsets[1] : nodes.size();
+    for ( size_t i = first_child_idx; i < nodes.size(); ++i )
+        if ( nodes[i].m_world_changed )
+            tfs[i].MarkDirty();
+}
+
+void Scene::SortTransformsByDepth()
+{
+    constexpr uint32_t unresolved_depth = std::numeric_limits<uint32_t>::max();
+
+    auto nodes = m_obj_tfs.get_column<TransformHierarchyNode>();
+    for ( auto& node : nodes )
+        node.m_depth = unresolved_depth;
+
+    // parents may be placed after their children, so depth is resolved by walking up to the first ancestor with known depth
+    std::vector<TransformHierarchyNode*> chain;
+    for ( auto& node : nodes )
+    {
+        TransformHierarchyNode* ancestor = &node;
+        while ( ancestor && ancestor->m_depth == unresolved_depth )
+        {
+            chain.push_back( ancestor );
+            ancestor = m_obj_tfs.try_get<TransformHierarchyNode>( ancestor->m_parent );
+        }
+
+        uint32_t depth = ancestor ? ancestor->m_depth + 1 : 0;
+        for ( auto chain_it = chain.rbegin(); chain_it != chain.rend(); ++chain_it )
+            ( *chain_it )->m_depth = depth++;
+        chain.clear();
+    }
+
+    m_obj_tfs.stable_sort<TransformHierarchyNode>( []( const auto& lhs, const auto& rhs ) { return lhs.m_depth < rhs.m_depth; } );
+
+    nodes = m_obj_tfs.get_column<TransformHierarchyNode>();
+    m_tf_level_offsets.clear();
+    for ( uint32_t packed_idx = 0; packed_idx < uint32_t( nodes.size() ); ++packed_idx )
+    {
+        auto& node = nodes[packed_idx];
+        if ( m_tf_level_offsets.size() <= node.m_depth )
+            m_tf_level_offsets.push_back( packed_idx );
+
+        if ( node.m_parent != TransformID::nullid )
+            node.m_parent_packed_idx = uint32_t( &m_obj_tfs.get<TransformHierarchyNode>( node.m_parent ) - nodes.begin() );
+    }
+    m_tf_level_offsets.push_back( uint32_t( nodes.size() ) );
+
+    m_tf_order_is_valid = true;
+    Touch( Column::TransformLayout );
 }
 
 ObjectTransform* Scene::TryModifyTransform( TransformID id ) noexcept
 {
-    return m_obj_tfs.try_get( id );
+    Touch( Column::Transforms );
+    return m_obj_tfs.try_get<ObjectTransform>( id );
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS* Scene::TryModifyTransformGPUView( TransformID id ) noexcept
+{
+    Touch( Column::TransformGPUViews );
+    return m_obj_tfs.try_get<D3D12_GPU_VIRTUAL_ADDRESS>( id );
 }
 
 
@@ -126,6 +314,7 @@ ObjectTransform* Scene::TryModifyTransform( TransformID id ) noexcept
 StaticMeshID Scene::AddStaticMesh() noexcept
 {
     StaticMesh mesh;
+    Touch( Column::StaticMeshes );
     return m_static_meshes.insert( std::move( mesh ) );
 }
 
@@ -136,7 +325,11 @@ bool Scene::RemoveStaticMesh( StaticMeshID id ) noexcept
 
 StaticMesh* Scene::TryModifyStaticMesh( StaticMeshID id ) noexcept
 {
-    return m_static_meshes.try_get( id );
+    Touch( Column::StaticMeshes );
+    StaticMesh* mesh = m_static_meshes.try_get( id );
+    if ( mesh )
+        mesh->m_generation++;
+    return mesh;
 }
 
 
@@ -149,7 +342,10 @@ StaticSubmeshID Scene::AddStaticSubmesh( StaticMeshID mesh_id )
     mesh->AddRef();
 
     StaticSubmesh submesh( mesh_id );
-    return m_static_submeshes.insert( std::move( submesh ) );
+    StaticSubmeshID id = m_static_submeshes.insert( std::move( submesh ) );
+    AttachJournal( m_static_submeshes[id], id, m_modified_submeshes );
+    Touch( Column::StaticSubmeshes );
+    return id;
 }
 
 bool Scene::RemoveStaticSubmesh( StaticSubmeshID id ) noexcept
@@ -164,11 +360,17 @@ bool Scene::RemoveStaticSubmesh( StaticSubmeshID id ) noexcept
     if ( mesh )
         mesh->ReleaseRef();
 
+    {
+        std::lock_guard<std::mutex> lock( m_submesh_triangle_bvh_mutex );
+        m_submesh_triangle_bvhs.erase( id.idx );
+    }
+
     return Remove( id );
 }
 
 StaticSubmesh* Scene::TryModifyStaticSubmesh( StaticSubmeshID id ) noexcept
 {
+    Touch( Column::StaticSubmeshes );
     return m_static_submeshes.try_get( id );
 }
 
@@ -178,7 +380,10 @@ StaticSubmesh* Scene::TryModifyStaticSubmesh( StaticSubmeshID id ) noexcept
 TextureID Scene::AddTexture() noexcept
 {
     Texture texture;
-    return m_textures.insert( std::move( texture ) );
+    TextureID id = m_textures.insert( std::move( texture ) );
+    AttachJournal( m_textures[id], id, m_modified_textures );
+    Touch( Column::Textures );
+    return id;
 }
 
 bool Scene::RemoveTexture( TextureID id ) noexcept
@@ -188,6 +393,7 @@ bool Scene::RemoveTexture( TextureID id ) noexcept
 
 Texture* Scene::TryModifyTexture( TextureID id ) noexcept
 {
+    Touch( Column::Textures );
     return m_textures.try_get( id );
 }
 
@@ -197,7 +403,10 @@ Texture* Scene::TryModifyTexture( TextureID id ) noexcept
 CubemapID Scene::AddCubemap() noexcept
 {
     Cubemap cubemap;
-    return m_cubemaps.insert( std::move( cubemap ) );
+    CubemapID id = m_cubemaps.insert( std::move( cubemap ) );
+    AttachJournal( m_cubemaps[id], id, m_modified_cubemaps );
+    Touch( Column::Cubemaps );
+    return id;
 }
 
 bool Scene::RemoveCubemap( CubemapID id ) noexcept
@@ -207,6 +416,7 @@ bool Scene::RemoveCubemap( CubemapID id ) noexcept
 
 Cubemap* Scene::TryModifyCubemap( CubemapID id ) noexcept
 {
+    Touch( Column::Cubemaps );
     return m_cubemaps.try_get( id );
 }
 
@@ -228,7 +438,11 @@ MaterialID Scene::AddMaterial( const MaterialPBR::TextureIds& textures )
 
     MaterialPBR material;
     material.Textures() = textures;
-    return m_materials.insert( std::move( material ) );
+    MaterialID id = m_materials.insert( std::move( material ) );
+    AttachJournal( m_materials[id], id, m_modified_materials );
+    LinkMaterial( id, textures );
+    Touch( Column::Materials );
+    return id;
 }
 
 bool Scene::RemoveMaterial( MaterialID id ) noexcept
@@ -237,6 +451,9 @@ bool Scene::RemoveMaterial( MaterialID id ) noexcept
     if ( ! material )
         return true;
 
+    if ( material->GetRefCount() != 0 )
+        return false;
+
     auto release_ref = [&]( TextureID id )
     {
         Texture* tex = m_textures.try_get( id );
@@ -249,11 +466,15 @@ bool Scene::RemoveMaterial( MaterialID id ) noexcept
     for ( const auto& tex_id : { textures.base_color, textures.normal, textures.specular, textures.preintegrated_brdf } )
         release_ref( tex_id );
 
+    UnlinkMaterial( id, textures );
+
+    m_removed_materials.push_back( id );
     return Remove( id );
 }
 
 MaterialPBR* Scene::TryModifyMaterial( MaterialID id ) noexcept
 {
+    Touch( Column::Materials );
     return m_materials.try_get( id );
 }
 
@@ -262,7 +483,7 @@ MaterialPBR* Scene::TryModifyMaterial( MaterialID id ) noexcept
 
 MeshInstanceID Scene::AddStaticMeshInstance( TransformID tf_id, StaticSubmeshID submesh_id, MaterialID material_id )
 {
-    ObjectTransform* tf = m_obj_tfs.try_get( tf_id );
+    RefCounter* tf = m_obj_tfs.try_get<RefCounter>( tf_id );
     StaticSubmesh* submesh = m_static_submeshes.try_get( submesh_id );
     MaterialPBR* material = m_materials.try_get( material_id );
     if ( ! ( tf && submesh && material ) )
@@ -277,16 +498,67 @@ MeshInstanceID Scene::AddStaticMeshInstance( TransformID tf_id, StaticSubmeshID
     instance.Submesh() = submesh_id;
     instance.Transform() = tf_id;
 
-    return m_static_mesh_instances.insert( instance );
+    Touch( Column::StaticMeshInstanceLayout );
+    m_instance_order_is_valid = false;
+    MeshInstanceID id = m_static_mesh_instances.insert( instance, StaticMeshInstanceFlags() );
+    LinkStaticMeshInstance( id, instance );
+    return id;
+}
+
+span<MeshInstanceID> Scene::AddStaticMeshInstances( span<const StaticMeshInstanceDesc> instances, span<MeshInstanceID> ids_storage )
+{
+    assert( ids_storage.size() >= instances.size() );
+
+    for ( const auto& instance : instances )
+        if ( ! ( m_obj_tfs.has( instance.tf ) && m_static_submeshes.has( instance.submesh ) && m_materials.has( instance.material ) ) )
+            throw SnowEngineException( "referenced objects do not exist" );
+
+    // neighbouring instances usually share a transform, a submesh or a material, so refs are added once per run of equal ids
+    auto add_refs = [&instances]( const auto& get_id, const auto& get_ref_counter )
+    {
+        for ( size_t run_begin = 0, run_end = 0; run_begin < instances.size(); run_begin = run_end )
+        {
+            const auto run_id = get_id( instances[run_begin] );
+            for ( run_end = run_begin + 1; run_end < instances.size() && get_id( instances[run_end] ) == run_id; ++run_end )
+                continue;
+            get_ref_counter( run_id ).AddRef( uint32_t( run_end - run_begin ) );
+        }
+    };
+    add_refs( []( const StaticMeshInstanceDesc& desc ) { return desc.tf; },
+              [this]( TransformID id ) -> RefCounter& { return m_obj_tfs.get<RefCounter>( id ); } );
+    add_refs( []( const StaticMeshInstanceDesc& desc ) { return desc.submesh; },
+              [this]( StaticSubmeshID id ) -> RefCounter& { return m_static_submeshes[id]; } );
+    add_refs( []( const StaticMeshInstanceDesc& desc ) { return desc.material; },
+              [this]( MaterialID id ) -> RefCounter& { return m_materials[id]; } );
+
+    std::vector<StaticMeshInstance> new_instances;
+    new_instances.reserve( instances.size() );
+    for ( const auto& desc : instances )
+    {
+        StaticMeshInstance instance;
+        instance.Material() = desc.material;
+        instance.Submesh() = desc.submesh;
+        instance.Transform() = desc.tf;
+        new_instances.push_back( instance );
+    }
+    std::vector<StaticMeshInstanceFlags> new_flags( instances.size() );
+
+    Touch( Column::StaticMeshInstanceLayout );
+    m_instance_order_is_valid = false;
+    span<MeshInstanceID> ids = m_static_mesh_instances.insert_range( make_span( new_instances ), make_span( new_flags ), ids_storage );
+    for ( size_t i = 0; i < ids.size(); ++i )
+        LinkStaticMeshInstance( ids[i], new_instances[i] );
+
+    return ids;
 }
 
 bool Scene::RemoveStaticMeshInstance( MeshInstanceID id ) noexcept
 {
-    StaticMeshInstance* instance = m_static_mesh_instances.try_get( id );
+    const StaticMeshInstance* instance = m_static_mesh_instances.try_get<StaticMeshInstance>( id );
     if ( ! instance )
         return true;
 
-    ObjectTransform* tf = m_obj_tfs.try_get( instance->GetTransform() );
+    RefCounter* tf = m_obj_tfs.try_get<RefCounter>( instance->GetTransform() );
     StaticSubmesh* submesh = m_static_submeshes.try_get( instance->Submesh() );
     MaterialPBR* material = m_materials.try_get( instance->Material() );
 
@@ -298,13 +570,337 @@ bool Scene::RemoveStaticMeshInstance( MeshInstanceID id ) noexcept
     if ( material )
         material->ReleaseRef();
 
+    UnlinkStaticMeshInstance( id, *instance );
     m_static_mesh_instances.erase( id );
+    Touch( Column::StaticMeshInstanceLayout );
+    m_instance_order_is_valid = false;
     return true;
 }
 
-StaticMeshInstance* Scene::TryModifyStaticMeshInstance( MeshInstanceID id ) noexcept
+void Scene::RemoveStaticMeshInstances( span<const MeshInstanceID> ids ) noexcept
 {
-    return m_static_mesh_instances.try_get( id );
+    for ( MeshInstanceID id : ids )
+    {
+        const StaticMeshInstance* instance = m_static_mesh_instances.try_get<StaticMeshInstance>( id );
+        if ( ! instance )
+            continue;
+
+        RefCounter* tf = m_obj_tfs.try_get<RefCounter>( instance->GetTransform() );
+        StaticSubmesh* submesh = m_static_submeshes.try_get( instance->Submesh() );
+        MaterialPBR* material = m_materials.try_get( instance->Material() );
+
+        assert( tf && submesh && material );
+        if ( tf )
+            tf->ReleaseRef();
+        if ( submesh )
+            submesh->ReleaseRef();
+        if ( material )
+            material->ReleaseRef();
+
+        UnlinkStaticMeshInstance( id, *instance );
+        // erased right away, so repeated ids are skipped by the check above instead of releasing refs twice
+        m_static_mesh_instances.erase( id );
+    }
+
+    Touch( Column::StaticMeshInstanceLayout );
+    m_instance_order_is_valid = false;
+}
+
+void Scene::GroupStaticMeshInstances()
+{
+    if ( m_instance_order_is_valid )
+        return;
+
+    // slot indices are enough to group equal ids together
+    auto group_key = []( const StaticMeshInstance& instance ) { return ( uint64_t( instance.Material().idx ) << 32 ) | instance.Submesh().idx; };
+    m_static_mesh_instances.stable_sort<StaticMeshInstance>( [&group_key]( const auto& lhs, const auto& rhs ) { return group_key( lhs ) < group_key( rhs ); } );
+
+    Touch( Column::StaticMeshInstanceLayout );
+    m_instance_order_is_valid = true;
+}
+
+void Scene::UpdateStaticMeshInstanceMasks()
+{
+    const std::array<uint64_t, 2> versions = { m_versions[size_t( Column::StaticMeshInstanceLayout )],
+                                               m_versions[size_t( Column::StaticMeshInstanceFlags )] };
+    if ( versions == m_instance_masks_versions )
+        return;
+
+    const auto flags = m_static_mesh_instances.get_column<StaticMeshInstanceFlags>();
+
+    auto& masks = m_instance_masks;
+    auto reset_mask = [n = flags.size()]( dense_bitset& mask ) { mask.resize( n ); mask.reset(); };
+    reset_mask( masks.enabled );
+    reset_mask( masks.casts_shadow );
+    reset_mask( masks.dynamic );
+    for ( auto& layer : masks.layers )
+        reset_mask( layer );
+
+    for ( size_t i = 0; i < flags.size(); ++i )
+    {
+        masks.enabled.set( i, flags[i].IsEnabled() );
+        masks.casts_shadow.set( i, flags[i].HasShadow() );
+        masks.dynamic.set( i, flags[i].IsDynamic() );
+        for ( uint8_t layer_bits = flags[i].LayerMask(); layer_bits != 0; layer_bits &= layer_bits - 1 )
+            masks.layers[lowest_set_bit( layer_bits )].set( i );
+    }
+
+    m_instance_masks_versions = versions;
+}
+
+const Scene::StaticMeshInstanceMasks& Scene::GetStaticMeshInstanceMasks() const noexcept
+{
+    assert( m_instance_masks_versions[0] == m_versions[size_t( Column::StaticMeshInstanceLayout )]
+            && m_instance_masks_versions[1] == m_versions[size_t( Column::StaticMeshInstanceFlags )] );
+    return m_instance_masks;
+}
+
+namespace
+{
+    aabb InstanceWorldBox( const DirectX::BoundingBox& local_box, const ObjectTransform& tf ) noexcept
+    {
+        const aabb box = aabb::from_center_extents( { local_box.Center.x, local_box.Center.y, local_box.Center.z },
+                                                    { local_box.Extents.x, local_box.Extents.y, local_box.Extents.z } );
+        return transform( box, tf.Obj2World().m );
+    }
+}
+
+void Scene::UpdateStaticMeshInstanceBounds()
+{
+    const auto instances = m_static_mesh_instances.get_column<StaticMeshInstance>();
+
+    constexpr size_t instances_per_task = 1024;
+    auto update_box = [&]( const StaticMeshInstance& instance )
+    {
+        m_instance_world_boxes[&instance - instances.begin()] = InstanceWorldBox( m_static_submeshes[instance.Submesh()].Box(),
+                                                                                  m_obj_tfs.get<ObjectTransform>( instance.GetTransform() ) );
+    };
+
+    auto& changes = m_instance_bounds_changes;
+    const auto flags = m_static_mesh_instances.get_column<StaticMeshInstanceFlags>();
+
+    const uint64_t layout_version = m_versions[size_t( Column::StaticMeshInstanceLayout )];
+    const uint64_t flags_version = m_versions[size_t( Column::StaticMeshInstanceFlags )];
+    bool needs_rebuild = layout_version != m_instance_bounds_layout_version;
+    if ( ! needs_rebuild && flags_version != m_instance_bounds_flags_version )
+    {
+        // flags are handed out as a whole column, only a changed dynamic flag moves an instance between the bvh and the grid
+        for ( size_t i = 0; i < flags.size() && ! needs_rebuild; ++i )
+            needs_rebuild = flags[i].IsDynamic() != m_instance_bounds_dynamic.test( i );
+        m_instance_bounds_flags_version = flags_version;
+    }
+
+    if ( needs_rebuild )
+    {
+        Touch( Column::StaticMeshInstanceBounds );
+
+        m_instance_world_boxes.resize( instances.size() );
+        parallel_for_each( instances, instances_per_task, update_box );
+
+        m_instance_bounds_dynamic.resize( instances.size() );
+        m_instance_bounds_dynamic.reset();
+        m_dynamic_instance_grid.clear();
+        std::vector<uint32_t> static_instances;
+        static_instances.reserve( instances.size() );
+        for ( uint32_t i = 0; i < instances.size(); ++i )
+        {
+            if ( flags[i].IsDynamic() )
+            {
+                m_instance_bounds_dynamic.set( i );
+                m_dynamic_instance_grid.insert( i, m_instance_world_boxes[i] );
+            }
+            else
+            {
+                static_instances.push_back( i );
+            }
+        }
+        m_instance_bvh.build( make_span( std::as_const( m_instance_world_boxes ) ), make_span( std::as_const( static_instances ) ) );
+        m_instance_bounds_layout_version = layout_version;
+        m_instance_bounds_flags_version = flags_version;
+
+        changes.version++;
+        changes.all = true;
+        changes.instances.clear();
+        return;
+    }
+
+    // world matrices of descendants are journaled by UpdateTransformHierarchy too,
+    // submesh boxes change only when the submesh is journaled (see SceneManager::ProcessSubmeshes)
+    // the previous list is kept if no static box changes
+    bool has_changed_static_boxes = false;
+    bool has_changed_dynamic_boxes = false;
+    auto update_journaled_box = [&]( MeshInstanceID instance_id )
+    {
+        const StaticMeshInstance& instance = m_static_mesh_instances.get<StaticMeshInstance>( instance_id );
+        const uint32_t instance_idx = uint32_t( &instance - instances.begin() );
+        update_box( instance );
+
+        if ( m_instance_bounds_dynamic.test( instance_idx ) )
+        {
+            m_dynamic_instance_grid.move( instance_idx, m_instance_world_boxes[instance_idx] );
+            has_changed_dynamic_boxes = true;
+            return;
+        }
+
+        if ( ! has_changed_static_boxes )
+        {
+            changes.version++;
+            changes.all = false;
+            changes.instances.clear();
+            has_changed_static_boxes = true;
+        }
+        changes.instances.push_back( instance_idx );
+    };
+
+    for ( TransformID tf_id : m_modified_tfs )
+        for ( MeshInstanceID instance_id : InstancesUsingTransform( tf_id ) )
+            update_journaled_box( instance_id );
+
+    for ( StaticSubmeshID submesh_id : m_modified_submeshes )
+        for ( MeshInstanceID instance_id : InstancesUsingSubmesh( submesh_id ) )
+            update_journaled_box( instance_id );
+
+    if ( has_changed_static_boxes || has_changed_dynamic_boxes )
+        Touch( Column::StaticMeshInstanceBounds );
+
+    if ( has_changed_static_boxes )
+        m_instance_bvh.refit( make_span( std::as_const( m_instance_world_boxes ) ) );
+}
+
+void Scene::QueryStaticMeshInstances( span<const frustum> views, span<uint8_t> view_masks ) const noexcept
+{
+    assert( view_masks.size() == m_instance_world_boxes.size() );
+    m_instance_bvh.cull( views, view_masks );
+    m_dynamic_instance_grid.cull( views, view_masks );
+}
+
+namespace
+{
+    bool IsQueried( const StaticMeshInstanceFlags& flags, uint8_t layer_mask ) noexcept
+    {
+        return flags.IsEnabled() && ( flags.LayerMask() & layer_mask ) != 0;
+    }
+}
+
+std::optional<Scene::StaticMeshInstanceHit> Scene::RaycastStaticMeshInstances( const ray& r, uint8_t layer_mask ) const
+{
+    const auto instances = m_static_mesh_instances.get_column<StaticMeshInstance>();
+    const auto flags = m_static_mesh_instances.get_column<StaticMeshInstanceFlags>();
+
+    // instances are reported by the distance to their boxes, the ray is shortened to the nearest triangle hit so far
+    std::optional<StaticMeshInstanceHit> res;
+    ray cur_ray = r;
+    auto raycast_instance = [&]( uint32_t instance_idx, float box_t )
+    {
+        if ( ! IsQueried( flags[instance_idx], layer_mask ) )
+            return cur_ray.t_max;
+
+        const StaticMeshInstance& instance = instances[instance_idx];
+        const auto tree = SubmeshTriangleBVH( instance.Submesh() );
+        if ( ! tree )
+        {
+            res = StaticMeshInstanceHit{ m_static_mesh_instances.get_id( instance_idx ), box_t, 0 };
+            cur_ray.t_max = box_t;
+            return box_t;
+        }
+
+        triangle_bvh::hit hit;
+        if ( tree->raycast( cur_ray, m_obj_tfs.get<ObjectTransform>( instance.GetTransform() ).Obj2World().m, hit ) )
+        {
+            res = StaticMeshInstanceHit{ m_static_mesh_instances.get_id( instance_idx ), hit.t, hit.triangle };
+            cur_ray.t_max = hit.t;
+        }
+        return cur_ray.t_max;
+    };
+
+    m_instance_bvh.raycast( cur_ray, raycast_instance );
+    m_dynamic_instance_grid.raycast( cur_ray, raycast_instance );
+    return res;
+}
+
+bool Scene::RaycastAnyStaticMeshInstance( const ray& r, uint8_t layer_mask ) const
+{
+    const auto instances = m_static_mesh_instances.get_column<StaticMeshInstance>();
+    const auto flags = m_static_mesh_instances.get_column<StaticMeshInstanceFlags>();
+
+    bool is_hit = false;
+    auto raycast_instance = [&]( uint32_t instance_idx, float )
+    {
+        if ( ! IsQueried( flags[instance_idx], layer_mask ) )
+            return r.t_max;
+
+        const StaticMeshInstance& instance = instances[instance_idx];
+        const auto tree = SubmeshTriangleBVH( instance.Submesh() );
+        is_hit = ! tree || tree->raycast_any( r, m_obj_tfs.get<ObjectTransform>( instance.GetTransform() ).Obj2World().m );
+        return is_hit ? -1.0f : r.t_max;
+    };
+
+    m_instance_bvh.raycast( r, raycast_instance );
+    if ( ! is_hit )
+        m_dynamic_instance_grid.raycast( r, raycast_instance );
+    return is_hit;
+}
+
+std::vector<MeshInstanceID> Scene::OverlapStaticMeshInstances( const aabb& box, uint8_t layer_mask ) const
+{
+    const auto instances = m_static_mesh_instances.get_column<StaticMeshInstance>();
+    const auto flags = m_static_mesh_instances.get_column<StaticMeshInstanceFlags>();
+
+    std::vector<MeshInstanceID> res;
+    QueryStaticMeshInstances( box, [&]( uint32_t instance_idx )
+    {
+        if ( ! IsQueried( flags[instance_idx], layer_mask ) )
+            return;
+
+        const StaticMeshInstance& instance = instances[instance_idx];
+        const auto tree = SubmeshTriangleBVH( instance.Submesh() );
+        if ( ! tree || tree->overlaps( box, m_obj_tfs.get<ObjectTransform>( instance.GetTransform() ).Obj2World().m ) )
+            res.push_back( m_static_mesh_instances.get_id( instance_idx ) );
+    } );
+    return res;
+}
+
+std::shared_ptr<const triangle_bvh> Scene::SubmeshTriangleBVH( StaticSubmeshID id ) const
+{
+    const StaticSubmesh* submesh = m_static_submeshes.try_get( id );
+    if ( ! submesh )
+        return nullptr;
+
+    const StaticMesh& mesh = m_static_meshes[submesh->GetMesh()];
+    if ( mesh.Vertices().empty() || mesh.Indices().empty() )
+        return nullptr;
+
+    // only a modification of this very mesh or changed draw args make the tree stale
+    const StaticSubmesh::Data& draw_args = submesh->DrawArgs();
+
+    // building under the lock keeps concurrent queries from building the same tree twice
+    std::lock_guard<std::mutex> lock( m_submesh_triangle_bvh_mutex );
+    SubmeshTriangleBVHEntry& entry = m_submesh_triangle_bvhs[id.idx];
+    const bool is_valid = entry.tree && entry.submesh == id && entry.mesh == submesh->GetMesh() && entry.mesh_generation == mesh.m_generation
+                          && entry.draw_args.idx_cnt == draw_args.idx_cnt && entry.draw_args.start_index_loc == draw_args.start_index_loc
+                          && entry.draw_args.base_vertex_loc == draw_args.base_vertex_loc;
+    if ( is_valid )
+        return entry.tree;
+
+    auto tree = std::make_shared<triangle_bvh>();
+    const uint32_t* first_index = mesh.Indices().data() + draw_args.start_index_loc;
+    tree->build( &mesh.Vertices()[draw_args.base_vertex_loc].pos.x, sizeof( Vertex ) / sizeof( float ),
+                 make_span( first_index, first_index + draw_args.idx_cnt ) );
+    entry = SubmeshTriangleBVHEntry{ id, submesh->GetMesh(), mesh.m_generation, draw_args, std::move( tree ) };
+    return entry.tree;
+}
+
+span<float> Scene::ModifyStaticMeshInstanceScreenSizes()
+{
+    Touch( Column::StaticMeshInstanceScreenSizes );
+    m_instance_screen_sizes.resize( StaticMeshInstanceSpan().size() );
+    return make_span( m_instance_screen_sizes );
+}
+
+StaticMeshInstanceFlags* Scene::TryModifyStaticMeshInstanceFlags( MeshInstanceID id ) noexcept
+{
+    Touch( Column::StaticMeshInstanceFlags );
+    return m_static_mesh_instances.try_get<StaticMeshInstanceFlags>( id );
 }
 
 
@@ -312,6 +908,7 @@ StaticMeshInstance* Scene::TryModifyStaticMeshInstance( MeshInstanceID id ) noex
 
 CameraID Scene::AddCamera() noexcept
 {
+    Touch( Column::Cameras );
     return m_cameras.emplace();
 }
 
@@ -319,11 +916,13 @@ bool Scene::RemoveCamera( CameraID id ) noexcept
 {
     bool has_camera = m_cameras.has( id );
     m_cameras.erase( id );
+    Touch( Column::Cameras );
     return has_camera;
 }
 
 Camera* Scene::TryModifyCamera( CameraID id ) noexcept
 {
+    Touch( Column::Cameras );
     return m_cameras.try_get( id );
 }
 
@@ -332,6 +931,7 @@ Camera* Scene::TryModifyCamera( CameraID id ) noexcept
 
 LightID Scene::AddLight() noexcept
 {
+    Touch( Column::Lights );
     return m_lights.emplace();
 }
 
@@ -339,11 +939,13 @@ bool Scene::RemoveLight( LightID id ) noexcept
 {
     bool has_light = m_lights.has( id );
     m_lights.erase( id );
+    Touch( Column::Lights );
     return has_light;
 }
 
 SceneLight* Scene::TryModifyLight( LightID id ) noexcept
 {
+    Touch( Column::Lights );
     return m_lights.try_get( id );
 }
 
@@ -356,7 +958,7 @@ EnvMapID Scene::AddEnviromentMap( CubemapID cubemap_id, TransformID tf_id )
         throw SnowEngineException( "referenced cubemap does not exist" );
     cubemap->AddRef();
 
-    ObjectTransform* tf = m_obj_tfs.try_get( tf_id );
+    RefCounter* tf = m_obj_tfs.try_get<RefCounter>( tf_id );
     if ( ! tf )
         throw SnowEngineException( "referenced transform does not exist" );
     tf->AddRef();
@@ -366,6 +968,7 @@ EnvMapID Scene::AddEnviromentMap( CubemapID cubemap_id, TransformID tf_id )
     envmap.Map() = cubemap_id;
     envmap.Transform() = tf_id;
 
+    Touch( Column::EnviromentMaps );
     return m_env_maps.insert( std::move( envmap ) );
 }
 
@@ -380,7 +983,7 @@ bool Scene::RemoveEnviromentMap( EnvMapID id ) noexcept
     if ( cubemap )
         cubemap->ReleaseRef();
 
-    ObjectTransform* tf = m_obj_tfs.try_get( envmap->GetTransform() );
+    RefCounter* tf = m_obj_tfs.try_get<RefCounter>( envmap->GetTransform() );
     assert( tf != nullptr );
     if ( tf )
         tf->ReleaseRef();
@@ -390,5 +993,183 @@ bool Scene::RemoveEnviromentMap( EnvMapID id ) noexcept
 
 EnviromentMap* Scene::TryModifyEnvMap( EnvMapID id ) noexcept
 {
+    Touch( Column::EnviromentMaps );
     return m_env_maps.try_get( id );
 }
+
+
+// Change journals
+
+void Scene::ClearChangeJournals() noexcept
+{
+    CleanJournaledItems( m_modified_tfs, &Scene::TryModifyTransform );
+    CleanJournaledItems( m_modified_submeshes, &Scene::TryModifyStaticSubmesh );
+    CleanJournaledItems( m_modified_textures, &Scene::TryModifyTexture );
+    CleanJournaledItems( m_modified_cubemaps, &Scene::TryModifyCubemap );
+    CleanJournaledItems( m_modified_materials, &Scene::TryModifyMaterial );
+    m_removed_tfs.clear();
+    m_removed_materials.clear();
+}
+
+
+// Reverse references
+
+namespace
+{
+    // a material may use one texture in several slots, but it is linked to every texture once
+    bc::static_vector<TextureID, 4> DistinctTextures( const MaterialPBR::TextureIds& textures ) noexcept
+    {
+        bc::static_vector<TextureID, 4> res;
+        for ( TextureID tex_id : { textures.base_color, textures.normal, textures.specular, textures.preintegrated_brdf } )
+            if ( std::find( res.begin(), res.end(), tex_id ) == res.end() )
+                res.push_back( tex_id );
+        return res;
+    }
+}
+
+span<const MaterialID> Scene::MaterialsUsingTexture( TextureID id ) const noexcept
+{
+    return m_textures.has( id ) ? m_texture2materials.get( id ) : span<const MaterialID>();
+}
+
+span<const MeshInstanceID> Scene::InstancesUsingMaterial( MaterialID id ) const noexcept
+{
+    return m_materials.has( id ) ? m_material2instances.get( id ) : span<const MeshInstanceID>();
+}
+
+span<const MeshInstanceID> Scene::InstancesUsingSubmesh( StaticSubmeshID id ) const noexcept
+{
+    return m_static_submeshes.has( id ) ? m_submesh2instances.get( id ) : span<const MeshInstanceID>();
+}
+
+span<const MeshInstanceID> Scene::InstancesUsingTransform( TransformID id ) const noexcept
+{
+    return m_obj_tfs.has( id ) ? m_tf2instances.get( id ) : span<const MeshInstanceID>();
+}
+
+void Scene::LinkMaterial( MaterialID id, const MaterialPBR::TextureIds& textures )
+{
+    for ( TextureID tex_id : DistinctTextures( textures ) )
+        m_texture2materials.add( tex_id, id );
+}
+
+void Scene::UnlinkMaterial( MaterialID id, const MaterialPBR::TextureIds& textures ) noexcept
+{
+    for ( TextureID tex_id : DistinctTextures( textures ) )
+        m_texture2materials.remove( tex_id, id );
+}
+
+void Scene::LinkStaticMeshInstance( MeshInstanceID id, const StaticMeshInstance& instance )
+{
+    m_material2instances.add( instance.Material(), id );
+    m_submesh2instances.add( instance.Submesh(), id );
+    m_tf2instances.add( instance.GetTransform(), id );
+}
+
+void Scene::UnlinkStaticMeshInstance( MeshInstanceID id, const StaticMeshInstance& instance ) noexcept
+{
+    m_material2instances.remove( instance.Material(), id );
+    m_submesh2instances.remove( instance.Submesh(), id );
+    m_tf2instances.remove( instance.GetTransform(), id );
+}
+
+void Scene::RebuildReverseReferences()
+{
+    m_texture2materials.clear();
+    const auto materials = m_materials.get_elems();
+    for ( size_t i = 0; i < materials.size(); ++i )
+        LinkMaterial( m_materials.get_id( i ), materials[i].Textures() );
+
+    m_material2instances.clear();
+    m_submesh2instances.clear();
+    m_tf2instances.clear();
+    const auto instances = m_static_mesh_instances.get_column<StaticMeshInstance>();
+    for ( size_t i = 0; i < instances.size(); ++i )
+        LinkStaticMeshInstance( m_static_mesh_instances.get_id( i ), instances[i] );
+}
+
+
+// Deferred modifications
+
+void Scene::Apply( span<SceneCommandBuffer> buffers )
+{
+    for ( SceneCommandBuffer& buffer : buffers )
+        buffer.Replay( *this );
+}
+
+
+// Snapshots
+
+size_t Scene::SyncWith( const Scene& source )
+{
+    auto is_stale = [&]( Column column ) { return m_versions[size_t( column )] != source.m_versions[size_t( column )]; };
+
+    size_t nstale = m_instance_masks_versions != source.m_instance_masks_versions ? 1 : 0;
+    for ( size_t column = 0; column < size_t( Column::Count ); ++column )
+        if ( is_stale( Column( column ) ) )
+            nstale++;
+
+    // columns can be copied one by one only while both storages have the same layout
+    if ( is_stale( Column::TransformLayout ) )
+    {
+        m_obj_tfs = source.m_obj_tfs;
+        m_tf_level_offsets = source.m_tf_level_offsets;
+        m_tf_order_is_valid = source.m_tf_order_is_valid;
+    }
+    else
+    {
+        if ( is_stale( Column::Transforms ) )
+            m_obj_tfs.copy_column<ObjectTransform>( source.m_obj_tfs );
+        if ( is_stale( Column::TransformGPUViews ) )
+            m_obj_tfs.copy_column<D3D12_GPU_VIRTUAL_ADDRESS>( source.m_obj_tfs );
+        if ( is_stale( Column::TransformHierarchy ) )
+            m_obj_tfs.copy_column<TransformHierarchyNode>( source.m_obj_tfs );
+    }
+
+    if ( is_stale( Column::StaticMeshInstanceLayout ) )
+    {
+        m_static_mesh_instances = source.m_static_mesh_instances;
+        m_instance_order_is_valid = source.m_instance_order_is_valid;
+        m_material2instances = source.m_material2instances;
+        m_submesh2instances = source.m_submesh2instances;
+        m_tf2instances = source.m_tf2instances;
+    }
+    else if ( is_stale( Column::StaticMeshInstanceFlags ) )
+        m_static_mesh_instances.copy_column<StaticMeshInstanceFlags>( source.m_static_mesh_instances );
+
+    if ( m_instance_masks_versions != source.m_instance_masks_versions )
+    {
+        m_instance_masks = source.m_instance_masks;
+        m_instance_masks_versions = source.m_instance_masks_versions;
+    }
+
+    if ( is_stale( Column::StaticMeshInstanceBounds ) )
+    {
+        m_instance_world_boxes = source.m_instance_world_boxes;
+        m_instance_bvh = source.m_instance_bvh;
+        m_dynamic_instance_grid = source.m_dynamic_instance_grid;
+        m_instance_bounds_dynamic = source.m_instance_bounds_dynamic;
+        m_instance_bounds_layout_version = source.m_instance_bounds_layout_version;
+        m_instance_bounds_flags_version = source.m_instance_bounds_flags_version;
+        m_instance_bounds_changes = source.m_instance_bounds_changes;
+    }
+
+    auto sync_storage = [&is_stale]( Column column, auto& storage, const auto& source_storage )
+    {
+        if ( is_stale( column ) )
+            storage = source_storage;
+    };
+    sync_storage( Column::StaticMeshInstanceScreenSizes, m_instance_screen_sizes, source.m_instance_screen_sizes );
+    sync_storage( Column::StaticMeshes, m_static_meshes, source.m_static_meshes );
+    sync_storage( Column::StaticSubmeshes, m_static_submeshes, source.m_static_submeshes );
+    sync_storage( Column::Textures, m_textures, source.m_textures );
+    sync_storage( Column::Cubemaps, m_cubemaps, source.m_cubemaps );
+    sync_storage( Column::Materials, m_materials, source.m_materials );
+    sync_storage( Column::Materials, m_texture2materials, source.m_texture2materials );
+    sync_storage( Column::Cameras, m_cameras, source.m_cameras );
+    sync_storage( Column::Lights, m_lights, source.m_lights );
+    sync_storage( Column::EnviromentMaps, m_env_maps, source.m_env_maps );
+
+    m_versions = source.m_versions;
+    return nstale;
+}
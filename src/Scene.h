@@ -1,21 +1,48 @@
 #pragma once
 
 #include "utils/packed_freelist.h"
+#include "utils/packed_soa_freelist.h"
+#include "utils/reverse_index.h"
+#include "utils/dense_bitset.h"
+#include "utils/bvh.h"
+#include "utils/loose_grid.h"
+#include "utils/triangle_bvh.h"
 
 #include "SceneItems.h"
 
+#include <array>
+#include <mutex>
+
+class SceneCommandBuffer;
+
 class Scene
 {
 public:
+    Scene() = default;
+    // items keep pointers to the change journals of the scene
+    Scene( const Scene& ) = delete;
+    Scene& operator=( const Scene& ) = delete;
+
     // Transforms
     TransformID AddTransform( ) noexcept;
+    // ids_storage must have room for n ids. Returns the written part of ids_storage
+    span<TransformID> AddTransforms( size_t n, span<TransformID> ids_storage ) noexcept;
     bool RemoveTransform( TransformID id ) noexcept; // returns true if remove was successful or object with this id no longer exists. Can fail if the object still has refs from other scene components.
+    // parent can be nullid to detach the transform. Throws if the parent is the transform itself or one of its descendants
+    void SetTransformParent( TransformID id, TransformID parent );
+    // recalculates world matrices of modified transforms and their descendants
+    // transforms are kept in breadth-first order, so every hierarchy level is a contiguous range of packed transforms
+    void UpdateTransformHierarchy();
     // read-only
     const auto& AllTransforms() const noexcept { return m_obj_tfs; }
-    auto TransformSpan() const noexcept { return m_obj_tfs.get_elems(); }
+    auto TransformSpan() const noexcept { return m_obj_tfs.get_column<ObjectTransform>(); }
+    auto TransformGPUViewSpan() const noexcept { return m_obj_tfs.get_column<D3D12_GPU_VIRTUAL_ADDRESS>(); }
+    auto TransformHierarchySpan() const noexcept { return m_obj_tfs.get_column<TransformHierarchyNode>(); }
     // for element modification
-    auto TransformSpan() noexcept { return m_obj_tfs.get_elems(); }
+    auto TransformSpan() noexcept { Touch( Column::Transforms ); return m_obj_tfs.get_column<ObjectTransform>(); }
     ObjectTransform* TryModifyTransform( TransformID id ) noexcept; // returns nullptr if object no longer exists
+    // gpu views are offsets of object constants in the dynamic scene buffer, see DynamicSceneBuffers::GetGPUAddress
+    D3D12_GPU_VIRTUAL_ADDRESS* TryModifyTransformGPUView( TransformID id ) noexcept; // returns nullptr if object no longer exists
 
 
     // Static meshes
@@ -25,7 +52,7 @@ public:
     const auto& AllStaticMeshes() const noexcept { return m_static_meshes; }
     auto StaticMeshSpan() const noexcept { return m_static_meshes.get_elems(); }
     // for element modification
-    auto StaticMeshSpan() noexcept { return m_static_meshes.get_elems(); }
+    auto StaticMeshSpan() noexcept { Touch( Column::StaticMeshes ); return m_static_meshes.get_elems(); }
     StaticMesh* TryModifyStaticMesh( StaticMeshID id ) noexcept; // returns nullptr if object no longer exists
 
 
@@ -36,7 +63,7 @@ public:
     const auto& AllStaticSubmeshes() const noexcept { return m_static_submeshes; }
     auto StaticSubmeshSpan() const noexcept { return m_static_submeshes.get_elems(); }
     // for element modification
-    auto StaticSubmeshSpan() noexcept { return m_static_submeshes.get_elems(); }
+    auto StaticSubmeshSpan() noexcept { Touch( Column::StaticSubmeshes ); return m_static_submeshes.get_elems(); }
     StaticSubmesh* TryModifyStaticSubmesh( StaticSubmeshID id ) noexcept; // returns nullptr if object no longer exists
 
 
@@ -47,7 +74,7 @@ public:
     const auto& AllTextures() const noexcept { return m_textures; }
     auto TextureSpan() const noexcept { return m_textures.get_elems(); }
     // for element modification
-    auto TextureSpan() noexcept { return m_textures.get_elems(); }
+    auto TextureSpan() noexcept { Touch( Column::Textures ); return m_textures.get_elems(); }
     Texture* TryModifyTexture( TextureID id ) noexcept; // returns nullptr if object no longer exists
 
 
@@ -58,7 +85,7 @@ public:
     const auto& AllCubemaps() const noexcept { return m_cubemaps; }
     auto CubemapSpan() const noexcept { return m_cubemaps.get_elems(); }
     // for element modification
-    auto CubemapSpan() noexcept { return m_cubemaps.get_elems(); }
+    auto CubemapSpan() noexcept { Touch( Column::Cubemaps ); return m_cubemaps.get_elems(); }
     Cubemap* TryModifyCubemap( CubemapID id ) noexcept; // returns nullptr if object no longer exists
 
 
@@ -69,19 +96,97 @@ public:
     const auto& AllMaterials() const noexcept { return m_materials; }
     auto MaterialSpan() const noexcept { return m_materials.get_elems(); }
     // for element modification
-    auto MaterialSpan() noexcept { return m_materials.get_elems(); }
+    auto MaterialSpan() noexcept { Touch( Column::Materials ); return m_materials.get_elems(); }
     MaterialPBR* TryModifyMaterial( MaterialID id ) noexcept; // returns nullptr if object no longer exists
 
 
     // Static mesh instances
+    struct StaticMeshInstanceDesc
+    {
+        TransformID tf;
+        StaticSubmeshID submesh;
+        MaterialID material;
+    };
     MeshInstanceID AddStaticMeshInstance( TransformID tf, StaticSubmeshID submesh, MaterialID material );
+    // ids_storage must have room for all instances. Returns the written part of ids_storage
+    // throws before adding anything if any of referenced objects does not exist
+    span<MeshInstanceID> AddStaticMeshInstances( span<const StaticMeshInstanceDesc> instances, span<MeshInstanceID> ids_storage );
     bool RemoveStaticMeshInstance( MeshInstanceID id ) noexcept; // returns true if remove was successful or object with this id no longer exists. Can fail if the object still has refs from other scene components.
+    void RemoveStaticMeshInstances( span<const MeshInstanceID> ids ) noexcept; // ids may repeat, missing ones are skipped
+    // reorders packed instances so that instances with the same material, and then the same submesh, are contiguous
+    // does nothing if no instances were added or removed since the previous call
+    void GroupStaticMeshInstances();
+    // bitsets mirroring the flags column, bit i describes StaticMeshInstanceSpan()[i]
+    struct StaticMeshInstanceMasks
+    {
+        dense_bitset enabled;
+        dense_bitset casts_shadow;
+        dense_bitset dynamic;
+        std::array<dense_bitset, StaticMeshInstanceFlags::MaxLayers> layers;
+    };
+    // rebuilds the masks if instances or their flags were handed out for modification since the previous call
+    // call it after GroupStaticMeshInstances, grouping reorders instances
+    void UpdateStaticMeshInstanceMasks();
+    // valid only if nothing was done to instances since the last UpdateStaticMeshInstanceMasks call
+    const StaticMeshInstanceMasks& GetStaticMeshInstanceMasks() const noexcept;
+    // cached world-space boxes of instances, box indices are packed instance indices. Boxes of static instances are kept
+    // in a bounding volume hierarchy, dynamic ones in a loose grid, so moving them never touches the hierarchy
+    // recomputes all boxes and rebuilds both if instances were added, removed, reordered or changed their dynamic flag,
+    // otherwise recomputes boxes of instances with journaled transforms or submeshes, refits the bvh if any static box changed
+    // and moves dynamic boxes in the grid
+    // call it after UpdateTransformHierarchy, GroupStaticMeshInstances and submesh processing, before the change journals are cleared
+    void UpdateStaticMeshInstanceBounds();
+    span<const aabb> StaticMeshInstanceWorldBoxSpan() const noexcept { return make_span( m_instance_world_boxes ); }
+    const bvh& StaticMeshInstanceBVH() const noexcept { return m_instance_bvh; }
+    const loose_grid& DynamicMeshInstanceGrid() const noexcept { return m_dynamic_instance_grid; }
+    // calls fn( packed_idx ) for every instance whose world box intersects the volume, static and dynamic ones alike
+    template<typename Fn>
+    void QueryStaticMeshInstances( const frustum& volume, Fn&& fn ) const { m_instance_bvh.cull( volume, fn ); m_dynamic_instance_grid.cull( volume, fn ); }
+    template<typename Fn>
+    void QueryStaticMeshInstances( const aabb& volume, Fn&& fn ) const { m_instance_bvh.query( volume, fn ); m_dynamic_instance_grid.query( volume, fn ); }
+    template<typename Fn>
+    void QueryStaticMeshInstances( const sphere& volume, Fn&& fn ) const { m_instance_bvh.query( volume, fn ); m_dynamic_instance_grid.query( volume, fn ); }
+    // same for several volumes at once, see bvh::cull. view_masks has an entry per instance
+    void QueryStaticMeshInstances( span<const frustum> views, span<uint8_t> view_masks ) const noexcept;
+    // static boxes changed by the last UpdateStaticMeshInstanceBounds call which changed any, so per-instance caches built
+    // on top of the bvh can follow them. Dynamic instances move all the time and are not listed
+    struct StaticMeshInstanceBoundsChanges
+    {
+        uint64_t version = 0; // bumped by every such call
+        bool all = true; // boxes were rebuilt, indices may refer to other instances than before
+        std::vector<uint32_t> instances; // packed indices of the changed boxes otherwise, may repeat
+    };
+    const StaticMeshInstanceBoundsChanges& LastStaticMeshInstanceBoundsChanges() const noexcept { return m_instance_bounds_changes; }
+    // surface queries for picking and gameplay, instances are found by their world boxes (see UpdateStaticMeshInstanceBounds),
+    // then tested triangle by triangle against the cpu-side geometry of their submeshes. Instances without it are hit at their boxes
+    // only enabled instances in one of the layers of layer_mask take part. Queries may run concurrently with each other
+    struct StaticMeshInstanceHit
+    {
+        MeshInstanceID instance;
+        float t; // along the ray
+        uint32_t triangle; // in the submesh, 0 for instances hit at their box
+    };
+    // nearest hit within [0, r.t_max]
+    std::optional<StaticMeshInstanceHit> RaycastStaticMeshInstances( const ray& r, uint8_t layer_mask = 0xff ) const;
+    // stops at the first hit found, e.g. for line of sight checks
+    bool RaycastAnyStaticMeshInstance( const ray& r, uint8_t layer_mask = 0xff ) const;
+    // instances with triangles intersecting the world-space box
+    std::vector<MeshInstanceID> OverlapStaticMeshInstances( const aabb& box, uint8_t layer_mask = 0xff ) const;
+    // triangle tree of a submesh in mesh space, built on first use and cached until the draw args of the submesh change
+    // or its own mesh is handed out for modification. nullptr if the mesh has no cpu-side geometry
+    std::shared_ptr<const triangle_bvh> SubmeshTriangleBVH( StaticSubmeshID id ) const;
+    // projected size of every instance on the main camera screen in pixels, the angular diameter of its bounding sphere.
+    // Drives contribution culling and is meant for mesh lod selection. Filled by UVScreenDensityCalculator, 0 for disabled instances
+    span<const float> StaticMeshInstanceScreenSizeSpan() const noexcept { return make_span( m_instance_screen_sizes ); }
+    // for modification, resized to the number of instances
+    span<float> ModifyStaticMeshInstanceScreenSizes();
     // read-only
     const auto& AllStaticMeshInstances() const noexcept { return m_static_mesh_instances; }
-    auto StaticMeshInstanceSpan() const noexcept { return m_static_mesh_instances.get_elems(); }
+    auto StaticMeshInstanceSpan() const noexcept { return m_static_mesh_instances.get_column<StaticMeshInstance>(); }
+    auto StaticMeshInstanceFlagsSpan() const noexcept { return m_static_mesh_instances.get_column<StaticMeshInstanceFlags>(); }
     // for element modification
-    auto StaticMeshInstanceSpan() noexcept { return m_static_mesh_instances.get_elems(); }
-    StaticMeshInstance* TryModifyStaticMeshInstance( MeshInstanceID id ) noexcept; // returns nullptr if object no longer exists
+    auto StaticMeshInstanceFlagsSpan() noexcept { Touch( Column::StaticMeshInstanceFlags ); return m_static_mesh_instances.get_column<StaticMeshInstanceFlags>(); }
+    StaticMeshInstanceFlags* TryModifyStaticMeshInstanceFlags( MeshInstanceID id ) noexcept; // returns nullptr if object no longer exists
 
     
     // Cameras
@@ -91,7 +196,7 @@ public:
     const auto& AllCameras() const noexcept { return m_cameras; }
     auto CameraSpan() const noexcept { return m_cameras.get_elems(); }
     // for element modification
-    auto CameraSpan() noexcept { return m_cameras.get_elems(); }
+    auto CameraSpan() noexcept { Touch( Column::Cameras ); return m_cameras.get_elems(); }
     Camera* TryModifyCamera( CameraID id ) noexcept; // returns nullptr if object no longer exists
 
 
@@ -102,7 +207,7 @@ public:
     const auto& AllLights() const noexcept { return m_lights; }
     auto LightSpan() const noexcept { return m_lights.get_elems(); }
     // for element modification
-    auto LightSpan() noexcept { return m_lights.get_elems(); }
+    auto LightSpan() noexcept { Touch( Column::Lights ); return m_lights.get_elems(); }
     SceneLight* TryModifyLight( LightID id ) noexcept; // returns nullptr if object no longer exists
 
 
@@ -113,9 +218,58 @@ public:
     const auto& AllEnviromentMaps() const noexcept { return m_env_maps; }
     auto EnviromentMapSpan() const noexcept { return m_env_maps.get_elems(); }
     // for element modification
-    auto EnviromentMapSpan() noexcept { return m_env_maps.get_elems(); }
+    auto EnviromentMapSpan() noexcept { Touch( Column::EnviromentMaps ); return m_env_maps.get_elems(); }
     EnviromentMap* TryModifyEnvMap( EnvMapID id ) noexcept; // returns nullptr if object no longer exists
 
+
+    // Change journals
+    // ids of items modified since the last ClearChangeJournals() call, each id appears once per journal
+    // may contain ids of already removed items, check them with has() before use
+    span<const TransformID> ModifiedTransforms() const noexcept { return make_span( m_modified_tfs ); }
+    span<const StaticSubmeshID> ModifiedStaticSubmeshes() const noexcept { return make_span( m_modified_submeshes ); }
+    span<const TextureID> ModifiedTextures() const noexcept { return make_span( m_modified_textures ); }
+    span<const CubemapID> ModifiedCubemaps() const noexcept { return make_span( m_modified_cubemaps ); }
+    span<const MaterialID> ModifiedMaterials() const noexcept { return make_span( m_modified_materials ); }
+    // ids of items removed since the last ClearChangeJournals() call
+    span<const TransformID> RemovedTransforms() const noexcept { return make_span( m_removed_tfs ); }
+    span<const MaterialID> RemovedMaterials() const noexcept { return make_span( m_removed_materials ); }
+    // cleans dirty status of all journaled items and empties the journals
+    void ClearChangeJournals() noexcept;
+
+
+    // Reverse references
+    // items referencing the given one, in unspecified order. Empty if the item doesn't exist
+    // spans are invalidated by adding or removing referencing items
+    span<const MaterialID> MaterialsUsingTexture( TextureID id ) const noexcept;
+    span<const MeshInstanceID> InstancesUsingMaterial( MaterialID id ) const noexcept;
+    span<const MeshInstanceID> InstancesUsingSubmesh( StaticSubmeshID id ) const noexcept;
+    span<const MeshInstanceID> InstancesUsingTransform( TransformID id ) const noexcept;
+
+
+    // Deferred modifications
+    // executes commands recorded by the buffers on worker threads. Buffers are applied one by one in the order of the span,
+    // so the ids given to the added items don't depend on the timing of worker threads. See SceneCommandBuffer::Replay for error handling
+    void Apply( span<SceneCommandBuffer> buffers );
+
+
+    // Binary snapshot
+    // writes all storages to a versioned relocatable blob, which can be loaded back with the same ids.
+    // Runtime GPU state (buffer views, descriptors, gpu addresses) is not saved, so restored meshes, textures and cubemaps are not loaded
+    void SaveBinary( std::vector<uint8_t>& blob ) const;
+    // replaces the contents of the scene with the blob, e.g. a memory-mapped file (see MemoryMappedFile)
+    // returns false and leaves the scene unchanged if the blob is malformed or has another version. Restored items are clean
+    bool LoadBinary( span<const uint8_t> blob );
+
+
+    // Snapshots
+    // makes this scene a read-only copy of source. Only storages and columns that source has handed out for modification
+    // since the previous SyncWith call are copied, so a snapshot must always be synced with the same source scene.
+    // Items of the snapshot still point to the change journals of source, so the snapshot must not be modified.
+    // Ref counts are refreshed only together with their storages, the snapshot never removes items anyway
+    // Returns the number of storages and columns which were out of date, 0 means nothing was copied.
+    // Existence checks should go through the const All*() accessors, every non-const accessor counts as a modification
+    size_t SyncWith( const Scene& source );
+
 private:
     template<typename ID>
     struct ID2Obj;
@@ -131,14 +285,98 @@ private:
     template<typename ID>
     bool Remove( ID obj ) noexcept;
 
-    packed_freelist<ObjectTransform> m_obj_tfs;
+    template<typename ID>
+    static void AttachJournal( ChangeTracker<ID>& item, ID item_id, std::vector<ID>& journal ) noexcept;
+
+    template<typename Item, typename ID>
+    static void AttachJournals( span<Item> items, const freelist_layout& layout, std::vector<ID>& journal ) noexcept;
+
+    template<typename ID, typename Item>
+    void CleanJournaledItems( std::vector<ID>& journal, Item* ( Scene::*try_modify )( ID ) noexcept ) noexcept;
+
+    void SortTransformsByDepth();
+
+    void LinkMaterial( MaterialID id, const MaterialPBR::TextureIds& textures );
+    void UnlinkMaterial( MaterialID id, const MaterialPBR::TextureIds& textures ) noexcept;
+    void LinkStaticMeshInstance( MeshInstanceID id, const StaticMeshInstance& instance );
+    void UnlinkStaticMeshInstance( MeshInstanceID id, const StaticMeshInstance& instance ) noexcept;
+    // rebuilds reverse references from forward ids of all materials and instances
+    void RebuildReverseReferences();
+
+    // every non-const access to a storage or a column bumps its version, snapshots compare versions to find what to copy
+    enum class Column : uint32_t
+    {
+        TransformLayout, // transform ids, packed order, ref counts and hierarchy levels
+        Transforms,
+        TransformGPUViews,
+        TransformHierarchy,
+        StaticMeshes,
+        StaticSubmeshes,
+        Textures,
+        Cubemaps,
+        Materials,
+        StaticMeshInstanceLayout, // instance ids, packed order and StaticMeshInstance column, which can't be modified in place
+        StaticMeshInstanceFlags,
+        StaticMeshInstanceBounds, // world boxes, bvh and grid, derived from instances, their flags, transforms and submeshes
+        StaticMeshInstanceScreenSizes,
+        Cameras,
+        Lights,
+        EnviromentMaps,
+        Count
+    };
+    void Touch( Column column ) noexcept { m_versions[size_t( column )]++; }
+
+    // transforms and mesh instances are traversed every frame, so every field has its own packed column
+    using TransformStorage = packed_soa_freelist<ObjectTransform, D3D12_GPU_VIRTUAL_ADDRESS, RefCounter, TransformHierarchyNode>;
+    using StaticMeshInstanceStorage = packed_soa_freelist<StaticMeshInstance, StaticMeshInstanceFlags>;
+
+    TransformStorage m_obj_tfs;
+    std::vector<uint32_t> m_tf_level_offsets; // packed index of the first transform of every hierarchy level, last element is the number of transforms
+    bool m_tf_order_is_valid = true;
     packed_freelist<StaticMesh> m_static_meshes;
     packed_freelist<StaticSubmesh> m_static_submeshes;
     packed_freelist<Texture> m_textures;
     packed_freelist<Cubemap> m_cubemaps;
     packed_freelist<MaterialPBR> m_materials;
-    packed_freelist<StaticMeshInstance> m_static_mesh_instances;
+    StaticMeshInstanceStorage m_static_mesh_instances;
+    bool m_instance_order_is_valid = true;
+    StaticMeshInstanceMasks m_instance_masks;
+    std::array<uint64_t, 2> m_instance_masks_versions = {}; // versions of the instance layout and flags the masks were built from
+    std::vector<aabb> m_instance_world_boxes;
+    bvh m_instance_bvh;
+    loose_grid m_dynamic_instance_grid;
+    dense_bitset m_instance_bounds_dynamic; // instances kept in the grid
+    uint64_t m_instance_bounds_layout_version = 0; // version of the instance layout the boxes and the bvh were built for
+    uint64_t m_instance_bounds_flags_version = 0; // version of the flags m_instance_bounds_dynamic was last compared to
+    StaticMeshInstanceBoundsChanges m_instance_bounds_changes;
+    std::vector<float> m_instance_screen_sizes;
+    struct SubmeshTriangleBVHEntry
+    {
+        StaticSubmeshID submesh = StaticSubmeshID::nullid;
+        StaticMeshID mesh = StaticMeshID::nullid;
+        uint64_t mesh_generation = 0; // see StaticMesh::m_generation
+        StaticSubmesh::Data draw_args = {};
+        std::shared_ptr<const triangle_bvh> tree;
+    };
+    mutable std::unordered_map<uint32_t, SubmeshTriangleBVHEntry> m_submesh_triangle_bvhs; // by submesh slot, not synced to snapshots
+    mutable std::mutex m_submesh_triangle_bvh_mutex;
     packed_freelist<Camera> m_cameras;
     packed_freelist<SceneLight> m_lights;
     packed_freelist<EnviromentMap> m_env_maps;
+
+    std::vector<TransformID> m_modified_tfs;
+    std::vector<StaticSubmeshID> m_modified_submeshes;
+    std::vector<TextureID> m_modified_textures;
+    std::vector<CubemapID> m_modified_cubemaps;
+    std::vector<MaterialID> m_modified_materials;
+    std::vector<TransformID> m_removed_tfs;
+    std::vector<MaterialID> m_removed_materials;
+
+    // reverse references, synced together with the layouts of the referencing storages
+    reverse_index<TextureID, MaterialID, 4> m_texture2materials;
+    reverse_index<MaterialID, MeshInstanceID> m_material2instances;
+    reverse_index<StaticSubmeshID, MeshInstanceID> m_submesh2instances;
+    reverse_index<TransformID, MeshInstanceID> m_tf2instances;
+
+    std::array<uint64_t, size_t( Column::Count )> m_versions = {};
 };
@@ -0,0 +1,642 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+#include "stdafx.h"
+
+#include "Scene.h"
+
+#include <cstring>
+
+// Binary snapshot of the scene
+//
+// blob layout: BlobHeader, table of BlobSection entries (one per Section), section data.
+// Every section is an array of trivially copyable records and starts at an offset aligned to SectionAlignment,
+// so a loader can view the records directly in the mapped file.
+// Offsets are relative to the beginning of the blob, so the blob can be mapped anywhere.
+// Freelist layout sections are uint32 arrays: free head, number of slots, slots (2 values each), packed2slot
+
+namespace
+{
+    constexpr uint32_t SceneBlobMagic = 0x43534e53; // "SNSC"
+    constexpr uint32_t SceneBlobVersion = 3; // 2: layers and dynamic flag in StaticMeshInstanceFlags, 3: alpha-tested flag in materials
+    constexpr size_t SectionAlignment = 16;
+
+    enum class Section : uint32_t
+    {
+        TransformLayout,
+        Transforms,
+        StaticMeshLayout,
+        StaticMeshes,
+        Vertices,
+        Indices,
+        StaticSubmeshLayout,
+        StaticSubmeshes,
+        TextureLayout,
+        Textures,
+        CubemapLayout,
+        Cubemaps,
+        MaterialLayout,
+        Materials,
+        StaticMeshInstanceLayout,
+        StaticMeshInstances,
+        StaticMeshInstanceFlags,
+        CameraLayout,
+        Cameras,
+        LightLayout,
+        Lights,
+        EnviromentMapLayout,
+        EnviromentMaps,
+        Count
+    };
+
+    struct BlobHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t nsections;
+        uint32_t padding;
+    };
+
+    struct BlobSection
+    {
+        uint64_t offset;
+        uint64_t size; // bytes
+    };
+
+    constexpr size_t AlignUp( size_t size ) noexcept
+    {
+        return ( size + SectionAlignment - 1 ) / SectionAlignment * SectionAlignment;
+    }
+
+    // records for items with non-trivial members or runtime-only state
+    struct TransformRecord
+    {
+        DirectX::XMFLOAT4X4 local2parent;
+        DirectX::XMFLOAT4X4 obj2world;
+        TransformID parent;
+        uint32_t refs;
+    };
+
+    struct StaticMeshRecord
+    {
+        uint64_t first_vertex;
+        uint64_t nvertices;
+        uint64_t first_index;
+        uint64_t nindices;
+        uint32_t topology;
+        uint32_t refs;
+    };
+
+    struct StaticSubmeshRecord
+    {
+        StaticSubmesh::Data draw_args;
+        StaticMeshID mesh;
+        DirectX::BoundingBox box;
+        DirectX::XMFLOAT2 max_inv_uv_density;
+        uint32_t refs;
+    };
+
+    struct TextureRecord
+    {
+        DirectX::XMFLOAT2 max_pixels_per_uv;
+        uint32_t refs;
+    };
+
+    struct CubemapRecord
+    {
+        uint32_t refs;
+    };
+
+    struct MaterialRecord
+    {
+        MaterialPBR::TextureIds textures;
+        MaterialPBR::Data data;
+        uint32_t refs;
+        uint32_t alpha_tested;
+    };
+
+    struct LightRecord
+    {
+        SceneLight::Data data;
+        SceneLight::Shadow shadow;
+        uint32_t has_shadow;
+        uint32_t is_enabled;
+    };
+
+    struct EnviromentMapRecord
+    {
+        CubemapID cubemap;
+        TransformID tf;
+        float radiance_factor;
+        uint32_t refs;
+    };
+
+    class BlobWriter
+    {
+    public:
+        explicit BlobWriter( std::vector<uint8_t>& blob ) : m_blob( blob )
+        {
+            m_blob.assign( AlignUp( sizeof( BlobHeader ) + sizeof( BlobSection ) * size_t( Section::Count ) ), 0 );
+
+            const BlobHeader header = { SceneBlobMagic, SceneBlobVersion, uint32_t( Section::Count ), 0 };
+            std::memcpy( m_blob.data(), &header, sizeof( header ) );
+        }
+
+        template<typename T>
+        void Write( Section section, span<T> records )
+        {
+            static_assert( std::is_trivially_copyable_v<T>, "blob records must be trivially copyable" );
+
+            const BlobSection entry = { m_blob.size(), records.size() * sizeof( T ) };
+            std::memcpy( m_blob.data() + sizeof( BlobHeader ) + sizeof( BlobSection ) * size_t( section ), &entry, sizeof( entry ) );
+
+            m_blob.resize( AlignUp( entry.offset + entry.size ), 0 );
+            if ( entry.size > 0 )
+                std::memcpy( m_blob.data() + entry.offset, records.begin(), entry.size );
+        }
+
+        void WriteLayout( Section section, const freelist_layout& layout )
+        {
+            std::vector<uint32_t> data;
+            data.reserve( 2 + layout.slots.size() + layout.packed2slot.size() );
+            data.push_back( layout.free_head );
+            data.push_back( uint32_t( layout.slots.size() / 2 ) );
+            data.insert( data.end(), layout.slots.begin(), layout.slots.end() );
+            data.insert( data.end(), layout.packed2slot.begin(), layout.packed2slot.end() );
+            Write( section, make_span( data ) );
+        }
+
+    private:
+        std::vector<uint8_t>& m_blob;
+    };
+
+    class BlobReader
+    {
+    public:
+        // validates the header and the section table
+        bool Open( span<const uint8_t> blob ) noexcept
+        {
+            const size_t table_end = sizeof( BlobHeader ) + sizeof( BlobSection ) * size_t( Section::Count );
+            if ( blob.size() < table_end )
+                return false;
+
+            BlobHeader header;
+            std::memcpy( &header, blob.begin(), sizeof( header ) );
+            if ( header.magic != SceneBlobMagic || header.version != SceneBlobVersion || header.nsections != uint32_t( Section::Count ) )
+                return false;
+
+            std::memcpy( m_sections, blob.begin() + sizeof( BlobHeader ), sizeof( m_sections ) );
+            for ( const BlobSection& section : m_sections )
+                if ( section.offset % SectionAlignment != 0 || section.offset > blob.size() || section.size > blob.size() - section.offset )
+                    return false;
+
+            m_blob = blob;
+            return true;
+        }
+
+        // views records in place, no copies are made
+        template<typename T>
+        bool Read( Section section, span<const T>& records ) const noexcept
+        {
+            static_assert( std::is_trivially_copyable_v<T>, "blob records must be trivially copyable" );
+            static_assert( alignof( T ) <= SectionAlignment, "records must fit section alignment" );
+
+            const BlobSection& entry = m_sections[size_t( section )];
+            if ( entry.size % sizeof( T ) != 0 )
+                return false;
+
+            const uint8_t* data = m_blob.begin() + entry.offset;
+            if ( reinterpret_cast<uintptr_t>( data ) % alignof( T ) != 0 )
+                return false;
+
+            records = span<const T>( reinterpret_cast<const T*>( data ), reinterpret_cast<const T*>( data + entry.size ) );
+            return true;
+        }
+
+        // layout of a freelist with nelems elements, span members point into the blob
+        bool ReadLayout( Section section, size_t nelems, freelist_layout& layout ) const noexcept
+        {
+            span<const uint32_t> data;
+            if ( ! Read( section, data ) || data.size() < 2 )
+                return false;
+
+            const size_t nslots = data[1];
+            if ( data.size() != 2 + 2 * nslots + nelems )
+                return false;
+
+            layout.free_head = data[0];
+            layout.slots = span<const uint32_t>( data.begin() + 2, data.begin() + 2 + 2 * nslots );
+            layout.packed2slot = span<const uint32_t>( layout.slots.end(), data.end() );
+            return true;
+        }
+
+    private:
+        span<const uint8_t> m_blob;
+        BlobSection m_sections[size_t( Section::Count )] = {};
+    };
+}
+
+
+template<typename Item, typename ID>
+void Scene::AttachJournals( span<Item> items, const freelist_layout& layout, std::vector<ID>& journal ) noexcept
+{
+    for ( size_t packed_idx = 0; packed_idx < items.size(); ++packed_idx )
+    {
+        const uint32_t slot = layout.packed2slot[packed_idx];
+        AttachJournal<ID>( items[packed_idx], ID{ slot, layout.slots[2 * size_t( slot ) + 1] }, journal );
+    }
+}
+
+
+void Scene::SaveBinary( std::vector<uint8_t>& blob ) const
+{
+    BlobWriter writer( blob );
+
+    // Transforms
+    {
+        const auto tfs = m_obj_tfs.get_column<ObjectTransform>();
+        const auto refs = m_obj_tfs.get_column<RefCounter>();
+        const auto nodes = m_obj_tfs.get_column<TransformHierarchyNode>();
+        std::vector<TransformRecord> records( tfs.size() );
+        for ( size_t i = 0; i < records.size(); ++i )
+            records[i] = TransformRecord{ tfs[i].m_local2parent, tfs[i].m_obj2world, nodes[i].m_parent, refs[i].GetRefCount() };
+
+        writer.WriteLayout( Section::TransformLayout, m_obj_tfs.get_layout() );
+        writer.Write( Section::Transforms, make_span( records ) );
+    }
+
+    // Static meshes, vertices and indices of all meshes are concatenated
+    {
+        std::vector<StaticMeshRecord> records;
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        for ( const StaticMesh& mesh : m_static_meshes )
+        {
+            records.push_back( StaticMeshRecord{ vertices.size(), mesh.m_vertices.size(), indices.size(), mesh.m_indices.size(),
+                                                 uint32_t( mesh.m_topology ), mesh.GetRefCount() } );
+            vertices.insert( vertices.end(), mesh.m_vertices.begin(), mesh.m_vertices.end() );
+            indices.insert( indices.end(), mesh.m_indices.begin(), mesh.m_indices.end() );
+        }
+
+        writer.WriteLayout( Section::StaticMeshLayout, m_static_meshes.get_layout() );
+        writer.Write( Section::StaticMeshes, make_span( records ) );
+        writer.Write( Section::Vertices, make_span( vertices ) );
+        writer.Write( Section::Indices, make_span( indices ) );
+    }
+
+    // Static submeshes
+    {
+        std::vector<StaticSubmeshRecord> records;
+        records.reserve( m_static_submeshes.size() );
+        for ( const StaticSubmesh& submesh : m_static_submeshes )
+            records.push_back( StaticSubmeshRecord{ submesh.m_data, submesh.m_mesh_id, submesh.m_box, submesh.m_max_inv_uv_density, submesh.GetRefCount() } );
+
+        writer.WriteLayout( Section::StaticSubmeshLayout, m_static_submeshes.get_layout() );
+        writer.Write( Section::StaticSubmeshes, make_span( records ) );
+    }
+
+    // Textures
+    {
+        std::vector<TextureRecord> records;
+        records.reserve( m_textures.size() );
+        for ( const Texture& texture : m_textures )
+            records.push_back( TextureRecord{ texture.m_max_pixels_per_uv, texture.GetRefCount() } );
+
+        writer.WriteLayout( Section::TextureLayout, m_textures.get_layout() );
+        writer.Write( Section::Textures, make_span( records ) );
+    }
+
+    // Cubemaps
+    {
+        std::vector<CubemapRecord> records;
+        records.reserve( m_cubemaps.size() );
+        for ( const Cubemap& cubemap : m_cubemaps )
+            records.push_back( CubemapRecord{ cubemap.GetRefCount() } );
+
+        writer.WriteLayout( Section::CubemapLayout, m_cubemaps.get_layout() );
+        writer.Write( Section::Cubemaps, make_span( records ) );
+    }
+
+    // Materials
+    {
+        std::vector<MaterialRecord> records;
+        records.reserve( m_materials.size() );
+        for ( const MaterialPBR& material : m_materials )
+            records.push_back( MaterialRecord{ material.m_textures, material.m_data, material.GetRefCount(), uint32_t( material.m_alpha_tested ) } );
+
+        writer.WriteLayout( Section::MaterialLayout, m_materials.get_layout() );
+        writer.Write( Section::Materials, make_span( records ) );
+    }
+
+    // Static mesh instances, both columns are stored as is
+    writer.WriteLayout( Section::StaticMeshInstanceLayout, m_static_mesh_instances.get_layout() );
+    writer.Write( Section::StaticMeshInstances, m_static_mesh_instances.get_column<StaticMeshInstance>() );
+    writer.Write( Section::StaticMeshInstanceFlags, m_static_mesh_instances.get_column<StaticMeshInstanceFlags>() );
+
+    // Cameras are stored as is
+    writer.WriteLayout( Section::CameraLayout, m_cameras.get_layout() );
+    writer.Write( Section::Cameras, m_cameras.get_elems() );
+
+    // Lights, shadow matrices are recalculated every frame
+    {
+        std::vector<LightRecord> records;
+        records.reserve( m_lights.size() );
+        for ( const SceneLight& light : m_lights )
+        {
+            LightRecord record = {};
+            record.data = light.GetData();
+            record.has_shadow = light.GetShadow().has_value();
+            if ( record.has_shadow )
+                record.shadow = *light.GetShadow();
+            record.is_enabled = light.IsEnabled();
+            records.push_back( record );
+        }
+
+        writer.WriteLayout( Section::LightLayout, m_lights.get_layout() );
+        writer.Write( Section::Lights, make_span( records ) );
+    }
+
+    // Enviroment maps
+    {
+        std::vector<EnviromentMapRecord> records;
+        records.reserve( m_env_maps.size() );
+        for ( const EnviromentMap& envmap : m_env_maps )
+            records.push_back( EnviromentMapRecord{ envmap.m_cubemap, envmap.m_tf, envmap.m_radiance_factor, envmap.GetRefCount() } );
+
+        writer.WriteLayout( Section::EnviromentMapLayout, m_env_maps.get_layout() );
+        writer.Write( Section::EnviromentMaps, make_span( records ) );
+    }
+}
+
+
+bool Scene::LoadBinary( span<const uint8_t> blob )
+{
+    BlobReader reader;
+    if ( ! reader.Open( blob ) )
+        return false;
+
+    // everything is restored into temporary storages first, so a malformed blob leaves the scene untouched
+    auto restore = [&reader]( Section layout_section, auto& storage, auto elems )
+    {
+        freelist_layout layout;
+        return reader.ReadLayout( layout_section, elems.size(), layout )
+            && storage.restore( layout, make_span( elems ) );
+    };
+
+    // Transforms
+    TransformStorage tfs;
+    {
+        span<const TransformRecord> records;
+        if ( ! reader.Read( Section::Transforms, records ) )
+            return false;
+
+        std::vector<ObjectTransform> tf_column;
+        tf_column.reserve( records.size() );
+        std::vector<D3D12_GPU_VIRTUAL_ADDRESS> gpu_views( records.size(), 0 );
+        std::vector<RefCounter> refs( records.size() );
+        std::vector<TransformHierarchyNode> nodes( records.size() );
+        for ( size_t i = 0; i < records.size(); ++i )
+        {
+            ObjectTransform tf;
+            tf.m_local2parent = records[i].local2parent;
+            tf.m_obj2world = records[i].obj2world;
+            tf_column.push_back( std::move( tf ) );
+            refs[i].AddRef( records[i].refs );
+            nodes[i].m_parent = records[i].parent;
+        }
+
+        freelist_layout layout;
+        if ( ! reader.ReadLayout( Section::TransformLayout, records.size(), layout )
+             || ! tfs.restore( layout, make_span( tf_column ), make_span( gpu_views ), make_span( refs ), make_span( nodes ) ) )
+            return false;
+    }
+
+    // Static meshes
+    packed_freelist<StaticMesh> meshes;
+    {
+        span<const StaticMeshRecord> records;
+        span<const Vertex> vertices;
+        span<const uint32_t> indices;
+        if ( ! ( reader.Read( Section::StaticMeshes, records ) && reader.Read( Section::Vertices, vertices ) && reader.Read( Section::Indices, indices ) ) )
+            return false;
+
+        std::vector<StaticMesh> elems;
+        elems.reserve( records.size() );
+        for ( const StaticMeshRecord& record : records )
+        {
+            if ( record.first_vertex > vertices.size() || record.nvertices > vertices.size() - record.first_vertex
+                 || record.first_index > indices.size() || record.nindices > indices.size() - record.first_index )
+                return false;
+
+            StaticMesh mesh;
+            mesh.m_vertices.assign( vertices.begin() + record.first_vertex, vertices.begin() + record.first_vertex + record.nvertices );
+            mesh.m_indices.assign( indices.begin() + record.first_index, indices.begin() + record.first_index + record.nindices );
+            mesh.m_topology = D3D_PRIMITIVE_TOPOLOGY( record.topology );
+            mesh.AddRef( record.refs );
+            elems.push_back( std::move( mesh ) );
+        }
+
+        if ( ! restore( Section::StaticMeshLayout, meshes, std::move( elems ) ) )
+            return false;
+    }
+
+    // Static submeshes
+    packed_freelist<StaticSubmesh> submeshes;
+    {
+        span<const StaticSubmeshRecord> records;
+        if ( ! reader.Read( Section::StaticSubmeshes, records ) )
+            return false;
+
+        std::vector<StaticSubmesh> elems;
+        elems.reserve( records.size() );
+        for ( const StaticSubmeshRecord& record : records )
+        {
+            StaticSubmesh submesh( record.mesh );
+            submesh.m_data = record.draw_args;
+            submesh.m_box = record.box;
+            submesh.m_max_inv_uv_density = record.max_inv_uv_density;
+            submesh.AddRef( record.refs );
+            elems.push_back( std::move( submesh ) );
+        }
+
+        if ( ! restore( Section::StaticSubmeshLayout, submeshes, std::move( elems ) ) )
+            return false;
+    }
+
+    // Textures
+    packed_freelist<Texture> textures;
+    {
+        span<const TextureRecord> records;
+        if ( ! reader.Read( Section::Textures, records ) )
+            return false;
+
+        std::vector<Texture> elems;
+        elems.reserve( records.size() );
+        for ( const TextureRecord& record : records )
+        {
+            Texture texture;
+            texture.m_max_pixels_per_uv = record.max_pixels_per_uv;
+            texture.AddRef( record.refs );
+            elems.push_back( std::move( texture ) );
+        }
+
+        if ( ! restore( Section::TextureLayout, textures, std::move( elems ) ) )
+            return false;
+    }
+
+    // Cubemaps
+    packed_freelist<Cubemap> cubemaps;
+    {
+        span<const CubemapRecord> records;
+        if ( ! reader.Read( Section::Cubemaps, records ) )
+            return false;
+
+        std::vector<Cubemap> elems;
+        elems.reserve( records.size() );
+        for ( const CubemapRecord& record : records )
+        {
+            Cubemap cubemap;
+            cubemap.AddRef( record.refs );
+            elems.push_back( std::move( cubemap ) );
+        }
+
+        if ( ! restore( Section::CubemapLayout, cubemaps, std::move( elems ) ) )
+            return false;
+    }
+
+    // Materials
+    packed_freelist<MaterialPBR> materials;
+    {
+        span<const MaterialRecord> records;
+        if ( ! reader.Read( Section::Materials, records ) )
+            return false;
+
+        std::vector<MaterialPBR> elems;
+        elems.reserve( records.size() );
+        for ( const MaterialRecord& record : records )
+        {
+            MaterialPBR material;
+            material.m_textures = record.textures;
+            material.m_data = record.data;
+            material.m_alpha_tested = record.alpha_tested != 0;
+            material.AddRef( record.refs );
+            elems.push_back( std::move( material ) );
+        }
+
+        if ( ! restore( Section::MaterialLayout, materials, std::move( elems ) ) )
+            return false;
+    }
+
+    // Static mesh instances
+    StaticMeshInstanceStorage instances;
+    {
+        span<const StaticMeshInstance> instance_records;
+        span<const StaticMeshInstanceFlags> flag_records;
+        if ( ! ( reader.Read( Section::StaticMeshInstances, instance_records ) && reader.Read( Section::StaticMeshInstanceFlags, flag_records ) ) )
+            return false;
+
+        std::vector<StaticMeshInstance> instance_column( instance_records.begin(), instance_records.end() );
+        std::vector<StaticMeshInstanceFlags> flag_column( flag_records.begin(), flag_records.end() );
+
+        freelist_layout layout;
+        if ( ! reader.ReadLayout( Section::StaticMeshInstanceLayout, instance_column.size(), layout )
+             || ! instances.restore( layout, make_span( instance_column ), make_span( flag_column ) ) )
+            return false;
+    }
+
+    // Cameras
+    packed_freelist<Camera> cameras;
+    {
+        span<const Camera> records;
+        if ( ! reader.Read( Section::Cameras, records ) )
+            return false;
+
+        if ( ! restore( Section::CameraLayout, cameras, std::vector<Camera>( records.begin(), records.end() ) ) )
+            return false;
+    }
+
+    // Lights
+    packed_freelist<SceneLight> lights;
+    {
+        span<const LightRecord> records;
+        if ( ! reader.Read( Section::Lights, records ) )
+            return false;
+
+        std::vector<SceneLight> elems( records.size() );
+        for ( size_t i = 0; i < records.size(); ++i )
+        {
+            elems[i].ModifyData() = records[i].data;
+            if ( records[i].has_shadow )
+                elems[i].ModifyShadow() = records[i].shadow;
+            elems[i].IsEnabled() = records[i].is_enabled != 0;
+        }
+
+        if ( ! restore( Section::LightLayout, lights, std::move( elems ) ) )
+            return false;
+    }
+
+    // Enviroment maps
+    packed_freelist<EnviromentMap> env_maps;
+    {
+        span<const EnviromentMapRecord> records;
+        if ( ! reader.Read( Section::EnviromentMaps, records ) )
+            return false;
+
+        std::vector<EnviromentMap> elems;
+        elems.reserve( records.size() );
+        for ( const EnviromentMapRecord& record : records )
+        {
+            EnviromentMap envmap;
+            envmap.m_cubemap = record.cubemap;
+            envmap.m_tf = record.tf;
+            envmap.m_radiance_factor = record.radiance_factor;
+            envmap.AddRef( record.refs );
+            elems.push_back( std::move( envmap ) );
+        }
+
+        if ( ! restore( Section::EnviromentMapLayout, env_maps, std::move( elems ) ) )
+            return false;
+    }
+
+    m_obj_tfs = std::move( tfs );
+    m_static_meshes = std::move( meshes );
+    m_static_submeshes = std::move( submeshes );
+    m_textures = std::move( textures );
+    m_cubemaps = std::move( cubemaps );
+    m_materials = std::move( materials );
+    m_static_mesh_instances = std::move( instances );
+    m_cameras = std::move( cameras );
+    m_lights = std::move( lights );
+    m_env_maps = std::move( env_maps );
+
+    // journals of restored items point to this scene, all items start clean
+    m_modified_tfs.clear();
+    m_modified_submeshes.clear();
+    m_modified_textures.clear();
+    m_modified_cubemaps.clear();
+    m_modified_materials.clear();
+    m_removed_tfs.clear();
+    m_removed_materials.clear();
+    AttachJournals( m_obj_tfs.get_column<ObjectTransform>(), m_obj_tfs.get_layout(), m_modified_tfs );
+    AttachJournals( m_static_submeshes.get_elems(), m_static_submeshes.get_layout(), m_modified_submeshes );
+    AttachJournals( m_textures.get_elems(), m_textures.get_layout(), m_modified_textures );
+    AttachJournals( m_cubemaps.get_elems(), m_cubemaps.get_layout(), m_modified_cubemaps );
+    AttachJournals( m_materials.get_elems(), m_materials.get_layout(), m_modified_materials );
+
+    // hierarchy levels are not saved, they are rebuilt by the next UpdateTransformHierarchy
+    m_tf_level_offsets.clear();
+    m_tf_order_is_valid = false;
+    m_instance_order_is_valid = false;
+
+    RebuildReverseReferences();
+
+    // restored meshes start from generation 0 again, so trees cached from the previous contents could look valid
+    {
+        std::lock_guard<std::mutex> lock( m_submesh_triangle_bvh_mutex );
+        m_submesh_triangle_bvhs.clear();
+    }
+
+    for ( auto& version : m_versions )
+        version++;
+
+    return true;
+}
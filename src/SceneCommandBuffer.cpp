@@ -0,0 +1,131 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+#include "stdafx.h"
+
+#include "SceneCommandBuffer.h"
+
+#include "Scene.h"
+
+
+// Recording
+
+TransformID SceneCommandBuffer::AddTransform( const DirectX::XMFLOAT4X4& local2parent, TransformID parent )
+{
+    m_commands.emplace_back( AddTransformCmd{ local2parent, parent } );
+    m_added_tfs.push_back( TransformID::nullid );
+    return TransformID{ uint32_t( m_added_tfs.size() - 1 ), ProvisionalTag };
+}
+
+void SceneCommandBuffer::ModifyTransform( TransformID id, const DirectX::XMFLOAT4X4& local2parent )
+{
+    m_commands.emplace_back( ModifyTransformCmd{ id, local2parent } );
+}
+
+void SceneCommandBuffer::SetTransformParent( TransformID id, TransformID parent )
+{
+    m_commands.emplace_back( SetTransformParentCmd{ id, parent } );
+}
+
+void SceneCommandBuffer::RemoveTransform( TransformID id )
+{
+    m_commands.emplace_back( RemoveTransformCmd{ id } );
+}
+
+MeshInstanceID SceneCommandBuffer::AddMeshInstance( StaticSubmeshID submesh_id, TransformID tf_id, MaterialID mat_id )
+{
+    m_commands.emplace_back( AddMeshInstanceCmd{ tf_id, submesh_id, mat_id } );
+    m_added_instances.push_back( MeshInstanceID::nullid );
+    return MeshInstanceID{ uint32_t( m_added_instances.size() - 1 ), ProvisionalTag };
+}
+
+void SceneCommandBuffer::ModifyInstanceFlags( MeshInstanceID id, const StaticMeshInstanceFlags& flags )
+{
+    m_commands.emplace_back( ModifyInstanceFlagsCmd{ id, flags } );
+}
+
+void SceneCommandBuffer::RemoveMeshInstance( MeshInstanceID id )
+{
+    m_commands.emplace_back( RemoveMeshInstanceCmd{ id } );
+}
+
+
+// Resolving
+
+TransformID SceneCommandBuffer::Resolve( TransformID id ) const noexcept
+{
+    if ( ! IsProvisional( id ) )
+        return id;
+
+    assert( id.idx < m_added_tfs.size() );
+    return m_added_tfs[id.idx];
+}
+
+MeshInstanceID SceneCommandBuffer::Resolve( MeshInstanceID id ) const noexcept
+{
+    if ( ! IsProvisional( id ) )
+        return id;
+
+    assert( id.idx < m_added_instances.size() );
+    return m_added_instances[id.idx];
+}
+
+void SceneCommandBuffer::Clear() noexcept
+{
+    m_commands.clear();
+    m_added_tfs.clear();
+    m_added_instances.clear();
+}
+
+
+// Execution
+
+void SceneCommandBuffer::Replay( Scene& scene )
+{
+    // provisional ids are numbered in the order of addition, so they are resolved in the same order
+    m_tfs_resolved = 0;
+    m_instances_resolved = 0;
+    for ( const Command& command : m_commands )
+        std::visit( [&]( const auto& cmd ) { Execute( cmd, scene ); }, command );
+}
+
+void SceneCommandBuffer::Execute( const AddTransformCmd& cmd, Scene& scene )
+{
+    TransformID id = scene.AddTransform();
+    scene.TryModifyTransform( id )->ModifyMat() = cmd.local2parent;
+    m_added_tfs[m_tfs_resolved++] = id;
+
+    if ( cmd.parent != TransformID::nullid )
+        scene.SetTransformParent( id, Resolve( cmd.parent ) );
+}
+
+void SceneCommandBuffer::Execute( const ModifyTransformCmd& cmd, Scene& scene )
+{
+    if ( ObjectTransform* tf = scene.TryModifyTransform( Resolve( cmd.id ) ) )
+        tf->ModifyMat() = cmd.local2parent;
+}
+
+void SceneCommandBuffer::Execute( const SetTransformParentCmd& cmd, Scene& scene )
+{
+    scene.SetTransformParent( Resolve( cmd.id ), Resolve( cmd.parent ) );
+}
+
+void SceneCommandBuffer::Execute( const RemoveTransformCmd& cmd, Scene& scene )
+{
+    scene.RemoveTransform( Resolve( cmd.id ) );
+}
+
+void SceneCommandBuffer::Execute( const AddMeshInstanceCmd& cmd, Scene& scene )
+{
+    m_added_instances[m_instances_resolved++] = scene.AddStaticMeshInstance( Resolve( cmd.tf ), cmd.submesh, cmd.material );
+}
+
+void SceneCommandBuffer::Execute( const ModifyInstanceFlagsCmd& cmd, Scene& scene )
+{
+    if ( StaticMeshInstanceFlags* flags = scene.TryModifyStaticMeshInstanceFlags( Resolve( cmd.id ) ) )
+        *flags = cmd.flags;
+}
+
+void SceneCommandBuffer::Execute( const RemoveMeshInstanceCmd& cmd, Scene& scene )
+{
+    scene.RemoveStaticMeshInstance( Resolve( cmd.id ) );
+}
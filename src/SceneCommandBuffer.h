@@ -0,0 +1,81 @@
+#pragma once
+
+#include "SceneItems.h"
+
+#include "utils/span.h"
+
+#include <variant>
+#include <vector>
+
+// Records scene modifications on a worker thread, so they can be applied later by the thread that owns the scene (see Scene::Apply).
+// Recording doesn't touch the scene, so every thread can fill its own buffer without locks.
+// Added items get provisional ids, which can be used by the following commands of the same buffer.
+// Provisional ids are resolved into real ones when the buffer is applied, see Resolve()
+class SceneCommandBuffer
+{
+public:
+    // Transforms
+    // local2parent is relative to the world if the transform has no parent. Returns provisional id
+    TransformID AddTransform( const DirectX::XMFLOAT4X4& local2parent = Identity4x4, TransformID parent = TransformID::nullid );
+    void ModifyTransform( TransformID id, const DirectX::XMFLOAT4X4& local2parent );
+    void SetTransformParent( TransformID id, TransformID parent );
+    void RemoveTransform( TransformID id );
+
+    // Static mesh instances
+    // returns provisional id
+    MeshInstanceID AddMeshInstance( StaticSubmeshID submesh_id, TransformID tf_id, MaterialID mat_id );
+    void ModifyInstanceFlags( MeshInstanceID id, const StaticMeshInstanceFlags& flags );
+    void RemoveMeshInstance( MeshInstanceID id );
+
+    // real id of an item added by this buffer, valid after the buffer has been applied and until Clear()
+    // real ids are returned as is
+    TransformID Resolve( TransformID id ) const noexcept;
+    MeshInstanceID Resolve( MeshInstanceID id ) const noexcept;
+
+    // real ids of all transforms added by this buffer, in the order of addition. Valid after the buffer has been applied
+    span<const TransformID> AddedTransforms() const noexcept { return make_span( m_added_tfs ); }
+
+    template<typename ID>
+    static bool IsProvisional( ID id ) noexcept { return id.inner_id == ProvisionalTag; }
+
+    bool IsEmpty() const noexcept { return m_commands.empty(); }
+    // drops recorded commands and resolved ids
+    void Clear() noexcept;
+
+private:
+    friend class Scene;
+
+    // real ids never get this slot counter in practice
+    static constexpr uint32_t ProvisionalTag = std::numeric_limits<uint32_t>::max();
+
+    struct AddTransformCmd { DirectX::XMFLOAT4X4 local2parent; TransformID parent; };
+    struct ModifyTransformCmd { TransformID id; DirectX::XMFLOAT4X4 local2parent; };
+    struct SetTransformParentCmd { TransformID id; TransformID parent; };
+    struct RemoveTransformCmd { TransformID id; };
+    struct AddMeshInstanceCmd { TransformID tf; StaticSubmeshID submesh; MaterialID material; };
+    struct ModifyInstanceFlagsCmd { MeshInstanceID id; StaticMeshInstanceFlags flags; };
+    struct RemoveMeshInstanceCmd { MeshInstanceID id; };
+
+    using Command = std::variant<AddTransformCmd, ModifyTransformCmd, SetTransformParentCmd, RemoveTransformCmd,
+                                 AddMeshInstanceCmd, ModifyInstanceFlagsCmd, RemoveMeshInstanceCmd>;
+
+    // executes recorded commands in the order of recording. Throws if a command references an item that doesn't exist,
+    // commands executed before that stay applied. Modifications of removed items and removals refused by the scene are skipped
+    void Replay( Scene& scene );
+
+    void Execute( const AddTransformCmd& cmd, Scene& scene );
+    void Execute( const ModifyTransformCmd& cmd, Scene& scene );
+    void Execute( const SetTransformParentCmd& cmd, Scene& scene );
+    void Execute( const RemoveTransformCmd& cmd, Scene& scene );
+    void Execute( const AddMeshInstanceCmd& cmd, Scene& scene );
+    void Execute( const ModifyInstanceFlagsCmd& cmd, Scene& scene );
+    void Execute( const RemoveMeshInstanceCmd& cmd, Scene& scene );
+
+    std::vector<Command> m_commands;
+
+    // indexed by idx of provisional ids
+    std::vector<TransformID> m_added_tfs;
+    std::vector<MeshInstanceID> m_added_instances;
+    size_t m_tfs_resolved = 0;
+    size_t m_instances_resolved = 0;
+};
@@ -307,24 +307,32 @@ namespace
             // Inherited via FbxSceneVisitor
             virtual bool VisitNode( FbxNode* node, bool& visit_children ) override
             {
+                // every node gets a transform, so submeshes keep only local transforms of their nodes
+                const int node_idx = int( m_scene.nodes.size() );
+                m_node_indices[node] = node_idx;
+
+                const auto parent_it = m_node_indices.find( node->GetParent() );
+                const int parent_idx = parent_it != m_node_indices.end() ? parent_it->second : -1;
+
+                const auto& transform = node->EvaluateLocalTransform();
+                DirectX::XMFLOAT4X4 dxtf( transform.Get( 0, 0 ), transform.Get( 0, 1 ), transform.Get( 0, 2 ), transform.Get( 0, 3 ),
+                                          transform.Get( 1, 0 ), transform.Get( 1, 1 ), transform.Get( 1, 2 ), transform.Get( 1, 3 ), 
+                                          transform.Get( 2, 0 ), transform.Get( 2, 1 ), transform.Get( 2, 2 ), transform.Get( 2, 3 ), 
+                                          transform.Get( 3, 0 ), transform.Get( 3, 1 ), transform.Get( 3, 2 ), transform.Get( 3, 3 ) );
+                m_scene.nodes.push_back( { dxtf, parent_idx } );
+
                 FbxNodeAttribute* main_attrib = node->GetNodeAttribute();
                 if ( ! main_attrib || main_attrib->GetAttributeType() != FbxNodeAttribute::eMesh )
                     return true;
                 
                 std::string name = node->GetName();
                 name += node->GetMesh()->GetName();
-                
-                const auto& transform = node->EvaluateGlobalTransform();
-                DirectX::XMFLOAT4X4 dxtf( transform.Get( 0, 0 ), transform.Get( 0, 1 ), transform.Get( 0, 2 ), transform.Get( 0, 3 ),
-                                          transform.Get( 1, 0 ), transform.Get( 1, 1 ), transform.Get( 1, 2 ), transform.Get( 1, 3 ), 
-                                          transform.Get( 2, 0 ), transform.Get( 2, 1 ), transform.Get( 2, 2 ), transform.Get( 2, 3 ), 
-                                          transform.Get( 3, 0 ), transform.Get( 3, 1 ), transform.Get( 3, 2 ), transform.Get( 3, 3 ) );
 
                 for ( int material_idx : m_data.mesh2submeshes.find( node->GetMesh() )->second )
                 {
                     const auto& submesh = m_data.submeshes.find( std::make_pair( node->GetMesh(), material_idx ) )->second;
                     name += std::to_string( material_idx );
-                    m_scene.submeshes.push_back( { name, size_t( submesh.triangle_count * 3 ), size_t( submesh.index_offset ), material_idx, dxtf } );
+                    m_scene.submeshes.push_back( { name, size_t( submesh.triangle_count * 3 ), size_t( submesh.index_offset ), material_idx, node_idx } );
                 }
 
                 return true;
@@ -334,6 +342,7 @@ namespace
 
             const PrepassData& m_data;
             ImportedScene& m_scene;
+            std::unordered_map<const FbxNode*, int> m_node_indices;
         };
 
     };
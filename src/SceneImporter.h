@@ -16,13 +16,20 @@ struct ImportedScene
     std::vector<uint32_t> indices;
     std::vector<std::pair<std::string, TextureID>> textures;
     std::vector<std::pair<std::string, SceneMaterial>> materials;
+    // parents always precede their children
+    struct Node
+    {
+        DirectX::XMFLOAT4X4 local2parent;
+        int parent_idx; // -1 for top-level nodes
+    };
+    std::vector<Node> nodes;
     struct Submesh
     {
         std::string name;
         size_t nindices;
         size_t index_offset;
         int material_idx;
-        DirectX::XMFLOAT4X4 transform;
+        int node_idx;
     };
     std::vector<Submesh> submeshes;
     StaticMeshID mesh_id = StaticMeshID::nullid;
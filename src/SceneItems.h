@@ -20,14 +20,15 @@ class RefCounter
 {
 public:
     RefCounter() noexcept = default;
-    RefCounter( const RefCounter& ) = delete;
-    RefCounter& operator=( const RefCounter& ) = delete;
+    // copies are made only by scene snapshots
+    RefCounter( const RefCounter& ) noexcept = default;
+    RefCounter& operator=( const RefCounter& ) noexcept = default;
 
     RefCounter( RefCounter&& ) noexcept = default;
     RefCounter& operator=( RefCounter&& rhs ) noexcept = default;
 
-    // Adds one ref
-    void AddRef() noexcept { m_refs++; }
+    // Adds nrefs refs
+    void AddRef( uint32_t nrefs = 1 ) noexcept { m_refs += nrefs; }
     // Releases one ref, returns true if there are references left
     bool ReleaseRef() noexcept { if ( m_refs ) m_refs--; return m_refs; }
 
@@ -37,28 +38,70 @@ private:
     uint32_t m_refs = 0;
 };
 
-class ObjectTransform : public RefCounter
+// Base for scene items that report their modifications.
+// First modification after Clean() appends the id of the item to the change journal of the owning scene,
+// so scene systems can visit only the items that have changed instead of scanning whole storages
+template<typename ID>
+class ChangeTracker
+{
+public:
+    bool IsDirty() const noexcept { return m_is_dirty; }
+    void Clean() noexcept { m_is_dirty = false; }
+
+protected:
+    void MarkDirty() noexcept
+    {
+        if ( ! m_is_dirty && m_journal )
+            m_journal->push_back( m_id );
+        m_is_dirty = true;
+    }
+
+private:
+    friend class Scene;
+
+    std::vector<ID>* m_journal = nullptr;
+    ID m_id = ID::nullid;
+    bool m_is_dirty = false;
+};
+
+// Scene stores transforms in columns, gpu view, ref counter and hierarchy node of a transform live in separate columns (see Scene::AllTransforms)
+class ObjectTransform : public ChangeTracker<freelist_id<ObjectTransform>>
 {
 public:
     // main data
-    DirectX::XMFLOAT4X4& ModifyMat() noexcept { m_is_dirty = true; return m_obj2world; }
-    const DirectX::XMFLOAT4X4& Obj2World() const noexcept { return m_obj2world; }
+    // relative to the parent transform, or to the world if the transform has no parent
+    DirectX::XMFLOAT4X4& ModifyMat() noexcept { MarkDirty(); return m_local2parent; }
+    const DirectX::XMFLOAT4X4& Local2Parent() const noexcept { return m_local2parent; }
 
     // properties
-    D3D12_GPU_VIRTUAL_ADDRESS& GPUView() noexcept { return m_gpu; }
-    const D3D12_GPU_VIRTUAL_ADDRESS& GPUView() const noexcept { return m_gpu; }
-    bool IsDirty() const noexcept { return m_is_dirty; }
-    void Clean() noexcept { m_is_dirty = false; }
+    // recalculated from the hierarchy in Scene::UpdateTransformHierarchy
+    const DirectX::XMFLOAT4X4& Obj2World() const noexcept { return m_obj2world; }
+
 private:
     friend class Scene;
     ObjectTransform() {}
 
+    DirectX::XMFLOAT4X4 m_local2parent;
     DirectX::XMFLOAT4X4 m_obj2world;
-    D3D12_GPU_VIRTUAL_ADDRESS m_gpu;
+};
+using TransformID = freelist_id<ObjectTransform>;
 
-    bool m_is_dirty = false;
+
+// Place of a transform in the transform hierarchy
+class TransformHierarchyNode
+{
+public:
+    TransformID GetParent() const noexcept { return m_parent; }
+    uint32_t Depth() const noexcept { return m_depth; } // 0 for transforms without a parent
+
+private:
+    friend class Scene;
+
+    TransformID m_parent = TransformID::nullid;
+    uint32_t m_parent_packed_idx = std::numeric_limits<uint32_t>::max(); // valid only while the hierarchy order is up to date
+    uint32_t m_depth = 0;
+    bool m_world_changed = false; // result of the last propagation pass
 };
-using TransformID = typename packed_freelist<ObjectTransform>::id;
 
 
 class StaticMesh : public RefCounter
@@ -92,11 +135,12 @@ private:
     D3D12_INDEX_BUFFER_VIEW m_ibv;
     D3D_PRIMITIVE_TOPOLOGY m_topology;
     bool m_is_loaded = false;
+    uint64_t m_generation = 0; // bumped by Scene::TryModifyStaticMesh, keys data cached from this mesh
 };
 using StaticMeshID = typename packed_freelist<StaticMesh>::id;
 
 
-class StaticSubmesh : public RefCounter
+class StaticSubmesh : public RefCounter, public ChangeTracker<freelist_id<StaticSubmesh>>
 {
 public:
     struct Data
@@ -108,7 +152,7 @@ public:
 
     // main data
     const Data& DrawArgs() const noexcept { return m_data; }
-    Data& Modify() noexcept { m_is_dirty = true; return m_data; }
+    Data& Modify() noexcept { MarkDirty(); return m_data; }
 
     StaticMeshID GetMesh() const noexcept { return m_mesh_id; }
 
@@ -119,9 +163,6 @@ public:
     DirectX::XMFLOAT2& MaxInverseUVDensity() noexcept { return m_max_inv_uv_density; }
     const DirectX::XMFLOAT2& MaxInverseUVDensity() const noexcept { return m_max_inv_uv_density; }
 
-    bool IsDirty() const noexcept { return m_is_dirty; }
-    void Clean() noexcept { m_is_dirty = false; }
-
 private:
     friend class Scene;
     StaticSubmesh( StaticMeshID mesh_id ) : m_mesh_id( mesh_id ), m_data{ 0, 0, 0 } {}
@@ -132,25 +173,21 @@ private:
 
     DirectX::BoundingBox m_box;
     DirectX::XMFLOAT2 m_max_inv_uv_density; // for mip streaming
-    bool m_is_dirty = false;
 };
 using StaticSubmeshID = typename packed_freelist<StaticSubmesh>::id;
 
 
-class Texture : public RefCounter
+class Texture : public RefCounter, public ChangeTracker<freelist_id<Texture>>
 {
 public:
     // main data
-    D3D12_CPU_DESCRIPTOR_HANDLE& ModifyStagingSRV() noexcept { m_is_dirty = true; return m_staging_srv; }
+    D3D12_CPU_DESCRIPTOR_HANDLE& ModifyStagingSRV() noexcept { MarkDirty(); return m_staging_srv; }
     D3D12_CPU_DESCRIPTOR_HANDLE StagingSRV() const noexcept { return m_staging_srv; }
 
     // properties
     DirectX::XMFLOAT2& MaxPixelsPerUV() noexcept { return m_max_pixels_per_uv; }
     const DirectX::XMFLOAT2& MaxPixelsPerUV() const noexcept { return m_max_pixels_per_uv; }
 
-    bool IsDirty() const noexcept { return m_is_dirty; }
-    void Clean() noexcept { m_is_dirty = false; }
-
     bool IsLoaded() const noexcept { return m_is_loaded; }
     void Load( D3D12_CPU_DESCRIPTOR_HANDLE descriptor ) noexcept { ModifyStagingSRV() = descriptor; m_is_loaded = true; }
 
@@ -160,23 +197,19 @@ private:
 
     D3D12_CPU_DESCRIPTOR_HANDLE m_staging_srv;
     DirectX::XMFLOAT2 m_max_pixels_per_uv = DirectX::XMFLOAT2( 0, 0 ); // for mip streaming
-    bool m_is_dirty = false;
     bool m_is_loaded = false;
 };
 using TextureID = typename packed_freelist<Texture>::id;
 
 
-class Cubemap : public RefCounter
+class Cubemap : public RefCounter, public ChangeTracker<freelist_id<Cubemap>>
 {
 public:
     // main data
-    D3D12_CPU_DESCRIPTOR_HANDLE& ModifyStagingSRV() noexcept { m_is_dirty = true; return m_staging_srv; }
+    D3D12_CPU_DESCRIPTOR_HANDLE& ModifyStagingSRV() noexcept { MarkDirty(); return m_staging_srv; }
     D3D12_CPU_DESCRIPTOR_HANDLE StagingSRV() const noexcept { return m_staging_srv; }
 
     // properties
-    bool IsDirty() const noexcept { return m_is_dirty; }
-    void Clean() noexcept { m_is_dirty = false; }
-
     bool IsLoaded() const noexcept { return m_is_loaded; }
     void Load( D3D12_CPU_DESCRIPTOR_HANDLE descriptor ) noexcept { ModifyStagingSRV() = descriptor; m_is_loaded = true; }
 
@@ -185,13 +218,12 @@ private:
     Cubemap() {}
 
     D3D12_CPU_DESCRIPTOR_HANDLE m_staging_srv;
-    bool m_is_dirty = false;
     bool m_is_loaded = false;
 };
 using CubemapID = typename packed_freelist<Cubemap>::id;
 
 
-class MaterialPBR : public RefCounter
+class MaterialPBR : public RefCounter, public ChangeTracker<freelist_id<MaterialPBR>>
 {
 public:
     struct TextureIds
@@ -211,19 +243,20 @@ public:
     // main data
     const TextureIds& Textures() const noexcept { return m_textures; }
     const Data& GetData() const noexcept { return m_data; }
-    Data& Modify() noexcept { m_is_dirty = true; return m_data; }
+    Data& Modify() noexcept { MarkDirty(); return m_data; }
 
     // properties
     // descriptor table with 3 entries. valid only if all textures above are loaded
     D3D12_GPU_DESCRIPTOR_HANDLE& DescriptorTable() noexcept { return m_desc_table; }
     const D3D12_GPU_DESCRIPTOR_HANDLE& DescriptorTable() const noexcept { return m_desc_table; }
 
-    // material cb
+    // offset of material constants in the dynamic scene buffer, see DynamicSceneBuffers::GetGPUAddress
     D3D12_GPU_VIRTUAL_ADDRESS& GPUConstantBuffer() noexcept { return m_material_cb; }
     const D3D12_GPU_VIRTUAL_ADDRESS& GPUConstantBuffer() const noexcept { return m_material_cb; }
 
-    bool IsDirty() const noexcept { return m_is_dirty; }
-    void Clean() noexcept { m_is_dirty = false; }
+    // the depth prepass clips pixels on base color alpha, so a material is alpha-tested unless it is known to be opaque
+    bool& IsAlphaTested() noexcept { return m_alpha_tested; }
+    bool IsAlphaTested() const noexcept { return m_alpha_tested; }
 
 private:
     friend class Scene;
@@ -235,13 +268,13 @@ private:
     Data m_data;
 
     D3D12_GPU_DESCRIPTOR_HANDLE m_desc_table;
-    D3D12_GPU_VIRTUAL_ADDRESS m_material_cb;
-
-    bool m_is_dirty = false;
+    D3D12_GPU_VIRTUAL_ADDRESS m_material_cb = 0;
+    bool m_alpha_tested = true;
 };
 using MaterialID = typename packed_freelist<MaterialPBR>::id;
 
 
+// Scene stores mesh instances in columns, flags of an instance live in a separate column (see Scene::AllStaticMeshInstances)
 class StaticMeshInstance
 {
 public:
@@ -249,12 +282,6 @@ public:
     MaterialID Material() const noexcept { return m_material; }
     StaticSubmeshID Submesh() const noexcept { return m_submesh; }
 
-    bool HasShadow() const noexcept { return m_has_shadow; }
-    bool& HasShadow() noexcept { return m_has_shadow; }
-
-    bool IsEnabled() const noexcept { return m_is_enabled; }
-    bool& IsEnabled() noexcept { return m_is_enabled; }
-
 private:
     friend class Scene;
     StaticMeshInstance() {}
@@ -265,11 +292,35 @@ private:
     TransformID m_transform;
     MaterialID m_material;
     StaticSubmeshID m_submesh;
+};
+using MeshInstanceID = freelist_id<StaticMeshInstance>;
+
+
+class StaticMeshInstanceFlags
+{
+public:
+    static constexpr uint32_t MaxLayers = 8;
 
-    bool m_has_shadow = false;
+    bool HasShadow() const noexcept { return m_has_shadow; }
+    bool& HasShadow() noexcept { return m_has_shadow; }
+
+    bool IsEnabled() const noexcept { return m_is_enabled; }
+    bool& IsEnabled() noexcept { return m_is_enabled; }
+
+    // dynamic instances are expected to move every frame, static ones almost never
+    bool IsDynamic() const noexcept { return m_is_dynamic; }
+    bool& IsDynamic() noexcept { return m_is_dynamic; }
+
+    // bit i is set if the instance belongs to layer i, views choose which layers they render
+    uint8_t LayerMask() const noexcept { return m_layer_mask; }
+    uint8_t& LayerMask() noexcept { return m_layer_mask; }
+
+private:
+    bool m_has_shadow = true;
     bool m_is_enabled = true;
+    bool m_is_dynamic = false;
+    uint8_t m_layer_mask = 1;
 };
-using MeshInstanceID = typename packed_freelist<StaticMeshInstance>::id;
 
 
 class EnviromentMap : public RefCounter
@@ -6,6 +6,8 @@
 
 #include "StaticMeshManager.h"
 
+#include "utils/worker_pool.h"
+
 #include <DirectXMath.h>
 
 StaticMeshID SceneClientView::LoadStaticMesh( std::string name, std::vector<Vertex> vertices, std::vector<uint32_t> indices )
@@ -50,10 +52,12 @@ CubemapID SceneClientView::AddCubemapFromTexture( TextureID tex_id )
     return cm_id;
 }
 
-TransformID SceneClientView::AddTransform( const DirectX::XMFLOAT4X4& obj2world )
+TransformID SceneClientView::AddTransform( const DirectX::XMFLOAT4X4& local2parent, TransformID parent )
 {
     TransformID tf_id = m_scene->AddTransform();
-    m_scene->TryModifyTransform( tf_id )->ModifyMat() = obj2world;
+    m_scene->TryModifyTransform( tf_id )->ModifyMat() = local2parent;
+    if ( parent != TransformID::nullid )
+        m_scene->SetTransformParent( tf_id, parent );
 
     m_dynamic_buffers->AddTransform( tf_id );
     return tf_id;
@@ -86,6 +90,11 @@ MeshInstanceID SceneClientView::AddMeshInstance( StaticSubmeshID submesh_id, Tra
     return m_scene->AddStaticMeshInstance( tf_id, submesh_id, mat_id );
 }
 
+span<MeshInstanceID> SceneClientView::AddMeshInstances( span<const Scene::StaticMeshInstanceDesc> instances, span<MeshInstanceID> ids_storage )
+{
+    return m_scene->AddStaticMeshInstances( instances, ids_storage );
+}
+
 EnvMapID SceneClientView::AddEnviromentMap( CubemapID cubemap_id, TransformID transform_id )
 {
     EnvMapID id = m_scene->AddEnviromentMap( cubemap_id, transform_id );
@@ -139,9 +148,14 @@ SceneLight* SceneClientView::ModifyLight( LightID id ) noexcept
     return m_scene->TryModifyLight( id );
 }
 
-StaticMeshInstance* SceneClientView::ModifyInstance( MeshInstanceID id ) noexcept
+const StaticMeshInstance* SceneClientView::GetInstance( MeshInstanceID id ) const noexcept
 {
-    return m_scene->TryModifyStaticMeshInstance( id );
+    return m_scene->AllStaticMeshInstances().try_get<StaticMeshInstance>( id );
+}
+
+StaticMeshInstanceFlags* SceneClientView::ModifyInstanceFlags( MeshInstanceID id ) noexcept
+{
+    return m_scene->TryModifyStaticMeshInstanceFlags( id );
 }
 
 ObjectTransform* SceneClientView::ModifyTransform( TransformID id ) noexcept
@@ -149,6 +163,16 @@ ObjectTransform* SceneClientView::ModifyTransform( TransformID id ) noexcept
     return m_scene->TryModifyTransform( id );
 }
 
+void SceneClientView::ApplyCommands( span<SceneCommandBuffer> buffers )
+{
+    m_scene->Apply( buffers );
+
+    for ( const SceneCommandBuffer& buffer : buffers )
+        for ( TransformID tf_id : buffer.AddedTransforms() )
+            if ( m_scene->AllTransforms().has( tf_id ) )
+                m_dynamic_buffers->AddTransform( tf_id );
+}
+
 
 
 SceneManager::SceneManager( Microsoft::WRL::ComPtr<ID3D12Device> device,
@@ -238,8 +262,12 @@ void SceneManager::UpdateFramegraphBindings( CameraID main_camera_id, const Para
 
     GPUTaskQueue::Timestamp current_copy_time = m_copy_queue->GetCurrentTimestamp();		
 
+    m_scene.UpdateTransformHierarchy();
+    m_scene.GroupStaticMeshInstances();
+    m_scene.UpdateStaticMeshInstanceMasks();
     m_static_mesh_mgr.Update( cur_op, current_copy_time, *m_copy_cmd_list.Get() );
     ProcessSubmeshes();
+    m_scene.UpdateStaticMeshInstanceBounds();
     m_uv_density_calculator.Update( main_camera_id, main_viewport );
     m_tex_streamer.Update( cur_op, current_copy_time, *m_copy_queue, *m_copy_cmd_list.Get() );
     m_static_texture_mgr.Update( cur_op, current_copy_time, *m_copy_cmd_list.Get() );
@@ -284,30 +312,24 @@ void SceneManager::FlushAllOperations()
 
 void SceneManager::CleanModifiedItemsStatus()
 {
-    for ( auto& tf : m_scene.TransformSpan() )
-        tf.Clean();
-
-    for ( auto& mat : m_scene.MaterialSpan() )
-        mat.Clean();
-
-    for ( auto& tex : m_scene.TextureSpan() )
-        tex.Clean();
-
-    for ( auto& submesh : m_scene.StaticSubmeshSpan() )
-        submesh.Clean();
+    m_scene.ClearChangeJournals();
 }
 
 
 void SceneManager::ProcessSubmeshes()
 {
-    for ( auto& submesh : m_scene.StaticSubmeshSpan() )
+    // TryModify* is not thread-safe, so the submeshes are gathered first. Processing only reads meshes
+    std::vector<StaticSubmesh*> submeshes;
+    submeshes.reserve( m_scene.ModifiedStaticSubmeshes().size() );
+    for ( StaticSubmeshID submesh_id : m_scene.ModifiedStaticSubmeshes() )
+        if ( StaticSubmesh* submesh = m_scene.TryModifyStaticSubmesh( submesh_id ) )
+            submeshes.push_back( submesh );
+
+    parallel_for_each( make_span( submeshes ), 1, [this]( StaticSubmesh* submesh )
     {
-        if ( submesh.IsDirty() )
-        {
-            CalcSubmeshBoundingBox( submesh );
-            m_uv_density_calculator.CalcUVDensityInObjectSpace( submesh );
-        }
-    }
+        CalcSubmeshBoundingBox( *submesh );
+        m_uv_density_calculator.CalcUVDensityInObjectSpace( *submesh );
+    } );
 }
 
 void SceneManager::CalcSubmeshBoundingBox( StaticSubmesh& submesh )
@@ -2,6 +2,7 @@
 
 #include "RenderData.h"
 #include "Scene.h"
+#include "SceneCommandBuffer.h"
 
 #include "StaticMeshManager.h"
 #include "StaticTextureManager.h"
@@ -43,10 +44,12 @@ public:
     TextureID LoadStaticTexture( std::string path );
     CubemapID LoadCubemap( std::string path );
     CubemapID AddCubemapFromTexture( TextureID tex_id );
-    TransformID AddTransform( const DirectX::XMFLOAT4X4& obj2world = Identity4x4 );
+    // local2parent is relative to the world if the transform has no parent
+    TransformID AddTransform( const DirectX::XMFLOAT4X4& local2parent = Identity4x4, TransformID parent = TransformID::nullid );
     MaterialID AddMaterial( const MaterialPBR::TextureIds& textures, const DirectX::XMFLOAT3& diffuse_fresnel, const DirectX::XMFLOAT4X4& uv_transform = Identity4x4 );
     StaticSubmeshID AddSubmesh( StaticMeshID mesh_id, const StaticSubmesh::Data& data );
     MeshInstanceID AddMeshInstance( StaticSubmeshID submesh_id, TransformID tf_id, MaterialID mat_id );
+    span<MeshInstanceID> AddMeshInstances( span<const Scene::StaticMeshInstanceDesc> instances, span<MeshInstanceID> ids_storage );
 
     EnvMapID AddEnviromentMap( CubemapID cubemap_id, TransformID transform_id );
     EnviromentMap* ModifyEnviromentMap( EnvMapID envmap_id ) noexcept;
@@ -60,9 +63,13 @@ public:
     const SceneLight* GetLight( LightID id ) const noexcept;
     SceneLight* ModifyLight( LightID id ) noexcept;
 
-    StaticMeshInstance* ModifyInstance( MeshInstanceID id ) noexcept;
+    const StaticMeshInstance* GetInstance( MeshInstanceID id ) const noexcept;
+    StaticMeshInstanceFlags* ModifyInstanceFlags( MeshInstanceID id ) noexcept;
     ObjectTransform* ModifyTransform( TransformID id ) noexcept;
 
+    // applies commands recorded on worker threads, see Scene::Apply
+    void ApplyCommands( span<SceneCommandBuffer> buffers );
+
 private:
     Scene* m_scene;
     StaticMeshManager* m_static_mesh_manager;
@@ -93,6 +100,7 @@ public:
     void FlushAllOperations();
 
     const TextureStreamer& GetTexStreamer() const noexcept { return m_tex_streamer; }
+    const DynamicSceneBuffers& GetDynamicBuffers() const noexcept { return m_dynamic_buffers; }
 
 private:
 
@@ -1,4 +1,4 @@
-// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+﻿// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
 // PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
 #include "stdafx.h"
 
@@ -7,6 +7,9 @@
 #include "FramegraphResource.h"
 #include "Framegraph.h"
 
+#include "utils/worker_pool.h"
+#include "utils/radix_sort.h"
+
 
 SceneRenderer SceneRenderer::Create( const DeviceContext& ctx, uint32_t width, uint32_t height, uint32_t n_frames_in_flight )
 {
@@ -208,6 +211,7 @@ void SceneRenderer::Draw( const SceneContext& scene_ctx, const FrameContext& fra
         NOTIMPL;
 
     m_framegraph.ClearResources();
+    m_frame_allocator.reset();
 
     if ( m_framegraph.IsRebuildNeeded() )
         m_framegraph.Rebuild();
@@ -218,17 +222,19 @@ void SceneRenderer::Draw( const SceneContext& scene_ctx, const FrameContext& fra
     if ( ! main_camera )
         throw SnowEngineException( "no main camera" );
 
-    std::vector<RenderItem> lighting_items = CreateRenderitems( main_camera->GetData(), scene );
-
     m_shadow_provider.Update( scene.LightSpan(), m_pssm, main_camera->GetData() );
     m_forward_cb_provider.Update( main_camera->GetData(), m_pssm, scene.LightSpan() );
+    m_shadow_provider.CreateShadowProducers( m_forward_cb_provider.GetLightsInCB() );
+
+    // the main view and shadow caster volumes are culled in one traversal, see CreateRenderitems
+    std::pmr::vector<RenderItem> lighting_items = CreateRenderitems( main_camera->GetData(), scene, scene_ctx.dynamic_buffer );
 
     {
         ShadowProducers producers;
         ShadowMaps sm_storage;
         ShadowCascadeProducers pssm_producers;
         ShadowCascade pssm_storage;
-        m_shadow_provider.FillFramegraphStructures( scene, m_forward_cb_provider.GetLightsInCB(), scene.StaticMeshInstanceSpan(),
+        m_shadow_provider.FillFramegraphStructures( scene, scene_ctx.dynamic_buffer, make_span( std::as_const( m_instance_view_masks ) ), 1,
                                                     producers, pssm_producers, sm_storage, pssm_storage );
         m_framegraph.SetRes( producers );
         m_framegraph.SetRes( sm_storage );
@@ -275,7 +281,7 @@ void SceneRenderer::Draw( const SceneContext& scene_ctx, const FrameContext& fra
     list_iface->SetDescriptorHeaps( 1, heaps );
 
     {
-        m_framegraph.SetRes( CreateSkybox( main_camera->GetSkybox(), scene_ctx.ibl_table, scene ) );
+        m_framegraph.SetRes( CreateSkybox( main_camera->GetSkybox(), scene_ctx.ibl_table, scene, scene_ctx.dynamic_buffer ) );
 
         ForwardPassCB pass_cb{ m_forward_cb_provider.GetCBPointer() };
         m_framegraph.SetRes( pass_cb );
@@ -355,12 +361,34 @@ void SceneRenderer::Draw( const SceneContext& scene_ctx, const FrameContext& fra
 
     m_framegraph.Run( *list_iface );
 
+    m_draw_state_stats = m_framegraph.GetNode<DepthPrepassNode>()->TakeDrawStateStats();
+    m_draw_state_stats += m_framegraph.GetNode<ShadowPassNode>()->TakeDrawStateStats();
+    m_draw_state_stats += m_framegraph.GetNode<PSSMNode>()->TakeDrawStateStats();
+    m_draw_state_stats += m_framegraph.GetNode<ForwardPassNode>()->TakeDrawStateStats();
+
     ThrowIfFailedH( list_iface->Close() );
 
     graphics_cmd_lists.emplace_back( std::move( cmd_list ) );
 }
 
 
+void SceneRenderer::SetTemporalCullingSettings( const TemporalCullingSettings& settings ) noexcept
+{
+    m_main_view_cache.set_margin( settings.margin );
+    m_main_view_cache.set_max_age( settings.max_age );
+    m_main_view_cache.invalidate();
+}
+
+
+SceneRenderer::TemporalCullingSettings SceneRenderer::GetTemporalCullingSettings() const noexcept
+{
+    TemporalCullingSettings settings;
+    settings.margin = m_main_view_cache.margin();
+    settings.max_age = m_main_view_cache.max_age();
+    return settings;
+}
+
+
 void SceneRenderer::SetInternalResolution( uint32_t width, uint32_t height )
 {
     m_resolution_width = width;
@@ -389,7 +417,25 @@ void SceneRenderer::SetTargetFormat( RenderMode mode, DXGI_FORMAT format )
 }
 
 
-std::vector<RenderItem> SceneRenderer::CreateRenderitems( const Camera::Data& camera, const Scene& scene ) const
+uint64_t SceneRenderer::MakeRenderItemSortKey( uint32_t material_idx, uint32_t mesh_idx, float normalized_depth ) noexcept
+{
+    // from the top: pipeline state, material, mesh buffers, depth. Only the low bits of the indices are taken,
+    // so indices past the field width merely share a group
+    constexpr uint32_t depth_bits = 24;
+    constexpr uint32_t mesh_bits = 16;
+    constexpr uint32_t material_bits = 20;
+
+    const uint64_t max_depth = ( 1ull << depth_bits ) - 1;
+    const uint64_t depth = uint64_t( std::clamp( normalized_depth, 0.0f, 1.0f ) * float( max_depth ) );
+    const uint64_t mesh = mesh_idx & ( ( 1ull << mesh_bits ) - 1 );
+    const uint64_t material = material_idx & ( ( 1ull << material_bits ) - 1 );
+
+    // every item is drawn with the same pipeline state for now, the top bits stay 0
+    return ( material << ( mesh_bits + depth_bits ) ) | ( mesh << depth_bits ) | depth;
+}
+
+
+std::pmr::vector<RenderItem> SceneRenderer::CreateRenderitems( const Camera::Data& camera, const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer )
 {
     if ( camera.type != Camera::Type::Perspective )
         NOTIMPL;
@@ -399,27 +445,123 @@ std::vector<RenderItem> SceneRenderer::CreateRenderitems( const Camera::Data& ca
                                                                 camera.near_plane,
                                                                 camera.far_plane );
 
-    DirectX::BoundingFrustum main_bf( proj );
-
     DirectX::XMMATRIX view = DirectX::XMMatrixLookToLH( DirectX::XMLoadFloat3( &camera.pos ),
                                                         DirectX::XMLoadFloat3( &camera.dir ),
                                                         DirectX::XMLoadFloat3( &camera.up ) ); // maybe store this matrix in the camera?
-    DirectX::XMVECTOR det;
-    main_bf.Transform( main_bf, DirectX::XMMatrixInverse( &det, view ) );
 
-    std::vector<RenderItem> items;
-    items.reserve( scene.StaticMeshInstanceSpan().size() );
-    for ( const auto& mesh_instance : scene.StaticMeshInstanceSpan() )
+    DirectX::XMFLOAT4X4 view_matrix;
+    DirectX::XMStoreFloat4x4( &view_matrix, view );
+    DirectX::XMFLOAT4X4 view_proj;
+    DirectX::XMStoreFloat4x4( &view_proj, DirectX::XMMatrixMultiply( view, proj ) );
+
+    const auto instances = scene.StaticMeshInstanceSpan();
+
+    // frustum culling on world boxes, bit 0 of the view masks is the main camera, shadow caster volumes follow.
+    // Only enabled instances which passed it are looked at below
+    const auto caster_volumes = m_shadow_provider.GetCasterVolumes();
+    if ( 1 + caster_volumes.size() > bvh::MaxViews )
+        throw SnowEngineException( "too many views to cull" );
+
+    const auto world_boxes = scene.StaticMeshInstanceWorldBoxSpan();
+    assert( world_boxes.size() == instances.size() );
+
+    // the main view keeps its result for static instances across frames and retests only instances near the frustum boundary
+    // and moved ones. Changes the renderer hasn't seen one by one, e.g. if it skipped a scene update, force a full cull
+    const auto& bounds_changes = scene.LastStaticMeshInstanceBoundsChanges();
+    span<const uint32_t> moved_instances;
+    if ( bounds_changes.version != m_seen_bounds_version )
+    {
+        if ( bounds_changes.all || bounds_changes.version != m_seen_bounds_version + 1 )
+            m_main_view_cache.invalidate();
+        else
+            moved_instances = make_span( bounds_changes.instances );
+        m_seen_bounds_version = bounds_changes.version;
+    }
+
+    {
+        DirectX::XMFLOAT4X4 proj_matrix;
+        DirectX::XMStoreFloat4x4( &proj_matrix, proj );
+
+        visibility_cache::view main_view;
+        std::copy( &view_matrix.m[0][0], &view_matrix.m[0][0] + 16, &main_view.view[0][0] );
+        std::copy( &proj_matrix.m[0][0], &proj_matrix.m[0][0] + 16, &main_view.proj[0][0] );
+        m_main_view_cache.update( main_view, scene.StaticMeshInstanceBVH(), world_boxes, moved_instances );
+    }
+
+    // caster volumes are culled together in one traversal and shifted past the main view bit
+    m_instance_view_masks.assign( instances.size(), 0 );
+    scene.QueryStaticMeshInstances( caster_volumes, make_span( m_instance_view_masks ) );
+
+    const dense_bitset& main_view_visible = m_main_view_cache.visible();
+    for ( size_t i = 0; i < instances.size(); ++i )
+        m_instance_view_masks[i] = uint8_t( m_instance_view_masks[i] << 1 ) | uint8_t( main_view_visible.test( i ) );
+
+    // dynamic instances move every frame, there is nothing to reuse for them
+    scene.DynamicMeshInstanceGrid().cull( make_frustum( view_proj.m ), [&]( uint32_t idx ) { m_instance_view_masks[idx] |= 1; } );
+
+    // contribution culling, the main view and caster volumes have their own thresholds
+    const auto screen_sizes = scene.StaticMeshInstanceScreenSizeSpan();
+    assert( screen_sizes.size() == instances.size() );
+    for ( size_t i = 0; i < instances.size(); ++i )
+    {
+        if ( screen_sizes[i] < m_contribution_cull_settings.min_screen_size )
+            m_instance_view_masks[i] &= uint8_t( ~1u );
+        if ( screen_sizes[i] < m_contribution_cull_settings.min_caster_screen_size )
+            m_instance_view_masks[i] &= uint8_t( 1u );
+    }
+
+    m_visible_instances.assign_masked( make_span( std::as_const( m_instance_view_masks ) ), 1 );
+    m_visible_instances &= scene.GetStaticMeshInstanceMasks().enabled;
+
+    m_occlusion_stats = OcclusionStats();
+    if ( m_occlusion_settings.enabled )
+        CullOccludedInstances( camera, view_proj, scene );
+
+    // every task packs its keys into its own part of the array, the parts are then moved together in instance order,
+    // so the result doesn't depend on the number of threads
+    std::pmr::vector<keyed_index> keys( instances.size(), &m_frame_allocator );
+
+    constexpr size_t words_per_task = 4;
+    const size_t nitems = parallel_gather( m_visible_instances.words(), words_per_task, make_span( keys ),
+                                           [&]( size_t i, keyed_index& key )
     {
-        if ( ! mesh_instance.IsEnabled() )
-            continue;
+        const StaticMeshInstance& mesh_instance = instances[i];
 
         const StaticSubmesh& submesh = scene.AllStaticSubmeshes()[mesh_instance.Submesh()];
         const StaticMesh& geom = scene.AllStaticMeshes()[submesh.GetMesh()];
         if ( ! geom.IsLoaded() )
-            continue;
+            return false;
+
+        const MaterialPBR& material = scene.AllMaterials()[mesh_instance.Material()];
+        const auto& textures = material.Textures();
+        for ( TextureID tex_id : { textures.base_color, textures.normal, textures.specular, textures.preintegrated_brdf } )
+            if ( ! scene.AllTextures()[tex_id].IsLoaded() )
+                return false;
+
+        const auto center = world_boxes[i].center();
+        const float view_depth = center[0] * view_matrix.m[0][2] + center[1] * view_matrix.m[1][2]
+                                 + center[2] * view_matrix.m[2][2] + view_matrix.m[3][2];
+
+        key.key = MakeRenderItemSortKey( mesh_instance.Material().idx, submesh.GetMesh().idx,
+                                         ( view_depth - camera.near_plane ) / ( camera.far_plane - camera.near_plane ) );
+        key.idx = uint32_t( i );
+        return true;
+    } );
+    keys.resize( nitems );
+
+    std::pmr::vector<keyed_index> sort_scratch( nitems, &m_frame_allocator );
+    radix_sort( make_span( keys ), make_span( sort_scratch ) );
+
+    std::pmr::vector<RenderItem> items( nitems, &m_frame_allocator );
+
+    constexpr size_t items_per_task = 256;
+    parallel_for_each( make_span( items ), items_per_task, [&]( RenderItem& item )
+    {
+        const StaticMeshInstance& mesh_instance = instances[keys[&item - items.data()].idx];
+
+        const StaticSubmesh& submesh = scene.AllStaticSubmeshes()[mesh_instance.Submesh()];
+        const StaticMesh& geom = scene.AllStaticMeshes()[submesh.GetMesh()];
 
-        RenderItem item;
         item.ibv = geom.IndexBufferView();
         item.vbv = geom.VertexBufferView();
 
@@ -430,42 +572,110 @@ std::vector<RenderItem> SceneRenderer::CreateRenderitems( const Camera::Data& ca
         item.vertex_offset = submesh_draw_args.base_vertex_loc;
 
         const MaterialPBR& material = scene.AllMaterials()[mesh_instance.Material()];
-        item.mat_cb = material.GPUConstantBuffer();
+        item.mat_cb = dynamic_buffer + material.GPUConstantBuffer();
         item.mat_table = material.DescriptorTable();
 
-        bool has_unloaded_texture = false;
+        item.tf_addr = dynamic_buffer + scene.AllTransforms().get<D3D12_GPU_VIRTUAL_ADDRESS>( mesh_instance.GetTransform() );
+    } );
+
+    return std::move( items );
+}
+
+void SceneRenderer::CullOccludedInstances( const Camera::Data& camera, const DirectX::XMFLOAT4X4& view_proj, const Scene& scene )
+{
+    const auto instances = scene.StaticMeshInstanceSpan();
+    const auto world_boxes = scene.StaticMeshInstanceWorldBoxSpan();
+    const std::array<float, 3> camera_pos = { camera.pos.x, camera.pos.y, camera.pos.z };
+
+    // occluders are the visible instances which look the largest, ties are broken by index so the choice is stable
+    // an occluder must be drawn this frame (same checks as in CreateRenderitems) and must not be clipped in the depth prepass
+    struct candidate
+    {
+        float screen_size;
+        uint32_t instance_idx;
+    };
+    std::pmr::vector<candidate> candidates( &m_frame_allocator );
+    m_visible_instances.for_each_set( [&]( size_t i )
+    {
+        const StaticSubmesh& submesh = scene.AllStaticSubmeshes()[instances[i].Submesh()];
+        const StaticMesh& geom = scene.AllStaticMeshes()[submesh.GetMesh()];
+        if ( ! geom.IsLoaded() || geom.Vertices().empty() || geom.Indices().empty() )
+            return;
+
+        const MaterialPBR& material = scene.AllMaterials()[instances[i].Material()];
+        if ( material.IsAlphaTested() )
+            return;
         const auto& textures = material.Textures();
         for ( TextureID tex_id : { textures.base_color, textures.normal, textures.specular, textures.preintegrated_brdf } )
-        {
             if ( ! scene.AllTextures()[tex_id].IsLoaded() )
-            {
-                has_unloaded_texture = true;
-                break;
-            }
-        }
+                return;
+
+        const aabb& box = world_boxes[i];
+        const float dx = box.max[0] - box.min[0];
+        const float dy = box.max[1] - box.min[1];
+        const float dz = box.max[2] - box.min[2];
+        const float radius = 0.5f * std::sqrt( dx * dx + dy * dy + dz * dz );
+        const float distance = std::max( std::sqrt( distance_sqr( box, camera_pos ) ), camera.near_plane );
+        const float screen_size = radius / distance;
+        if ( screen_size >= m_occlusion_settings.min_occluder_screen_size )
+            candidates.push_back( candidate{ screen_size, uint32_t( i ) } );
+    } );
+
+    const size_t noccluders = std::min<size_t>( candidates.size(), m_occlusion_settings.max_occluders );
+    std::partial_sort( candidates.begin(), candidates.begin() + noccluders, candidates.end(),
+                       []( const candidate& lhs, const candidate& rhs )
+    {
+        return lhs.screen_size > rhs.screen_size || ( lhs.screen_size == rhs.screen_size && lhs.instance_idx < rhs.instance_idx );
+    } );
 
-        if ( has_unloaded_texture )
-            continue;
+    std::pmr::vector<occlusion_buffer::occluder> occluders( noccluders, &m_frame_allocator );
+    for ( size_t i = 0; i < noccluders; ++i )
+    {
+        const StaticMeshInstance& mesh_instance = instances[candidates[i].instance_idx];
+        const StaticSubmesh& submesh = scene.AllStaticSubmeshes()[mesh_instance.Submesh()];
+        const StaticMesh& geom = scene.AllStaticMeshes()[submesh.GetMesh()];
+        const auto& draw_args = submesh.DrawArgs();
 
-        const ObjectTransform& tf = scene.AllTransforms()[mesh_instance.GetTransform()];
-        item.tf_addr = tf.GPUView();
+        occlusion_buffer::occluder& occluder = occluders[i];
+        occluder.positions = &geom.Vertices()[draw_args.base_vertex_loc].pos.x;
+        occluder.vertex_stride = sizeof( Vertex ) / sizeof( float );
+        const uint32_t* first_index = geom.Indices().data() + draw_args.start_index_loc;
+        occluder.indices = make_span( first_index, first_index + draw_args.idx_cnt );
 
-        DirectX::BoundingOrientedBox item_box;
-        DirectX::BoundingOrientedBox::CreateFromBoundingBox( item_box, submesh.Box() );
+        const DirectX::XMFLOAT4X4& obj2world = scene.AllTransforms().get<ObjectTransform>( mesh_instance.GetTransform() ).Obj2World();
+        std::copy( &obj2world.m[0][0], &obj2world.m[0][0] + 16, &occluder.obj2world[0][0] );
+    }
 
-        item_box.Transform( item_box, DirectX::XMLoadFloat4x4( &tf.Obj2World() ) );
+    if ( m_occlusion_buffer.width() != m_occlusion_settings.buffer_width
+         || m_occlusion_buffer.height() != m_occlusion_settings.buffer_height )
+        m_occlusion_buffer.resize( m_occlusion_settings.buffer_width, m_occlusion_settings.buffer_height );
 
-        if ( item_box.Intersects( main_bf ) )
-            items.push_back( item );
+    m_occlusion_stats.noccluders = uint32_t( noccluders );
+    m_occlusion_stats.noccluder_triangles = m_occlusion_buffer.rasterize( view_proj.m, make_span( std::as_const( occluders ) ) );
+    m_occlusion_stats.ntested = m_visible_instances.count();
 
-    }
+    // every task owns whole words of the result, so bits can be set without synchronization
+    m_unoccluded_instances.resize( m_visible_instances.size() );
+    m_unoccluded_instances.reset();
 
-    boost::sort( items, []( const auto& lhs, const auto& rhs ) { return lhs.mat_table.ptr < rhs.mat_table.ptr; } );
+    const auto words = m_visible_instances.words();
+    constexpr size_t words_per_task = 4;
+    worker_pool::shared().run( ( words.size() + words_per_task - 1 ) / words_per_task, [&]( size_t task_idx )
+    {
+        const size_t last_word = std::min( ( task_idx + 1 ) * words_per_task, words.size() );
+        for ( size_t word_idx = task_idx * words_per_task; word_idx < last_word; ++word_idx )
+            for_each_set_bit( words[word_idx], word_idx, [&]( size_t i )
+            {
+                if ( ! m_occlusion_buffer.is_occluded( world_boxes[i] ) )
+                    m_unoccluded_instances.set( i );
+            } );
+    } );
+    m_visible_instances &= m_unoccluded_instances;
 
-    return std::move( items );
+    m_occlusion_stats.noccluded = m_occlusion_stats.ntested - m_visible_instances.count();
 }
 
-Skybox SceneRenderer::CreateSkybox( EnvMapID skybox_id, DescriptorTableID ibl_table, const Scene& scene ) const
+Skybox SceneRenderer::CreateSkybox( EnvMapID skybox_id, DescriptorTableID ibl_table, const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer ) const
 {
     assert( scene.AllEnviromentMaps().has( skybox_id ) );
 
@@ -489,11 +699,11 @@ Skybox SceneRenderer::CreateSkybox( EnvMapID skybox_id, DescriptorTableID ibl_ta
         framegraph_res.srv_table = desc_table;
     }
 
-    const ObjectTransform* tf = scene.AllTransforms().try_get( skybox.GetTransform() );
-    if ( ! tf )
+    const D3D12_GPU_VIRTUAL_ADDRESS* tf_gpu_view = scene.AllTransforms().try_get<D3D12_GPU_VIRTUAL_ADDRESS>( skybox.GetTransform() );
+    if ( ! tf_gpu_view )
         throw SnowEngineException( "skybox does not have a transform attached" );
 
-    framegraph_res.tf_cbv = tf->GPUView();
+    framegraph_res.tf_cbv = dynamic_buffer + *tf_gpu_view;
 
     framegraph_res.radiance_factor = skybox.GetRadianceFactor();
 
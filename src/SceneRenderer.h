@@ -20,6 +20,9 @@
 
 #include "ParallelSplitShadowMapping.h"
 
+#include "utils/occlusion_buffer.h"
+#include "utils/visibility_cache.h"
+
 
 class SceneRenderer
 {
@@ -43,6 +46,43 @@ public:
         float min_luminance = 1.e-2f;
     };
 
+    // main view culling results are reused while the camera moves by less than margin relative to any instance,
+    // for at most max_age frames. Instances near the frustum boundary and moved ones are retested every frame
+    struct TemporalCullingSettings
+    {
+        float margin = 1.0f;
+        uint32_t max_age = 8;
+    };
+
+    // instances smaller on screen than this many pixels are not drawn, see Scene::StaticMeshInstanceScreenSizeSpan
+    // sizes are measured on the main camera screen for shadow casters too
+    struct ContributionCullSettings
+    {
+        float min_screen_size = 1.0f;
+        float min_caster_screen_size = 2.0f;
+    };
+
+    // software occlusion culling for the main camera, runs on the cpu after frustum culling
+    // the largest visible instances on screen are rasterized into a small depth buffer, then every visible instance is tested against it
+    // only drawn instances with opaque materials occlude. Off by default: imported materials carry no opacity and stay alpha-tested
+    struct OcclusionSettings
+    {
+        bool enabled = false;
+        uint32_t max_occluders = 64;
+        float min_occluder_screen_size = 0.1f; // bounding sphere radius over distance to the camera
+        uint32_t buffer_width = 256;
+        uint32_t buffer_height = 128;
+    };
+
+    // numbers for the last Draw
+    struct OcclusionStats
+    {
+        uint32_t noccluders = 0;
+        size_t noccluder_triangles = 0;
+        size_t ntested = 0; // instances which passed frustum culling
+        size_t noccluded = 0;
+    };
+
     struct DeviceContext
     {
         ID3D12Device* device = nullptr;
@@ -67,6 +107,8 @@ public:
     {
         Scene* scene = nullptr;
         CameraID main_camera = CameraID::nullid;
+        // transform and material constants, scene items store offsets into it (see DynamicSceneBuffers::GetGPUAddress)
+        D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer = 0;
 
         // temporary
         DescriptorTableID ibl_table = DescriptorTableID::nullid;
@@ -93,6 +135,19 @@ public:
     void SetHBAOSettings( const HBAOSettings& settings ) noexcept { m_hbao_settings = settings; }
     HBAOSettings GetHBAOSettings() const noexcept { return m_hbao_settings; }
 
+    void SetTemporalCullingSettings( const TemporalCullingSettings& settings ) noexcept;
+    TemporalCullingSettings GetTemporalCullingSettings() const noexcept;
+
+    void SetContributionCullSettings( const ContributionCullSettings& settings ) noexcept { m_contribution_cull_settings = settings; }
+    ContributionCullSettings GetContributionCullSettings() const noexcept { return m_contribution_cull_settings; }
+
+    void SetOcclusionSettings( const OcclusionSettings& settings ) noexcept { m_occlusion_settings = settings; }
+    OcclusionSettings GetOcclusionSettings() const noexcept { return m_occlusion_settings; }
+    OcclusionStats GetOcclusionStats() const noexcept { return m_occlusion_stats; }
+
+    // per-item bindings recorded by the forward, depth prepass, shadow and PSSM passes in the last Draw
+    DrawStateCache::Stats GetDrawStateStats() const noexcept { return m_draw_state_stats; }
+
     ParallelSplitShadowMapping& GetPSSM() noexcept { return m_pssm; }
 
     // All queues used in Draw must be flushed before calling this method
@@ -115,6 +170,8 @@ private:
 
     HBAOSettings m_hbao_settings;
     TonemapSettings m_tonemap_settings;
+    ContributionCullSettings m_contribution_cull_settings;
+    OcclusionSettings m_occlusion_settings;
     ParallelSplitShadowMapping m_pssm;
 
     // framegraph
@@ -134,6 +191,16 @@ private:
     ForwardCBProvider m_forward_cb_provider;
     ShadowProvider m_shadow_provider;
 
+    linear_allocator m_frame_allocator; // per-frame cpu scratch memory, reset at the start of Draw
+    std::vector<uint8_t> m_instance_view_masks; // per-instance bits for every view culled this frame
+    visibility_cache m_main_view_cache;
+    uint64_t m_seen_bounds_version = 0; // see Scene::LastStaticMeshInstanceBoundsChanges
+    dense_bitset m_visible_instances; // main camera culling result, kept to reuse the storage
+    dense_bitset m_unoccluded_instances;
+    occlusion_buffer m_occlusion_buffer;
+    OcclusionStats m_occlusion_stats;
+    DrawStateCache::Stats m_draw_state_stats;
+
     // transient resources
     DXGI_FORMAT m_depth_stencil_format_resource = DXGI_FORMAT_R32_TYPELESS;
     DXGI_FORMAT m_depth_stencil_format_dsv = DXGI_FORMAT_D32_FLOAT;
@@ -170,8 +237,15 @@ private:
     void CreateTransientResources();
     void ResizeTransientResources();
 
-    std::vector<RenderItem> CreateRenderitems( const Camera::Data& camera, const Scene& scene ) const;
-    Skybox CreateSkybox( EnvMapID skybox_id, DescriptorTableID ibl_table, const Scene& scene ) const;
+    // items are allocated from the frame allocator and are valid until the next Draw
+    // also culls shadow caster volumes of m_shadow_provider, so shadow producers must be created before
+    // items come sorted by MakeRenderItemSortKey: grouped by material, then by mesh buffers, then front to back
+    std::pmr::vector<RenderItem> CreateRenderitems( const Camera::Data& camera, const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer );
+    // normalized_depth is the view depth mapped to [0, 1] between the near and far planes, it is clamped
+    static uint64_t MakeRenderItemSortKey( uint32_t material_idx, uint32_t mesh_idx, float normalized_depth ) noexcept;
+    // clears bits of m_visible_instances hidden behind the largest visible instances
+    void CullOccludedInstances( const Camera::Data& camera, const DirectX::XMFLOAT4X4& view_proj, const Scene& scene );
+    Skybox CreateSkybox( EnvMapID skybox_id, DescriptorTableID ibl_table, const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer ) const;
 
     D3D12_GPU_DESCRIPTOR_HANDLE GetGPUHandle( DescriptorTableID id ) const { return m_descriptor_tables->GetTable( id )->gpu_handle; }
 };
\ No newline at end of file
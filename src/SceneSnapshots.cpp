@@ -0,0 +1,46 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+#include "stdafx.h"
+
+#include "SceneSnapshots.h"
+
+
+void SceneSnapshots::Publish( const Scene& scene )
+{
+    int target;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        // the reader holds at most one snapshot, so the other one is free
+        if ( m_acquired != NoSnapshot )
+            target = 1 - m_acquired;
+        else
+            target = m_latest == 0 ? 1 : 0;
+
+        // the reader may acquire again while the target is being written, so it gets the older complete snapshot meanwhile
+        if ( m_latest == target )
+            m_latest = 1 - target;
+    }
+
+    m_snapshots[target].SyncWith( scene );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_latest = target;
+}
+
+
+const Scene* SceneSnapshots::Acquire() noexcept
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    assert( m_acquired == NoSnapshot );
+    m_acquired = m_latest;
+    return m_acquired == NoSnapshot ? nullptr : &m_snapshots[m_acquired];
+}
+
+
+void SceneSnapshots::Release() noexcept
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_acquired = NoSnapshot;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <mutex>
+
+// Double-buffered read-only copies of a scene for a render thread.
+// The thread that modifies the scene calls Publish() at its sync point, which updates the snapshot the reader doesn't hold
+// and makes it the latest one. The reader takes the latest snapshot with Acquire() and gives it back with Release(),
+// so neither side ever waits for the other to finish its frame
+class SceneSnapshots
+{
+public:
+    // must not run concurrently with modifications of scene. Only scene columns modified since the previous Publish() are copied
+    void Publish( const Scene& scene );
+
+    // returns nullptr if nothing has been published yet. The reader may hold only one snapshot at a time,
+    // the snapshot stays unchanged until Release()
+    const Scene* Acquire() noexcept;
+    void Release() noexcept;
+
+private:
+    static constexpr int NoSnapshot = -1;
+
+    Scene m_snapshots[2];
+
+    std::mutex m_mutex;
+    int m_latest = NoSnapshot; // guarded by m_mutex
+    int m_acquired = NoSnapshot; // guarded by m_mutex
+};
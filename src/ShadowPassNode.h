@@ -71,6 +71,8 @@ public:
 
     }
 
+    DrawStateCache::Stats TakeDrawStateStats() noexcept { return m_pass.TakeDrawStateStats(); }
+
 private:
     DepthOnlyPass m_pass;
     DepthOnlyPass::RenderStateID m_state;
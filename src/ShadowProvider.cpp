@@ -9,7 +9,7 @@ using namespace DirectX;
 // temporary implementation, only one shadow map 4kx4k max
 
 ShadowProvider::ShadowProvider( ID3D12Device* device, int n_bufferized_frames, DescriptorTableBakery* srv_tables )
-    : m_device( device ), m_dsv_heap( D3D12_DESCRIPTOR_HEAP_TYPE_DSV, device ), m_descriptor_tables( srv_tables )
+    : m_device( device ), m_dsv_heap( D3D12_DESCRIPTOR_HEAP_TYPE_DSV, device ), m_caster_items( &m_casters_allocator ), m_descriptor_tables( srv_tables )
 {
     assert( device );
     assert( srv_tables );
@@ -117,11 +117,9 @@ void ShadowProvider::Update( span<SceneLight> scene_lights, const ParallelSplitS
 }
 
 
-void ShadowProvider::FillFramegraphStructures( const Scene& scene, const span<const LightInCB>& lights, const span<const StaticMeshInstance>& renderitems, ShadowProducers& producers, ShadowCascadeProducers& pssm_producers, ShadowMaps& storage, ShadowCascade& pssm_storage )
+void ShadowProvider::FillFramegraphStructures( const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer, span<const uint8_t> view_masks, uint32_t first_view, ShadowProducers& producers, ShadowCascadeProducers& pssm_producers, ShadowMaps& storage, ShadowCascade& pssm_storage )
 {
-    // todo: frustrum cull renderitems
-    CreateShadowProducers( lights );
-    FillProducersWithRenderitems( renderitems, scene );
+    FillProducersWithRenderitems( scene, dynamic_buffer, view_masks, first_view );
 
     producers.arr = make_span( m_producers );
 
@@ -140,7 +138,11 @@ void ShadowProvider::FillFramegraphStructures( const Scene& scene, const span<co
 void ShadowProvider::CreateShadowProducers( const span<const LightInCB>& lights )
 {
     m_pssm_producers.clear();
+    m_caster_volumes.clear();
     m_producers.clear();
+    // releases the storage before the allocator forgets it
+    m_caster_items = std::pmr::vector<RenderItem>( &m_casters_allocator );
+    m_casters_allocator.reset();
 
     bool pssm_light_with_shadow_found = false;
     bool regular_light_with_shadow_found = false;
@@ -162,7 +164,7 @@ void ShadowProvider::CreateShadowProducers( const span<const LightInCB>& lights
 
             pssm_light_with_shadow_found = true;
 
-            m_pssm_producers.emplace_back();
+            m_pssm_producers.push_back( ShadowCascadeProducer{ {}, 0, 0, {}, std::pmr::vector<uint32_t>( &m_casters_allocator ), {} } );
             auto& producer = m_pssm_producers.back();
             if ( light.GetShadow()->sm_size > PSSMShadowMapSize )
                 throw SnowEngineException( "pssm shadow map does not fit in texture" );
@@ -176,6 +178,16 @@ void ShadowProvider::CreateShadowProducers( const span<const LightInCB>& lights
             producer.viewport.Height = shadow_desc->sm_size;
 
             producer.light_idx_in_cb = light_in_cb.light_idx_in_cb;
+
+            // casters for every cascade are culled against its ortho volume, extruded towards the light
+            const auto& shadow_matrices = light.GetShadowMatrices();
+            producer.ncascades = uint32_t( shadow_matrices.size() );
+            for ( uint32_t i = 0; i < producer.ncascades; ++i )
+            {
+                XMFLOAT4X4 light_view_proj;
+                XMStoreFloat4x4( &light_view_proj, shadow_matrices[i] );
+                m_caster_volumes.push_back( make_shadow_caster_volume( light_view_proj.m ) );
+            }
         }
         else if ( light.GetShadowMatrices().size() == 1 )
         {
@@ -185,17 +197,51 @@ void ShadowProvider::CreateShadowProducers( const span<const LightInCB>& lights
 }
 
 
-void ShadowProvider::FillProducersWithRenderitems( const span<const StaticMeshInstance>& renderitems, const Scene& scene )
+void ShadowProvider::FillProducersWithRenderitems( const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer, span<const uint8_t> view_masks, uint32_t first_view )
 {
-    for ( const auto& mesh_instance : renderitems )
+    const auto instances = scene.StaticMeshInstanceSpan();
+    const auto& masks = scene.GetStaticMeshInstanceMasks();
+
+    m_shadow_casters.resize( instances.size() );
+    m_shadow_casters.reset();
+
+    // regular shadow maps aren't culled yet, they take every caster
+    if ( ! m_producers.empty() )
     {
-        if ( ! mesh_instance.IsEnabled() )
-            continue;
+        m_shadow_casters |= masks.enabled;
+        m_shadow_casters &= masks.casts_shadow;
+    }
+
+    // caster volumes were culled by the renderer along with its other views, every cascade takes its bit out of the masks
+    assert( view_masks.size() == instances.size() );
+    assert( first_view + m_caster_volumes.size() <= bvh::MaxViews );
+    m_cascade_casters.resize( m_pssm_producers.size() * MAX_CASCADE_SIZE );
+    uint32_t view = first_view;
+    for ( size_t producer_idx = 0; producer_idx < m_pssm_producers.size(); ++producer_idx )
+    {
+        for ( uint32_t cascade_idx = 0; cascade_idx < m_pssm_producers[producer_idx].ncascades; ++cascade_idx )
+        {
+            dense_bitset& casters = m_cascade_casters[producer_idx * MAX_CASCADE_SIZE + cascade_idx];
+            casters.assign_masked( view_masks, uint8_t( 1u << view++ ) );
+            casters &= masks.enabled;
+            casters &= masks.casts_shadow;
+            m_shadow_casters |= casters;
+        }
+    }
+
+    // one item per caster no matter how many cascades it is drawn into
+    std::pmr::vector<uint32_t> item_instances( &m_casters_allocator );
+    const size_t ncasters = m_shadow_casters.count();
+    m_caster_items.reserve( ncasters );
+    item_instances.reserve( ncasters );
+    m_shadow_casters.for_each_set( [&]( size_t i )
+    {
+        const StaticMeshInstance& mesh_instance = instances[i];
 
         const StaticSubmesh& submesh = scene.AllStaticSubmeshes()[mesh_instance.Submesh()];
         const StaticMesh& geom = scene.AllStaticMeshes()[submesh.GetMesh()];
         if ( ! geom.IsLoaded() )
-            continue;
+            return;
 
         RenderItem item;
         item.ibv = geom.IndexBufferView();
@@ -207,30 +253,36 @@ void ShadowProvider::FillProducersWithRenderitems( const span<const StaticMeshIn
         item.vertex_offset = submesh_draw_args.base_vertex_loc;
 
         const MaterialPBR& material = scene.AllMaterials()[mesh_instance.Material()];
-        item.mat_cb = material.GPUConstantBuffer();
+        item.mat_cb = dynamic_buffer + material.GPUConstantBuffer();
         item.mat_table = material.DescriptorTable();
 
-        bool has_unloaded_texture = false;
         const auto& textures = material.Textures();
         for ( TextureID tex_id : { textures.base_color, textures.normal, textures.specular } )
-        {
             if ( ! scene.AllTextures()[tex_id].IsLoaded() )
-            {
-                has_unloaded_texture = true;
-                break;
-            }
-        }
+                return;
 
-        if ( has_unloaded_texture )
-            continue;
+        item.tf_addr = dynamic_buffer + scene.AllTransforms().get<D3D12_GPU_VIRTUAL_ADDRESS>( mesh_instance.GetTransform() );
 
-        const ObjectTransform& tf = scene.AllTransforms()[mesh_instance.GetTransform()];
-        item.tf_addr = tf.GPUView();
+        m_caster_items.push_back( item );
+        item_instances.push_back( uint32_t( i ) );
+    } );
 
-        for ( auto& producer : m_pssm_producers )
-            producer.casters.push_back( item );
+    for ( size_t producer_idx = 0; producer_idx < m_pssm_producers.size(); ++producer_idx )
+    {
+        ShadowCascadeProducer& producer = m_pssm_producers[producer_idx];
+        producer.items = make_span( std::as_const( m_caster_items ) );
 
-        for ( auto& producer : m_producers )
-            producer.casters.push_back( item );
+        for ( uint32_t cascade_idx = 0; cascade_idx < producer.ncascades; ++cascade_idx )
+        {
+            const dense_bitset& casters = m_cascade_casters[producer_idx * MAX_CASCADE_SIZE + cascade_idx];
+            producer.cascade_begin[cascade_idx] = uint32_t( producer.casters.size() );
+            for ( uint32_t item_idx = 0; item_idx < item_instances.size(); ++item_idx )
+                if ( casters.test( item_instances[item_idx] ) )
+                    producer.casters.push_back( item_idx );
+        }
+        std::fill( producer.cascade_begin.begin() + producer.ncascades, producer.cascade_begin.end(), uint32_t( producer.casters.size() ) );
     }
+
+    for ( auto& producer : m_producers )
+        producer.casters.assign( m_caster_items.begin(), m_caster_items.end() );
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "utils/span.h"
+#include "utils/linear_allocator.h"
 
 #include "StagingDescriptorHeap.h"
 #include "DescriptorTableBakery.h"
@@ -19,15 +20,21 @@ public:
 
     void Update( span<SceneLight> scene_lights, const ParallelSplitShadowMapping& pssm, const Camera::Data& main_camera_data );
 
-    void FillFramegraphStructures( const Scene& scene, const span<const LightInCB>& lights, const span<const StaticMeshInstance>& renderitems,
+    // caster volumes of the new producers are available right after this call, so they can be culled together with other views
+    void CreateShadowProducers( const span<const LightInCB>& lights );
+    // one volume per cascade of every cascade producer, in producer order
+    span<const frustum> GetCasterVolumes() const noexcept { return make_span( m_caster_volumes ); }
+
+    // bit first_view + i of view_masks[instance_idx] is set if the instance intersects GetCasterVolumes()[i]
+    // dynamic_buffer is the base of the scene transform and material constants
+    void FillFramegraphStructures( const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer, span<const uint8_t> view_masks, uint32_t first_view,
                                    ShadowProducers& producers, ShadowCascadeProducers& pssm_producers,
                                    ShadowMaps& storage, ShadowCascade& pssm_storage );
 
 private:
     using SrvID = DescriptorTableBakery::TableID;
 
-    void CreateShadowProducers( const span<const LightInCB>& lights );
-    void FillProducersWithRenderitems( const span<const StaticMeshInstance>& renderitems, const Scene& scene );
+    void FillProducersWithRenderitems( const Scene& scene, D3D12_GPU_VIRTUAL_ADDRESS dynamic_buffer, span<const uint8_t> view_masks, uint32_t first_view );
 
     std::vector<ShadowProducer> m_producers;
     std::unique_ptr<Descriptor> m_dsv = nullptr;
@@ -35,12 +42,19 @@ private:
     Microsoft::WRL::ComPtr<ID3D12Resource> m_sm_res;
 
     std::vector<ShadowCascadeProducer> m_pssm_producers;
+    std::vector<frustum> m_caster_volumes;
     std::unique_ptr<Descriptor> m_pssm_dsv = nullptr;
     SrvID m_pssm_srv = SrvID::nullid;
     Microsoft::WRL::ComPtr<ID3D12Resource> m_pssm_res;
 
     StagingDescriptorHeap m_dsv_heap;
 
+    linear_allocator m_casters_allocator; // backs producers' caster lists, reset every frame
+    std::pmr::vector<RenderItem> m_caster_items; // items of all instances casting shadows this frame, shared by cascade producers
+
+    std::vector<dense_bitset> m_cascade_casters; // MAX_CASCADE_SIZE per cascade producer, instances inside each caster volume
+    dense_bitset m_shadow_casters; // union of all caster sets, instances which need an item
+
     DescriptorTableBakery* m_descriptor_tables;
     ID3D12Device* m_device;
 
@@ -94,7 +94,8 @@ void StaticMeshManager::Update( SceneCopyOp operation_tag, GPUTaskQueue::Timesta
     {
         auto& mesh_data = m_loaded_meshes[i];
 
-        StaticMesh* mesh = m_scene->TryModifyStaticMesh( mesh_data.id );
+        // const lookup, a non-const one would mark the mesh storage as modified every frame
+        const StaticMesh* mesh = m_scene->AllStaticMeshes().try_get( mesh_data.id );
         if ( ! mesh )
         {
             // remove mesh
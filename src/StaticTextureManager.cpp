@@ -144,7 +144,7 @@ void StaticTextureManager::EnqueueRemovedTexturesForDestruction()
     {
         auto& tex_data = m_loaded_textures[i];
 
-        Texture* tex = m_scene->TryModifyTexture( tex_data.id );
+        const Texture* tex = m_scene->AllTextures().try_get( tex_data.id );
         if ( ! tex )
         {
             // remove texture
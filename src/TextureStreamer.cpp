@@ -187,9 +187,11 @@ void TextureStreamer::Update( SceneCopyOp operation_tag, GPUTaskQueue::Timestamp
 
     for ( const auto& tex_data : m_loaded_textures )
     {
-        auto& texture = *m_scene->TryModifyTexture( tex_data.id );
-        if ( texture.IsLoaded() )
-            texture.ModifyStagingSRV() = tex_data.mip_cumulative_srv[tex_data.most_detailed_loaded_mip].HandleCPU();
+        // the srv changes only when a mip is streamed in or out, writing it anyway would journal the texture every frame
+        const Texture& texture = m_scene->AllTextures()[tex_data.id];
+        const D3D12_CPU_DESCRIPTOR_HANDLE srv = tex_data.mip_cumulative_srv[tex_data.most_detailed_loaded_mip].HandleCPU();
+        if ( texture.IsLoaded() && texture.StagingSRV().ptr != srv.ptr )
+            m_scene->TryModifyTexture( tex_data.id )->ModifyStagingSRV() = srv;
     }
 }
 
@@ -229,7 +231,9 @@ std::optional<
     if ( texture.tiling.packed_mip_pages == GPUPagedAllocator::ChunkID::nullid )
         throw SnowEngineException( "not enough vidmem for basic mips" );
 
-    std::vector<D3D12_TILED_RESOURCE_COORDINATE> resource_region_coords;
+    m_tile_mapping_allocator.reset();
+
+    std::pmr::vector<D3D12_TILED_RESOURCE_COORDINATE> resource_region_coords( &m_tile_mapping_allocator );
     resource_region_coords.emplace_back();
     auto& coords = resource_region_coords.back();
     coords.Subresource = texture.tiling.packed_mip_info.NumStandardMips;
@@ -241,14 +245,13 @@ std::optional<
     resource_region_size.UseBox = FALSE;
     resource_region_size.NumTiles = required_tiles_num;
 
-    // too many heap memory allocations for such a simple thing. TODO: use linear allocator here.
-    std::vector<D3D12_TILE_RANGE_FLAGS> range_flags;
+    std::pmr::vector<D3D12_TILE_RANGE_FLAGS> range_flags( &m_tile_mapping_allocator );
     range_flags.resize( required_tiles_num, D3D12_TILE_RANGE_FLAG_NONE );
-    std::vector<UINT> range_start_offsets;
+    std::pmr::vector<UINT> range_start_offsets( &m_tile_mapping_allocator );
     range_start_offsets.reserve( required_tiles_num );
     for ( uint32_t page : m_gpu_mem_basic_mips->GetPages( texture.tiling.packed_mip_pages ) )
         range_start_offsets.push_back( page );
-    std::vector<UINT> range_tile_counts;
+    std::pmr::vector<UINT> range_tile_counts( &m_tile_mapping_allocator );
     range_tile_counts.resize( required_tiles_num, 1 ); // this is ridiculous. Maybe use static array of ones?
     copy_queue.GetCmdQueue()->UpdateTileMappings( texture.gpu_res.Get(),
                                                   resource_region_coords.size(),
@@ -319,7 +322,9 @@ std::optional<
     task.src_data.push_back( texture.file_layout[mip_to_load] );
 
     // Tile mappings
-    std::vector<D3D12_TILED_RESOURCE_COORDINATE> resource_region_coords;
+    m_tile_mapping_allocator.reset();
+
+    std::pmr::vector<D3D12_TILED_RESOURCE_COORDINATE> resource_region_coords( &m_tile_mapping_allocator );
     resource_region_coords.emplace_back();
     auto& coords = resource_region_coords.back();
     coords.Subresource = mip_to_load;
@@ -327,18 +332,18 @@ std::optional<
     coords.Y = 0;
     coords.Z = 0;
 
-    std::vector<D3D12_TILE_REGION_SIZE> resource_region_sizes;
+    std::pmr::vector<D3D12_TILE_REGION_SIZE> resource_region_sizes( &m_tile_mapping_allocator );
     resource_region_sizes.emplace_back();
     resource_region_sizes.back().UseBox = FALSE;
     resource_region_sizes.back().NumTiles = required_tiles_num;
 
-    std::vector<D3D12_TILE_RANGE_FLAGS> range_flags;
+    std::pmr::vector<D3D12_TILE_RANGE_FLAGS> range_flags( &m_tile_mapping_allocator );
     range_flags.resize( required_tiles_num, D3D12_TILE_RANGE_FLAG_NONE );
-    std::vector<UINT> range_start_offsets;
+    std::pmr::vector<UINT> range_start_offsets( &m_tile_mapping_allocator );
     range_start_offsets.reserve( required_tiles_num );
     for ( uint32_t page : m_gpu_mem_detailed_mips->GetPages( pages ) )
         range_start_offsets.push_back( page );
-    std::vector<UINT> range_tile_counts;
+    std::pmr::vector<UINT> range_tile_counts( &m_tile_mapping_allocator );
     range_tile_counts.resize( required_tiles_num, 1 );
     copy_queue.GetCmdQueue()->UpdateTileMappings( texture.gpu_res.Get(),
                                                   resource_region_coords.size(),
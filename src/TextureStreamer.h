@@ -7,6 +7,7 @@
 #include "Ptr.h"
 
 #include "utils/MemoryMappedFile.h"
+#include "utils/linear_allocator.h"
 
 #include <d3d12.h>
 #include <future>
@@ -139,6 +140,8 @@ private:
 
     Scene* m_scene = nullptr;
 
+    linear_allocator m_tile_mapping_allocator; // scratch memory for UpdateTileMappings arguments, reset on each use
+
     void FinalizeCompletedGPUUploads( GPUTaskQueue::Timestamp current_timestamp );
     void CheckFilledUploaders( SceneCopyOp op, ID3D12GraphicsCommandList& cmd_list );
     void CopyUploaderToMainResource( const TextureData& texture, ID3D12Resource* uploader, uint32_t mip_idx, uint32_t base_mip, ID3D12GraphicsCommandList& cmd_list );
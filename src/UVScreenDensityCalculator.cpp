@@ -4,6 +4,8 @@
 
 #include "UVScreenDensityCalculator.h"
 
+#include "utils/worker_pool.h"
+
 using namespace DirectX;
 
 UVScreenDensityCalculator::UVScreenDensityCalculator( Scene* scene )
@@ -16,7 +18,8 @@ void UVScreenDensityCalculator::Update( CameraID camera_id, const D3D12_VIEWPORT
 {
     // For each mesh instance
     // 1. Find distance to camera
-    // 2. Calc approximate number of pixels per uv coord
+    // 2. Calc projected size on screen
+    // 3. Calc approximate number of pixels per uv coord
 
     const Camera::Data& camera_data = m_scene->AllCameras()[camera_id].GetData();
     if ( camera_data.type != Camera::Type::Perspective )
@@ -24,49 +27,92 @@ void UVScreenDensityCalculator::Update( CameraID camera_id, const D3D12_VIEWPORT
 
     const float pixels_per_angle_est = std::max( viewport.Height, viewport.Width / camera_data.aspect_ratio ) / camera_data.fov_y;
 
-    XMVECTOR camera_origin= XMLoadFloat3( &camera_data.pos );
-
-    for ( const auto& mesh_instance : m_scene->StaticMeshInstanceSpan() )
-    {
-        if ( ! mesh_instance.IsEnabled() )
-            continue;
-
-        const MaterialPBR::TextureIds& material_textures = m_scene->AllMaterials()[mesh_instance.Material()].Textures();
-        std::array<Texture*, 3> textures;
-        textures[0] = m_scene->TryModifyTexture( material_textures.base_color );
-        textures[1] = m_scene->TryModifyTexture( material_textures.specular );
-        textures[2] = m_scene->TryModifyTexture( material_textures.normal );
+    const std::array<float, 3> camera_pos = { camera_data.pos.x, camera_data.pos.y, camera_data.pos.z };
 
-        bool has_unloaded_texture = false;
-        for ( int i : { 0, 1, 2 } )
-            if ( has_unloaded_texture = ! textures[i]->IsLoaded() ) //-V559
-                break;
+    // instances are processed in parallel through the const scene interface,
+    // results are written to the scene afterwards, and only where they have changed
+    const Scene& scene = *m_scene;
+    const auto instances = scene.StaticMeshInstanceSpan();
+    const auto world_boxes = scene.StaticMeshInstanceWorldBoxSpan();
+    const auto enabled_words = scene.GetStaticMeshInstanceMasks().enabled.words();
 
-        if ( has_unloaded_texture )
-            continue;
-
-        const StaticSubmesh& submesh = m_scene->AllStaticSubmeshes()[mesh_instance.Submesh()];
-        const ObjectTransform& tf = m_scene->AllTransforms()[mesh_instance.GetTransform()];
-
-        BoundingOrientedBox bob;
-        BoundingOrientedBox::CreateFromBoundingBox( bob, submesh.Box() );
+    m_instance_pixels_per_uv.assign( instances.size(), std::nullopt );
 
-        const float lengths2_sum_local = XMVectorGetX( XMVector3LengthSq( XMLoadFloat3( &bob.Extents ) ) );
-        bob.Transform( bob, XMLoadFloat4x4( &tf.Obj2World() ) );
+    m_screen_sizes.assign( instances.size(), 0.0f );
 
-        const float lengths2_sum_world = XMVectorGetX( XMVector3LengthSq( XMLoadFloat3( &bob.Extents ) ) );
-
-        const float camera2box = std::sqrt( DistanceToBoxSqr( camera_origin, bob ) );
+    constexpr size_t words_per_task = 4;
+    parallel_for_each( enabled_words, words_per_task, [&]( const uint64_t& enabled_word )
+    {
+        for_each_set_bit( enabled_word, &enabled_word - enabled_words.begin(), [&]( size_t instance_idx )
+        {
+            const StaticMeshInstance& mesh_instance = instances[instance_idx];
+
+            const StaticSubmesh& submesh = scene.AllStaticSubmeshes()[mesh_instance.Submesh()];
+            const ObjectTransform& tf = scene.AllTransforms().get<ObjectTransform>( mesh_instance.GetTransform() );
+
+            // local extents scaled by the lengths of the basis vectors, as an oriented box would be
+            const float local_extents[3] = { submesh.Box().Extents.x, submesh.Box().Extents.y, submesh.Box().Extents.z };
+            const XMFLOAT4X4& obj2world = tf.Obj2World();
+            float lengths2_sum_local = 0;
+            float lengths2_sum_world = 0;
+            for ( size_t axis = 0; axis < 3; ++axis )
+            {
+                const float extent = local_extents[axis];
+                const float* basis = obj2world.m[axis];
+                lengths2_sum_local += extent * extent;
+                lengths2_sum_world += extent * extent * ( basis[0] * basis[0] + basis[1] * basis[1] + basis[2] * basis[2] );
+            }
+
+            // the cached world box encloses the transformed local box, so the distance is never overestimated
+            const float camera2box = std::sqrt( distance_sqr( world_boxes[instance_idx], camera_pos ) );
+
+            // the oriented box fits in a sphere with the radius of its half diagonal
+            m_screen_sizes[instance_idx] = 2.0f * std::sqrt( lengths2_sum_world ) * pixels_per_angle_est / ( camera2box + FLT_EPSILON );
+
+            const MaterialPBR::TextureIds& material_textures = scene.AllMaterials()[mesh_instance.Material()].Textures();
+
+            bool has_unloaded_texture = false;
+            for ( TextureID tex_id : { material_textures.base_color, material_textures.specular, material_textures.normal } )
+                if ( has_unloaded_texture = ! scene.AllTextures()[tex_id].IsLoaded() ) //-V559
+                    break;
+
+            if ( has_unloaded_texture )
+                return;
+
+            // Add FLT_EPSILON to avoid division by zero because the camera may be inside the box
+            XMVECTOR pixels_per_uv = XMLoadFloat2( &submesh.MaxInverseUVDensity() );
+            pixels_per_uv *= pixels_per_angle_est
+                             * ( std::sqrt( lengths2_sum_world
+                                            / lengths2_sum_local )
+                                 / ( camera2box + FLT_EPSILON ) );
+
+            XMFLOAT2 res;
+            XMStoreFloat2( &res, pixels_per_uv );
+            m_instance_pixels_per_uv[instance_idx] = res;
+        } );
+    } );
+
+    // a still camera over still instances gives the same sizes, then the column is not touched and snapshots don't copy it
+    const auto cur_screen_sizes = scene.StaticMeshInstanceScreenSizeSpan();
+    if ( ! std::equal( m_screen_sizes.begin(), m_screen_sizes.end(), cur_screen_sizes.begin(), cur_screen_sizes.end() ) )
+    {
+        const span<float> screen_sizes = m_scene->ModifyStaticMeshInstanceScreenSizes();
+        std::copy( m_screen_sizes.begin(), m_screen_sizes.end(), screen_sizes.begin() );
+    }
 
-        // Add FLT_EPSILON to avoid division by zero because the camera may be inside the box
-        XMVECTOR pixels_per_uv = XMLoadFloat2( &submesh.MaxInverseUVDensity() );
-        pixels_per_uv *= pixels_per_angle_est
-                         * ( std::sqrt( lengths2_sum_world
-                                        / lengths2_sum_local )
-                             / ( camera2box + FLT_EPSILON ) );
+    for ( size_t instance_idx = 0; instance_idx < instances.size(); ++instance_idx )
+    {
+        const auto& pixels_per_uv = m_instance_pixels_per_uv[instance_idx];
+        if ( ! pixels_per_uv )
+            continue;
 
-        for ( int i : { 0, 1, 2 } )
-            XMStoreFloat2( &textures[i]->MaxPixelsPerUV(), pixels_per_uv );
+        const MaterialPBR::TextureIds& material_textures = scene.AllMaterials()[instances[instance_idx].Material()].Textures();
+        for ( TextureID tex_id : { material_textures.base_color, material_textures.specular, material_textures.normal } )
+        {
+            const DirectX::XMFLOAT2& cur_pixels_per_uv = scene.AllTextures()[tex_id].MaxPixelsPerUV();
+            if ( cur_pixels_per_uv.x != pixels_per_uv->x || cur_pixels_per_uv.y != pixels_per_uv->y )
+                m_scene->TryModifyTexture( tex_id )->MaxPixelsPerUV() = *pixels_per_uv;
+        }
     }
 }
 
@@ -85,52 +131,64 @@ void UVScreenDensityCalculator::CalcUVDensityInObjectSpace( StaticSubmesh& subme
     if ( ! ( mesh_indices.size() % 3 == 0 && mesh.Topology() == D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST ) )
         throw SnowEngineException( "only triangle meshes are supported" );
 
-    XMFLOAT2 max_uv_basis_len2( 0.0f, 0.0f );
-
     const int32_t vertex_offset = submesh_draw_args.base_vertex_loc;
 
-    for ( auto i = mesh_indices.begin() + submesh_draw_args.start_index_loc,
-          end = mesh_indices.begin() + submesh_draw_args.start_index_loc + submesh_draw_args.idx_cnt;
-          i != end; )
-    {
-        const Vertex& v1 = mesh_vertices[*i++ + vertex_offset];
-        const Vertex& v2 = mesh_vertices[*i++ + vertex_offset];
-        const Vertex& v3 = mesh_vertices[*i++ + vertex_offset];
-
-        // Find basis of UV-space on triangle in object space
-        // let a = v2 - v1; b = v3 - v1
-        //     a_uv = v2.uv - v1.uv; b_uv = v3.uv - v1.uv
-        // M = | a_uv | 
-        //     | b_uv | 
-        // eu, ev - UV-space basis vector coords in object space
-        // so
-        // | eu | = inv( M ) * | a |
-        // | ev |              | b |
-        //
-        // Inverse uv density is the length of uv basis vectors in object space
-
-        // TODO: use 2x2 specialized code
-        XMMATRIX ab( XMVectorSubtract( XMLoadFloat3( &v2.pos ), XMLoadFloat3( &v1.pos ) ),
-                     XMVectorSubtract( XMLoadFloat3( &v3.pos ), XMLoadFloat3( &v1.pos ) ),
-                     XMVECTORF32{ 0, 0, 1.0f, 0 },
-                     XMVECTORF32{ 0, 0, 0, 1.0f } );
-
-        XMMATRIX m_inv( XMVectorSubtract( XMLoadFloat2( &v2.uv ), XMLoadFloat2( &v1.uv ) ),
-                        XMVectorSubtract( XMLoadFloat2( &v3.uv ), XMLoadFloat2( &v1.uv ) ),
-                        XMVECTORF32{ 0, 0, 1.0f, 0 },
-                        XMVECTORF32{ 0, 0, 0, 1.0f } );
-
-        constexpr float determinant_eps = 1.e-5f;
-
-        XMVECTOR det;
-        m_inv = XMMatrixInverse( &det, m_inv );
-        if ( det.m128_f32[0] < determinant_eps )
-            continue;
+    const uint32_t* submesh_indices_begin = mesh_indices.data() + submesh_draw_args.start_index_loc;
+    const span<const uint32_t> submesh_indices( submesh_indices_begin, submesh_indices_begin + submesh_draw_args.idx_cnt );
 
-        XMMATRIX uv_basis = XMMatrixMultiply( m_inv, ab );
-        max_uv_basis_len2.x = std::max( XMVector3LengthSq( uv_basis.r[0] ).m128_f32[0], max_uv_basis_len2.x );
-        max_uv_basis_len2.y = std::max( XMVector3LengthSq( uv_basis.r[1] ).m128_f32[0], max_uv_basis_len2.y );
-    }
+    // max of squared uv basis lengths over a range of whole triangles
+    auto process_triangles = [&]( span<const uint32_t> indices ) -> XMFLOAT2
+    {
+        XMFLOAT2 max_uv_basis_len2( 0.0f, 0.0f );
+
+        for ( auto i = indices.begin(), end = indices.end(); i != end; )
+        {
+            const Vertex& v1 = mesh_vertices[*i++ + vertex_offset];
+            const Vertex& v2 = mesh_vertices[*i++ + vertex_offset];
+            const Vertex& v3 = mesh_vertices[*i++ + vertex_offset];
+
+            // Find basis of UV-space on triangle in object space
+            // let a = v2 - v1; b = v3 - v1
+            //     a_uv = v2.uv - v1.uv; b_uv = v3.uv - v1.uv
+            // M = | a_uv | 
+            //     | b_uv | 
+            // eu, ev - UV-space basis vector coords in object space
+            // so
+            // | eu | = inv( M ) * | a |
+            // | ev |              | b |
+            //
+            // Inverse uv density is the length of uv basis vectors in object space
+
+            // TODO: use 2x2 specialized code
+            XMMATRIX ab( XMVectorSubtract( XMLoadFloat3( &v2.pos ), XMLoadFloat3( &v1.pos ) ),
+                         XMVectorSubtract( XMLoadFloat3( &v3.pos ), XMLoadFloat3( &v1.pos ) ),
+                         XMVECTORF32{ 0, 0, 1.0f, 0 },
+                         XMVECTORF32{ 0, 0, 0, 1.0f } );
+
+            XMMATRIX m_inv( XMVectorSubtract( XMLoadFloat2( &v2.uv ), XMLoadFloat2( &v1.uv ) ),
+                            XMVectorSubtract( XMLoadFloat2( &v3.uv ), XMLoadFloat2( &v1.uv ) ),
+                            XMVECTORF32{ 0, 0, 1.0f, 0 },
+                            XMVECTORF32{ 0, 0, 0, 1.0f } );
+
+            constexpr float determinant_eps = 1.e-5f;
+
+            XMVECTOR det;
+            m_inv = XMMatrixInverse( &det, m_inv );
+            if ( det.m128_f32[0] < determinant_eps )
+                continue;
+
+            XMMATRIX uv_basis = XMMatrixMultiply( m_inv, ab );
+            max_uv_basis_len2.x = std::max( XMVector3LengthSq( uv_basis.r[0] ).m128_f32[0], max_uv_basis_len2.x );
+            max_uv_basis_len2.y = std::max( XMVector3LengthSq( uv_basis.r[1] ).m128_f32[0], max_uv_basis_len2.y );
+        }
+
+        return max_uv_basis_len2;
+    };
+
+    auto max2 = []( const XMFLOAT2& lhs, const XMFLOAT2& rhs ) { return XMFLOAT2( std::max( lhs.x, rhs.x ), std::max( lhs.y, rhs.y ) ); };
+
+    constexpr size_t indices_per_task = 3 * 4096; // chunks must contain whole triangles
+    XMFLOAT2 max_uv_basis_len2 = parallel_reduce( submesh_indices, indices_per_task, XMFLOAT2( 0.0f, 0.0f ), process_triangles, max2 );
 
     max_uv_basis_len2.x = std::sqrtf( max_uv_basis_len2.x );
     max_uv_basis_len2.y = std::sqrtf( max_uv_basis_len2.y );
@@ -13,4 +13,8 @@ public:
 
 private:
     Scene* m_scene;
+
+    std::vector<std::optional<DirectX::XMFLOAT2>> m_instance_pixels_per_uv; // per packed instance, nullopt if the instance is skipped
+    std::vector<float> m_screen_sizes; // per packed instance, written to the scene only if it differs from the scene column
+
 };
\ No newline at end of file
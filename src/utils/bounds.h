@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// plain float bounding volumes for culling code that has to stay independent of DirectXMath
+// matrices are row-major and multiply row vectors ( p' = p * m ), as in DirectXMath
+
+struct aabb
+{
+    std::array<float, 3> min;
+    std::array<float, 3> max;
+
+    // inverted box, neutral element for merge()
+    static aabb empty() noexcept;
+    static aabb from_center_extents( const std::array<float, 3>& center, const std::array<float, 3>& extents ) noexcept;
+
+    std::array<float, 3> center() const noexcept;
+    float surface_area() const noexcept;
+    void merge( const aabb& other ) noexcept;
+};
+
+// boxes stored as one array per coordinate, so many of them can be tested at once (see frustum_cull.h)
+class aabb_soa
+{
+public:
+    enum Column { MinX = 0, MinY, MinZ, MaxX, MaxY, MaxZ, Count };
+
+    size_t size() const noexcept { return m_columns[0].size(); }
+    void resize( size_t n ) noexcept;
+    void clear() noexcept { resize( 0 ); }
+
+    void set( size_t idx, const aabb& box ) noexcept;
+    aabb get( size_t idx ) const noexcept;
+
+    const float* column( Column column ) const noexcept { return m_columns[column].data(); }
+
+private:
+    std::array<std::vector<float>, Column::Count> m_columns;
+};
+
+struct sphere
+{
+    std::array<float, 3> center;
+    float radius;
+};
+
+// points origin + t * dir for t in [0, t_max], dir doesn't have to be normalized
+struct ray
+{
+    std::array<float, 3> origin;
+    std::array<float, 3> dir;
+    float t_max = std::numeric_limits<float>::infinity();
+};
+
+// 6 planes ( nx, ny, nz, d ) with normals pointing inside, point p is inside if dot( n, p ) + d >= 0 for every plane
+// planes are normalized, so dot( n, p ) + d is the signed distance
+struct frustum
+{
+    enum Plane { Left = 0, Right, Bottom, Top, Near, Far, Count };
+
+    std::array<std::array<float, 4>, Plane::Count> planes;
+};
+
+// clip volume -w <= x, y <= w, 0 <= z <= w of clip = p * view_proj
+frustum make_frustum( const float ( &view_proj )[4][4] ) noexcept;
+
+// clip volume of an orthographic light view_proj without the near plane, so it reaches infinitely far towards the light
+// and keeps occluders standing between the light and the volume. Their depth has to be clamped when drawing
+frustum make_shadow_caster_volume( const float ( &light_view_proj )[4][4] ) noexcept;
+
+// box which contains the box transformed by m
+aabb transform( const aabb& box, const float ( &m )[4][4] ) noexcept;
+
+// signed distances from the plane to the box corners furthest along and against the plane normal
+float max_plane_distance( const std::array<float, 4>& plane, const aabb& box ) noexcept;
+float min_plane_distance( const std::array<float, 4>& plane, const aabb& box ) noexcept;
+
+// conservative test, boxes near the frustum edges may be reported as visible
+bool intersects( const frustum& f, const aabb& box ) noexcept;
+
+// ray in the space m transforms to, t keeps its meaning
+ray transform( const ray& r, const float ( &m )[4][4] ) noexcept;
+
+// t at which the ray enters the box, 0 if it starts inside, negative if it misses the box within [0, t_max]
+// inv_dir is 1 / r.dir per component, computed once per ray
+float ray_distance( const ray& r, const std::array<float, 3>& inv_dir, const aabb& box ) noexcept;
+std::array<float, 3> inverse_dir( const ray& r ) noexcept;
+
+// touching boxes and spheres intersect
+bool intersects( const aabb& lhs, const aabb& rhs ) noexcept;
+bool intersects( const sphere& s, const aabb& box ) noexcept;
+
+// 0 if the point is inside the box
+float distance_sqr( const aabb& box, const std::array<float, 3>& point ) noexcept;
+
+
+inline aabb aabb::empty() noexcept
+{
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    return aabb{ { inf, inf, inf }, { -inf, -inf, -inf } };
+}
+
+
+inline aabb aabb::from_center_extents( const std::array<float, 3>& center, const std::array<float, 3>& extents ) noexcept
+{
+    aabb res;
+    for ( size_t i = 0; i < 3; ++i )
+    {
+        res.min[i] = center[i] - extents[i];
+        res.max[i] = center[i] + extents[i];
+    }
+    return res;
+}
+
+
+inline std::array<float, 3> aabb::center() const noexcept
+{
+    return { ( min[0] + max[0] ) * 0.5f, ( min[1] + max[1] ) * 0.5f, ( min[2] + max[2] ) * 0.5f };
+}
+
+
+inline float aabb::surface_area() const noexcept
+{
+    const float dx = max[0] - min[0];
+    const float dy = max[1] - min[1];
+    const float dz = max[2] - min[2];
+    return 2.0f * ( dx * dy + dy * dz + dz * dx );
+}
+
+
+inline void aabb::merge( const aabb& other ) noexcept
+{
+    for ( size_t i = 0; i < 3; ++i )
+    {
+        min[i] = std::min( min[i], other.min[i] );
+        max[i] = std::max( max[i], other.max[i] );
+    }
+}
+
+
+inline void aabb_soa::resize( size_t n ) noexcept
+{
+    for ( auto& column : m_columns )
+        column.resize( n );
+}
+
+
+inline void aabb_soa::set( size_t idx, const aabb& box ) noexcept
+{
+    for ( size_t i = 0; i < 3; ++i )
+    {
+        m_columns[MinX + i][idx] = box.min[i];
+        m_columns[MaxX + i][idx] = box.max[i];
+    }
+}
+
+
+inline aabb aabb_soa::get( size_t idx ) const noexcept
+{
+    aabb res;
+    for ( size_t i = 0; i < 3; ++i )
+    {
+        res.min[i] = m_columns[MinX + i][idx];
+        res.max[i] = m_columns[MaxX + i][idx];
+    }
+    return res;
+}
+
+
+inline frustum make_frustum( const float ( &m )[4][4] ) noexcept
+{
+    // Gribb-Hartmann: every plane is a combination of clip matrix columns
+    auto column = [&m]( size_t j ) { return std::array<float, 4>{ m[0][j], m[1][j], m[2][j], m[3][j] }; };
+    const auto c0 = column( 0 );
+    const auto c1 = column( 1 );
+    const auto c2 = column( 2 );
+    const auto c3 = column( 3 );
+
+    frustum res;
+    for ( size_t i = 0; i < 4; ++i )
+    {
+        res.planes[frustum::Left][i] = c3[i] + c0[i];
+        res.planes[frustum::Right][i] = c3[i] - c0[i];
+        res.planes[frustum::Bottom][i] = c3[i] + c1[i];
+        res.planes[frustum::Top][i] = c3[i] - c1[i];
+        res.planes[frustum::Near][i] = c2[i];
+        res.planes[frustum::Far][i] = c3[i] - c2[i];
+    }
+
+    for ( auto& plane : res.planes )
+    {
+        const float len = std::sqrt( plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2] );
+        for ( float& coef : plane )
+            coef /= len;
+    }
+    return res;
+}
+
+
+inline frustum make_shadow_caster_volume( const float ( &light_view_proj )[4][4] ) noexcept
+{
+    frustum res = make_frustum( light_view_proj );
+    // zero normal, every point is at distance 1
+    res.planes[frustum::Near] = { 0, 0, 0, 1 };
+    return res;
+}
+
+
+inline aabb transform( const aabb& box, const float ( &m )[4][4] ) noexcept
+{
+    // Arvo: transformed center plus extents projected on the absolute values of the basis
+    const auto center = box.center();
+    std::array<float, 3> new_center;
+    std::array<float, 3> new_extents;
+    for ( size_t j = 0; j < 3; ++j )
+    {
+        new_center[j] = m[3][j];
+        new_extents[j] = 0;
+        for ( size_t i = 0; i < 3; ++i )
+        {
+            new_center[j] += center[i] * m[i][j];
+            new_extents[j] += ( box.max[i] - center[i] ) * std::abs( m[i][j] );
+        }
+    }
+    return aabb::from_center_extents( new_center, new_extents );
+}
+
+
+inline ray transform( const ray& r, const float ( &m )[4][4] ) noexcept
+{
+    ray res;
+    for ( size_t j = 0; j < 3; ++j )
+    {
+        res.origin[j] = m[3][j];
+        res.dir[j] = 0;
+        for ( size_t i = 0; i < 3; ++i )
+        {
+            res.origin[j] += r.origin[i] * m[i][j];
+            res.dir[j] += r.dir[i] * m[i][j];
+        }
+    }
+    res.t_max = r.t_max;
+    return res;
+}
+
+
+inline std::array<float, 3> inverse_dir( const ray& r ) noexcept
+{
+    return { 1.0f / r.dir[0], 1.0f / r.dir[1], 1.0f / r.dir[2] };
+}
+
+
+inline float ray_distance( const ray& r, const std::array<float, 3>& inv_dir, const aabb& box ) noexcept
+{
+    // slabs, a zero direction component gives infinite slab distances of the right signs for origins off the slab planes
+    float t_enter = 0;
+    float t_exit = r.t_max;
+    for ( size_t i = 0; i < 3; ++i )
+    {
+        const float t0 = ( box.min[i] - r.origin[i] ) * inv_dir[i];
+        const float t1 = ( box.max[i] - r.origin[i] ) * inv_dir[i];
+        t_enter = std::max( t_enter, std::min( t0, t1 ) );
+        t_exit = std::min( t_exit, std::max( t0, t1 ) );
+    }
+    return t_enter <= t_exit ? t_enter : -1.0f;
+}
+
+
+inline float max_plane_distance( const std::array<float, 4>& plane, const aabb& box ) noexcept
+{
+    const float x = plane[0] >= 0 ? box.max[0] : box.min[0];
+    const float y = plane[1] >= 0 ? box.max[1] : box.min[1];
+    const float z = plane[2] >= 0 ? box.max[2] : box.min[2];
+    return plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+}
+
+
+inline float min_plane_distance( const std::array<float, 4>& plane, const aabb& box ) noexcept
+{
+    const float x = plane[0] >= 0 ? box.min[0] : box.max[0];
+    const float y = plane[1] >= 0 ? box.min[1] : box.max[1];
+    const float z = plane[2] >= 0 ? box.min[2] : box.max[2];
+    return plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+}
+
+
+inline bool intersects( const frustum& f, const aabb& box ) noexcept
+{
+    for ( const auto& plane : f.planes )
+        if ( max_plane_distance( plane, box ) < 0 )
+            return false;
+    return true;
+}
+
+
+inline float distance_sqr( const aabb& box, const std::array<float, 3>& point ) noexcept
+{
+    float res = 0;
+    for ( size_t i = 0; i < 3; ++i )
+    {
+        const float d = std::max( std::max( box.min[i] - point[i], point[i] - box.max[i] ), 0.0f );
+        res += d * d;
+    }
+    return res;
+}
+
+
+inline bool intersects( const aabb& lhs, const aabb& rhs ) noexcept
+{
+    for ( size_t i = 0; i < 3; ++i )
+        if ( lhs.max[i] < rhs.min[i] || rhs.max[i] < lhs.min[i] )
+            return false;
+    return true;
+}
+
+
+inline bool intersects( const sphere& s, const aabb& box ) noexcept
+{
+    return distance_sqr( box, s.center ) <= s.radius * s.radius;
+}
@@ -0,0 +1,319 @@
+﻿// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "bvh.h"
+
+
+
+namespace
+{
+    constexpr uint32_t NumBins = 16;
+    // past this depth subtrees are split at the median, which caps the total depth at MedianDepth + log2( 2^32 )
+    constexpr uint32_t MedianDepth = 32;
+
+    // boxes are moved around during the build, so subtrees are contiguous in memory
+    struct build_item
+    {
+        aabb box;
+        std::array<float, 3> centroid;
+        uint32_t idx;
+    };
+
+    struct split
+    {
+        uint32_t axis;
+        float pos; // centroids below pos go to the left child
+        float cost;
+    };
+
+    // binned SAH along the axis where centroids are spread the most,
+    // cost is relative to the area of the parent and counts one unit per box
+    split find_sah_split( span<const build_item> items, const aabb& centroid_bounds ) noexcept
+    {
+        uint32_t axis = 0;
+        for ( uint32_t i = 1; i < 3; ++i )
+            if ( centroid_bounds.max[i] - centroid_bounds.min[i] > centroid_bounds.max[axis] - centroid_bounds.min[axis] )
+                axis = i;
+
+        split best{ axis, 0, std::numeric_limits<float>::infinity() };
+        const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        if ( ! ( extent > 0 ) )
+            return best;
+
+        aabb bin_boxes[NumBins];
+        uint32_t bin_counts[NumBins] = {};
+        std::fill( std::begin( bin_boxes ), std::end( bin_boxes ), aabb::empty() );
+
+        const float scale = NumBins / extent;
+        for ( const build_item& item : items )
+        {
+            const uint32_t bin = std::min( uint32_t( ( item.centroid[axis] - centroid_bounds.min[axis] ) * scale ), NumBins - 1 );
+            bin_boxes[bin].merge( item.box );
+            bin_counts[bin]++;
+        }
+
+        // sweep from the right to get suffix areas, then from the left evaluating every bin border
+        float right_areas[NumBins];
+        uint32_t right_counts[NumBins];
+        aabb acc = aabb::empty();
+        uint32_t acc_count = 0;
+        for ( uint32_t bin = NumBins - 1; bin > 0; --bin )
+        {
+            acc.merge( bin_boxes[bin] );
+            acc_count += bin_counts[bin];
+            right_areas[bin] = acc_count > 0 ? acc.surface_area() : 0;
+            right_counts[bin] = acc_count;
+        }
+
+        acc = aabb::empty();
+        acc_count = 0;
+        for ( uint32_t bin = 0; bin + 1 < NumBins; ++bin )
+        {
+            acc.merge( bin_boxes[bin] );
+            acc_count += bin_counts[bin];
+            if ( acc_count == 0 || right_counts[bin + 1] == 0 )
+                continue;
+
+            const float cost = acc.surface_area() * acc_count + right_areas[bin + 1] * right_counts[bin + 1];
+            if ( cost < best.cost )
+                best = split{ axis, centroid_bounds.min[axis] + ( bin + 1 ) / scale, cost };
+        }
+        return best;
+    }
+}
+
+
+void bvh::build( span<const aabb> boxes )
+{
+    assert( boxes.size() < std::numeric_limits<uint32_t>::max() );
+
+    std::vector<uint32_t> all( boxes.size() );
+    std::iota( all.begin(), all.end(), 0 );
+    build( boxes, make_span( std::as_const( all ) ) );
+}
+
+
+void bvh::build( span<const aabb> boxes, span<const uint32_t> subset )
+{
+    assert( boxes.size() < std::numeric_limits<uint32_t>::max() );
+
+    clear();
+    if ( subset.size() == 0 )
+        return;
+
+    std::vector<build_item> items( subset.size() );
+    for ( size_t i = 0; i < items.size(); ++i )
+    {
+        assert( subset[i] < boxes.size() );
+        const aabb& box = boxes[subset[i]];
+        items[i] = build_item{ box, box.center(), subset[i] };
+    }
+
+    m_nodes.reserve( 2 * items.size() / MaxLeafSize + 1 );
+    m_nodes.push_back( node{ aabb::empty(), 0, uint32_t( items.size() ), 0 } );
+
+    struct task
+    {
+        uint32_t node_idx;
+        uint32_t depth;
+    };
+    std::vector<task> tasks{ task{ 0, 0 } };
+    while ( ! tasks.empty() )
+    {
+        const task cur = tasks.back();
+        tasks.pop_back();
+
+        // m_nodes may grow below, so the node is addressed by index
+        const uint32_t first = m_nodes[cur.node_idx].first;
+        const uint32_t count = m_nodes[cur.node_idx].count;
+        const auto node_items = make_span( items.data() + first, items.data() + first + count );
+
+        aabb node_box = aabb::empty();
+        aabb centroid_bounds = aabb::empty();
+        for ( const build_item& item : node_items )
+        {
+            node_box.merge( item.box );
+            centroid_bounds.merge( aabb{ item.centroid, item.centroid } );
+        }
+        m_nodes[cur.node_idx].box = node_box;
+
+        if ( count <= 2 )
+            continue;
+
+        build_item* middle = nullptr;
+        if ( cur.depth < MedianDepth )
+        {
+            const split best = find_sah_split( node_items, centroid_bounds );
+            const float leaf_cost = node_box.surface_area() * count;
+            if ( best.cost >= leaf_cost && count <= MaxLeafSize )
+                continue;
+
+            if ( best.cost < std::numeric_limits<float>::infinity() )
+                middle = std::partition( node_items.begin(), node_items.end(), [&best]( const build_item& item )
+                {
+                    return item.centroid[best.axis] < best.pos;
+                } );
+        }
+
+        // no usable split, e.g. all centroids coincide, or the subtree is too deep
+        if ( middle == nullptr || middle == node_items.begin() || middle == node_items.end() )
+        {
+            if ( count <= MaxLeafSize )
+                continue;
+
+            uint32_t axis = 0;
+            for ( uint32_t i = 1; i < 3; ++i )
+                if ( centroid_bounds.max[i] - centroid_bounds.min[i] > centroid_bounds.max[axis] - centroid_bounds.min[axis] )
+                    axis = i;
+
+            middle = node_items.begin() + count / 2;
+            std::nth_element( node_items.begin(), middle, node_items.end(), [axis]( const build_item& lhs, const build_item& rhs )
+            {
+                return lhs.centroid[axis] < rhs.centroid[axis];
+            } );
+        }
+
+        const uint32_t left_count = uint32_t( middle - node_items.begin() );
+        const uint32_t left = uint32_t( m_nodes.size() );
+        m_nodes[cur.node_idx].left = left;
+        m_nodes.push_back( node{ aabb::empty(), first, left_count, 0 } );
+        m_nodes.push_back( node{ aabb::empty(), first + left_count, count - left_count, 0 } );
+
+        tasks.push_back( task{ left, cur.depth + 1 } );
+        tasks.push_back( task{ left + 1, cur.depth + 1 } );
+    }
+
+    m_indices.resize( items.size() );
+    m_boxes.resize( items.size() );
+    for ( size_t i = 0; i < items.size(); ++i )
+    {
+        m_indices[i] = items[i].idx;
+        m_boxes.set( i, items[i].box );
+    }
+}
+
+
+void bvh::refit( span<const aabb> boxes ) noexcept
+{
+    for ( size_t i = 0; i < m_indices.size(); ++i )
+        m_boxes.set( i, boxes[m_indices[i]] );
+
+    // children are always placed after their parents
+    for ( size_t node_idx = m_nodes.size(); node_idx-- > 0; )
+    {
+        node& cur = m_nodes[node_idx];
+        cur.box = aabb::empty();
+        if ( cur.left == 0 )
+        {
+            for ( uint32_t i = cur.first; i < cur.first + cur.count; ++i )
+                cur.box.merge( m_boxes.get( i ) );
+        }
+        else
+        {
+            cur.box.merge( m_nodes[cur.left].box );
+            cur.box.merge( m_nodes[cur.left + 1].box );
+        }
+    }
+}
+
+
+void bvh::cull( span<const frustum> views, span<uint8_t> view_masks ) const noexcept
+{
+    assert( views.size() <= MaxViews );
+    assert( view_masks.size() >= m_indices.size() );
+    if ( m_nodes.empty() || views.size() == 0 )
+        return;
+
+    const cull_isa isa = best_cull_isa();
+    constexpr uint32_t all_planes = ( 1u << frustum::Count ) - 1;
+
+    struct entry
+    {
+        uint32_t node_idx;
+        uint32_t view_mask; // views the node straddles, others are already resolved for the whole subtree
+        uint64_t plane_masks; // frustum::Count bits per view, planes the node is not known to be entirely inside of
+    };
+    entry stack[MaxDepth + 1];
+    size_t stack_size = 0;
+
+    uint64_t root_plane_masks = 0;
+    for ( uint32_t view_idx = 0; view_idx < views.size(); ++view_idx )
+        root_plane_masks |= uint64_t( all_planes ) << ( view_idx * frustum::Count );
+    stack[stack_size++] = entry{ 0, ( 1u << views.size() ) - 1, root_plane_masks };
+
+    while ( stack_size > 0 )
+    {
+        entry cur = stack[--stack_size];
+        const node& cur_node = m_nodes[cur.node_idx];
+
+        uint32_t inside_mask = 0; // views containing the whole subtree, written once for all of them
+        for ( uint32_t view_idx = 0; view_idx < views.size(); ++view_idx )
+        {
+            if ( ! ( cur.view_mask & ( 1u << view_idx ) ) )
+                continue;
+
+            const uint32_t shift = view_idx * frustum::Count;
+            uint32_t plane_mask = uint32_t( cur.plane_masks >> shift ) & all_planes;
+            bool is_outside = false;
+            for ( uint32_t plane_idx = 0; plane_idx < frustum::Count && ! is_outside; ++plane_idx )
+            {
+                if ( ! ( plane_mask & ( 1u << plane_idx ) ) )
+                    continue;
+
+                const auto& plane = views[view_idx].planes[plane_idx];
+                is_outside = max_plane_distance( plane, cur_node.box ) < 0;
+                if ( min_plane_distance( plane, cur_node.box ) >= 0 )
+                    plane_mask &= ~( 1u << plane_idx );
+            }
+
+            cur.plane_masks &= ~( uint64_t( all_planes ) << shift );
+            cur.plane_masks |= uint64_t( plane_mask ) << shift;
+
+            if ( ! is_outside && plane_mask == 0 )
+                inside_mask |= 1u << view_idx;
+
+            if ( is_outside || plane_mask == 0 )
+                cur.view_mask &= ~( 1u << view_idx );
+        }
+
+        // same as in the single view cull, one simd batch per straddled view, then every box mask is written once
+        if ( cur.view_mask != 0 && ( cur_node.left == 0 || cur_node.count <= BatchSize ) )
+        {
+            uint8_t box_masks[BatchSize];
+            std::fill( box_masks, box_masks + cur_node.count, uint8_t( inside_mask ) );
+            for ( uint32_t view_idx = 0; view_idx < views.size(); ++view_idx )
+            {
+                if ( ! ( cur.view_mask & ( 1u << view_idx ) ) )
+                    continue;
+
+                uint64_t visible_bits;
+                frustum_cull( views[view_idx], m_boxes, cur_node.first, cur_node.count, make_span( &visible_bits, &visible_bits + 1 ), isa );
+                for_each_set_bit( visible_bits, 0, [&]( size_t i ) { box_masks[i] |= uint8_t( 1u << view_idx ); } );
+            }
+
+            for ( uint32_t i = 0; i < cur_node.count; ++i )
+                view_masks[m_indices[cur_node.first + i]] |= box_masks[i];
+            continue;
+        }
+
+        if ( inside_mask != 0 )
+            for ( uint32_t i = cur_node.first; i < cur_node.first + cur_node.count; ++i )
+                view_masks[m_indices[i]] |= uint8_t( inside_mask );
+
+        if ( cur.view_mask == 0 )
+            continue;
+
+        stack[stack_size++] = entry{ cur_node.left + 1, cur.view_mask, cur.plane_masks };
+        stack[stack_size++] = entry{ cur_node.left, cur.view_mask, cur.plane_masks };
+    }
+}
+
+
+void bvh::clear() noexcept
+{
+    m_nodes.clear();
+    m_indices.clear();
+    m_boxes.clear();
+}
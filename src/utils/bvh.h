@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+#include "bounds.h"
+#include "frustum_cull.h"
+#include "dense_bitset.h"
+
+// bounding volume hierarchy over a set of boxes, built with binned SAH
+// leaves reference boxes by their index in the span given to build()
+// refit() moves the boxes without changing the topology, so the tree gets worse if boxes travel far from where they were built.
+// Rebuild it in that case, and whenever boxes are added or removed
+// all const methods are thread-safe, no thread safety on any non-const method
+
+class bvh
+{
+public:
+    static constexpr uint32_t MaxLeafSize = 8;
+
+    void build( span<const aabb> boxes );
+    // tree over boxes[subset[i]] only, leaves still reference boxes by their index in boxes
+    void build( span<const aabb> boxes, span<const uint32_t> subset );
+    // boxes must be laid out as the ones the tree was built from
+    void refit( span<const aabb> boxes ) noexcept;
+    void clear() noexcept;
+
+    // number of boxes in the tree
+    size_t size() const noexcept { return m_indices.size(); }
+    size_t node_count() const noexcept { return m_nodes.size(); }
+    // box of the whole tree, empty if there are no boxes
+    aabb bounds() const noexcept { return m_nodes.empty() ? aabb::empty() : m_nodes[0].box; }
+
+    // calls fn( box_idx ) for every box intersecting the volume, in unspecified order
+    template<typename Fn>
+    void query( const aabb& volume, Fn&& fn ) const;
+    template<typename Fn>
+    void query( const sphere& volume, Fn&& fn ) const;
+
+    // calls fn( box_idx, t ) for boxes the ray enters at t within [0, t_max], descending into nearer children first.
+    // fn returns the t_max for the rest of the traversal: a closest hit search returns the distance of its hit,
+    // an any hit search stops the traversal by returning a negative value
+    template<typename Fn>
+    void raycast( const ray& r, Fn&& fn ) const;
+
+    // calls fn( box_idx ) for every box intersecting the frustum, in unspecified order
+    // reports exactly the boxes for which intersects( f, box ) is true, without testing the ones deep inside or outside
+    template<typename Fn>
+    void cull( const frustum& f, Fn&& fn ) const;
+
+    static constexpr uint32_t MaxViews = 8;
+
+    // culls against several volumes in one traversal, a node is loaded once for all the views it may intersect
+    // sets bit i of view_masks[box_idx] for every box for which intersects( views[i], box ) is true, other bits are left as they are.
+    // view_masks has an entry per box of the span the tree was built from, views.size() must not exceed MaxViews
+    void cull( span<const frustum> views, span<uint8_t> view_masks ) const noexcept;
+
+private:
+    struct node
+    {
+        aabb box;
+        uint32_t first; // boxes of the subtree are m_indices[first, first + count)
+        uint32_t count;
+        uint32_t left; // index of the left child, the right one follows it. 0 for leaves, the root is never a child
+    };
+
+    // descends into nodes passing test( node_box ), calls fn( box_idx ) for boxes passing it
+    template<typename Test, typename Fn>
+    void query_if( const Test& test, Fn& fn ) const;
+
+    // subtrees with at most this many boxes are culled with one frustum_cull call, leaves are always smaller
+    static constexpr uint32_t BatchSize = 64;
+
+    // depth is bounded by forcing median splits in deep subtrees, so a traversal stack has a fixed size
+    static constexpr uint32_t MaxDepth = 64;
+
+    std::vector<node> m_nodes;
+    std::vector<uint32_t> m_indices;
+    aabb_soa m_boxes; // copies of the boxes in m_indices order, a leaf is tested with one frustum_cull batch
+};
+
+
+template<typename Fn>
+void bvh::cull( const frustum& f, Fn&& fn ) const
+{
+    if ( m_nodes.empty() )
+        return;
+
+    const cull_isa isa = best_cull_isa();
+
+    struct entry
+    {
+        uint32_t node_idx;
+        uint32_t plane_mask; // planes the node is not known to be entirely inside of
+    };
+    entry stack[MaxDepth + 1];
+    size_t stack_size = 0;
+    stack[stack_size++] = entry{ 0, ( 1u << frustum::Count ) - 1 };
+
+    while ( stack_size > 0 )
+    {
+        const entry cur = stack[--stack_size];
+        const node& cur_node = m_nodes[cur.node_idx];
+
+        uint32_t plane_mask = cur.plane_mask;
+        bool is_outside = false;
+        for ( uint32_t plane_idx = 0; plane_idx < frustum::Count && ! is_outside; ++plane_idx )
+        {
+            if ( ! ( plane_mask & ( 1u << plane_idx ) ) )
+                continue;
+
+            const auto& plane = f.planes[plane_idx];
+            is_outside = max_plane_distance( plane, cur_node.box ) < 0;
+            if ( min_plane_distance( plane, cur_node.box ) >= 0 )
+                plane_mask &= ~( 1u << plane_idx );
+        }
+
+        if ( is_outside )
+            continue;
+
+        if ( plane_mask == 0 )
+        {
+            for ( uint32_t i = cur_node.first; i < cur_node.first + cur_node.count; ++i )
+                fn( m_indices[i] );
+            continue;
+        }
+
+        // boxes of a subtree are contiguous, so small subtrees are tested in one simd batch instead of being descended into.
+        // Planes dropped above are passed by these boxes anyway, so testing them again doesn't change the result
+        if ( cur_node.left == 0 || cur_node.count <= BatchSize )
+        {
+            uint64_t visible_bits;
+            frustum_cull( f, m_boxes, cur_node.first, cur_node.count, make_span( &visible_bits, &visible_bits + 1 ), isa );
+            for_each_set_bit( visible_bits, 0, [&]( size_t i ) { fn( m_indices[cur_node.first + i] ); } );
+            continue;
+        }
+
+        stack[stack_size++] = entry{ cur_node.left + 1, plane_mask };
+        stack[stack_size++] = entry{ cur_node.left, plane_mask };
+    }
+}
+
+
+template<typename Fn>
+void bvh::query( const aabb& volume, Fn&& fn ) const
+{
+    query_if( [&volume]( const aabb& box ) { return intersects( volume, box ); }, fn );
+}
+
+
+template<typename Fn>
+void bvh::query( const sphere& volume, Fn&& fn ) const
+{
+    query_if( [&volume]( const aabb& box ) { return intersects( volume, box ); }, fn );
+}
+
+
+template<typename Test, typename Fn>
+void bvh::query_if( const Test& test, Fn& fn ) const
+{
+    if ( m_nodes.empty() )
+        return;
+
+    uint32_t stack[MaxDepth + 1];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while ( stack_size > 0 )
+    {
+        const node& cur_node = m_nodes[stack[--stack_size]];
+        if ( ! test( cur_node.box ) )
+            continue;
+
+        if ( cur_node.left == 0 )
+        {
+            for ( uint32_t i = cur_node.first; i < cur_node.first + cur_node.count; ++i )
+                if ( test( m_boxes.get( i ) ) )
+                    fn( m_indices[i] );
+            continue;
+        }
+
+        stack[stack_size++] = cur_node.left + 1;
+        stack[stack_size++] = cur_node.left;
+    }
+}
+
+
+template<typename Fn>
+void bvh::raycast( const ray& r, Fn&& fn ) const
+{
+    if ( m_nodes.empty() )
+        return;
+
+    const auto inv_dir = inverse_dir( r );
+    float t_max = r.t_max;
+    auto distance = [&]( const aabb& box ) { return ray_distance( ray{ r.origin, r.dir, t_max }, inv_dir, box ); };
+
+    struct entry
+    {
+        uint32_t node_idx;
+        float t; // where the ray enters the node
+    };
+    entry stack[MaxDepth + 1];
+    size_t stack_size = 0;
+
+    const float root_t = distance( m_nodes[0].box );
+    if ( root_t >= 0 )
+        stack[stack_size++] = entry{ 0, root_t };
+
+    while ( stack_size > 0 )
+    {
+        const entry cur = stack[--stack_size];
+        if ( cur.t > t_max )
+            continue;
+
+        const node& cur_node = m_nodes[cur.node_idx];
+        if ( cur_node.left == 0 )
+        {
+            for ( uint32_t i = cur_node.first; i < cur_node.first + cur_node.count; ++i )
+            {
+                const float t = distance( m_boxes.get( i ) );
+                if ( t < 0 )
+                    continue;
+
+                t_max = std::min( t_max, fn( m_indices[i], t ) );
+                if ( t_max < 0 )
+                    return;
+            }
+            continue;
+        }
+
+        entry near_child{ cur_node.left, distance( m_nodes[cur_node.left].box ) };
+        entry far_child{ cur_node.left + 1, distance( m_nodes[cur_node.left + 1].box ) };
+        if ( near_child.t < 0 || ( far_child.t >= 0 && far_child.t < near_child.t ) )
+            std::swap( near_child, far_child );
+
+        if ( far_child.t >= 0 )
+            stack[stack_size++] = far_child;
+        if ( near_child.t >= 0 )
+            stack[stack_size++] = near_child;
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// growable bitset stored in 64-bit words, meant to mirror a boolean property of packed elements
+// so that a traversal can skip 64 elements at once. Bits past size() are always 0
+// all const methods are thread-safe, no thread safety on any non-const method
+
+class dense_bitset
+{
+public:
+    static constexpr size_t BitsPerWord = 64;
+
+    size_t size() const noexcept { return m_nbits; }
+    // new bits are 0
+    void resize( size_t nbits ) noexcept;
+    void clear() noexcept { m_words.clear(); m_nbits = 0; }
+    // sets all bits to 0, keeps the size
+    void reset() noexcept { std::fill( m_words.begin(), m_words.end(), 0 ); }
+
+    void set( size_t idx, bool value = true ) noexcept;
+    bool test( size_t idx ) const noexcept { assert( idx < m_nbits ); return ( m_words[idx / BitsPerWord] >> ( idx % BitsPerWord ) ) & 1; }
+
+    size_t count() const noexcept;
+
+    // word-wise operations, sizes must match
+    dense_bitset& operator&=( const dense_bitset& other ) noexcept;
+    dense_bitset& operator|=( const dense_bitset& other ) noexcept;
+
+    // bit i is set iff values[i] & mask is non-zero, e.g. to extract one view from per-instance view masks. Resizes to values.size()
+    void assign_masked( span<const uint8_t> values, uint8_t mask ) noexcept;
+
+    // word i holds bits [64 * i, 64 * ( i + 1 ) )
+    span<const uint64_t> words() const noexcept { return make_span( m_words ); }
+
+    // calls fn( idx ) for every set bit in ascending order
+    template<typename Fn>
+    void for_each_set( Fn&& fn ) const;
+
+private:
+    std::vector<uint64_t> m_words;
+    size_t m_nbits = 0;
+};
+
+
+inline uint32_t lowest_set_bit( uint64_t word ) noexcept
+{
+    assert( word != 0 );
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64( &idx, word );
+    return uint32_t( idx );
+#else
+    return uint32_t( __builtin_ctzll( word ) );
+#endif
+}
+
+
+inline uint32_t popcount( uint64_t word ) noexcept
+{
+#ifdef _MSC_VER
+    return uint32_t( __popcnt64( word ) );
+#else
+    return uint32_t( __builtin_popcountll( word ) );
+#endif
+}
+
+
+// calls fn( idx ) for every bit set in word, word_idx is the position of the word in its bitset
+template<typename Fn>
+void for_each_set_bit( uint64_t word, size_t word_idx, Fn&& fn )
+{
+    const size_t base = word_idx * dense_bitset::BitsPerWord;
+    for ( ; word != 0; word &= word - 1 )
+        fn( base + lowest_set_bit( word ) );
+}
+
+
+inline void dense_bitset::resize( size_t nbits ) noexcept
+{
+    m_words.resize( ( nbits + BitsPerWord - 1 ) / BitsPerWord, 0 );
+
+    // drop the bits cut off from the last word
+    if ( nbits % BitsPerWord != 0 )
+        m_words.back() &= ( uint64_t( 1 ) << ( nbits % BitsPerWord ) ) - 1;
+
+    m_nbits = nbits;
+}
+
+
+inline void dense_bitset::set( size_t idx, bool value ) noexcept
+{
+    assert( idx < m_nbits );
+    const uint64_t bit = uint64_t( 1 ) << ( idx % BitsPerWord );
+    if ( value )
+        m_words[idx / BitsPerWord] |= bit;
+    else
+        m_words[idx / BitsPerWord] &= ~bit;
+}
+
+
+inline size_t dense_bitset::count() const noexcept
+{
+    size_t res = 0;
+    for ( uint64_t word : m_words )
+        res += popcount( word );
+    return res;
+}
+
+
+inline dense_bitset& dense_bitset::operator&=( const dense_bitset& other ) noexcept
+{
+    assert( m_nbits == other.m_nbits );
+    for ( size_t i = 0; i < m_words.size(); ++i )
+        m_words[i] &= other.m_words[i];
+    return *this;
+}
+
+
+inline dense_bitset& dense_bitset::operator|=( const dense_bitset& other ) noexcept
+{
+    assert( m_nbits == other.m_nbits );
+    for ( size_t i = 0; i < m_words.size(); ++i )
+        m_words[i] |= other.m_words[i];
+    return *this;
+}
+
+
+inline void dense_bitset::assign_masked( span<const uint8_t> values, uint8_t mask ) noexcept
+{
+    m_nbits = values.size();
+    m_words.resize( ( m_nbits + BitsPerWord - 1 ) / BitsPerWord );
+    for ( size_t word_idx = 0; word_idx < m_words.size(); ++word_idx )
+    {
+        const size_t first = word_idx * BitsPerWord;
+        const size_t last = std::min( first + BitsPerWord, m_nbits );
+        uint64_t word = 0;
+        for ( size_t i = first; i < last; ++i )
+            word |= uint64_t( ( values[i] & mask ) != 0 ) << ( i - first );
+        m_words[word_idx] = word;
+    }
+}
+
+
+template<typename Fn>
+void dense_bitset::for_each_set( Fn&& fn ) const
+{
+    for ( size_t i = 0; i < m_words.size(); ++i )
+        for_each_set_bit( m_words[i], i, fn );
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+// persistent id of an element in packed freelists (see packed_freelist.h, packed_soa_freelist.h)
+// T is only a tag, so the id can be named while T is still incomplete
+
+template<typename T>
+struct alignas( 8 ) freelist_id
+{
+    uint32_t idx;
+    uint32_t inner_id;
+    bool operator==( const freelist_id& rhs ) const noexcept { return this->idx == rhs.idx && this->inner_id == rhs.inner_id; }
+    bool operator!=( const freelist_id& rhs ) const noexcept { return this->idx != rhs.idx || this->inner_id != rhs.inner_id; }
+
+    static const freelist_id nullid;
+};
+
+template<typename T>
+const freelist_id<T> freelist_id<T>::nullid = freelist_id<T>{ std::numeric_limits<uint32_t>::max(), 0 };
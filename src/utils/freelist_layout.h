@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#include "span.h"
+
+// id bookkeeping of a packed freelist (see packed_freelist.h, packed_soa_freelist.h)
+// a freelist restored from the layout of another freelist gives out exactly the same ids, so the layout can be saved to disk with the elements
+struct freelist_layout
+{
+    span<const uint32_t> slots; // 2 values per slot: packed index (or next free slot) and slot counter
+    span<const uint32_t> packed2slot; // slot of every packed element
+    uint32_t free_head = std::numeric_limits<uint32_t>::max();
+
+    // checks that every packed element owns its slot and the free chain covers all other slots
+    bool is_consistent( size_t nelems ) const noexcept
+    {
+        constexpr uint32_t free_end = std::numeric_limits<uint32_t>::max();
+
+        if ( slots.size() % 2 != 0 || packed2slot.size() != nelems )
+            return false;
+
+        const size_t nslots = slots.size() / 2;
+        for ( size_t packed_idx = 0; packed_idx < nelems; ++packed_idx )
+            if ( packed2slot[packed_idx] >= nslots || slots[2 * packed2slot[packed_idx]] != packed_idx )
+                return false;
+
+        size_t nfree = 0;
+        for ( uint32_t slot = free_head; slot != free_end; slot = slots[2 * size_t( slot )] )
+            if ( slot >= nslots || ++nfree > nslots )
+                return false;
+
+        return nfree + nelems == nslots;
+    }
+};
@@ -0,0 +1,166 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "frustum_cull.h"
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+#define SNOW_CULL_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// msvc emits vex-encoded avx for intrinsics without /arch:AVX, gcc and clang need the target attribute
+#if defined( SNOW_CULL_X64 ) && ! defined( _MSC_VER )
+#define SNOW_TARGET_AVX __attribute__( ( target( "avx" ) ) )
+#else
+#define SNOW_TARGET_AVX
+#endif
+
+
+namespace
+{
+    // per-plane coefficients and the box corner furthest along the plane normal
+    struct plane_setup
+    {
+        float coefs[4];
+        const float* corner[3];
+    };
+
+    void setup_planes( const frustum& f, const aabb_soa& boxes, plane_setup ( &setup )[frustum::Count] ) noexcept
+    {
+        for ( size_t plane_idx = 0; plane_idx < frustum::Count; ++plane_idx )
+        {
+            const auto& plane = f.planes[plane_idx];
+            for ( size_t i = 0; i < 4; ++i )
+                setup[plane_idx].coefs[i] = plane[i];
+            for ( size_t i = 0; i < 3; ++i )
+                setup[plane_idx].corner[i] = boxes.column( aabb_soa::Column( ( plane[i] >= 0 ? aabb_soa::MaxX : aabb_soa::MinX ) + i ) );
+        }
+    }
+
+    bool is_visible_scalar( const plane_setup ( &setup )[frustum::Count], size_t box_idx ) noexcept
+    {
+        for ( const plane_setup& plane : setup )
+        {
+            const float dist = plane.coefs[0] * plane.corner[0][box_idx]
+                               + plane.coefs[1] * plane.corner[1][box_idx]
+                               + plane.coefs[2] * plane.corner[2][box_idx]
+                               + plane.coefs[3];
+            if ( dist < 0 )
+                return false;
+        }
+        return true;
+    }
+
+    void set_bits( span<uint64_t> visibility, size_t bit_idx, uint64_t bits ) noexcept
+    {
+        // batches are 4 or 8 bits wide and start at a multiple of their width, so they never straddle words
+        visibility[bit_idx / 64] |= bits << ( bit_idx % 64 );
+    }
+
+    void cull_scalar( const plane_setup ( &setup )[frustum::Count], size_t first, size_t begin, size_t count, span<uint64_t> visibility ) noexcept
+    {
+        for ( size_t i = begin; i < count; ++i )
+            if ( is_visible_scalar( setup, first + i ) )
+                set_bits( visibility, i, 1 );
+    }
+
+#ifdef SNOW_CULL_X64
+    size_t cull_sse( const plane_setup ( &setup )[frustum::Count], size_t first, size_t count, span<uint64_t> visibility ) noexcept
+    {
+        const __m128 zero = _mm_setzero_ps();
+        size_t i = 0;
+        for ( ; i + 4 <= count; i += 4 )
+        {
+            __m128 outside = zero;
+            for ( const plane_setup& plane : setup )
+            {
+                const size_t box_idx = first + i;
+                __m128 dist = _mm_mul_ps( _mm_set1_ps( plane.coefs[0] ), _mm_loadu_ps( plane.corner[0] + box_idx ) );
+                dist = _mm_add_ps( dist, _mm_mul_ps( _mm_set1_ps( plane.coefs[1] ), _mm_loadu_ps( plane.corner[1] + box_idx ) ) );
+                dist = _mm_add_ps( dist, _mm_mul_ps( _mm_set1_ps( plane.coefs[2] ), _mm_loadu_ps( plane.corner[2] + box_idx ) ) );
+                dist = _mm_add_ps( dist, _mm_set1_ps( plane.coefs[3] ) );
+                outside = _mm_or_ps( outside, _mm_cmplt_ps( dist, zero ) );
+            }
+            set_bits( visibility, i, uint64_t( ~_mm_movemask_ps( outside ) & 0xf ) );
+        }
+        return i;
+    }
+
+    SNOW_TARGET_AVX
+    size_t cull_avx( const plane_setup ( &setup )[frustum::Count], size_t first, size_t count, span<uint64_t> visibility ) noexcept
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        size_t i = 0;
+        for ( ; i + 8 <= count; i += 8 )
+        {
+            __m256 outside = zero;
+            for ( const plane_setup& plane : setup )
+            {
+                const size_t box_idx = first + i;
+                __m256 dist = _mm256_mul_ps( _mm256_set1_ps( plane.coefs[0] ), _mm256_loadu_ps( plane.corner[0] + box_idx ) );
+                dist = _mm256_add_ps( dist, _mm256_mul_ps( _mm256_set1_ps( plane.coefs[1] ), _mm256_loadu_ps( plane.corner[1] + box_idx ) ) );
+                dist = _mm256_add_ps( dist, _mm256_mul_ps( _mm256_set1_ps( plane.coefs[2] ), _mm256_loadu_ps( plane.corner[2] + box_idx ) ) );
+                dist = _mm256_add_ps( dist, _mm256_set1_ps( plane.coefs[3] ) );
+                outside = _mm256_or_ps( outside, _mm256_cmp_ps( dist, zero, _CMP_LT_OQ ) );
+            }
+            set_bits( visibility, i, uint64_t( ~_mm256_movemask_ps( outside ) & 0xff ) );
+        }
+        return i;
+    }
+
+    bool cpu_has_avx() noexcept
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid( info, 1 );
+        const bool has_osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+        const bool has_avx = ( info[2] & ( 1 << 28 ) ) != 0;
+        // the os must save ymm registers on context switches
+        return has_osxsave && has_avx && ( _xgetbv( 0 ) & 6 ) == 6;
+#else
+        return __builtin_cpu_supports( "avx" );
+#endif
+    }
+#endif
+}
+
+
+cull_isa best_cull_isa() noexcept
+{
+#ifdef SNOW_CULL_X64
+    // sse2 is a part of x64
+    static const cull_isa isa = cpu_has_avx() ? cull_isa::avx : cull_isa::sse;
+    return isa;
+#else
+    return cull_isa::scalar;
+#endif
+}
+
+
+void frustum_cull( const frustum& f, const aabb_soa& boxes, size_t first, size_t count, span<uint64_t> visibility, cull_isa isa ) noexcept
+{
+    assert( first + count <= boxes.size() );
+    assert( visibility.size() >= ( count + 63 ) / 64 );
+
+    std::fill( visibility.begin(), visibility.begin() + ( count + 63 ) / 64, 0 );
+
+    plane_setup setup[frustum::Count];
+    setup_planes( f, boxes, setup );
+
+    size_t ndone = 0;
+#ifdef SNOW_CULL_X64
+    if ( isa == cull_isa::avx )
+        ndone = cull_avx( setup, first, count, visibility );
+    else if ( isa == cull_isa::sse )
+        ndone = cull_sse( setup, first, count, visibility );
+#else
+    ( void )isa;
+#endif
+    // the tail which doesn't fill a whole batch
+    cull_scalar( setup, first, ndone, count, visibility );
+}
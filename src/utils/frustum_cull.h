@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "span.h"
+#include "bounds.h"
+
+// batched frustum test over boxes in SoA layout
+// simd variants test 4 (sse) or 8 (avx) boxes per iteration and give exactly the same results as intersects( f, box ),
+// they evaluate the plane distances in the same order and never fuse multiplies with adds
+
+enum class cull_isa
+{
+    scalar,
+    sse,
+    avx
+};
+
+// the widest variant this cpu and os support, detected once
+cull_isa best_cull_isa() noexcept;
+
+// sets bit i of visibility if boxes[first + i] intersects the frustum, for i in [0, count)
+// visibility must have room for ( count + 63 ) / 64 words, bits past count are set to 0
+// isa must be supported by the cpu
+void frustum_cull( const frustum& f, const aabb_soa& boxes, size_t first, size_t count, span<uint64_t> visibility,
+                   cull_isa isa = best_cull_isa() ) noexcept;
@@ -0,0 +1,128 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "linear_allocator.h"
+
+#include <utility>
+
+
+linear_allocator::linear_allocator( size_t initial_size, std::pmr::memory_resource* upstream ) noexcept
+    : m_upstream( upstream ), m_next_chunk_size( std::max<size_t>( initial_size, sizeof( chunk_header ) ) )
+{
+    assert( m_upstream != nullptr );
+}
+
+
+linear_allocator::linear_allocator( linear_allocator&& other ) noexcept
+    : m_upstream( other.m_upstream )
+    , m_head( std::exchange( other.m_head, nullptr ) )
+    , m_cur( std::exchange( other.m_cur, nullptr ) )
+    , m_end( std::exchange( other.m_end, nullptr ) )
+    , m_capacity( std::exchange( other.m_capacity, 0 ) )
+    , m_next_chunk_size( other.m_next_chunk_size )
+    , m_allocation_count( std::exchange( other.m_allocation_count, 0 ) )
+    , m_bytes_allocated( std::exchange( other.m_bytes_allocated, 0 ) )
+    , m_upstream_allocation_count( other.m_upstream_allocation_count )
+{
+}
+
+
+linear_allocator::~linear_allocator()
+{
+    release_chunks();
+}
+
+
+void linear_allocator::reset() noexcept
+{
+    m_allocation_count = 0;
+    m_bytes_allocated = 0;
+
+    if ( ! m_head )
+        return;
+
+    if ( m_head->prev )
+    {
+        // coalesce the chain, next frame will most likely need the same amount of memory
+        const size_t total_size = m_capacity;
+        release_chunks();
+        m_next_chunk_size = total_size;
+        add_chunk( 0 );
+        return;
+    }
+
+    m_cur = reinterpret_cast<char*>( m_head + 1 );
+}
+
+
+void* linear_allocator::do_allocate( size_t bytes, size_t alignment )
+{
+    assert( alignment > 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+
+    auto align_cur = [&]() -> char*
+    {
+        const uintptr_t cur = reinterpret_cast<uintptr_t>( m_cur );
+        return reinterpret_cast<char*>( ( cur + alignment - 1 ) & ~uintptr_t( alignment - 1 ) );
+    };
+
+    char* res = m_head ? align_cur() : nullptr;
+    if ( ! m_head || res > m_end || size_t( m_end - res ) < bytes )
+    {
+        add_chunk( bytes + alignment );
+        res = align_cur();
+    }
+
+    m_cur = res + bytes;
+    m_allocation_count++;
+    m_bytes_allocated += bytes;
+
+    return res;
+}
+
+
+void linear_allocator::do_deallocate( void* /*p*/, size_t /*bytes*/, size_t /*alignment*/ )
+{
+    // memory is reclaimed in reset()
+}
+
+
+bool linear_allocator::do_is_equal( const std::pmr::memory_resource& other ) const noexcept
+{
+    return this == &other;
+}
+
+
+void linear_allocator::add_chunk( size_t min_payload_size )
+{
+    const size_t chunk_size = std::max( m_next_chunk_size, min_payload_size + sizeof( chunk_header ) );
+
+    void* mem = m_upstream->allocate( chunk_size, alignof( chunk_header ) );
+    m_upstream_allocation_count++;
+
+    chunk_header* chunk = static_cast<chunk_header*>( mem );
+    chunk->prev = m_head;
+    chunk->size = chunk_size;
+    m_head = chunk;
+
+    m_cur = reinterpret_cast<char*>( chunk + 1 );
+    m_end = static_cast<char*>( mem ) + chunk_size;
+
+    m_capacity += chunk_size;
+    m_next_chunk_size = chunk_size * 2;
+}
+
+
+void linear_allocator::release_chunks() noexcept
+{
+    while ( m_head )
+    {
+        chunk_header* prev = m_head->prev;
+        m_upstream->deallocate( m_head, m_head->size, alignof( chunk_header ) );
+        m_head = prev;
+    }
+    m_cur = nullptr;
+    m_end = nullptr;
+    m_capacity = 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory_resource>
+
+// linear (bump) allocator for per-frame scratch memory
+// allocations are carved sequentially from a chunk requested from the upstream resource,
+// when the chunk runs out a new, larger one is chained. deallocate() does nothing, all memory is reclaimed at once by reset()
+// reset() merges the chain into one chunk big enough for everything allocated before, so after a few frames
+// the allocator stops touching the upstream resource at all
+//
+// can be plugged into std::pmr containers, e.g. std::pmr::vector<T> vec( &allocator );
+// containers using the allocator must not outlive the next reset()
+// no thread safety
+
+class linear_allocator : public std::pmr::memory_resource
+{
+public:
+    explicit linear_allocator( size_t initial_size = 64 * 1024,
+                               std::pmr::memory_resource* upstream = std::pmr::get_default_resource() ) noexcept;
+    ~linear_allocator() override;
+
+    linear_allocator( const linear_allocator& ) = delete;
+    linear_allocator& operator=( const linear_allocator& ) = delete;
+    // containers already using other keep pointing to it, so move only allocators with nothing allocated from them
+    linear_allocator( linear_allocator&& other ) noexcept;
+
+    // invalidates all memory given out since the previous reset
+    void reset() noexcept;
+
+    // since the last reset
+    size_t allocation_count() const noexcept { return m_allocation_count; }
+    size_t bytes_allocated() const noexcept { return m_bytes_allocated; }
+
+    // total size of all chained chunks
+    size_t capacity() const noexcept { return m_capacity; }
+    // number of requests to the upstream resource over the lifetime of the allocator
+    size_t upstream_allocation_count() const noexcept { return m_upstream_allocation_count; }
+
+private:
+    struct chunk_header
+    {
+        chunk_header* prev;
+        size_t size; // including header
+    };
+
+    void* do_allocate( size_t bytes, size_t alignment ) override;
+    void do_deallocate( void* p, size_t bytes, size_t alignment ) override;
+    bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override;
+
+    void add_chunk( size_t min_payload_size );
+    void release_chunks() noexcept;
+
+    std::pmr::memory_resource* m_upstream = nullptr;
+
+    chunk_header* m_head = nullptr;
+    char* m_cur = nullptr;
+    char* m_end = nullptr;
+
+    size_t m_capacity = 0;
+    size_t m_next_chunk_size = 0;
+
+    size_t m_allocation_count = 0;
+    size_t m_bytes_allocated = 0;
+    size_t m_upstream_allocation_count = 0;
+};
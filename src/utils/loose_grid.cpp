@@ -0,0 +1,204 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "loose_grid.h"
+
+
+
+void loose_grid::reset( float cell_size ) noexcept
+{
+    clear();
+    m_cell_size = cell_size;
+}
+
+
+void loose_grid::insert( uint32_t idx, const aabb& box )
+{
+    assert( ! contains( idx ) );
+
+    if ( idx >= m_items.size() )
+        m_items.resize( size_t( idx ) + 1 );
+
+    add_to_bucket( idx, is_oversized( box ) ? Oversized : find_or_add_cell( box ), box );
+    m_size++;
+}
+
+
+void loose_grid::move( uint32_t idx, const aabb& box )
+{
+    assert( contains( idx ) );
+
+    const item cur = m_items[idx];
+    const bool is_in_place = is_oversized( box ) ? cur.cell == Oversized
+                                                 : cur.cell != Oversized && m_cells[cur.cell].key == make_key( cell_coords( box.center() ) );
+    if ( is_in_place )
+    {
+        get_bucket( cur.cell ).boxes[cur.slot] = box;
+        return;
+    }
+
+    remove_from_bucket( idx );
+    add_to_bucket( idx, is_oversized( box ) ? Oversized : find_or_add_cell( box ), box );
+}
+
+
+void loose_grid::remove( uint32_t idx ) noexcept
+{
+    if ( ! contains( idx ) )
+        return;
+
+    remove_from_bucket( idx );
+    m_size--;
+}
+
+
+void loose_grid::clear() noexcept
+{
+    m_size = 0;
+    m_items.clear();
+    m_cells.clear();
+    m_cell_lookup.clear();
+    m_oversized.indices.clear();
+    m_oversized.boxes.clear();
+}
+
+
+const aabb& loose_grid::box( uint32_t idx ) const noexcept
+{
+    assert( contains( idx ) );
+    const item& cur = m_items[idx];
+    return get_bucket( cur.cell ).boxes[cur.slot];
+}
+
+
+void loose_grid::cull( span<const frustum> views, span<uint8_t> view_masks ) const noexcept
+{
+    assert( views.size() <= MaxViews );
+    assert( view_masks.size() >= m_items.size() );
+
+    auto cull_bucket = [&]( const bucket& b, uint32_t view_mask )
+    {
+        for ( size_t i = 0; i < b.indices.size(); ++i )
+        {
+            uint8_t box_mask = 0;
+            for ( uint32_t view_idx = 0; view_idx < views.size(); ++view_idx )
+                if ( ( view_mask & ( 1u << view_idx ) ) && intersects( views[view_idx], b.boxes[i] ) )
+                    box_mask |= uint8_t( 1u << view_idx );
+            view_masks[b.indices[i]] |= box_mask;
+        }
+    };
+
+    // boxes of a cell are tested only against the views its loose box intersects
+    for ( const cell& c : m_cells )
+    {
+        uint32_t view_mask = 0;
+        for ( uint32_t view_idx = 0; view_idx < views.size(); ++view_idx )
+            if ( intersects( views[view_idx], c.loose_box ) )
+                view_mask |= 1u << view_idx;
+
+        if ( view_mask != 0 )
+            cull_bucket( c, view_mask );
+    }
+
+    cull_bucket( m_oversized, ( 1u << views.size() ) - 1 );
+}
+
+
+bool loose_grid::is_oversized( const aabb& box ) const noexcept
+{
+    const auto center = box.center();
+    for ( size_t axis = 0; axis < 3; ++axis )
+    {
+        if ( ! ( box.max[axis] - center[axis] <= m_cell_size ) )
+            return true;
+        if ( ! ( std::abs( center[axis] ) < MaxCoord * m_cell_size ) )
+            return true;
+    }
+    return false;
+}
+
+
+std::array<int32_t, 3> loose_grid::cell_coords( const std::array<float, 3>& point ) const noexcept
+{
+    constexpr float max_coord = float( MaxCoord + 1 );
+
+    std::array<int32_t, 3> res;
+    for ( size_t axis = 0; axis < 3; ++axis )
+        res[axis] = int32_t( std::clamp( std::floor( point[axis] / m_cell_size ), -max_coord, max_coord ) );
+    return res;
+}
+
+
+uint64_t loose_grid::make_key( const std::array<int32_t, 3>& coords ) noexcept
+{
+    constexpr int32_t bias = 1 << 20;
+
+    uint64_t res = 0;
+    for ( int32_t coord : coords )
+    {
+        assert( coord + bias >= 0 && coord + bias < 2 * bias );
+        res = ( res << 21 ) | uint64_t( coord + bias );
+    }
+    return res;
+}
+
+
+uint32_t loose_grid::find_or_add_cell( const aabb& box )
+{
+    const auto coords = cell_coords( box.center() );
+    const auto [it, is_new] = m_cell_lookup.try_emplace( make_key( coords ), uint32_t( m_cells.size() ) );
+    if ( ! is_new )
+        return it->second;
+
+    cell& new_cell = m_cells.emplace_back();
+    new_cell.key = it->first;
+    for ( size_t axis = 0; axis < 3; ++axis )
+    {
+        new_cell.loose_box.min[axis] = ( coords[axis] - 1 ) * m_cell_size;
+        new_cell.loose_box.max[axis] = ( coords[axis] + 2 ) * m_cell_size;
+    }
+    return it->second;
+}
+
+
+void loose_grid::add_to_bucket( uint32_t idx, uint32_t cell_idx, const aabb& box )
+{
+    bucket& b = get_bucket( cell_idx );
+    m_items[idx] = item{ cell_idx, uint32_t( b.indices.size() ) };
+    b.indices.push_back( idx );
+    b.boxes.push_back( box );
+}
+
+
+void loose_grid::remove_from_bucket( uint32_t idx ) noexcept
+{
+    const item cur = m_items[idx];
+    m_items[idx] = item();
+
+    // the last box of the bucket takes the freed slot
+    bucket& b = get_bucket( cur.cell );
+    if ( cur.slot + 1 != b.indices.size() )
+    {
+        b.indices[cur.slot] = b.indices.back();
+        b.boxes[cur.slot] = b.boxes.back();
+        m_items[b.indices[cur.slot]].slot = cur.slot;
+    }
+    b.indices.pop_back();
+    b.boxes.pop_back();
+
+    if ( cur.cell == Oversized || ! b.indices.empty() )
+        return;
+
+    // empty cells are dropped, the last cell takes the place of the removed one
+    m_cell_lookup.erase( m_cells[cur.cell].key );
+    if ( cur.cell + 1 != m_cells.size() )
+    {
+        m_cells[cur.cell] = std::move( m_cells.back() );
+        m_cell_lookup[m_cells[cur.cell].key] = cur.cell;
+        for ( uint32_t moved_idx : m_cells[cur.cell].indices )
+            m_items[moved_idx].cell = cur.cell;
+    }
+    m_cells.pop_back();
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "span.h"
+#include "bounds.h"
+
+// loose uniform grid over boxes which move every frame, the counterpart of bvh for dynamic objects
+// a box lives in the cell containing its center, and a cell reaches cell_size beyond its borders, so any box with
+// extents up to cell_size fits into its cell. Larger boxes are kept in a separate list tested by every query.
+// Moving a box is O(1): it is only rewritten in place, or swapped out of its cell into another one
+// cells are hashed by their coordinates and exist only while they hold boxes, so the world has no fixed size
+// all const methods are thread-safe, no thread safety on any non-const method
+
+class loose_grid
+{
+public:
+    explicit loose_grid( float cell_size = 16.0f ) noexcept : m_cell_size( cell_size ) {}
+
+    // removes every box
+    void reset( float cell_size ) noexcept;
+    float cell_size() const noexcept { return m_cell_size; }
+
+    // idx is chosen by the caller, e.g. a packed instance index, and must not be in the grid
+    void insert( uint32_t idx, const aabb& box );
+    // idx must be in the grid
+    void move( uint32_t idx, const aabb& box );
+    void remove( uint32_t idx ) noexcept;
+    void clear() noexcept;
+
+    bool contains( uint32_t idx ) const noexcept { return idx < m_items.size() && m_items[idx].cell != Absent; }
+    const aabb& box( uint32_t idx ) const noexcept;
+    // number of boxes
+    size_t size() const noexcept { return m_size; }
+    size_t cell_count() const noexcept { return m_cells.size(); }
+    // boxes too large for any cell or too far from the origin
+    size_t oversized_count() const noexcept { return m_oversized.indices.size(); }
+
+    // calls fn( idx ) for every box intersecting the volume, in unspecified order
+    template<typename Fn>
+    void query( const aabb& volume, Fn&& fn ) const;
+    template<typename Fn>
+    void query( const sphere& volume, Fn&& fn ) const;
+    // same contract as bvh::raycast, except that boxes come in no particular order
+    template<typename Fn>
+    void raycast( const ray& r, Fn&& fn ) const;
+    // reports exactly the boxes for which intersects( f, box ) is true
+    template<typename Fn>
+    void cull( const frustum& f, Fn&& fn ) const;
+
+    static constexpr uint32_t MaxViews = 8;
+
+    // same as bvh::cull for several views, sets bit i of view_masks[idx] if intersects( views[i], box( idx ) ) is true
+    // view_masks has an entry for every index in the grid
+    void cull( span<const frustum> views, span<uint8_t> view_masks ) const noexcept;
+
+private:
+    static constexpr uint32_t Absent = ~0u;
+    static constexpr uint32_t Oversized = Absent - 1;
+
+    // cell coordinates of boxes stay within +-MaxCoord, farther boxes are treated as oversized.
+    // Queries clamp coordinates just past it, so a key packs all three into 21 bits each
+    static constexpr int32_t MaxCoord = ( 1 << 20 ) - 4;
+
+    struct bucket
+    {
+        std::vector<uint32_t> indices;
+        std::vector<aabb> boxes;
+    };
+
+    struct cell : bucket
+    {
+        uint64_t key;
+        aabb loose_box; // cell bounds grown by cell_size on every side
+    };
+
+    struct item
+    {
+        uint32_t cell = Absent; // index in m_cells, Oversized or Absent
+        uint32_t slot = 0; // position in the bucket
+    };
+
+    bool is_oversized( const aabb& box ) const noexcept;
+    // clamped to +-( MaxCoord + 1 )
+    std::array<int32_t, 3> cell_coords( const std::array<float, 3>& point ) const noexcept;
+    static uint64_t make_key( const std::array<int32_t, 3>& coords ) noexcept;
+
+    // cell which takes the box, created if needed
+    uint32_t find_or_add_cell( const aabb& box );
+    void add_to_bucket( uint32_t idx, uint32_t cell_idx, const aabb& box );
+    void remove_from_bucket( uint32_t idx ) noexcept;
+
+    bucket& get_bucket( uint32_t cell_idx ) noexcept { return cell_idx == Oversized ? m_oversized : m_cells[cell_idx]; }
+    const bucket& get_bucket( uint32_t cell_idx ) const noexcept { return cell_idx == Oversized ? m_oversized : m_cells[cell_idx]; }
+
+    // calls fn( cell ) for the cells whose loose box may intersect volume_box, looks them up by coordinates
+    // if the volume covers fewer cells than there are, otherwise walks every cell
+    template<typename Fn>
+    void for_each_cell_near( const aabb& volume_box, Fn&& fn ) const;
+
+    template<typename Test, typename Fn>
+    void query_if( const aabb& volume_box, const Test& test, Fn& fn ) const;
+
+    float m_cell_size;
+    size_t m_size = 0;
+    std::vector<item> m_items; // by idx
+    std::vector<cell> m_cells;
+    std::unordered_map<uint64_t, uint32_t> m_cell_lookup; // key to index in m_cells
+    bucket m_oversized;
+};
+
+
+template<typename Fn>
+void loose_grid::query( const aabb& volume, Fn&& fn ) const
+{
+    query_if( volume, [&volume]( const aabb& box ) { return intersects( volume, box ); }, fn );
+}
+
+
+template<typename Fn>
+void loose_grid::query( const sphere& volume, Fn&& fn ) const
+{
+    const aabb volume_box = aabb::from_center_extents( volume.center, { volume.radius, volume.radius, volume.radius } );
+    query_if( volume_box, [&volume]( const aabb& box ) { return intersects( volume, box ); }, fn );
+}
+
+
+template<typename Fn>
+void loose_grid::cull( const frustum& f, Fn&& fn ) const
+{
+    auto cull_bucket = [&]( const bucket& b )
+    {
+        for ( size_t i = 0; i < b.indices.size(); ++i )
+            if ( intersects( f, b.boxes[i] ) )
+                fn( b.indices[i] );
+    };
+
+    for ( const cell& c : m_cells )
+        if ( intersects( f, c.loose_box ) )
+            cull_bucket( c );
+
+    cull_bucket( m_oversized );
+}
+
+
+template<typename Fn>
+void loose_grid::raycast( const ray& r, Fn&& fn ) const
+{
+    const auto inv_dir = inverse_dir( r );
+    float t_max = r.t_max;
+    auto distance = [&]( const aabb& box ) { return ray_distance( ray{ r.origin, r.dir, t_max }, inv_dir, box ); };
+
+    // returns false once fn stopped the search
+    auto raycast_bucket = [&]( const bucket& b )
+    {
+        for ( size_t i = 0; i < b.indices.size(); ++i )
+        {
+            const float t = distance( b.boxes[i] );
+            if ( t < 0 )
+                continue;
+
+            t_max = std::min( t_max, fn( b.indices[i], t ) );
+            if ( t_max < 0 )
+                return false;
+        }
+        return true;
+    };
+
+    for ( const cell& c : m_cells )
+        if ( distance( c.loose_box ) >= 0 && ! raycast_bucket( c ) )
+            return;
+
+    raycast_bucket( m_oversized );
+}
+
+
+template<typename Fn>
+void loose_grid::for_each_cell_near( const aabb& volume_box, Fn&& fn ) const
+{
+    // a cell reaches one cell beyond its borders, so cells next to the covered ones may hold intersecting boxes too
+    const auto min_coords = cell_coords( volume_box.min );
+    const auto max_coords = cell_coords( volume_box.max );
+    uint64_t ncovered = 1;
+    for ( size_t axis = 0; axis < 3; ++axis )
+        ncovered *= uint64_t( max_coords[axis] - min_coords[axis] + 3 );
+
+    if ( ncovered > m_cells.size() )
+    {
+        for ( const cell& c : m_cells )
+            if ( intersects( volume_box, c.loose_box ) )
+                fn( c );
+        return;
+    }
+
+    std::array<int32_t, 3> coords;
+    for ( coords[0] = min_coords[0] - 1; coords[0] <= max_coords[0] + 1; ++coords[0] )
+        for ( coords[1] = min_coords[1] - 1; coords[1] <= max_coords[1] + 1; ++coords[1] )
+            for ( coords[2] = min_coords[2] - 1; coords[2] <= max_coords[2] + 1; ++coords[2] )
+            {
+                const auto it = m_cell_lookup.find( make_key( coords ) );
+                if ( it != m_cell_lookup.end() )
+                    fn( m_cells[it->second] );
+            }
+}
+
+
+template<typename Test, typename Fn>
+void loose_grid::query_if( const aabb& volume_box, const Test& test, Fn& fn ) const
+{
+    auto query_bucket = [&]( const bucket& b )
+    {
+        for ( size_t i = 0; i < b.indices.size(); ++i )
+            if ( test( b.boxes[i] ) )
+                fn( b.indices[i] );
+    };
+
+    for_each_cell_near( volume_box, query_bucket );
+    query_bucket( m_oversized );
+}
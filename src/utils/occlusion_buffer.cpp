@@ -0,0 +1,319 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "occlusion_buffer.h"
+
+#if defined( _M_X64 ) || defined( __x86_64__ )
+#define SNOW_OCCLUSION_SSE
+#include <emmintrin.h>
+#endif
+
+
+namespace
+{
+    // rows rasterized by one task
+    constexpr int32_t RowsPerBand = 8;
+
+    std::array<float, 4> to_clip( const float* p, const float ( &m )[4][4] ) noexcept
+    {
+        std::array<float, 4> res;
+        for ( size_t j = 0; j < 4; ++j )
+            res[j] = p[0] * m[0][j] + p[1] * m[1][j] + p[2] * m[2][j] + m[3][j];
+        return res;
+    }
+
+    void multiply( const float ( &lhs )[4][4], const float ( &rhs )[4][4], float ( &res )[4][4] ) noexcept
+    {
+        for ( size_t i = 0; i < 4; ++i )
+            for ( size_t j = 0; j < 4; ++j )
+                res[i][j] = lhs[i][0] * rhs[0][j] + lhs[i][1] * rhs[1][j] + lhs[i][2] * rhs[2][j] + lhs[i][3] * rhs[3][j];
+    }
+
+    // first and last pixel whose center lies in [lo, hi], clamped to [0, size)
+    std::pair<int32_t, int32_t> covered_pixels( float lo, float hi, uint32_t size ) noexcept
+    {
+        const float limit = float( size );
+        const int32_t first = int32_t( std::ceil( std::clamp( lo - 0.5f, -1.0f, limit ) ) );
+        const int32_t last = int32_t( std::floor( std::clamp( hi - 0.5f, -1.0f, limit ) ) );
+        return { std::max( first, 0 ), std::min( last, int32_t( size ) - 1 ) };
+    }
+}
+
+
+void occlusion_buffer::resize( uint32_t width, uint32_t height )
+{
+    assert( width > 0 && height > 0 );
+
+    m_width = width;
+    m_height = height;
+
+    m_levels.clear();
+    for ( ;; )
+    {
+        level new_level;
+        new_level.width = width;
+        new_level.height = height;
+        new_level.stride = m_levels.empty() ? ( width + 3 ) & ~3u : width;
+        new_level.texels.assign( size_t( new_level.stride ) * height, 1.0f );
+        m_levels.push_back( std::move( new_level ) );
+
+        if ( width == 1 && height == 1 )
+            break;
+        width = ( width + 1 ) / 2;
+        height = ( height + 1 ) / 2;
+    }
+}
+
+
+size_t occlusion_buffer::rasterize( const float ( &view_proj )[4][4], span<const occluder> occluders, worker_pool& pool )
+{
+    assert( ! m_levels.empty() );
+
+    std::copy( &view_proj[0][0], &view_proj[0][0] + 16, &m_view_proj[0][0] );
+
+    if ( m_triangles.size() < occluders.size() )
+        m_triangles.resize( occluders.size() );
+    pool.run( occluders.size(), [&]( size_t occluder_idx )
+    {
+        setup_triangles( occluders[occluder_idx], m_triangles[occluder_idx] );
+    } );
+
+    // bin triangles by the bands they touch, in occluder order
+    const size_t nbands = ( m_height + RowsPerBand - 1 ) / RowsPerBand;
+    m_band_triangles.resize( nbands );
+    for ( auto& band_triangles : m_band_triangles )
+        band_triangles.clear();
+    for ( size_t occluder_idx = 0; occluder_idx < occluders.size(); ++occluder_idx )
+        for ( const triangle& tri : m_triangles[occluder_idx] )
+            for ( int32_t band_idx = tri.min_y / RowsPerBand; band_idx <= tri.max_y / RowsPerBand; ++band_idx )
+                m_band_triangles[band_idx].push_back( &tri );
+
+    // bands don't share pixels, and the depth test is order-independent
+    pool.run( nbands, [&]( size_t band_idx )
+    {
+        const int32_t first_row = int32_t( band_idx ) * RowsPerBand;
+        const int32_t last_row = std::min( first_row + RowsPerBand, int32_t( m_height ) ) - 1;
+
+        level& buffer = m_levels[0];
+        std::fill( buffer.texels.begin() + size_t( first_row ) * buffer.stride,
+                   buffer.texels.begin() + size_t( last_row + 1 ) * buffer.stride, 1.0f );
+
+        for ( const triangle* tri : m_band_triangles[band_idx] )
+            rasterize_rows( *tri, std::max( first_row, tri->min_y ), std::min( last_row, tri->max_y ) );
+    } );
+
+    build_pyramid();
+
+    size_t ntriangles = 0;
+    for ( size_t occluder_idx = 0; occluder_idx < occluders.size(); ++occluder_idx )
+        ntriangles += m_triangles[occluder_idx].size();
+    return ntriangles;
+}
+
+
+bool occlusion_buffer::is_occluded( const aabb& box ) const noexcept
+{
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    float min_x = inf, min_y = inf, min_z = inf;
+    float max_x = -inf, max_y = -inf;
+    for ( uint32_t corner = 0; corner < 8; ++corner )
+    {
+        const float p[3] = { ( corner & 1 ) ? box.max[0] : box.min[0],
+                             ( corner & 2 ) ? box.max[1] : box.min[1],
+                             ( corner & 4 ) ? box.max[2] : box.min[2] };
+        const auto clip = to_clip( p, m_view_proj );
+        if ( ! ( clip[3] > 0 ) || clip[2] < 0 )
+            return false;
+
+        const float inv_w = 1.0f / clip[3];
+        min_x = std::min( min_x, clip[0] * inv_w );
+        max_x = std::max( max_x, clip[0] * inv_w );
+        min_y = std::min( min_y, clip[1] * inv_w );
+        max_y = std::max( max_y, clip[1] * inv_w );
+        min_z = std::min( min_z, clip[2] * inv_w );
+    }
+
+    // ndc to pixels, y points down
+    const float left = ( min_x + 1.0f ) * 0.5f * m_width;
+    const float right = ( max_x + 1.0f ) * 0.5f * m_width;
+    const float top = ( 1.0f - max_y ) * 0.5f * m_height;
+    const float bottom = ( 1.0f - min_y ) * 0.5f * m_height;
+    if ( right < 0 || left >= m_width || bottom < 0 || top >= m_height )
+        return false;
+
+    // every pixel the rect touches
+    const uint32_t x0 = uint32_t( std::max( left, 0.0f ) );
+    const uint32_t x1 = uint32_t( std::min( right, float( m_width - 1 ) ) );
+    const uint32_t y0 = uint32_t( std::max( top, 0.0f ) );
+    const uint32_t y1 = uint32_t( std::min( bottom, float( m_height - 1 ) ) );
+
+    // the finest level where the rect covers at most 2x2 texels
+    uint32_t k = 0;
+    while ( k + 1 < m_levels.size() && ( ( x1 >> k ) - ( x0 >> k ) > 1 || ( y1 >> k ) - ( y0 >> k ) > 1 ) )
+        k++;
+
+    float max_depth = 0;
+    for ( uint32_t y = y0 >> k; y <= ( y1 >> k ); ++y )
+        for ( uint32_t x = x0 >> k; x <= ( x1 >> k ); ++x )
+            max_depth = std::max( max_depth, depth( k, x, y ) );
+
+    return min_z > max_depth;
+}
+
+
+void occlusion_buffer::setup_triangles( const occluder& mesh, std::vector<triangle>& triangles ) const
+{
+    triangles.clear();
+
+    float obj2clip[4][4];
+    multiply( mesh.obj2world, m_view_proj, obj2clip );
+
+    const float half_width = 0.5f * m_width;
+    const float half_height = 0.5f * m_height;
+
+    if ( mesh.indices.size() < 3 )
+        return;
+
+    // vertices are shared between triangles, so the referenced range is projected once
+    const auto [min_index, max_index] = std::minmax_element( mesh.indices.begin(), mesh.indices.end() );
+    struct screen_vertex
+    {
+        float x, y, z;
+        bool is_in_front; // of the near plane
+    };
+    std::vector<screen_vertex> vertices( size_t( *max_index - *min_index ) + 1 );
+    for ( size_t v = 0; v < vertices.size(); ++v )
+    {
+        const auto clip = to_clip( mesh.positions + ( *min_index + v ) * mesh.vertex_stride, obj2clip );
+        screen_vertex& res = vertices[v];
+        res.is_in_front = clip[3] > 0 && clip[2] >= 0;
+        if ( ! res.is_in_front )
+            continue;
+
+        const float inv_w = 1.0f / clip[3];
+        res.x = ( clip[0] * inv_w + 1.0f ) * half_width;
+        res.y = ( 1.0f - clip[1] * inv_w ) * half_height;
+        res.z = clip[2] * inv_w;
+    }
+
+    for ( size_t i = 0; i + 2 < mesh.indices.size(); i += 3 )
+    {
+        const screen_vertex* tri_vertices[3];
+        for ( size_t v = 0; v < 3; ++v )
+            tri_vertices[v] = &vertices[mesh.indices[i + v] - *min_index];
+        if ( ! ( tri_vertices[0]->is_in_front && tri_vertices[1]->is_in_front && tri_vertices[2]->is_in_front ) )
+            continue;
+
+        const float x[3] = { tri_vertices[0]->x, tri_vertices[1]->x, tri_vertices[2]->x };
+        const float y[3] = { tri_vertices[0]->y, tri_vertices[1]->y, tri_vertices[2]->y };
+        const float z[3] = { tri_vertices[0]->z, tri_vertices[1]->z, tri_vertices[2]->z };
+
+        triangle tri;
+        std::tie( tri.min_x, tri.max_x ) = covered_pixels( std::min( { x[0], x[1], x[2] } ), std::max( { x[0], x[1], x[2] } ), m_width );
+        std::tie( tri.min_y, tri.max_y ) = covered_pixels( std::min( { y[0], y[1], y[2] } ), std::max( { y[0], y[1], y[2] } ), m_height );
+        if ( tri.min_x > tri.max_x || tri.min_y > tri.max_y )
+            continue;
+
+        const float d1x = x[1] - x[0], d1y = y[1] - y[0], d1z = z[1] - z[0];
+        const float d2x = x[2] - x[0], d2y = y[2] - y[0], d2z = z[2] - z[0];
+        const float area = d1x * d2y - d2x * d1y;
+        if ( ! ( std::abs( area ) > 0 ) )
+            continue;
+
+        // edge a -> b is ( x - xa ) * ( yb - ya ) - ( y - ya ) * ( xb - xa ), which is -area at the opposite vertex
+        const float sign = area > 0 ? -1.0f : 1.0f;
+        for ( size_t e = 0; e < 3; ++e )
+        {
+            const size_t a = e;
+            const size_t b = ( e + 1 ) % 3;
+            tri.edges[e][0] = sign * ( y[b] - y[a] );
+            tri.edges[e][1] = sign * ( x[a] - x[b] );
+            tri.edges[e][2] = -( tri.edges[e][0] * x[a] + tri.edges[e][1] * y[a] );
+        }
+
+        tri.dzdx = ( d1z * d2y - d2z * d1y ) / area;
+        tri.dzdy = ( d2z * d1x - d1z * d2x ) / area;
+        // the plane is evaluated at pixel centers, the farthest pixel corner is half a pixel away along both axes
+        tri.z0 = z[0] - tri.dzdx * x[0] - tri.dzdy * y[0] + 0.5f * ( std::abs( tri.dzdx ) + std::abs( tri.dzdy ) );
+        tri.zmax = std::max( { z[0], z[1], z[2] } );
+
+        triangles.push_back( tri );
+    }
+}
+
+
+void occlusion_buffer::rasterize_rows( const triangle& tri, int32_t first_row, int32_t last_row ) noexcept
+{
+    level& buffer = m_levels[0];
+
+    for ( int32_t py = first_row; py <= last_row; ++py )
+    {
+        const float cy = float( py ) + 0.5f;
+        float row_edges[3];
+        for ( size_t e = 0; e < 3; ++e )
+            row_edges[e] = tri.edges[e][1] * cy + tri.edges[e][2];
+        const float row_z = tri.dzdy * cy + tri.z0;
+
+        float* row = buffer.texels.data() + size_t( py ) * buffer.stride;
+
+#ifdef SNOW_OCCLUSION_SSE
+        // 4 pixels at a time from an aligned column, rows are padded so the last group stays inside the row
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lane_offsets = _mm_setr_ps( 0, 1, 2, 3 );
+        for ( int32_t px = tri.min_x & ~3; px <= tri.max_x; px += 4 )
+        {
+            const __m128 cx = _mm_add_ps( _mm_set1_ps( float( px ) + 0.5f ), lane_offsets );
+
+            __m128 inside = _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tri.edges[0][0] ), cx ), _mm_set1_ps( row_edges[0] ) ), zero );
+            for ( size_t e = 1; e < 3; ++e )
+                inside = _mm_and_ps( inside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tri.edges[e][0] ), cx ), _mm_set1_ps( row_edges[e] ) ), zero ) );
+            if ( _mm_movemask_ps( inside ) == 0 )
+                continue;
+
+            const __m128 z = _mm_min_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( tri.dzdx ), cx ), _mm_set1_ps( row_z ) ), _mm_set1_ps( tri.zmax ) );
+            const __m128 old_z = _mm_loadu_ps( row + px );
+            const __m128 new_z = _mm_min_ps( old_z, z );
+            _mm_storeu_ps( row + px, _mm_or_ps( _mm_and_ps( inside, new_z ), _mm_andnot_ps( inside, old_z ) ) );
+        }
+#else
+        for ( int32_t px = tri.min_x; px <= tri.max_x; ++px )
+        {
+            const float cx = float( px ) + 0.5f;
+
+            bool inside = true;
+            for ( size_t e = 0; e < 3; ++e )
+                inside &= tri.edges[e][0] * cx + row_edges[e] >= 0;
+            if ( ! inside )
+                continue;
+
+            const float z = std::min( tri.dzdx * cx + row_z, tri.zmax );
+            row[px] = std::min( row[px], z );
+        }
+#endif
+    }
+}
+
+
+void occlusion_buffer::build_pyramid() noexcept
+{
+    for ( size_t k = 1; k < m_levels.size(); ++k )
+    {
+        const level& src = m_levels[k - 1];
+        level& dst = m_levels[k];
+        for ( uint32_t y = 0; y < dst.height; ++y )
+        {
+            const uint32_t src_y[2] = { 2 * y, std::min( 2 * y + 1, src.height - 1 ) };
+            for ( uint32_t x = 0; x < dst.width; ++x )
+            {
+                const uint32_t src_x[2] = { 2 * x, std::min( 2 * x + 1, src.width - 1 ) };
+                float max_depth = 0;
+                for ( uint32_t sy : src_y )
+                    for ( uint32_t sx : src_x )
+                        max_depth = std::max( max_depth, src.texels[sy * src.stride + sx] );
+                dst.texels[y * dst.stride + x] = max_depth;
+            }
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+#include "bounds.h"
+#include "worker_pool.h"
+
+// low resolution depth buffer for cpu occlusion culling
+// a few large occluders are rasterized into it, then a max-depth pyramid is built on top: a texel of level k holds the farthest
+// depth of the 2x2 texels below it, so a box whose nearest point is behind every texel under its screen rect is hidden
+// depth follows DirectX conventions, z / w of clip = p * view_proj is in [0, 1] and the buffer is cleared to 1
+//
+// occluders are rasterized at pixel centers, and each pixel takes the depth of the farthest point of the triangle plane
+// over the pixel, so the buffer never places an occluder closer than it is
+// coverage is not conservative though: a pixel whose center is inside a triangle counts as fully covered, so occluders grow
+// by up to half a pixel at their silhouettes and geometry peeking out from behind an edge by less than that may be culled.
+// Shrinking triangles to fully covered pixels would instead open gaps along edges shared inside a mesh
+// const methods are thread-safe
+
+class occlusion_buffer
+{
+public:
+    struct occluder
+    {
+        const float* positions = nullptr; // object-space x, y, z of vertex 0
+        size_t vertex_stride = 3; // distance between consecutive vertices, in floats
+        span<const uint32_t> indices; // triangle list
+        float obj2world[4][4];
+    };
+
+    void resize( uint32_t width, uint32_t height );
+    uint32_t width() const noexcept { return m_width; }
+    uint32_t height() const noexcept { return m_height; }
+
+    // clears the buffer, rasterizes occluders and rebuilds the pyramid
+    // triangles are set up per occluder and rasterized per band of rows, both on pool threads; the result doesn't depend on
+    // the number of threads. Triangles crossing the near plane are skipped, which only makes the buffer occlude less
+    // returns the number of rasterized triangles
+    size_t rasterize( const float ( &view_proj )[4][4], span<const occluder> occluders, worker_pool& pool = worker_pool::shared() );
+
+    // true if the world-space box is behind occluders everywhere it is on screen
+    // boxes crossing the near plane or lying off screen are never occluded
+    bool is_occluded( const aabb& box ) const noexcept;
+
+    // level 0 is the full resolution buffer, the last level is 1x1
+    uint32_t level_count() const noexcept { return uint32_t( m_levels.size() ); }
+    uint32_t level_width( uint32_t level ) const noexcept { return m_levels[level].width; }
+    uint32_t level_height( uint32_t level ) const noexcept { return m_levels[level].height; }
+    float depth( uint32_t level, uint32_t x, uint32_t y ) const noexcept { return m_levels[level].texels[y * m_levels[level].stride + x]; }
+
+private:
+    // screen-space triangle ready for rasterization
+    struct triangle
+    {
+        float edges[3][3]; // a * x + b * y + c >= 0 inside, for every edge
+        float z0, dzdx, dzdy; // depth plane z = z0 + dzdx * x + dzdy * y, pushed to the farthest corner of a pixel
+        float zmax;
+        int32_t min_x, max_x, min_y, max_y; // pixel bounds, inclusive
+    };
+
+    struct level
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t stride = 0; // level 0 rows are padded to a multiple of 4 pixels
+        std::vector<float> texels;
+    };
+
+    void setup_triangles( const occluder& mesh, std::vector<triangle>& triangles ) const;
+    void rasterize_rows( const triangle& tri, int32_t first_row, int32_t last_row ) noexcept;
+    void build_pyramid() noexcept;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    float m_view_proj[4][4] = {};
+
+    std::vector<level> m_levels;
+    std::vector<std::vector<triangle>> m_triangles; // per occluder, kept to reuse the storage
+    std::vector<std::vector<const triangle*>> m_band_triangles; // triangles touching every band of rows
+};
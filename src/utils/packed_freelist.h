@@ -2,8 +2,11 @@
 
 #include <vector>
 #include <optional>
+#include <numeric>
 
 #include "span.h"
+#include "freelist_id.h"
+#include "freelist_layout.h"
 
 // packed vector-based freelist, provides persistent ids for all its elements.
 // O(1) access by id (2 lookups in base_container)
@@ -18,15 +21,7 @@ template<typename T, template <typename ...> typename base_container = std::vect
 class packed_freelist
 {
 public:
-    struct alignas( 8 ) id
-    {
-        uint32_t idx;
-        uint32_t inner_id;
-        bool operator==( const id& rhs ) const noexcept { return this->idx == rhs.idx && this->inner_id == rhs.inner_id; }
-        bool operator!=( const id& rhs ) const noexcept { return this->idx != rhs.idx || this->inner_id != rhs.inner_id; }
-
-        static const id nullid;
-    };
+    using id = freelist_id<T>;
 
 
     bool has( id elem_id ) const noexcept;
@@ -35,6 +30,12 @@ public:
     template<typename ... Args>
     id emplace( Args&& ... args ) noexcept;
 
+    // bulk versions of insert and emplace, storage is reserved only once
+    // ids of new elements are written to ids_storage, which must have room for all of them. Returns the written part of ids_storage
+    span<id> insert_range( span<T> elems, span<id> ids_storage ) noexcept; // elems are moved from
+    template<typename ... Args>
+    span<id> emplace_n( size_t n, span<id> ids_storage, const Args& ... args ) noexcept; // every element is constructed from the same args
+
     // returns nullptr if elem does not exist
     T* try_get( id elem_id ) noexcept;
     const T* try_get( id elem_id ) const noexcept;
@@ -47,8 +48,13 @@ public:
     T& operator[]( id elem_id ) noexcept;
     const T& operator[]( id elem_id ) const noexcept;
 
+    // id of the element at packed_idx in get_elems()
+    id get_id( size_t packed_idx ) const noexcept;
+
     // does nothing if element does not exist
     void erase( id elem_id ) noexcept;
+    // same as erase() for each id in turn, nothing is batched
+    void erase_range( span<const id> ids ) noexcept;
     void clear() noexcept;
 
     // semanticaly the same as clear(), but also destroys slot counters for the nodes, so it will invalidate all previously given ids
@@ -77,6 +83,19 @@ public:
     span<T> get_elems() noexcept;
     span<const T> get_elems() const noexcept;
 
+    // physically reorders packed elements, ids stay valid. new2old[i] is the old packed index of the element placed at i,
+    // it must be a permutation of [0, size())
+    void reorder( span<const uint32_t> new2old ) noexcept;
+    // stable sort of packed elements by key_fn( const T& ), the key is computed once per element. ids stay valid
+    template<typename KeyFn>
+    void sort_packed( KeyFn&& key_fn );
+
+    // id bookkeeping for serialization, the spans are invalidated by the same methods as iterators
+    freelist_layout get_layout() const noexcept;
+    // replaces the contents with elems (moved from, in packed order) and ids from layout
+    // returns false and leaves the freelist unchanged if layout doesn't match elems
+    bool restore( const freelist_layout& layout, span<T> elems ) noexcept;
+
 private:
     struct freelist_elem
     {
@@ -94,8 +113,10 @@ private:
     static constexpr uint32_t FREE_END = std::numeric_limits<uint32_t>::max();
 
     id insert_elem_to_freelist( uint32_t packed_idx ) noexcept;
+    void reserve_for_insertion( size_t nelems ) noexcept;
 
     base_container<T> m_packed_data;
+    base_container<uint32_t> m_packed2slot; // reverse mapping, required to patch m_freelist when elements are moved inside m_packed_data
     base_container<freelist_elem> m_freelist;
     uint32_t m_free_head = FREE_END;
 };
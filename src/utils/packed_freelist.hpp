@@ -3,10 +3,8 @@
 #include "packed_freelist.h"
 
 #include <cassert>
-
-
-template<typename T, template <typename...> typename base_container>
-const typename packed_freelist<T, base_container>::id packed_freelist<T, base_container>::id::nullid = id{ std::numeric_limits<uint32_t>::max(), 0 };
+#include <cstring>
+#include <algorithm>
 
 
 template<typename T, template <typename...> typename base_container>
@@ -40,6 +38,44 @@ typename packed_freelist<T, base_container>::id packed_freelist<T, base_containe
 }
 
 
+template<typename T, template <typename...> typename base_container>
+span<typename packed_freelist<T, base_container>::id> packed_freelist<T, base_container>::insert_range( span<T> elems, span<id> ids_storage ) noexcept
+{
+    assert( ids_storage.size() >= elems.size() );
+
+    reserve_for_insertion( elems.size() );
+    for ( size_t i = 0; i < elems.size(); ++i )
+        ids_storage[i] = insert( std::move( elems[i] ) );
+
+    return span<id>( ids_storage.begin(), ids_storage.begin() + elems.size() );
+}
+
+
+template<typename T, template <typename...> typename base_container>
+template<typename ... Args>
+span<typename packed_freelist<T, base_container>::id> packed_freelist<T, base_container>::emplace_n( size_t n, span<id> ids_storage, const Args& ... args ) noexcept
+{
+    assert( ids_storage.size() >= n );
+
+    reserve_for_insertion( n );
+    for ( size_t i = 0; i < n; ++i )
+        ids_storage[i] = emplace( args... );
+
+    return span<id>( ids_storage.begin(), ids_storage.begin() + n );
+}
+
+
+template<typename T, template <typename...> typename base_container>
+void packed_freelist<T, base_container>::reserve_for_insertion( size_t nelems ) noexcept
+{
+    const size_t new_size = m_packed_data.size() + nelems;
+    m_packed_data.reserve( new_size );
+    m_packed2slot.reserve( new_size );
+    // free slots are reused first, freelist grows only by the rest
+    m_freelist.reserve( std::max( m_freelist.size(), new_size ) );
+}
+
+
 template<typename T, template <typename...> typename base_container>
 typename packed_freelist<T, base_container>::id packed_freelist<T, base_container>::insert_elem_to_freelist( uint32_t packed_idx ) noexcept
 {
@@ -58,6 +94,7 @@ typename packed_freelist<T, base_container>::id packed_freelist<T, base_containe
         m_free_head = new_elem.next_free;
         new_elem.packed_idx = packed_idx;
     }
+    m_packed2slot.push_back( new_id.idx );
 
     return new_id;
 }
@@ -120,22 +157,44 @@ void packed_freelist<T, base_container>::erase( id elem_id ) noexcept
     auto& freelist_elem = m_freelist[elem_id.idx];
     freelist_elem.slot_cnt++;
 
-    using std::swap; // include to adl
-    swap( m_packed_data.back(), m_packed_data[freelist_elem.packed_idx] );
+    const uint32_t packed_idx = freelist_elem.packed_idx;
+    const uint32_t last_idx = uint32_t( m_packed_data.size() ) - 1;
+    if ( packed_idx != last_idx )
+    {
+        using std::swap; // include to adl
+        swap( m_packed_data.back(), m_packed_data[packed_idx] );
+        // the element moved from the back must point to its new place
+        m_packed2slot[packed_idx] = m_packed2slot[last_idx];
+        m_freelist[m_packed2slot[packed_idx]].packed_idx = packed_idx;
+    }
     m_packed_data.pop_back();
+    m_packed2slot.pop_back();
 
     freelist_elem.next_free = uint32_t( m_free_head );
     m_free_head = elem_id.idx;
 }
 
 
+template<typename T, template <typename...> typename base_container>
+void packed_freelist<T, base_container>::erase_range( span<const id> ids ) noexcept
+{
+    for ( id elem_id : ids )
+        erase( elem_id );
+}
+
+
 template<typename T, template <typename...> typename base_container>
 void packed_freelist<T, base_container>::clear( ) noexcept
 {
     m_packed_data.clear();
+    m_packed2slot.clear();
+
+    if ( m_freelist.empty() )
+        return;
+
     m_freelist.back().next_free = FREE_END;
     m_freelist.back().slot_cnt++;
-    m_free_head = m_freelist.empty() ? FREE_END : 0;
+    m_free_head = 0;
     for ( uint32_t i = 0, end = uint32_t( m_freelist.size() ) - 1; i < end; ++i )
     {
         m_freelist[i].next_free = i + 1;
@@ -148,6 +207,7 @@ template<typename T, template <typename...> typename base_container>
 void packed_freelist<T, base_container>::destroy() noexcept
 {
     m_packed_data.clear();
+    m_packed2slot.clear();
     m_freelist.clear();
     m_free_head = FREE_END;
 }
@@ -171,6 +231,7 @@ template<typename T, template <typename...> typename base_container>
 void packed_freelist<T, base_container>::reserve( uint32_t nelems ) noexcept
 {
     m_packed_data.reserve( nelems );
+    m_packed2slot.reserve( nelems );
     m_freelist.reserve( nelems );
 }
 
@@ -179,6 +240,7 @@ template<typename T, template <typename...> typename base_container>
 void packed_freelist<T, base_container>::shrink_to_fit( ) noexcept
 {
     m_packed_data.shrink_to_fit();
+    m_packed2slot.shrink_to_fit();
     m_freelist.shrink_to_fit();
 }
 
@@ -237,3 +299,83 @@ span<const T> packed_freelist<T, base_container>::get_elems() const noexcept
 {
     return make_span( m_packed_data );
 }
+
+
+template<typename T, template <typename...> typename base_container>
+typename packed_freelist<T, base_container>::id packed_freelist<T, base_container>::get_id( size_t packed_idx ) const noexcept
+{
+    assert( packed_idx < m_packed2slot.size() );
+    const uint32_t slot = m_packed2slot[packed_idx];
+    return id{ slot, m_freelist[slot].slot_cnt };
+}
+
+
+template<typename T, template <typename...> typename base_container>
+freelist_layout packed_freelist<T, base_container>::get_layout() const noexcept
+{
+    static_assert( sizeof( freelist_elem ) == 2 * sizeof( uint32_t ), "freelist_layout expects 2 values per slot" );
+
+    const uint32_t* slots = reinterpret_cast<const uint32_t*>( m_freelist.data() );
+    return freelist_layout{ span<const uint32_t>( slots, slots + 2 * m_freelist.size() ), make_span( m_packed2slot ), m_free_head };
+}
+
+
+template<typename T, template <typename...> typename base_container>
+bool packed_freelist<T, base_container>::restore( const freelist_layout& layout, span<T> elems ) noexcept
+{
+    if ( ! layout.is_consistent( elems.size() ) )
+        return false;
+
+    m_freelist.resize( layout.slots.size() / 2 );
+    std::memcpy( m_freelist.data(), layout.slots.begin(), layout.slots.size() * sizeof( uint32_t ) );
+    m_packed2slot.assign( layout.packed2slot.begin(), layout.packed2slot.end() );
+    m_free_head = layout.free_head;
+
+    m_packed_data.clear();
+    m_packed_data.reserve( elems.size() );
+    for ( T& elem : elems )
+        m_packed_data.push_back( std::move( elem ) );
+
+    return true;
+}
+
+
+template<typename T, template <typename...> typename base_container>
+void packed_freelist<T, base_container>::reorder( span<const uint32_t> new2old ) noexcept
+{
+    assert( new2old.size() == m_packed_data.size() );
+
+    base_container<T> reordered_data;
+    reordered_data.reserve( m_packed_data.capacity() );
+    for ( uint32_t old_idx : new2old )
+        reordered_data.push_back( std::move( m_packed_data[old_idx] ) );
+    m_packed_data = std::move( reordered_data );
+
+    base_container<uint32_t> reordered_packed2slot;
+    reordered_packed2slot.reserve( m_packed2slot.capacity() );
+    for ( uint32_t old_idx : new2old )
+        reordered_packed2slot.push_back( m_packed2slot[old_idx] );
+    m_packed2slot = std::move( reordered_packed2slot );
+
+    for ( uint32_t packed_idx = 0; packed_idx < uint32_t( m_packed2slot.size() ); ++packed_idx )
+        m_freelist[m_packed2slot[packed_idx]].packed_idx = packed_idx;
+}
+
+
+template<typename T, template <typename...> typename base_container>
+template<typename KeyFn>
+void packed_freelist<T, base_container>::sort_packed( KeyFn&& key_fn )
+{
+    using key_type = std::decay_t<decltype( key_fn( std::declval<const T&>() ) )>;
+
+    std::vector<key_type> keys;
+    keys.reserve( m_packed_data.size() );
+    for ( const T& elem : m_packed_data )
+        keys.push_back( key_fn( elem ) );
+
+    std::vector<uint32_t> new2old( m_packed_data.size() );
+    std::iota( new2old.begin(), new2old.end(), 0 );
+    std::stable_sort( new2old.begin(), new2old.end(), [&keys]( uint32_t lhs, uint32_t rhs ) { return keys[lhs] < keys[rhs]; } );
+
+    reorder( make_span( new2old ) );
+}
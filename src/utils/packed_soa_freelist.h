@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <numeric>
+#include <algorithm>
+
+#include "span.h"
+#include "freelist_id.h"
+#include "freelist_layout.h"
+
+// structure-of-arrays variant of packed_freelist.
+// each field is stored in its own packed column, so a traversal over one field doesn't pull the other fields into cache
+// provides persistent ids for all its elements, ids have the same semantics as in packed_freelist
+// O(1) access by id (2 lookups)
+// all const methods are thread-safe
+// no thread safety on any non-const method
+//
+// fields must be movable
+// access by field type is allowed only if this type is unique among Fields
+// max 2^32 elems simultaneously in freelist
+
+template<typename ... Fields>
+class packed_soa_freelist
+{
+    static_assert( sizeof...( Fields ) > 0, "freelist must have at least one field" );
+
+public:
+    template<size_t I>
+    using field_type = std::tuple_element_t<I, std::tuple<Fields...>>;
+
+    // id is tagged with the first field
+    using id = freelist_id<field_type<0>>;
+
+    bool has( id elem_id ) const noexcept;
+
+    id insert( Fields ... fields ) noexcept;
+
+    // bulk version of insert, storage is reserved only once. Field spans must have the same size
+    // ids of new elements are written to ids_storage, which must have room for all of them. Returns the written part of ids_storage
+    span<id> insert_range( span<Fields> ... elems, span<id> ids_storage ) noexcept; // elems are moved from
+
+    // returns nullptr if elem does not exist
+    template<size_t I>
+    field_type<I>* try_get( id elem_id ) noexcept;
+    template<size_t I>
+    const field_type<I>* try_get( id elem_id ) const noexcept;
+    template<typename T>
+    T* try_get( id elem_id ) noexcept;
+    template<typename T>
+    const T* try_get( id elem_id ) const noexcept;
+
+    // ub if element with elem_id has been deleted
+    template<size_t I>
+    field_type<I>& get( id elem_id ) noexcept;
+    template<size_t I>
+    const field_type<I>& get( id elem_id ) const noexcept;
+    template<typename T>
+    T& get( id elem_id ) noexcept;
+    template<typename T>
+    const T& get( id elem_id ) const noexcept;
+
+    // id of the element at packed_idx in the columns
+    id get_id( size_t packed_idx ) const noexcept;
+
+    // does nothing if element does not exist
+    void erase( id elem_id ) noexcept;
+    // same as erase() for each id in turn, nothing is batched
+    void erase_range( span<const id> ids ) noexcept;
+    void clear() noexcept;
+
+    // semanticaly the same as clear(), but also destroys slot counters for the nodes, so it will invalidate all previously given ids
+    // use it over clear only if you want to reclaim memory afterwards with shink_to_fit() call
+    void destroy() noexcept;
+
+    size_t size() const noexcept;
+    size_t capacity() const noexcept;
+
+    void reserve( uint32_t nelems ) noexcept;
+    void shrink_to_fit() noexcept;
+
+    // physically reorders packed elements, ids stay valid. new2old[i] is the old packed index of the element placed at i,
+    // it must be a permutation of [0, size())
+    void reorder( span<const uint32_t> new2old ) noexcept;
+
+    // reorders packed elements so that column I is sorted by cmp( const field_type<I>&, const field_type<I>& )
+    // relative order of equal elements is preserved, ids stay valid
+    template<size_t I, typename Compare>
+    void stable_sort( Compare&& cmp );
+    template<typename T, typename Compare>
+    void stable_sort( Compare&& cmp );
+
+    // packed columns. Elements with the same index in different columns belong to the same freelist element
+    // these spans may be invalidated after a call to any non-const method except get() and try_get()
+    template<size_t I>
+    span<field_type<I>> get_column() noexcept;
+    template<size_t I>
+    span<const field_type<I>> get_column() const noexcept;
+    template<typename T>
+    span<T> get_column() noexcept;
+    template<typename T>
+    span<const T> get_column() const noexcept;
+
+    // replaces column I with the same column of other. Both freelists must have the same ids and packed order,
+    // e.g. this one is a copy of other and other has only modified its elements in place since then
+    template<size_t I>
+    void copy_column( const packed_soa_freelist& other );
+    template<typename T>
+    void copy_column( const packed_soa_freelist& other );
+
+    // id bookkeeping for serialization, the spans are invalidated by the same methods as column spans
+    freelist_layout get_layout() const noexcept;
+    // replaces the contents with columns (moved from, in packed order) and ids from layout
+    // returns false and leaves the freelist unchanged if layout doesn't match the columns
+    bool restore( const freelist_layout& layout, span<Fields> ... columns ) noexcept;
+
+private:
+    struct freelist_elem
+    {
+        union
+        {
+            uint32_t packed_idx;
+            uint32_t next_free;
+        };
+        uint32_t slot_cnt;
+
+        freelist_elem( uint32_t offset ) : packed_idx( offset ), slot_cnt( 0 ) {}
+        freelist_elem() = default;
+    };
+
+    static constexpr uint32_t FREE_END = std::numeric_limits<uint32_t>::max();
+
+    template<typename T>
+    static constexpr size_t find_unique_field() noexcept;
+
+    template<typename T>
+    struct column_of
+    {
+        static constexpr size_t value = find_unique_field<T>();
+        static_assert( value < sizeof...( Fields ), "field type is either not present in the freelist or is not unique" );
+    };
+
+    template<typename Fn>
+    void for_each_column( Fn&& fn ) noexcept;
+
+    template<size_t ... Is>
+    void push_back_fields( std::index_sequence<Is...>, Fields&& ... fields ) noexcept;
+
+    template<size_t ... Is>
+    void restore_columns( std::index_sequence<Is...>, span<Fields> ... columns ) noexcept;
+
+    id insert_elem_to_freelist( uint32_t packed_idx ) noexcept;
+    void reserve_for_insertion( size_t nelems ) noexcept;
+
+    std::tuple<std::vector<Fields>...> m_columns;
+    std::vector<uint32_t> m_packed2slot; // reverse mapping, required to patch m_freelist when elements are moved inside columns
+    std::vector<freelist_elem> m_freelist;
+    uint32_t m_free_head = FREE_END;
+};
+
+#include "packed_soa_freelist.hpp"
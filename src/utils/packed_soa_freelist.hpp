@@ -0,0 +1,423 @@
+#pragma once
+
+#include "packed_soa_freelist.h"
+
+#include <cassert>
+#include <cstring>
+
+
+template<typename ... Fields>
+bool packed_soa_freelist<Fields...>::has( id elem_id ) const noexcept
+{
+    if ( elem_id.idx < m_freelist.size() )
+        return m_freelist[elem_id.idx].slot_cnt == elem_id.inner_id;
+    else
+        return false;
+}
+
+
+template<typename ... Fields>
+typename packed_soa_freelist<Fields...>::id packed_soa_freelist<Fields...>::insert( Fields ... fields ) noexcept
+{
+    uint32_t packed_idx = uint32_t( size() );
+    push_back_fields( std::index_sequence_for<Fields...>(), std::move( fields )... );
+
+    return insert_elem_to_freelist( packed_idx );
+}
+
+
+template<typename ... Fields>
+span<typename packed_soa_freelist<Fields...>::id> packed_soa_freelist<Fields...>::insert_range( span<Fields> ... elems, span<id> ids_storage ) noexcept
+{
+    const size_t nelems = std::get<0>( std::forward_as_tuple( elems... ) ).size();
+    assert( ( ( elems.size() == nelems ) && ... ) );
+    assert( ids_storage.size() >= nelems );
+
+    reserve_for_insertion( nelems );
+    for ( size_t i = 0; i < nelems; ++i )
+        ids_storage[i] = insert( std::move( elems[i] )... );
+
+    return span<id>( ids_storage.begin(), ids_storage.begin() + nelems );
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::reserve_for_insertion( size_t nelems ) noexcept
+{
+    const size_t new_size = size() + nelems;
+    for_each_column( [new_size]( auto& column ) { column.reserve( new_size ); } );
+    m_packed2slot.reserve( new_size );
+    // free slots are reused first, freelist grows only by the rest
+    m_freelist.reserve( std::max( m_freelist.size(), new_size ) );
+}
+
+
+template<typename ... Fields>
+template<size_t ... Is>
+void packed_soa_freelist<Fields...>::push_back_fields( std::index_sequence<Is...>, Fields&& ... fields ) noexcept
+{
+    ( std::get<Is>( m_columns ).push_back( std::move( fields ) ), ... );
+}
+
+
+template<typename ... Fields>
+typename packed_soa_freelist<Fields...>::id packed_soa_freelist<Fields...>::insert_elem_to_freelist( uint32_t packed_idx ) noexcept
+{
+    id new_id;
+    if ( m_free_head == FREE_END )
+    {
+        new_id.idx = uint32_t( m_freelist.size() );
+        new_id.inner_id = 0;
+        m_freelist.emplace_back( packed_idx );
+    }
+    else
+    {
+        freelist_elem& new_elem = m_freelist[m_free_head];
+        new_id.idx = uint32_t( m_free_head );
+        new_id.inner_id = new_elem.slot_cnt;
+        m_free_head = new_elem.next_free;
+        new_elem.packed_idx = packed_idx;
+    }
+    m_packed2slot.push_back( new_id.idx );
+
+    return new_id;
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+typename packed_soa_freelist<Fields...>::template field_type<I>* packed_soa_freelist<Fields...>::try_get( id elem_id ) noexcept
+{
+    if ( has( elem_id ) )
+        return &std::get<I>( m_columns )[m_freelist[elem_id.idx].packed_idx];
+    return nullptr;
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+const typename packed_soa_freelist<Fields...>::template field_type<I>* packed_soa_freelist<Fields...>::try_get( id elem_id ) const noexcept
+{
+    if ( has( elem_id ) )
+        return &std::get<I>( m_columns )[m_freelist[elem_id.idx].packed_idx];
+    return nullptr;
+}
+
+
+template<typename ... Fields>
+template<typename T>
+T* packed_soa_freelist<Fields...>::try_get( id elem_id ) noexcept
+{
+    return try_get<column_of<T>::value>( elem_id );
+}
+
+
+template<typename ... Fields>
+template<typename T>
+const T* packed_soa_freelist<Fields...>::try_get( id elem_id ) const noexcept
+{
+    return try_get<column_of<T>::value>( elem_id );
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+typename packed_soa_freelist<Fields...>::template field_type<I>& packed_soa_freelist<Fields...>::get( id elem_id ) noexcept
+{
+    assert( has( elem_id ) );
+    return std::get<I>( m_columns )[m_freelist[elem_id.idx].packed_idx];
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+const typename packed_soa_freelist<Fields...>::template field_type<I>& packed_soa_freelist<Fields...>::get( id elem_id ) const noexcept
+{
+    assert( has( elem_id ) );
+    return std::get<I>( m_columns )[m_freelist[elem_id.idx].packed_idx];
+}
+
+
+template<typename ... Fields>
+template<typename T>
+T& packed_soa_freelist<Fields...>::get( id elem_id ) noexcept
+{
+    return get<column_of<T>::value>( elem_id );
+}
+
+
+template<typename ... Fields>
+template<typename T>
+const T& packed_soa_freelist<Fields...>::get( id elem_id ) const noexcept
+{
+    return get<column_of<T>::value>( elem_id );
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::erase( id elem_id ) noexcept
+{
+    if ( ! has( elem_id ) )
+        return;
+
+    auto& freelist_elem = m_freelist[elem_id.idx];
+    freelist_elem.slot_cnt++;
+
+    const uint32_t packed_idx = freelist_elem.packed_idx;
+    const uint32_t last_idx = uint32_t( size() ) - 1;
+    if ( packed_idx != last_idx )
+    {
+        for_each_column( [packed_idx]( auto& column )
+        {
+            using std::swap; // include to adl
+            swap( column.back(), column[packed_idx] );
+        } );
+        m_packed2slot[packed_idx] = m_packed2slot[last_idx];
+        m_freelist[m_packed2slot[packed_idx]].packed_idx = packed_idx;
+    }
+
+    for_each_column( []( auto& column ) { column.pop_back(); } );
+    m_packed2slot.pop_back();
+
+    freelist_elem.next_free = uint32_t( m_free_head );
+    m_free_head = elem_id.idx;
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::erase_range( span<const id> ids ) noexcept
+{
+    for ( id elem_id : ids )
+        erase( elem_id );
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::clear() noexcept
+{
+    for_each_column( []( auto& column ) { column.clear(); } );
+    m_packed2slot.clear();
+
+    if ( m_freelist.empty() )
+        return;
+
+    m_freelist.back().next_free = FREE_END;
+    m_freelist.back().slot_cnt++;
+    m_free_head = 0;
+    for ( uint32_t i = 0, end = uint32_t( m_freelist.size() ) - 1; i < end; ++i )
+    {
+        m_freelist[i].next_free = i + 1;
+        m_freelist[i].slot_cnt++;
+    }
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::destroy() noexcept
+{
+    for_each_column( []( auto& column ) { column.clear(); } );
+    m_packed2slot.clear();
+    m_freelist.clear();
+    m_free_head = FREE_END;
+}
+
+
+template<typename ... Fields>
+size_t packed_soa_freelist<Fields...>::size() const noexcept
+{
+    return m_packed2slot.size();
+}
+
+
+template<typename ... Fields>
+size_t packed_soa_freelist<Fields...>::capacity() const noexcept
+{
+    return m_packed2slot.capacity();
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::reserve( uint32_t nelems ) noexcept
+{
+    for_each_column( [nelems]( auto& column ) { column.reserve( nelems ); } );
+    m_packed2slot.reserve( nelems );
+    m_freelist.reserve( nelems );
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::shrink_to_fit() noexcept
+{
+    for_each_column( []( auto& column ) { column.shrink_to_fit(); } );
+    m_packed2slot.shrink_to_fit();
+    m_freelist.shrink_to_fit();
+}
+
+
+template<typename ... Fields>
+template<size_t I, typename Compare>
+void packed_soa_freelist<Fields...>::stable_sort( Compare&& cmp )
+{
+    const auto& key_column = std::get<I>( m_columns );
+
+    std::vector<uint32_t> new2old( size() );
+    std::iota( new2old.begin(), new2old.end(), 0 );
+    std::stable_sort( new2old.begin(), new2old.end(), [&]( uint32_t lhs, uint32_t rhs ) { return cmp( key_column[lhs], key_column[rhs] ); } );
+
+    reorder( make_span( new2old ) );
+}
+
+
+template<typename ... Fields>
+void packed_soa_freelist<Fields...>::reorder( span<const uint32_t> new2old ) noexcept
+{
+    assert( new2old.size() == size() );
+
+    for_each_column( [new2old]( auto& column )
+    {
+        std::remove_reference_t<decltype( column )> reordered_column;
+        reordered_column.reserve( column.capacity() );
+        for ( uint32_t old_idx : new2old )
+            reordered_column.push_back( std::move( column[old_idx] ) );
+        column = std::move( reordered_column );
+    } );
+
+    std::vector<uint32_t> reordered_packed2slot;
+    reordered_packed2slot.reserve( m_packed2slot.capacity() );
+    for ( uint32_t old_idx : new2old )
+        reordered_packed2slot.push_back( m_packed2slot[old_idx] );
+    m_packed2slot = std::move( reordered_packed2slot );
+
+    for ( uint32_t packed_idx = 0; packed_idx < uint32_t( m_packed2slot.size() ); ++packed_idx )
+        m_freelist[m_packed2slot[packed_idx]].packed_idx = packed_idx;
+}
+
+
+template<typename ... Fields>
+template<typename T, typename Compare>
+void packed_soa_freelist<Fields...>::stable_sort( Compare&& cmp )
+{
+    stable_sort<column_of<T>::value>( std::forward<Compare>( cmp ) );
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+span<typename packed_soa_freelist<Fields...>::template field_type<I>> packed_soa_freelist<Fields...>::get_column() noexcept
+{
+    return make_span( std::get<I>( m_columns ) );
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+span<const typename packed_soa_freelist<Fields...>::template field_type<I>> packed_soa_freelist<Fields...>::get_column() const noexcept
+{
+    return make_span( std::get<I>( m_columns ) );
+}
+
+
+template<typename ... Fields>
+template<typename T>
+span<T> packed_soa_freelist<Fields...>::get_column() noexcept
+{
+    return get_column<column_of<T>::value>();
+}
+
+
+template<typename ... Fields>
+template<typename T>
+span<const T> packed_soa_freelist<Fields...>::get_column() const noexcept
+{
+    return get_column<column_of<T>::value>();
+}
+
+
+template<typename ... Fields>
+template<size_t I>
+void packed_soa_freelist<Fields...>::copy_column( const packed_soa_freelist& other )
+{
+    assert( size() == other.size() );
+    std::get<I>( m_columns ) = std::get<I>( other.m_columns );
+}
+
+
+template<typename ... Fields>
+template<typename T>
+void packed_soa_freelist<Fields...>::copy_column( const packed_soa_freelist& other )
+{
+    copy_column<column_of<T>::value>( other );
+}
+
+
+template<typename ... Fields>
+typename packed_soa_freelist<Fields...>::id packed_soa_freelist<Fields...>::get_id( size_t packed_idx ) const noexcept
+{
+    assert( packed_idx < m_packed2slot.size() );
+    const uint32_t slot = m_packed2slot[packed_idx];
+    return id{ slot, m_freelist[slot].slot_cnt };
+}
+
+
+template<typename ... Fields>
+freelist_layout packed_soa_freelist<Fields...>::get_layout() const noexcept
+{
+    static_assert( sizeof( freelist_elem ) == 2 * sizeof( uint32_t ), "freelist_layout expects 2 values per slot" );
+
+    const uint32_t* slots = reinterpret_cast<const uint32_t*>( m_freelist.data() );
+    return freelist_layout{ span<const uint32_t>( slots, slots + 2 * m_freelist.size() ), make_span( m_packed2slot ), m_free_head };
+}
+
+
+template<typename ... Fields>
+bool packed_soa_freelist<Fields...>::restore( const freelist_layout& layout, span<Fields> ... columns ) noexcept
+{
+    const size_t nelems = std::get<0>( std::forward_as_tuple( columns... ) ).size();
+    if ( ! ( ( columns.size() == nelems ) && ... ) || ! layout.is_consistent( nelems ) )
+        return false;
+
+    m_freelist.resize( layout.slots.size() / 2 );
+    std::memcpy( m_freelist.data(), layout.slots.begin(), layout.slots.size() * sizeof( uint32_t ) );
+    m_packed2slot.assign( layout.packed2slot.begin(), layout.packed2slot.end() );
+    m_free_head = layout.free_head;
+
+    restore_columns( std::index_sequence_for<Fields...>(), columns... );
+    return true;
+}
+
+
+template<typename ... Fields>
+template<size_t ... Is>
+void packed_soa_freelist<Fields...>::restore_columns( std::index_sequence<Is...>, span<Fields> ... columns ) noexcept
+{
+    ( std::get<Is>( m_columns ).assign( std::make_move_iterator( columns.begin() ), std::make_move_iterator( columns.end() ) ), ... );
+}
+
+
+template<typename ... Fields>
+template<typename T>
+constexpr size_t packed_soa_freelist<Fields...>::find_unique_field() noexcept
+{
+    constexpr bool matches[] = { std::is_same_v<T, Fields>... };
+
+    size_t idx = sizeof...( Fields );
+    size_t nmatches = 0;
+    for ( size_t i = 0; i < sizeof...( Fields ); ++i )
+    {
+        if ( matches[i] )
+        {
+            idx = i;
+            nmatches++;
+        }
+    }
+
+    return nmatches == 1 ? idx : sizeof...( Fields );
+}
+
+
+template<typename ... Fields>
+template<typename Fn>
+void packed_soa_freelist<Fields...>::for_each_column( Fn&& fn ) noexcept
+{
+    std::apply( [&fn]( auto& ... columns ) { ( fn( columns ), ... ); }, m_columns );
+}
@@ -0,0 +1,51 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "radix_sort.h"
+
+
+void radix_sort( span<keyed_index> items, span<keyed_index> scratch ) noexcept
+{
+    assert( scratch.size() >= items.size() );
+
+    constexpr size_t npasses = sizeof( uint64_t );
+    constexpr size_t nbuckets = 256;
+
+    const size_t nitems = items.size();
+    if ( nitems < 2 )
+        return;
+
+    uint32_t histograms[npasses][nbuckets] = {};
+    for ( const keyed_index& item : items )
+        for ( size_t pass = 0; pass < npasses; ++pass )
+            histograms[pass][( item.key >> ( pass * 8 ) ) & 0xff]++;
+
+    keyed_index* src = items.begin();
+    keyed_index* dst = scratch.begin();
+    for ( size_t pass = 0; pass < npasses; ++pass )
+    {
+        uint32_t* histogram = histograms[pass];
+        const uint64_t first_byte = ( src[0].key >> ( pass * 8 ) ) & 0xff;
+        if ( histogram[first_byte] == nitems )
+            continue;
+
+        // bucket counts become bucket offsets
+        uint32_t offset = 0;
+        for ( size_t bucket = 0; bucket < nbuckets; ++bucket )
+        {
+            const uint32_t count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += count;
+        }
+
+        for ( size_t i = 0; i < nitems; ++i )
+            dst[histogram[( src[i].key >> ( pass * 8 ) ) & 0xff]++] = src[i];
+
+        std::swap( src, dst );
+    }
+
+    if ( src != items.begin() )
+        std::copy( src, src + nitems, items.begin() );
+}
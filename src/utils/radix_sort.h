@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include "span.h"
+
+// stable LSD radix sort of 64-bit keys carrying the index of the element they were made for
+// elements themselves are not moved, the caller gathers them by the sorted indices
+// keys are sorted 8 bits per pass, histograms of all passes are built in one read of the keys, and passes over bytes
+// which are the same in every key are skipped, so unused high bits cost nothing
+
+struct keyed_index
+{
+    uint64_t key;
+    uint32_t idx;
+};
+
+// scratch must be at least as large as items, the result is in items
+void radix_sort( span<keyed_index> items, span<keyed_index> scratch ) noexcept;
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <limits>
+#include <vector>
+
+#include "span.h"
+#include "freelist_id.h"
+
+// lists of children referencing each parent, e.g. all mesh instances using a material
+// parents and children are identified by freelist ids (see freelist_id.h), lists are indexed by parent slot,
+// so the owner has to check that the parent id is still alive before the lookup
+// a child may be linked to at most MaxParents different parents and to each of them only once
+// add() and remove() are O(MaxParents), order of children in a list is unspecified
+// all const methods are thread-safe, no thread safety on any non-const method
+
+template<typename ParentID, typename ChildID, size_t MaxParents = 1>
+class reverse_index
+{
+public:
+    void add( ParentID parent, ChildID child );
+    // does nothing if child is not linked to parent
+    void remove( ParentID parent, ChildID child ) noexcept;
+    void clear() noexcept;
+
+    span<const ChildID> get( ParentID parent ) const noexcept;
+
+private:
+    static constexpr uint32_t NoParent = std::numeric_limits<uint32_t>::max();
+
+    struct link
+    {
+        uint32_t parent_slot = NoParent;
+        uint32_t pos = 0; // position of the child in the parent's list
+    };
+
+    link* find_link( ChildID child, uint32_t parent_slot ) noexcept;
+
+    std::vector<std::vector<ChildID>> m_children; // by parent slot
+    std::vector<std::array<link, MaxParents>> m_links; // by child slot
+};
+
+
+template<typename ParentID, typename ChildID, size_t MaxParents>
+void reverse_index<ParentID, ChildID, MaxParents>::add( ParentID parent, ChildID child )
+{
+    assert( find_link( child, parent.idx ) == nullptr );
+
+    if ( m_children.size() <= parent.idx )
+        m_children.resize( parent.idx + 1 );
+    if ( m_links.size() <= child.idx )
+        m_links.resize( child.idx + 1 );
+
+    auto& links = m_links[child.idx];
+    auto free_link = std::find_if( links.begin(), links.end(), []( const link& l ) { return l.parent_slot == NoParent; } );
+    assert( free_link != links.end() );
+
+    auto& children = m_children[parent.idx];
+    free_link->parent_slot = parent.idx;
+    free_link->pos = uint32_t( children.size() );
+    children.push_back( child );
+}
+
+
+template<typename ParentID, typename ChildID, size_t MaxParents>
+void reverse_index<ParentID, ChildID, MaxParents>::remove( ParentID parent, ChildID child ) noexcept
+{
+    link* child_link = find_link( child, parent.idx );
+    if ( ! child_link )
+        return;
+
+    // the last child takes the place of the removed one
+    auto& children = m_children[parent.idx];
+    const ChildID moved = children.back();
+    children[child_link->pos] = moved;
+    find_link( moved, parent.idx )->pos = child_link->pos;
+    children.pop_back();
+
+    *child_link = link();
+}
+
+
+template<typename ParentID, typename ChildID, size_t MaxParents>
+void reverse_index<ParentID, ChildID, MaxParents>::clear() noexcept
+{
+    m_children.clear();
+    m_links.clear();
+}
+
+
+template<typename ParentID, typename ChildID, size_t MaxParents>
+span<const ChildID> reverse_index<ParentID, ChildID, MaxParents>::get( ParentID parent ) const noexcept
+{
+    if ( parent.idx >= m_children.size() )
+        return span<const ChildID>();
+
+    return make_span( m_children[parent.idx] );
+}
+
+
+template<typename ParentID, typename ChildID, size_t MaxParents>
+typename reverse_index<ParentID, ChildID, MaxParents>::link* reverse_index<ParentID, ChildID, MaxParents>::find_link( ChildID child, uint32_t parent_slot ) noexcept
+{
+    if ( child.idx >= m_links.size() )
+        return nullptr;
+
+    for ( link& l : m_links[child.idx] )
+        if ( l.parent_slot == parent_slot )
+            return &l;
+
+    return nullptr;
+}
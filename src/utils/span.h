@@ -54,14 +54,14 @@ span<const T> make_span( const T (&arr)[N] )
     return span<const T>( arr, arr + N );
 }
 
-template<typename T>
-span<T> make_span( std::vector<T>& vec )
+template<typename T, typename Alloc>
+span<T> make_span( std::vector<T, Alloc>& vec )
 {
     return span<T>( vec.data(), vec.data() + vec.size() );
 }
 
-template<typename T>
-span<const T> make_span( const std::vector<T>& vec )
+template<typename T, typename Alloc>
+span<const T> make_span( const std::vector<T, Alloc>& vec )
 {
     return span<const T>( vec.data(), vec.data() + vec.size() );
 }
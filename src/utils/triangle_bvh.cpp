@@ -0,0 +1,199 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "triangle_bvh.h"
+
+
+
+namespace
+{
+    using vec3 = std::array<float, 3>;
+
+    vec3 sub( const vec3& lhs, const vec3& rhs ) noexcept { return { lhs[0] - rhs[0], lhs[1] - rhs[1], lhs[2] - rhs[2] }; }
+    float dot( const vec3& lhs, const vec3& rhs ) noexcept { return lhs[0] * rhs[0] + lhs[1] * rhs[1] + lhs[2] * rhs[2]; }
+    vec3 cross( const vec3& lhs, const vec3& rhs ) noexcept
+    {
+        return { lhs[1] * rhs[2] - lhs[2] * rhs[1], lhs[2] * rhs[0] - lhs[0] * rhs[2], lhs[0] * rhs[1] - lhs[1] * rhs[0] };
+    }
+
+    vec3 transform_point( const vec3& p, const float ( &m )[4][4] ) noexcept
+    {
+        vec3 res;
+        for ( size_t j = 0; j < 3; ++j )
+            res[j] = p[0] * m[0][j] + p[1] * m[1][j] + p[2] * m[2][j] + m[3][j];
+        return res;
+    }
+
+    // inverse of a matrix with the last column ( 0, 0, 0, 1 ), the upper 3x3 part is inverted by cofactors
+    void invert_affine( const float ( &m )[4][4], float ( &res )[4][4] ) noexcept
+    {
+        const vec3 r0 = { m[0][0], m[0][1], m[0][2] };
+        const vec3 r1 = { m[1][0], m[1][1], m[1][2] };
+        const vec3 r2 = { m[2][0], m[2][1], m[2][2] };
+        const vec3 c0 = cross( r1, r2 );
+        const vec3 c1 = cross( r2, r0 );
+        const vec3 c2 = cross( r0, r1 );
+        const float inv_det = 1.0f / dot( r0, c0 );
+
+        // columns of the inverse are the cofactor rows
+        for ( size_t i = 0; i < 3; ++i )
+        {
+            res[i][0] = c0[i] * inv_det;
+            res[i][1] = c1[i] * inv_det;
+            res[i][2] = c2[i] * inv_det;
+            res[i][3] = 0;
+        }
+        for ( size_t j = 0; j < 3; ++j )
+            res[3][j] = -( m[3][0] * res[0][j] + m[3][1] * res[1][j] + m[3][2] * res[2][j] );
+        res[3][3] = 1;
+    }
+
+    // Moller-Trumbore, both sides count. Returns false or t within [0, t_max] and barycentrics of vertices 1 and 2
+    bool ray_intersects_triangle( const ray& r, const std::array<vec3, 3>& tri, float& t, float& u, float& v ) noexcept
+    {
+        const vec3 e1 = sub( tri[1], tri[0] );
+        const vec3 e2 = sub( tri[2], tri[0] );
+        const vec3 p = cross( r.dir, e2 );
+        const float det = dot( e1, p );
+        if ( det == 0 )
+            return false;
+
+        const float inv_det = 1.0f / det;
+        const vec3 s = sub( r.origin, tri[0] );
+        u = dot( s, p ) * inv_det;
+        if ( u < 0 || u > 1 )
+            return false;
+
+        const vec3 q = cross( s, e1 );
+        v = dot( r.dir, q ) * inv_det;
+        if ( v < 0 || u + v > 1 )
+            return false;
+
+        t = dot( e2, q ) * inv_det;
+        return t >= 0 && t <= r.t_max;
+    }
+
+    // separating axis test of Akenine-Moller: box normals, the triangle normal and the 9 edge cross products
+    bool triangle_intersects_box( const std::array<vec3, 3>& tri, const aabb& box ) noexcept
+    {
+        const vec3 center = box.center();
+        const vec3 half = sub( box.max, center );
+        const std::array<vec3, 3> v = { sub( tri[0], center ), sub( tri[1], center ), sub( tri[2], center ) };
+
+        // the triangle is projected on the axis and compared with the projection radius of the box
+        auto is_separating = [&]( const vec3& axis )
+        {
+            const float p0 = dot( v[0], axis );
+            const float p1 = dot( v[1], axis );
+            const float p2 = dot( v[2], axis );
+            const float radius = half[0] * std::abs( axis[0] ) + half[1] * std::abs( axis[1] ) + half[2] * std::abs( axis[2] );
+            return std::min( { p0, p1, p2 } ) > radius || std::max( { p0, p1, p2 } ) < -radius;
+        };
+
+        for ( size_t axis = 0; axis < 3; ++axis )
+            if ( std::min( { v[0][axis], v[1][axis], v[2][axis] } ) > half[axis] || std::max( { v[0][axis], v[1][axis], v[2][axis] } ) < -half[axis] )
+                return false;
+
+        const std::array<vec3, 3> edges = { sub( v[1], v[0] ), sub( v[2], v[1] ), sub( v[0], v[2] ) };
+        if ( is_separating( cross( edges[0], edges[1] ) ) )
+            return false;
+
+        for ( const vec3& edge : edges )
+            for ( size_t axis = 0; axis < 3; ++axis )
+            {
+                vec3 box_axis = { 0, 0, 0 };
+                box_axis[axis] = 1;
+                if ( is_separating( cross( edge, box_axis ) ) )
+                    return false;
+            }
+
+        return true;
+    }
+}
+
+
+void triangle_bvh::build( const float* positions, size_t vertex_stride, span<const uint32_t> indices )
+{
+    assert( indices.size() % 3 == 0 );
+
+    m_triangles.resize( indices.size() / 3 );
+    std::vector<aabb> boxes( m_triangles.size() );
+    for ( size_t i = 0; i < m_triangles.size(); ++i )
+    {
+        aabb& box = boxes[i];
+        box = aabb::empty();
+        for ( size_t corner = 0; corner < 3; ++corner )
+        {
+            const float* pos = positions + indices[i * 3 + corner] * vertex_stride;
+            m_triangles[i][corner] = { pos[0], pos[1], pos[2] };
+            box.merge( aabb{ m_triangles[i][corner], m_triangles[i][corner] } );
+        }
+    }
+
+    m_tree.build( make_span( std::as_const( boxes ) ) );
+}
+
+
+void triangle_bvh::clear() noexcept
+{
+    m_triangles.clear();
+    m_tree.clear();
+}
+
+
+bool triangle_bvh::raycast( const ray& r, const float ( &obj2world )[4][4], hit& res ) const noexcept
+{
+    return raycast( r, obj2world, false, res );
+}
+
+
+bool triangle_bvh::raycast_any( const ray& r, const float ( &obj2world )[4][4] ) const noexcept
+{
+    hit unused;
+    return raycast( r, obj2world, true, unused );
+}
+
+
+bool triangle_bvh::raycast( const ray& r, const float ( &obj2world )[4][4], bool stop_at_first, hit& res ) const noexcept
+{
+    // an affine transform keeps the ray parameter, so hits in object space are at the same t
+    float world2obj[4][4];
+    invert_affine( obj2world, world2obj );
+    ray obj_ray = transform( r, world2obj );
+
+    bool is_hit = false;
+    m_tree.raycast( obj_ray, [&]( uint32_t triangle_idx, float )
+    {
+        float t, u, v;
+        if ( ! ray_intersects_triangle( obj_ray, m_triangles[triangle_idx], t, u, v ) )
+            return obj_ray.t_max;
+
+        is_hit = true;
+        res = hit{ t, triangle_idx, u, v };
+        obj_ray.t_max = t;
+        return stop_at_first ? -1.0f : t;
+    } );
+    return is_hit;
+}
+
+
+bool triangle_bvh::overlaps( const aabb& box, const float ( &obj2world )[4][4] ) const noexcept
+{
+    // candidates come from the box brought to object space, which is larger than the box itself,
+    // so they are tested in world space
+    float world2obj[4][4];
+    invert_affine( obj2world, world2obj );
+
+    bool is_overlapping = false;
+    m_tree.query( transform( box, world2obj ), [&]( uint32_t triangle_idx )
+    {
+        if ( is_overlapping )
+            return;
+
+        const triangle& tri = m_triangles[triangle_idx];
+        is_overlapping = triangle_intersects_box( { transform_point( tri[0], obj2world ), transform_point( tri[1], obj2world ), transform_point( tri[2], obj2world ) }, box );
+    } );
+    return is_overlapping;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+#include "bounds.h"
+#include "bvh.h"
+
+// bvh over the triangles of an indexed triangle list, for ray and box queries against mesh surfaces
+// positions are copied, so the tree doesn't depend on the storage of the mesh it was built from
+// queries take the world space placement of the mesh, obj2world must be invertible. Triangles are double-sided
+// all const methods are thread-safe, no thread safety on any non-const method
+
+class triangle_bvh
+{
+public:
+    // x, y, z of vertex i start at positions[i * vertex_stride], every 3 indices make a triangle
+    void build( const float* positions, size_t vertex_stride, span<const uint32_t> indices );
+    void clear() noexcept;
+
+    size_t triangle_count() const noexcept { return m_triangles.size(); }
+    // object space box of all triangles
+    aabb bounds() const noexcept { return m_tree.bounds(); }
+
+    struct hit
+    {
+        float t = 0; // in units of the ray given to the query
+        uint32_t triangle = 0; // index in the list the tree was built from
+        float u = 0; // barycentric coordinates of vertices 1 and 2 of the triangle
+        float v = 0;
+    };
+
+    // nearest triangle hit within [0, r.t_max], res is left as it is if there is none
+    bool raycast( const ray& r, const float ( &obj2world )[4][4], hit& res ) const noexcept;
+    // stops at the first triangle found
+    bool raycast_any( const ray& r, const float ( &obj2world )[4][4] ) const noexcept;
+    // true if any triangle intersects the world space box
+    bool overlaps( const aabb& box, const float ( &obj2world )[4][4] ) const noexcept;
+
+private:
+    using triangle = std::array<std::array<float, 3>, 3>;
+
+    // closest hit search if stop_at_first is false
+    bool raycast( const ray& r, const float ( &obj2world )[4][4], bool stop_at_first, hit& res ) const noexcept;
+
+    std::vector<triangle> m_triangles; // object space
+    bvh m_tree; // over boxes of m_triangles
+};
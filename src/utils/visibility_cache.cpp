@@ -0,0 +1,160 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "visibility_cache.h"
+
+
+
+namespace
+{
+    // planes of consecutive frames are rebuilt from matrices, so view-space distances drift by rounding errors
+    // proportional to the distance from the camera
+    constexpr float RelativeRoundingSlack = 1.e-5f;
+
+    void multiply( const float ( &lhs )[4][4], const float ( &rhs )[4][4], float ( &res )[4][4] ) noexcept
+    {
+        for ( size_t i = 0; i < 4; ++i )
+            for ( size_t j = 0; j < 4; ++j )
+            {
+                res[i][j] = 0;
+                for ( size_t k = 0; k < 4; ++k )
+                    res[i][j] += lhs[i][k] * rhs[k][j];
+            }
+    }
+
+    frustum offset_planes( frustum f, float offset ) noexcept
+    {
+        for ( auto& plane : f.planes )
+            plane[3] += offset;
+        return f;
+    }
+}
+
+
+bool visibility_cache::update( const view& cur_view, const bvh& tree, span<const aabb> boxes, span<const uint32_t> moved )
+{
+    assert( tree.size() <= boxes.size() );
+
+    const pose cur_pose = make_pose( cur_view.view );
+    if ( ! can_reuse( cur_view, cur_pose, boxes.size() ) )
+    {
+        full_cull( cur_view, cur_pose, tree, boxes );
+        return true;
+    }
+
+    // moved boxes lose their margin for good, they are tested on every frame until the next full cull
+    for ( uint32_t idx : moved )
+    {
+        assert( idx < boxes.size() );
+        if ( ! m_is_retested.test( idx ) )
+        {
+            m_is_retested.set( idx );
+            m_retested.push_back( idx );
+        }
+    }
+
+    float view_proj[4][4];
+    multiply( cur_view.view, cur_view.proj, view_proj );
+    const frustum f = make_frustum( view_proj );
+    for ( uint32_t idx : m_retested )
+        m_visible.set( idx, intersects( f, boxes[idx] ) );
+
+    m_age++;
+    return false;
+}
+
+
+visibility_cache::pose visibility_cache::make_pose( const float ( &view )[4][4] ) noexcept
+{
+    // p * view = ( p - pos ) * rotation, so pos = -translation * transpose( rotation ) for an orthonormal rotation
+    pose res;
+    for ( size_t i = 0; i < 3; ++i )
+        for ( size_t j = 0; j < 3; ++j )
+            res.rotation[i][j] = view[i][j];
+
+    for ( size_t i = 0; i < 3; ++i )
+        res.pos[i] = -( view[3][0] * view[i][0] + view[3][1] * view[i][1] + view[3][2] * view[i][2] );
+
+    return res;
+}
+
+
+bool visibility_cache::can_reuse( const view& cur_view, const pose& cur_pose, size_t nboxes ) const noexcept
+{
+    if ( ! m_is_valid || m_age >= m_max_age || nboxes != m_nboxes )
+        return false;
+
+    if ( ! std::equal( &m_proj[0][0], &m_proj[0][0] + 16, &cur_view.proj[0][0] ) )
+        return false;
+
+    // a point p moves in view space by ( p - pos ) * ( rotation' - rotation ) - ( pos' - pos ) * rotation',
+    // which is bounded by |p - pos| times the frobenius norm of the rotation change plus the camera shift.
+    // Plane distances in view space change by no more than that
+    float shift2 = 0;
+    for ( size_t i = 0; i < 3; ++i )
+        shift2 += ( cur_pose.pos[i] - m_pose.pos[i] ) * ( cur_pose.pos[i] - m_pose.pos[i] );
+
+    float rotation_change2 = 0;
+    for ( size_t i = 0; i < 3; ++i )
+        for ( size_t j = 0; j < 3; ++j )
+            rotation_change2 += ( cur_pose.rotation[i][j] - m_pose.rotation[i][j] ) * ( cur_pose.rotation[i][j] - m_pose.rotation[i][j] );
+
+    const float max_point_shift = std::sqrt( shift2 ) + std::sqrt( rotation_change2 ) * m_radius;
+    return max_point_shift + RelativeRoundingSlack * m_radius < m_margin;
+}
+
+
+void visibility_cache::full_cull( const view& cur_view, const pose& cur_pose, const bvh& tree, span<const aabb> boxes )
+{
+    float view_proj[4][4];
+    multiply( cur_view.view, cur_view.proj, view_proj );
+    const frustum f = make_frustum( view_proj );
+
+    m_visible.resize( boxes.size() );
+    m_visible.reset();
+    m_is_retested.resize( boxes.size() );
+    m_is_retested.reset();
+    m_retested.clear();
+
+    // boxes outside the frustum pushed out by the margin aren't reported at all, the rest is either inside
+    // every plane by the margin or lies on the boundary
+    tree.cull( offset_planes( f, m_margin ), [&]( uint32_t idx )
+    {
+        const aabb& box = boxes[idx];
+        if ( intersects( f, box ) )
+            m_visible.set( idx );
+
+        bool is_deep_inside = true;
+        for ( const auto& plane : f.planes )
+            is_deep_inside &= min_plane_distance( plane, box ) >= m_margin;
+
+        if ( ! is_deep_inside )
+        {
+            m_is_retested.set( idx );
+            m_retested.push_back( idx );
+        }
+    } );
+
+    // every box is inside the tree bounds, so none is farther from the camera than the farthest corner
+    const aabb bounds = tree.bounds();
+    float radius2 = 0;
+    for ( size_t corner = 0; corner < 8 && boxes.size() > 0; ++corner )
+    {
+        float dist2 = 0;
+        for ( size_t axis = 0; axis < 3; ++axis )
+        {
+            const float coord = ( corner >> axis ) & 1 ? bounds.max[axis] : bounds.min[axis];
+            dist2 += ( coord - cur_pose.pos[axis] ) * ( coord - cur_pose.pos[axis] );
+        }
+        radius2 = std::max( radius2, dist2 );
+    }
+
+    m_is_valid = true;
+    m_age = 0;
+    m_pose = cur_pose;
+    std::copy( &cur_view.proj[0][0], &cur_view.proj[0][0] + 16, &m_proj[0][0] );
+    m_radius = std::sqrt( radius2 );
+    m_nboxes = boxes.size();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+#include "bounds.h"
+#include "bvh.h"
+#include "dense_bitset.h"
+
+// frustum culling result of one view reused across frames, only boxes close to the frustum boundary are tested every frame
+// a full cull sorts boxes into ones inside the frustum or outside of it by at least margin, and boundary boxes.
+// Sorted boxes keep their result until the camera could have moved by margin relative to them, or for max_age frames,
+// boundary boxes and boxes reported as moved are retested on every frame in between
+//
+// the result always equals intersects( f, box ) for the current frustum. The view rotation must be orthonormal,
+// a changed projection or number of boxes forces a full cull
+
+class visibility_cache
+{
+public:
+    struct view
+    {
+        float view[4][4]; // world to view, rows are transformed as p * view
+        float proj[4][4];
+    };
+
+    // settings take effect on the next full cull
+    void set_margin( float margin ) noexcept { m_margin = margin; }
+    float margin() const noexcept { return m_margin; }
+    // 0 culls everything from scratch every frame
+    void set_max_age( uint32_t max_age ) noexcept { m_max_age = max_age; }
+    uint32_t max_age() const noexcept { return m_max_age; }
+
+    // next update does a full cull
+    void invalidate() noexcept { m_is_valid = false; }
+
+    // tree is built from boxes, possibly over a subset of them, boxes outside of it are never visible.
+    // moved lists boxes of the tree which changed since the previous update. Returns true if a full cull was done
+    bool update( const view& cur_view, const bvh& tree, span<const aabb> boxes, span<const uint32_t> moved );
+
+    // bit i is set iff intersects( f, boxes[i] ) for the frustum of the last update
+    const dense_bitset& visible() const noexcept { return m_visible; }
+    // boxes tested by the last update which wasn't a full cull
+    size_t retested_count() const noexcept { return m_retested.size(); }
+
+private:
+    struct pose
+    {
+        std::array<float, 3> pos;
+        float rotation[3][3];
+    };
+
+    static pose make_pose( const float ( &view )[4][4] ) noexcept;
+    bool can_reuse( const view& cur_view, const pose& cur_pose, size_t nboxes ) const noexcept;
+    void full_cull( const view& cur_view, const pose& cur_pose, const bvh& tree, span<const aabb> boxes );
+
+    float m_margin = 1.0f;
+    uint32_t m_max_age = 8;
+
+    bool m_is_valid = false;
+    uint32_t m_age = 0; // frames since the full cull
+    pose m_pose; // camera of the full cull
+    float m_proj[4][4] = {};
+    float m_radius = 0; // distance from the camera of the full cull to the farthest corner of the tree bounds
+    size_t m_nboxes = 0;
+
+    dense_bitset m_visible;
+    std::vector<uint32_t> m_retested; // boundary boxes and boxes moved since the full cull
+    dense_bitset m_is_retested;
+};
@@ -0,0 +1,123 @@
+// This is an independent project of an individual developer. Dear PVS-Studio, please check it.
+// PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+
+#include "../stdafx.h"
+
+#include "worker_pool.h"
+
+namespace
+{
+    thread_local bool t_inside_job = false;
+}
+
+
+worker_pool::worker_pool( uint32_t nworkers ) noexcept
+{
+    m_workers.reserve( nworkers );
+    for ( uint32_t i = 0; i < nworkers; ++i )
+        m_workers.emplace_back( [this]() { worker_loop(); } );
+}
+
+
+worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stop = true;
+    }
+    m_job_posted.notify_all();
+
+    for ( auto& worker : m_workers )
+        worker.join();
+}
+
+
+worker_pool& worker_pool::shared() noexcept
+{
+    static worker_pool pool( std::max( std::thread::hardware_concurrency(), 1u ) - 1 );
+    return pool;
+}
+
+
+void worker_pool::run_job( job& j )
+{
+    if ( t_inside_job || m_workers.empty() || j.ntasks == 1 )
+    {
+        // nested or trivial job, no point in waking anyone up
+        for ( size_t i = 0; i < j.ntasks; ++i )
+            j.invoke( j.task, i );
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock( m_run_mutex );
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_job = &j;
+        m_generation++;
+    }
+    m_job_posted.notify_all();
+
+    process( j );
+
+    std::exception_ptr error;
+    {
+        // all tasks are taken at this point, wait for the workers still finishing theirs
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_job = nullptr;
+        m_job_left.wait( lock, [&j]() { return j.nhelpers == 0; } );
+        error = j.error;
+    }
+
+    if ( error )
+        std::rethrow_exception( error );
+}
+
+
+void worker_pool::process( job& j ) noexcept
+{
+    t_inside_job = true;
+    for ( size_t i = j.next++; i < j.ntasks; i = j.next++ )
+    {
+        try
+        {
+            j.invoke( j.task, i );
+        }
+        catch ( ... )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if ( ! j.error )
+                j.error = std::current_exception();
+            j.next = j.ntasks;
+        }
+    }
+    t_inside_job = false;
+}
+
+
+void worker_pool::worker_loop() noexcept
+{
+    uint64_t last_generation = 0;
+    for ( ;; )
+    {
+        job* j = nullptr;
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_job_posted.wait( lock, [&]() { return m_stop || ( m_job && m_generation != last_generation ); } );
+            if ( m_stop )
+                return;
+
+            last_generation = m_generation;
+            j = m_job;
+            j->nhelpers++;
+        }
+
+        process( *j );
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            j->nhelpers--;
+        }
+        m_job_left.notify_all();
+    }
+}
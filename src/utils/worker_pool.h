@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "span.h"
+#include "dense_bitset.h"
+
+// persistent pool of worker threads for data-parallel loops over packed storages
+// the calling thread takes part in the work, so a pool with 0 workers runs everything in place
+// run() calls are serialized, a run() issued from inside a task is executed inline by the calling worker
+//
+// tasks running concurrently may only use const methods of the storages they traverse (see packed_freelist),
+// and write only to the elements they were given
+
+class worker_pool
+{
+public:
+    explicit worker_pool( uint32_t nworkers ) noexcept;
+    ~worker_pool();
+
+    worker_pool( const worker_pool& ) = delete;
+    worker_pool& operator=( const worker_pool& ) = delete;
+
+    // process-wide pool with a worker per hardware thread except the calling one, created on first use
+    static worker_pool& shared() noexcept;
+
+    uint32_t worker_count() const noexcept { return uint32_t( m_workers.size() ); }
+
+    // calls task( i ) for every i in [0, ntasks) and blocks until all of them are done
+    // if tasks throw, the first exception is rethrown here and the tasks not started yet are skipped
+    template<typename Fn>
+    void run( size_t ntasks, Fn&& task );
+
+private:
+    struct job
+    {
+        void( *invoke )( void* task, size_t idx ) = nullptr;
+        void* task = nullptr;
+        size_t ntasks = 0;
+
+        std::atomic<size_t> next = 0;
+        uint32_t nhelpers = 0; // workers currently inside the job, guarded by m_mutex
+
+        std::exception_ptr error = nullptr; // guarded by m_mutex
+    };
+
+    void run_job( job& j );
+    void process( job& j ) noexcept;
+    void worker_loop() noexcept;
+
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_run_mutex; // one job at a time
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_posted;
+    std::condition_variable m_job_left;
+    job* m_job = nullptr;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+
+// calls fn( T& ) for every element of elems, chunk_size consecutive elements are processed by one thread
+template<typename T, typename Fn>
+void parallel_for_each( span<T> elems, size_t chunk_size, Fn&& fn, worker_pool& pool = worker_pool::shared() );
+
+// splits elems into chunks of chunk_size elements, calls map_chunk( span<T> ) -> R for each one
+// and folds init and the results with reduce( R, R ) -> R in chunk order, so reduce only has to be associative
+template<typename T, typename R, typename MapFn, typename ReduceFn>
+R parallel_reduce( span<T> elems, size_t chunk_size, R init, MapFn&& map_chunk, ReduceFn&& reduce,
+                   worker_pool& pool = worker_pool::shared() );
+
+// calls make( idx, T& out ) -> bool for every bit idx set in words, words_per_task consecutive words are processed by one thread
+// outputs make() returned true for are packed at the start of out in ascending order of idx, no matter how many threads ran,
+// out must have a slot for every bit index, returns the number of packed outputs
+template<typename T, typename MakeFn>
+size_t parallel_gather( span<const uint64_t> words, size_t words_per_task, span<T> out, MakeFn&& make,
+                        worker_pool& pool = worker_pool::shared() );
+
+
+template<typename Fn>
+void worker_pool::run( size_t ntasks, Fn&& task )
+{
+    if ( ntasks == 0 )
+        return;
+
+    job j;
+    j.invoke = []( void* task, size_t idx ) { ( *static_cast<std::remove_reference_t<Fn>*>( task ) )( idx ); };
+    j.task = const_cast<void*>( static_cast<const void*>( &task ) );
+    j.ntasks = ntasks;
+
+    run_job( j );
+}
+
+
+template<typename T, typename Fn>
+void parallel_for_each( span<T> elems, size_t chunk_size, Fn&& fn, worker_pool& pool )
+{
+    chunk_size = std::max<size_t>( chunk_size, 1 );
+    const size_t nchunks = ( elems.size() + chunk_size - 1 ) / chunk_size;
+
+    pool.run( nchunks, [&]( size_t chunk_idx )
+    {
+        T* chunk_begin = elems.begin() + chunk_idx * chunk_size;
+        T* chunk_end = elems.begin() + std::min( ( chunk_idx + 1 ) * chunk_size, elems.size() );
+        for ( T* elem = chunk_begin; elem != chunk_end; ++elem )
+            fn( *elem );
+    } );
+}
+
+
+template<typename T, typename R, typename MapFn, typename ReduceFn>
+R parallel_reduce( span<T> elems, size_t chunk_size, R init, MapFn&& map_chunk, ReduceFn&& reduce, worker_pool& pool )
+{
+    chunk_size = std::max<size_t>( chunk_size, 1 );
+    const size_t nchunks = ( elems.size() + chunk_size - 1 ) / chunk_size;
+    if ( nchunks == 1 )
+        return reduce( std::move( init ), map_chunk( elems ) );
+
+    std::vector<R> partial( nchunks, init );
+    pool.run( nchunks, [&]( size_t chunk_idx )
+    {
+        T* chunk_begin = elems.begin() + chunk_idx * chunk_size;
+        T* chunk_end = elems.begin() + std::min( ( chunk_idx + 1 ) * chunk_size, elems.size() );
+        partial[chunk_idx] = map_chunk( span<T>( chunk_begin, chunk_end ) );
+    } );
+
+    R res = std::move( init );
+    for ( R& chunk_res : partial )
+        res = reduce( std::move( res ), std::move( chunk_res ) );
+
+    return res;
+}
+
+
+template<typename T, typename MakeFn>
+size_t parallel_gather( span<const uint64_t> words, size_t words_per_task, span<T> out, MakeFn&& make, worker_pool& pool )
+{
+    constexpr size_t bits_per_word = dense_bitset::BitsPerWord;
+    words_per_task = std::max<size_t>( words_per_task, 1 );
+    const size_t ntasks = ( words.size() + words_per_task - 1 ) / words_per_task;
+
+    // every task packs its outputs at the start of its own part of out, the parts are moved together in task order afterwards
+    std::vector<size_t> counts( ntasks, 0 );
+    pool.run( ntasks, [&]( size_t task_idx )
+    {
+        const size_t first_word = task_idx * words_per_task;
+        const size_t last_word = std::min( first_word + words_per_task, words.size() );
+        const size_t first_idx = first_word * bits_per_word;
+
+        size_t count = 0;
+        for ( size_t word_idx = first_word; word_idx < last_word; ++word_idx )
+            for_each_set_bit( words[word_idx], word_idx, [&]( size_t idx )
+            {
+                assert( idx < out.size() );
+                if ( make( idx, out[first_idx + count] ) )
+                    count++;
+            } );
+        counts[task_idx] = count;
+    } );
+
+    size_t total = 0;
+    for ( size_t task_idx = 0; task_idx < ntasks; ++task_idx )
+    {
+        T* part = out.begin() + task_idx * words_per_task * bits_per_word;
+        if ( part != out.begin() + total )
+            std::move( part, part + counts[task_idx], out.begin() + total );
+        total += counts[task_idx];
+    }
+
+    return total;
+}
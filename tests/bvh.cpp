@@ -0,0 +1,371 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/bvh.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	using matrix = float[4][4];
+
+	// DirectX-style left-handed perspective looking along +z from pos
+	void make_view_proj( const std::array<float, 3>& pos, float fov_y, float aspect, float near_z, float far_z, matrix& res )
+	{
+		const float ys = 1.0f / std::tan( fov_y * 0.5f );
+		const float xs = ys / aspect;
+		const float zs = far_z / ( far_z - near_z );
+		const matrix proj = { { xs, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zs, 1 }, { 0, 0, -near_z * zs, 0 } };
+		const matrix view = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { -pos[0], -pos[1], -pos[2], 1 } };
+		for ( size_t i = 0; i < 4; ++i )
+			for ( size_t j = 0; j < 4; ++j )
+			{
+				res[i][j] = 0;
+				for ( size_t k = 0; k < 4; ++k )
+					res[i][j] += view[i][k] * proj[k][j];
+			}
+	}
+
+	frustum make_test_frustum( const std::array<float, 3>& pos )
+	{
+		matrix view_proj;
+		make_view_proj( pos, 1.0f, 1.5f, 0.1f, 200.0f, view_proj );
+		return make_frustum( view_proj );
+	}
+
+	std::vector<aabb> make_random_boxes( size_t n, float world_size, std::mt19937& rng )
+	{
+		std::uniform_real_distribution<float> pos( -world_size, world_size );
+		std::uniform_real_distribution<float> extent( 0.1f, 2.0f );
+		std::vector<aabb> boxes( n );
+		for ( auto& box : boxes )
+			box = aabb::from_center_extents( { pos( rng ), pos( rng ), pos( rng ) }, { extent( rng ), extent( rng ), extent( rng ) } );
+		return boxes;
+	}
+
+	std::vector<uint32_t> cull_linear( const frustum& f, const std::vector<aabb>& boxes )
+	{
+		std::vector<uint32_t> res;
+		for ( size_t i = 0; i < boxes.size(); ++i )
+			if ( intersects( f, boxes[i] ) )
+				res.push_back( uint32_t( i ) );
+		return res;
+	}
+
+	std::vector<uint32_t> cull_bvh( const frustum& f, const bvh& tree )
+	{
+		std::vector<uint32_t> res;
+		tree.cull( f, [&res]( uint32_t idx ) { res.push_back( idx ); } );
+		std::sort( res.begin(), res.end() );
+		return res;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( bvh_tests )
+
+BOOST_AUTO_TEST_CASE( frustum_planes )
+{
+	const frustum f = make_test_frustum( { 0, 0, 0 } );
+
+	auto point_box = []( float x, float y, float z ) { return aabb{ { x, y, z }, { x, y, z } }; };
+	BOOST_TEST( intersects( f, point_box( 0, 0, 5 ) ) );
+	BOOST_TEST( ! intersects( f, point_box( 0, 0, -1 ) ) );
+	BOOST_TEST( ! intersects( f, point_box( 0, 0, 300 ) ) );
+	BOOST_TEST( ! intersects( f, point_box( 100, 0, 5 ) ) );
+	BOOST_TEST( intersects( f, aabb{ { -1, -1, -1 }, { 1, 1, 1 } } ) );
+
+	// translation and axis swap
+	const matrix m = { { 0, 1, 0, 0 }, { 1, 0, 0, 0 }, { 0, 0, 1, 0 }, { 10, 20, 30, 1 } };
+	const aabb moved = transform( aabb{ { 0, 0, 0 }, { 1, 2, 3 } }, m );
+	BOOST_TEST( moved.min[0] == 10.0f );
+	BOOST_TEST( moved.max[0] == 12.0f );
+	BOOST_TEST( moved.max[1] == 21.0f );
+	BOOST_TEST( moved.max[2] == 33.0f );
+}
+
+BOOST_AUTO_TEST_CASE( matches_linear_culling )
+{
+	std::mt19937 rng( 42 );
+	std::vector<aabb> boxes = make_random_boxes( 5000, 100.0f, rng );
+
+	bvh tree;
+	tree.build( make_span( std::as_const( boxes ) ) );
+	BOOST_TEST( tree.size() == boxes.size() );
+
+	for ( const auto& pos : { std::array<float, 3>{ 0, 0, -150 }, std::array<float, 3>{ 0, 0, 0 }, std::array<float, 3>{ 50, -20, -60 } } )
+	{
+		const frustum f = make_test_frustum( pos );
+		const auto expected = cull_linear( f, boxes );
+		BOOST_TEST( ! expected.empty() );
+		BOOST_TEST( cull_bvh( f, tree ) == expected, boost::test_tools::per_element() );
+	}
+
+	// move half of the boxes far away, refitted tree must still agree with the linear path
+	for ( size_t i = 0; i < boxes.size(); i += 2 )
+		for ( size_t axis = 0; axis < 3; ++axis )
+		{
+			boxes[i].min[axis] += 37.0f;
+			boxes[i].max[axis] += 37.0f;
+		}
+	tree.refit( make_span( std::as_const( boxes ) ) );
+
+	const frustum f = make_test_frustum( { 0, 0, 0 } );
+	BOOST_TEST( cull_bvh( f, tree ) == cull_linear( f, boxes ), boost::test_tools::per_element() );
+}
+
+BOOST_AUTO_TEST_CASE( multi_view_cull )
+{
+	std::mt19937 rng( 3 );
+	const std::vector<aabb> boxes = make_random_boxes( 5000, 100.0f, rng );
+
+	bvh tree;
+	tree.build( make_span( std::as_const( boxes ) ) );
+
+	// perspective views looking into and away from the boxes, a huge ortho volume containing all of them and a small one
+	std::vector<frustum> views;
+	for ( const auto& pos : { std::array<float, 3>{ 0, 0, -150 }, std::array<float, 3>{ 0, 0, 0 }, std::array<float, 3>{ 50, -20, -60 },
+	                          std::array<float, 3>{ 0, 0, 150 } } )
+		views.push_back( make_test_frustum( pos ) );
+	const matrix huge_ortho = { { 0.001f, 0, 0, 0 }, { 0, 0.001f, 0, 0 }, { 0, 0, 0.001f, 0 }, { 0, 0, 0.5f, 1 } };
+	const matrix small_ortho = { { 0.1f, 0, 0, 0 }, { 0, 0.1f, 0, 0 }, { 0, 0, 0.02f, 0 }, { 0, 0, 0, 1 } };
+	views.push_back( make_frustum( huge_ortho ) );
+	views.push_back( make_shadow_caster_volume( small_ortho ) );
+
+	for ( size_t nviews : { size_t( 1 ), size_t( 3 ), views.size() } )
+	{
+		// bits past nviews are kept
+		std::vector<uint8_t> masks( boxes.size(), 0x80 );
+		tree.cull( make_span( std::as_const( views ).data(), std::as_const( views ).data() + nviews ), make_span( masks ) );
+
+		size_t nmismatches = 0;
+		for ( size_t i = 0; i < boxes.size(); ++i )
+		{
+			uint32_t expected = 0x80;
+			for ( size_t view_idx = 0; view_idx < nviews; ++view_idx )
+				expected |= uint32_t( intersects( views[view_idx], boxes[i] ) ) << view_idx;
+			nmismatches += masks[i] != expected;
+		}
+		BOOST_TEST( nmismatches == 0 );
+	}
+}
+
+BOOST_AUTO_TEST_CASE( subset_and_volume_queries )
+{
+	std::mt19937 rng( 5 );
+	const std::vector<aabb> boxes = make_random_boxes( 5000, 100.0f, rng );
+
+	// every third box stays out of the tree
+	std::vector<uint32_t> subset;
+	for ( uint32_t i = 0; i < boxes.size(); ++i )
+		if ( i % 3 != 0 )
+			subset.push_back( i );
+
+	bvh tree;
+	tree.build( make_span( std::as_const( boxes ) ), make_span( std::as_const( subset ) ) );
+	BOOST_TEST( tree.size() == subset.size() );
+
+	auto sorted = []( std::vector<uint32_t> indices ) { std::sort( indices.begin(), indices.end() ); return indices; };
+
+	const frustum f = make_test_frustum( { 0, 0, -150 } );
+	std::vector<uint32_t> expected;
+	for ( uint32_t i : subset )
+		if ( intersects( f, boxes[i] ) )
+			expected.push_back( i );
+	BOOST_TEST( cull_bvh( f, tree ) == expected, boost::test_tools::per_element() );
+
+	std::vector<uint8_t> masks( boxes.size(), 0 );
+	tree.cull( make_span( &f, &f + 1 ), make_span( masks ) );
+	size_t nmismatches = 0;
+	for ( uint32_t i = 0; i < boxes.size(); ++i )
+		nmismatches += masks[i] != uint8_t( i % 3 != 0 && intersects( f, boxes[i] ) );
+	BOOST_TEST( nmismatches == 0 );
+
+	for ( const aabb& volume : { aabb{ { -20, -20, -20 }, { 20, 20, 20 } }, aabb{ { 90, -100, 0 }, { 200, 100, 1 } } } )
+	{
+		std::vector<uint32_t> found;
+		tree.query( volume, [&found]( uint32_t idx ) { found.push_back( idx ); } );
+
+		expected.clear();
+		for ( uint32_t i : subset )
+			if ( intersects( volume, boxes[i] ) )
+				expected.push_back( i );
+		BOOST_TEST( ! expected.empty() );
+		BOOST_TEST( sorted( found ) == expected, boost::test_tools::per_element() );
+	}
+
+	for ( const sphere& volume : { sphere{ { 0, 0, 0 }, 25.0f }, sphere{ { 100, 100, 100 }, 30.0f } } )
+	{
+		std::vector<uint32_t> found;
+		tree.query( volume, [&found]( uint32_t idx ) { found.push_back( idx ); } );
+
+		expected.clear();
+		for ( uint32_t i : subset )
+			if ( intersects( volume, boxes[i] ) )
+				expected.push_back( i );
+		BOOST_TEST( ! expected.empty() );
+		BOOST_TEST( sorted( found ) == expected, boost::test_tools::per_element() );
+	}
+}
+
+BOOST_AUTO_TEST_CASE( raycast )
+{
+	std::mt19937 rng( 9 );
+	const std::vector<aabb> boxes = make_random_boxes( 5000, 100.0f, rng );
+
+	bvh tree;
+	tree.build( make_span( std::as_const( boxes ) ) );
+
+	std::uniform_real_distribution<float> pos( -100.0f, 100.0f );
+	size_t nmismatches = 0;
+	for ( int i = 0; i < 200; ++i )
+	{
+		ray r{ { pos( rng ), pos( rng ), -150.0f }, { pos( rng ) * 0.01f, pos( rng ) * 0.01f, 1.0f } };
+		r.t_max = i % 2 == 0 ? 200.0f : std::numeric_limits<float>::infinity();
+		const auto inv_dir = inverse_dir( r );
+
+		// every box on the ray, then the nearest one with the ray shortened by every hit
+		std::vector<uint32_t> expected;
+		float nearest_t = -1;
+		for ( uint32_t box_idx = 0; box_idx < boxes.size(); ++box_idx )
+		{
+			const float t = ray_distance( r, inv_dir, boxes[box_idx] );
+			if ( t < 0 )
+				continue;
+			expected.push_back( box_idx );
+			if ( nearest_t < 0 || t < nearest_t )
+				nearest_t = t;
+		}
+
+		std::vector<uint32_t> found;
+		tree.raycast( r, [&]( uint32_t idx, float ) { found.push_back( idx ); return std::numeric_limits<float>::infinity(); } );
+		std::sort( found.begin(), found.end() );
+		nmismatches += found != expected;
+
+		float found_t = -1;
+		tree.raycast( r, [&]( uint32_t, float t ) { found_t = found_t < 0 ? t : std::min( found_t, t ); return t; } );
+		nmismatches += found_t != nearest_t;
+
+		size_t ncalls = 0;
+		tree.raycast( r, [&]( uint32_t, float ) { ncalls++; return -1.0f; } );
+		nmismatches += ncalls != std::min<size_t>( expected.size(), 1 );
+	}
+	BOOST_TEST( nmismatches == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( degenerate_input )
+{
+	bvh tree;
+	tree.build( span<const aabb>() );
+	BOOST_TEST( cull_bvh( make_test_frustum( { 0, 0, 0 } ), tree ).empty() );
+
+	// identical boxes can't be split by SAH
+	std::vector<aabb> boxes( 1000, aabb{ { -1, -1, 5 }, { 1, 1, 6 } } );
+	tree.build( make_span( std::as_const( boxes ) ) );
+	BOOST_TEST( cull_bvh( make_test_frustum( { 0, 0, 0 } ), tree ).size() == 1000 );
+	BOOST_TEST( cull_bvh( make_test_frustum( { 0, 0, 10 } ), tree ).empty() );
+}
+
+BOOST_AUTO_TEST_CASE( shadow_caster_volume )
+{
+	// DirectX-style orthographic projection 20x20, depth [0, 50], light at the origin shining along +z
+	const matrix light_view_proj = { { 0.1f, 0, 0, 0 }, { 0, 0.1f, 0, 0 }, { 0, 0, 1.0f / 50.0f, 0 }, { 0, 0, 0, 1 } };
+	const frustum clip_volume = make_frustum( light_view_proj );
+	const frustum caster_volume = make_shadow_caster_volume( light_view_proj );
+
+	const aabb receiver{ { -1, -1, 20 }, { 1, 1, 21 } };
+	const aabb occluder_behind_light{ { -1, -1, -100 }, { 1, 1, -90 } };
+	const aabb beyond_far{ { -1, -1, 60 }, { 1, 1, 61 } };
+	const aabb aside{ { 30, -1, -100 }, { 31, 1, 21 } };
+
+	BOOST_TEST( intersects( caster_volume, receiver ) );
+	BOOST_TEST( ! intersects( clip_volume, occluder_behind_light ) );
+	BOOST_TEST( intersects( caster_volume, occluder_behind_light ) );
+	BOOST_TEST( ! intersects( caster_volume, beyond_far ) );
+	BOOST_TEST( ! intersects( caster_volume, aside ) );
+}
+
+// linear path does what SceneRenderer used to do every frame: transforms the local box of every instance and tests it
+BOOST_AUTO_TEST_CASE( benchmark, *boost::unit_test::disabled() )
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+	for ( size_t n : { 10'000, 100'000, 1'000'000 } )
+	{
+		std::mt19937 rng( 1 );
+		const float world_size = 10.0f * std::cbrt( float( n ) );
+		const std::vector<aabb> local_boxes = make_random_boxes( n, 1.0f, rng );
+		const std::vector<aabb> translations = make_random_boxes( n, world_size, rng );
+
+		std::vector<matrix> obj2world( n );
+		std::vector<aabb> world_boxes( n );
+		for ( size_t i = 0; i < n; ++i )
+		{
+			const auto pos = translations[i].center();
+			const matrix m = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { pos[0], pos[1], pos[2], 1 } };
+			std::copy( &m[0][0], &m[0][0] + 16, &obj2world[i][0][0] );
+			world_boxes[i] = transform( local_boxes[i], obj2world[i] );
+		}
+
+		const frustum f = make_test_frustum( { 0, 0, -world_size } );
+		constexpr int nruns = 10;
+
+		auto start = clock::now();
+		size_t nvisible_linear = 0;
+		for ( int run = 0; run < nruns; ++run )
+			for ( size_t i = 0; i < n; ++i )
+				nvisible_linear += intersects( f, transform( local_boxes[i], obj2world[i] ) );
+		const double linear_ms = ms_since( start ) / nruns;
+
+		bvh tree;
+		start = clock::now();
+		tree.build( make_span( std::as_const( world_boxes ) ) );
+		const double build_ms = ms_since( start );
+
+		start = clock::now();
+		tree.refit( make_span( std::as_const( world_boxes ) ) );
+		const double refit_ms = ms_since( start );
+
+		start = clock::now();
+		size_t nvisible_bvh = 0;
+		for ( int run = 0; run < nruns; ++run )
+			tree.cull( f, [&nvisible_bvh]( uint32_t ) { nvisible_bvh++; } );
+		const double bvh_ms = ms_since( start ) / nruns;
+
+		// main view plus four cascade-like ortho volumes, culled one by one and in one traversal
+		std::vector<frustum> views = { f };
+		for ( float offset : { -0.5f, -0.25f, 0.0f, 0.25f } )
+		{
+			const float scale = 1.0f / world_size;
+			const matrix ortho = { { scale, 0, 0, 0 }, { 0, scale, 0, 0 }, { 0, 0, scale, 0 }, { offset, 0, 0.5f, 1 } };
+			views.push_back( make_shadow_caster_volume( ortho ) );
+		}
+
+		std::vector<uint8_t> separate_masks( n );
+		start = clock::now();
+		for ( int run = 0; run < nruns; ++run )
+		{
+			std::fill( separate_masks.begin(), separate_masks.end(), 0 );
+			for ( uint32_t view_idx = 0; view_idx < views.size(); ++view_idx )
+				tree.cull( views[view_idx], [&separate_masks, view_idx]( uint32_t idx ) { separate_masks[idx] |= uint8_t( 1u << view_idx ); } );
+		}
+		const double separate_ms = ms_since( start ) / nruns;
+
+		std::vector<uint8_t> multi_masks( n );
+		start = clock::now();
+		for ( int run = 0; run < nruns; ++run )
+		{
+			std::fill( multi_masks.begin(), multi_masks.end(), 0 );
+			tree.cull( make_span( std::as_const( views ) ), make_span( multi_masks ) );
+		}
+		const double multi_ms = ms_since( start ) / nruns;
+
+		BOOST_TEST( nvisible_bvh == nvisible_linear );
+		BOOST_TEST( multi_masks == separate_masks );
+		BOOST_TEST_MESSAGE( n << " instances, " << nvisible_linear / nruns << " visible: linear " << linear_ms << " ms, bvh cull " << bvh_ms
+		                    << " ms, build " << build_ms << " ms, refit " << refit_ms << " ms, " << views.size() << " views separately "
+		                    << separate_ms << " ms, in one traversal " << multi_ms << " ms" );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/dense_bitset.h"
+
+BOOST_AUTO_TEST_SUITE( dense_bitset_tests )
+
+BOOST_AUTO_TEST_CASE( set_and_test )
+{
+	dense_bitset bits;
+	bits.resize( 130 );
+	BOOST_TEST( bits.words().size() == 3 );
+	BOOST_TEST( bits.count() == 0 );
+
+	bits.set( 0 );
+	bits.set( 63 );
+	bits.set( 64 );
+	bits.set( 129 );
+	BOOST_TEST( bits.test( 63 ) );
+	BOOST_TEST( bits.test( 64 ) );
+	BOOST_TEST( ! bits.test( 65 ) );
+	BOOST_TEST( bits.count() == 4 );
+
+	bits.set( 63, false );
+	BOOST_TEST( ! bits.test( 63 ) );
+	BOOST_TEST( bits.count() == 3 );
+
+	// shrinking drops the cut off bits, growing back brings zeros
+	bits.resize( 100 );
+	bits.resize( 130 );
+	BOOST_TEST( ! bits.test( 129 ) );
+	BOOST_TEST( bits.count() == 2 );
+
+	bits.reset();
+	BOOST_TEST( bits.size() == 130 );
+	BOOST_TEST( bits.count() == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( iteration )
+{
+	dense_bitset bits;
+	bits.resize( 200 );
+	const size_t set_bits[] = { 1, 5, 64, 127, 128, 199 };
+	for ( size_t idx : set_bits )
+		bits.set( idx );
+
+	std::vector<size_t> visited;
+	bits.for_each_set( [&visited]( size_t idx ) { visited.push_back( idx ); } );
+	BOOST_TEST( visited == std::vector<size_t>( std::begin( set_bits ), std::end( set_bits ) ), boost::test_tools::per_element() );
+
+	// intersection of two bitsets word by word
+	dense_bitset other;
+	other.resize( 200 );
+	other.set( 5 );
+	other.set( 128 );
+	other.set( 130 );
+
+	visited.clear();
+	for ( size_t i = 0; i < bits.words().size(); ++i )
+		for_each_set_bit( bits.words()[i] & other.words()[i], i, [&visited]( size_t idx ) { visited.push_back( idx ); } );
+	BOOST_TEST( visited.size() == 2 );
+	BOOST_TEST( visited[0] == 5 );
+	BOOST_TEST( visited[1] == 128 );
+
+	bits &= other;
+	BOOST_TEST( bits.count() == 2 );
+	BOOST_TEST( bits.test( 5 ) );
+	BOOST_TEST( bits.test( 128 ) );
+	BOOST_TEST( ! bits.test( 130 ) );
+
+	bits |= other;
+	BOOST_TEST( bits.count() == 3 );
+	BOOST_TEST( bits.test( 130 ) );
+}
+
+BOOST_AUTO_TEST_CASE( assign_masked )
+{
+	std::vector<uint8_t> view_masks( 150, 0 );
+	view_masks[0] = 0b001;
+	view_masks[63] = 0b011;
+	view_masks[64] = 0b110;
+	view_masks[149] = 0b010;
+
+	dense_bitset bits;
+	bits.assign_masked( make_span( std::as_const( view_masks ) ), 0b010 );
+	BOOST_TEST( bits.size() == 150 );
+	BOOST_TEST( bits.count() == 3 );
+	BOOST_TEST( bits.test( 63 ) );
+	BOOST_TEST( bits.test( 64 ) );
+	BOOST_TEST( bits.test( 149 ) );
+
+	// shrinking keeps the bits past size() cleared
+	view_masks.resize( 10 );
+	bits.assign_masked( make_span( std::as_const( view_masks ) ), 0b001 );
+	BOOST_TEST( bits.words().size() == 1 );
+	BOOST_TEST( bits.count() == 1 );
+	BOOST_TEST( bits.test( 0 ) );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,142 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/frustum_cull.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	// variants this cpu can run, the best one is always the widest
+	std::vector<cull_isa> supported_isas()
+	{
+		std::vector<cull_isa> res = { cull_isa::scalar };
+		if ( best_cull_isa() != cull_isa::scalar )
+			res.push_back( cull_isa::sse );
+		if ( best_cull_isa() == cull_isa::avx )
+			res.push_back( cull_isa::avx );
+		return res;
+	}
+
+	frustum make_perspective_frustum()
+	{
+		// DirectX-style left-handed perspective at the origin looking along +z, fov_y = 1, aspect = 1.5, near = 0.1, far = 200
+		const float ys = 1.0f / std::tan( 0.5f );
+		const float zs = 200.0f / ( 200.0f - 0.1f );
+		const float view_proj[4][4] = { { ys / 1.5f, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zs, 1 }, { 0, 0, -0.1f * zs, 0 } };
+		return make_frustum( view_proj );
+	}
+
+	// box [-5, 5]^3 with unnormalized integer planes, so boxes on an integer grid hit distance 0 exactly
+	frustum make_cube_frustum()
+	{
+		frustum res;
+		res.planes = { { { 1, 0, 0, 5 }, { -1, 0, 0, 5 }, { 0, 1, 0, 5 }, { 0, -1, 0, 5 }, { 0, 0, 1, 5 }, { 0, 0, -1, 5 } } };
+		return res;
+	}
+
+	void check_matches_scalar_test( const frustum& f, const aabb_soa& boxes, size_t first, size_t count )
+	{
+		std::vector<uint64_t> visibility( ( count + 63 ) / 64 + 1, ~uint64_t( 0 ) );
+		for ( cull_isa isa : supported_isas() )
+		{
+			frustum_cull( f, boxes, first, count, make_span( visibility ), isa );
+
+			size_t nmismatches = 0;
+			for ( size_t i = 0; i < count; ++i )
+			{
+				const bool is_visible = ( visibility[i / 64] >> ( i % 64 ) ) & 1;
+				nmismatches += is_visible != intersects( f, boxes.get( first + i ) );
+			}
+			BOOST_TEST( nmismatches == 0 );
+
+			// bits past count are cleared
+			if ( count % 64 != 0 )
+				BOOST_TEST( ( visibility[count / 64] >> ( count % 64 ) ) == 0 );
+		}
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( frustum_cull_tests )
+
+BOOST_AUTO_TEST_CASE( random_boxes )
+{
+	std::mt19937 rng( 7 );
+	std::uniform_real_distribution<float> pos( -150.0f, 150.0f );
+	std::uniform_real_distribution<float> extent( 0.0f, 10.0f );
+
+	aabb_soa boxes;
+	boxes.resize( 10000 );
+	for ( size_t i = 0; i < boxes.size(); ++i )
+		boxes.set( i, aabb::from_center_extents( { pos( rng ), pos( rng ), pos( rng ) }, { extent( rng ), extent( rng ), extent( rng ) } ) );
+
+	const frustum f = make_perspective_frustum();
+	check_matches_scalar_test( f, boxes, 0, boxes.size() );
+	// unaligned start and a tail which doesn't fill a batch
+	check_matches_scalar_test( f, boxes, 3, 61 );
+	check_matches_scalar_test( f, boxes, 17, 7 );
+	check_matches_scalar_test( f, boxes, 0, 0 );
+}
+
+BOOST_AUTO_TEST_CASE( boxes_touching_planes )
+{
+	aabb_soa boxes;
+	for ( int min_x = -7; min_x <= 7; ++min_x )
+		for ( int min_y = -7; min_y <= 7; ++min_y )
+			for ( int size : { 0, 1, 2 } )
+			{
+				const float lo = float( size == 0 ? -5 : -6 );
+				const size_t idx = boxes.size();
+				boxes.resize( idx + 1 );
+				boxes.set( idx, aabb{ { float( min_x ), float( min_y ), lo }, { float( min_x + size ), float( min_y + size ), lo + size } } );
+			}
+
+	const frustum f = make_cube_frustum();
+	check_matches_scalar_test( f, boxes, 0, boxes.size() );
+
+	// a box touching the plane from outside is visible, the closed test is inclusive
+	BOOST_TEST( intersects( f, aabb{ { 5, 0, 0 }, { 6, 1, 1 } } ) );
+	BOOST_TEST( ! intersects( f, aabb{ { 5.5f, 0, 0 }, { 6, 1, 1 } } ) );
+}
+
+BOOST_AUTO_TEST_CASE( benchmark, *boost::unit_test::disabled() )
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+	constexpr size_t nboxes = 1'000'000;
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<float> pos( -300.0f, 300.0f );
+	std::uniform_real_distribution<float> extent( 0.1f, 2.0f );
+
+	std::vector<aabb> aos_boxes( nboxes );
+	aabb_soa boxes;
+	boxes.resize( nboxes );
+	for ( size_t i = 0; i < nboxes; ++i )
+	{
+		aos_boxes[i] = aabb::from_center_extents( { pos( rng ), pos( rng ), pos( rng ) }, { extent( rng ), extent( rng ), extent( rng ) } );
+		boxes.set( i, aos_boxes[i] );
+	}
+
+	const frustum f = make_perspective_frustum();
+	constexpr int nruns = 20;
+
+	auto start = clock::now();
+	size_t nvisible = 0;
+	for ( int run = 0; run < nruns; ++run )
+		for ( const aabb& box : aos_boxes )
+			nvisible += intersects( f, box );
+	BOOST_TEST_MESSAGE( "aos intersects(): " << ms_since( start ) / nruns << " ms, " << nvisible / nruns << " visible of " << nboxes );
+
+	std::vector<uint64_t> visibility( ( nboxes + 63 ) / 64 );
+	const char* isa_names[] = { "scalar", "sse", "avx" };
+	for ( cull_isa isa : supported_isas() )
+	{
+		start = clock::now();
+		for ( int run = 0; run < nruns; ++run )
+			frustum_cull( f, boxes, 0, nboxes, make_span( visibility ), isa );
+		BOOST_TEST_MESSAGE( "frustum_cull " << isa_names[size_t( isa )] << ": " << ms_since( start ) / nruns << " ms" );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
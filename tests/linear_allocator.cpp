@@ -0,0 +1,94 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/linear_allocator.h"
+
+#include <vector>
+
+namespace
+{
+    // forwards to new_delete_resource and counts requests
+    class counting_resource : public std::pmr::memory_resource
+    {
+    public:
+        size_t nallocs = 0;
+        size_t nfrees = 0;
+
+    private:
+        void* do_allocate( size_t bytes, size_t alignment ) override
+        {
+            nallocs++;
+            return std::pmr::new_delete_resource()->allocate( bytes, alignment );
+        }
+        void do_deallocate( void* p, size_t bytes, size_t alignment ) override
+        {
+            nfrees++;
+            std::pmr::new_delete_resource()->deallocate( p, bytes, alignment );
+        }
+        bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override { return this == &other; }
+    };
+}
+
+BOOST_AUTO_TEST_SUITE( linear_allocator_tests )
+
+BOOST_AUTO_TEST_CASE( alignment_and_overflow )
+{
+    counting_resource upstream;
+    {
+        linear_allocator allocator( 256, &upstream );
+        BOOST_TEST( upstream.nallocs == 0 );
+
+        void* a = allocator.allocate( 3, 1 );
+        void* b = allocator.allocate( 8, 64 );
+        BOOST_TEST( ( reinterpret_cast<uintptr_t>( b ) % 64 ) == 0 );
+        BOOST_TEST( ( static_cast<char*>( b ) >= static_cast<char*>( a ) + 3 ) );
+        BOOST_TEST( upstream.nallocs == 1 );
+
+        // doesn't fit in the first chunk, a new one is chained
+        void* big = allocator.allocate( 1024, 16 );
+        BOOST_TEST( upstream.nallocs == 2 );
+        BOOST_TEST( ( reinterpret_cast<uintptr_t>( big ) % 16 ) == 0 );
+        BOOST_TEST( allocator.allocation_count() == 3 );
+
+        // earlier memory stays valid after overflow
+        std::memset( a, 0xab, 3 );
+        std::memset( big, 0xcd, 1024 );
+        BOOST_TEST( static_cast<unsigned char*>( a )[2] == 0xab );
+    }
+    BOOST_TEST( upstream.nfrees == upstream.nallocs );
+}
+
+BOOST_AUTO_TEST_CASE( frame_reset )
+{
+    counting_resource upstream;
+    linear_allocator allocator( 128, &upstream );
+
+    auto simulate_frame = [&]()
+    {
+        std::pmr::vector<int> items( &allocator );
+        for ( int i = 0; i < 1000; ++i )
+            items.push_back( i );
+        std::pmr::vector<double> other( 500, 1.0, &allocator );
+        BOOST_TEST( items[999] == 999 );
+        BOOST_TEST( other[499] == 1.0 );
+    };
+
+    simulate_frame();
+    BOOST_TEST( upstream.nallocs > 1 ); // vector growth overflowed the initial chunk
+
+    allocator.reset();
+    BOOST_TEST( allocator.allocation_count() == 0 );
+    BOOST_TEST( allocator.bytes_allocated() == 0 );
+
+    // chain was merged into one chunk, steady-state frames don't go upstream
+    const size_t nallocs_after_warmup = upstream.nallocs;
+    for ( int frame = 0; frame < 10; ++frame )
+    {
+        simulate_frame();
+        BOOST_TEST( allocator.allocation_count() > 0 );
+        allocator.reset();
+    }
+    BOOST_TEST( upstream.nallocs == nallocs_after_warmup );
+    BOOST_TEST( upstream.nallocs - upstream.nfrees == 1 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
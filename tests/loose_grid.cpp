@@ -0,0 +1,276 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/loose_grid.h"
+#include "../src/utils/bvh.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	using matrix = float[4][4];
+
+	// DirectX-style left-handed perspective looking along +z from pos
+	frustum make_test_frustum( const std::array<float, 3>& pos )
+	{
+		const float ys = 1.0f / std::tan( 0.5f );
+		const float zs = 200.0f / ( 200.0f - 0.1f );
+		const matrix view_proj = { { ys / 1.5f, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zs, 1 },
+		                           { -pos[0] * ys / 1.5f, -pos[1] * ys, -pos[2] * zs - 0.1f * zs, -pos[2] } };
+		return make_frustum( view_proj );
+	}
+
+	aabb make_random_box( float world_size, float max_extent, std::mt19937& rng )
+	{
+		std::uniform_real_distribution<float> pos( -world_size, world_size );
+		std::uniform_real_distribution<float> extent( 0.1f, max_extent );
+		return aabb::from_center_extents( { pos( rng ), pos( rng ), pos( rng ) }, { extent( rng ), extent( rng ), extent( rng ) } );
+	}
+
+	std::vector<uint32_t> sorted( std::vector<uint32_t> indices )
+	{
+		std::sort( indices.begin(), indices.end() );
+		return indices;
+	}
+
+	// boxes which are not in the grid are empty
+	template<typename Volume>
+	std::vector<uint32_t> query_linear( const Volume& volume, const std::vector<aabb>& boxes, const std::vector<bool>& is_inserted )
+	{
+		std::vector<uint32_t> res;
+		for ( uint32_t i = 0; i < boxes.size(); ++i )
+			if ( is_inserted[i] && intersects( volume, boxes[i] ) )
+				res.push_back( i );
+		return res;
+	}
+
+	template<typename Volume>
+	std::vector<uint32_t> query_grid( const Volume& volume, const loose_grid& grid )
+	{
+		std::vector<uint32_t> res;
+		grid.query( volume, [&res]( uint32_t idx ) { res.push_back( idx ); } );
+		return sorted( std::move( res ) );
+	}
+
+	std::vector<uint32_t> cull_grid( const frustum& f, const loose_grid& grid )
+	{
+		std::vector<uint32_t> res;
+		grid.cull( f, [&res]( uint32_t idx ) { res.push_back( idx ); } );
+		return sorted( std::move( res ) );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( loose_grid_tests )
+
+BOOST_AUTO_TEST_CASE( matches_linear_queries )
+{
+	std::mt19937 rng( 7 );
+	constexpr uint32_t n = 3000;
+
+	// mostly boxes fitting the cells, some which don't
+	std::vector<aabb> boxes( n );
+	std::vector<bool> is_inserted( n, false );
+	loose_grid grid( 8.0f );
+	for ( uint32_t i = 0; i < n; ++i )
+		if ( i % 4 != 0 )
+		{
+			boxes[i] = make_random_box( 100.0f, i % 50 == 1 ? 20.0f : 4.0f, rng );
+			grid.insert( i, boxes[i] );
+			is_inserted[i] = true;
+		}
+	BOOST_TEST( grid.size() == n - n / 4 );
+	BOOST_TEST( grid.oversized_count() > 0 );
+
+	std::uniform_int_distribution<uint32_t> box_idx( 0, n - 1 );
+	std::uniform_real_distribution<float> shift( -3.0f, 3.0f );
+	std::uniform_int_distribution<int> action( 0, 9 );
+	for ( int frame = 0; frame < 20; ++frame )
+	{
+		// boxes drift, sometimes jump far away, leave the grid or come back
+		for ( int change = 0; change < 300; ++change )
+		{
+			const uint32_t idx = box_idx( rng );
+			const int cur_action = action( rng );
+			if ( ! is_inserted[idx] )
+			{
+				boxes[idx] = make_random_box( 100.0f, 4.0f, rng );
+				grid.insert( idx, boxes[idx] );
+				is_inserted[idx] = true;
+			}
+			else if ( cur_action == 0 )
+			{
+				grid.remove( idx );
+				is_inserted[idx] = false;
+			}
+			else
+			{
+				const float offset[3] = { shift( rng ), shift( rng ), shift( rng ) };
+				boxes[idx] = cur_action == 1 ? make_random_box( 100.0f, 16.0f, rng )
+				                             : aabb{ { boxes[idx].min[0] + offset[0], boxes[idx].min[1] + offset[1], boxes[idx].min[2] + offset[2] },
+				                                     { boxes[idx].max[0] + offset[0], boxes[idx].max[1] + offset[1], boxes[idx].max[2] + offset[2] } };
+				grid.move( idx, boxes[idx] );
+			}
+		}
+
+		BOOST_TEST( grid.size() == size_t( std::count( is_inserted.begin(), is_inserted.end(), true ) ) );
+		size_t nbox_mismatches = 0;
+		for ( uint32_t i = 0; i < n; ++i )
+		{
+			BOOST_TEST( grid.contains( i ) == is_inserted[i] );
+			if ( is_inserted[i] )
+				nbox_mismatches += grid.box( i ).min != boxes[i].min || grid.box( i ).max != boxes[i].max;
+		}
+		BOOST_TEST( nbox_mismatches == 0 );
+
+		// small volumes are looked up by cell coordinates, large ones walk every cell
+		for ( const aabb& volume : { aabb{ { -5, -5, -5 }, { 5, 5, 5 } }, aabb{ { -60, -10, 20 }, { 60, 30, 90 } }, aabb{ { -200, -200, -200 }, { 200, 200, 200 } } } )
+			BOOST_TEST( query_grid( volume, grid ) == query_linear( volume, boxes, is_inserted ), boost::test_tools::per_element() );
+
+		for ( const sphere& volume : { sphere{ { 10, 0, -10 }, 3.0f }, sphere{ { 0, 50, 0 }, 40.0f } } )
+			BOOST_TEST( query_grid( volume, grid ) == query_linear( volume, boxes, is_inserted ), boost::test_tools::per_element() );
+
+		for ( const ray& r : { ray{ { -150, 1, 2 }, { 1, 0.01f, -0.02f } }, ray{ { 0, 0, 0 }, { 0.3f, 0.2f, 1 }, 50.0f } } )
+		{
+			std::vector<uint32_t> found;
+			grid.raycast( r, [&found]( uint32_t idx, float ) { found.push_back( idx ); return std::numeric_limits<float>::infinity(); } );
+
+			std::vector<uint32_t> expected;
+			for ( uint32_t i = 0; i < n; ++i )
+				if ( is_inserted[i] && ray_distance( r, inverse_dir( r ), boxes[i] ) >= 0 )
+					expected.push_back( i );
+			BOOST_TEST( sorted( found ) == expected, boost::test_tools::per_element() );
+		}
+
+		std::vector<frustum> views;
+		for ( const auto& pos : { std::array<float, 3>{ 0, 0, -150 }, std::array<float, 3>{ 0, 0, 0 }, std::array<float, 3>{ 50, -20, -60 } } )
+		{
+			views.push_back( make_test_frustum( pos ) );
+			BOOST_TEST( cull_grid( views.back(), grid ) == query_linear( views.back(), boxes, is_inserted ), boost::test_tools::per_element() );
+		}
+
+		// bits past the views are kept
+		std::vector<uint8_t> masks( n, 0x80 );
+		grid.cull( make_span( std::as_const( views ) ), make_span( masks ) );
+		size_t nmask_mismatches = 0;
+		for ( uint32_t i = 0; i < n; ++i )
+		{
+			uint32_t expected = 0x80;
+			for ( size_t view_idx = 0; view_idx < views.size(); ++view_idx )
+				expected |= uint32_t( is_inserted[i] && intersects( views[view_idx], boxes[i] ) ) << view_idx;
+			nmask_mismatches += masks[i] != expected;
+		}
+		BOOST_TEST( nmask_mismatches == 0 );
+	}
+}
+
+BOOST_AUTO_TEST_CASE( cells_follow_boxes )
+{
+	loose_grid grid( 10.0f );
+	BOOST_TEST( grid.cell_count() == 0 );
+
+	// moving inside a cell keeps it, crossing a border moves the box into a new cell and drops the empty one
+	grid.insert( 0, aabb{ { 1, 1, 1 }, { 2, 2, 2 } } );
+	grid.insert( 5, aabb{ { 3, 3, 3 }, { 4, 4, 4 } } );
+	BOOST_TEST( grid.cell_count() == 1 );
+	grid.move( 0, aabb{ { 6, 6, 6 }, { 7, 7, 7 } } );
+	BOOST_TEST( grid.cell_count() == 1 );
+	grid.move( 0, aabb{ { 16, 6, 6 }, { 17, 7, 7 } } );
+	BOOST_TEST( grid.cell_count() == 2 );
+	grid.remove( 5 );
+	BOOST_TEST( grid.cell_count() == 1 );
+	BOOST_TEST( grid.size() == 1 );
+
+	// a box sticking out of its cell by less than the cell size is found from the neighbouring cells
+	grid.move( 0, aabb{ { 11, -5, -5 }, { 28, 5, 5 } } );
+	BOOST_TEST( grid.oversized_count() == 0 );
+	BOOST_TEST( query_grid( aabb{ { 27, 0, 0 }, { 27.5f, 1, 1 } }, grid ) == std::vector<uint32_t>{ 0 }, boost::test_tools::per_element() );
+	BOOST_TEST( query_grid( sphere{ { 31, 0, 0 }, 2.0f }, grid ).empty() );
+
+	// too large and too far boxes are kept aside
+	grid.move( 0, aabb{ { -50, 0, 0 }, { 50, 1, 1 } } );
+	grid.insert( 1, aabb{ { 1e30f, 0, 0 }, { 1e30f, 1, 1 } } );
+	BOOST_TEST( grid.oversized_count() == 2 );
+	BOOST_TEST( grid.cell_count() == 0 );
+	BOOST_TEST( query_grid( aabb{ { 45, 0, 0 }, { 46, 1, 1 } }, grid ) == std::vector<uint32_t>{ 0 }, boost::test_tools::per_element() );
+	BOOST_TEST( query_grid( aabb{ { 1e30f, 0, 0 }, { 1e30f, 1, 1 } }, grid ) == std::vector<uint32_t>{ 1 }, boost::test_tools::per_element() );
+
+	grid.move( 0, aabb{ { 1, 1, 1 }, { 2, 2, 2 } } );
+	BOOST_TEST( grid.oversized_count() == 1 );
+	BOOST_TEST( grid.cell_count() == 1 );
+
+	grid.reset( 4.0f );
+	BOOST_TEST( grid.size() == 0 );
+	BOOST_TEST( grid.cell_count() == 0 );
+	BOOST_TEST( ! grid.contains( 0 ) );
+}
+
+// a static world in a bvh and a few hundred moving boxes, either refitted in the same bvh or moved in the grid
+BOOST_AUTO_TEST_CASE( benchmark, *boost::unit_test::disabled() )
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+	for ( size_t nstatic : { 100'000, 1'000'000 } )
+	{
+		constexpr uint32_t ndynamic = 500;
+		constexpr int nframes = 20;
+
+		std::mt19937 rng( 1 );
+		const float world_size = 10.0f * std::cbrt( float( nstatic ) );
+		std::vector<aabb> boxes( nstatic + ndynamic );
+		for ( auto& box : boxes )
+			box = make_random_box( world_size, 2.0f, rng );
+
+		std::vector<uint32_t> static_indices( nstatic );
+		std::iota( static_indices.begin(), static_indices.end(), 0 );
+
+		bvh everything;
+		everything.build( make_span( std::as_const( boxes ) ) );
+		bvh static_world;
+		static_world.build( make_span( std::as_const( boxes ) ), make_span( std::as_const( static_indices ) ) );
+		loose_grid grid( 8.0f );
+		for ( uint32_t i = nstatic; i < boxes.size(); ++i )
+			grid.insert( i, boxes[i] );
+
+		auto move_dynamic = [&]( int frame )
+		{
+			for ( uint32_t i = uint32_t( nstatic ); i < boxes.size(); ++i )
+				for ( size_t axis = 0; axis < 3; ++axis )
+				{
+					const float offset = ( ( i + frame ) % 2 ? 0.5f : -0.5f );
+					boxes[i].min[axis] += offset;
+					boxes[i].max[axis] += offset;
+				}
+		};
+
+		const frustum f = make_test_frustum( { 0, 0, -world_size } );
+
+		auto start = clock::now();
+		size_t nvisible_refit = 0;
+		for ( int frame = 0; frame < nframes; ++frame )
+		{
+			move_dynamic( frame );
+			everything.refit( make_span( std::as_const( boxes ) ) );
+			everything.cull( f, [&nvisible_refit]( uint32_t ) { nvisible_refit++; } );
+		}
+		const double refit_ms = ms_since( start ) / nframes;
+
+		start = clock::now();
+		size_t nvisible_grid = 0;
+		for ( int frame = 0; frame < nframes; ++frame )
+		{
+			move_dynamic( frame );
+			for ( uint32_t i = uint32_t( nstatic ); i < boxes.size(); ++i )
+				grid.move( i, boxes[i] );
+			static_world.cull( f, [&nvisible_grid]( uint32_t ) { nvisible_grid++; } );
+			grid.cull( f, [&nvisible_grid]( uint32_t ) { nvisible_grid++; } );
+		}
+		const double grid_ms = ms_since( start ) / nframes;
+
+		BOOST_TEST( nvisible_refit == nvisible_grid );
+		BOOST_TEST_MESSAGE( nstatic << " static, " << ndynamic << " moving boxes, per frame: refit whole bvh + cull " << refit_ms
+		                    << " ms, move in grid + cull both " << grid_ms << " ms" );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,209 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/occlusion_buffer.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	using matrix = float[4][4];
+
+	// DirectX-style left-handed perspective at the origin looking along +z, fov_y = 1, aspect = 1.5, near = 0.1, far = 200
+	void make_view_proj( matrix& res )
+	{
+		const float ys = 1.0f / std::tan( 0.5f );
+		const float zs = 200.0f / ( 200.0f - 0.1f );
+		const matrix proj = { { ys / 1.5f, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zs, 1 }, { 0, 0, -0.1f * zs, 0 } };
+		std::copy( &proj[0][0], &proj[0][0] + 16, &res[0][0] );
+	}
+
+	void make_translation( float x, float y, float z, matrix& res )
+	{
+		const matrix m = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { x, y, z, 1 } };
+		std::copy( &m[0][0], &m[0][0] + 16, &res[0][0] );
+	}
+
+	// square [-half_size, half_size]^2 in the z = 0 plane, split into n x n quads
+	struct grid_mesh
+	{
+		std::vector<float> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	grid_mesh make_grid( float half_size, uint32_t n )
+	{
+		grid_mesh res;
+		for ( uint32_t y = 0; y <= n; ++y )
+			for ( uint32_t x = 0; x <= n; ++x )
+				res.positions.insert( res.positions.end(), { -half_size + 2 * half_size * x / n, -half_size + 2 * half_size * y / n, 0.0f } );
+
+		for ( uint32_t y = 0; y < n; ++y )
+			for ( uint32_t x = 0; x < n; ++x )
+			{
+				const uint32_t v = y * ( n + 1 ) + x;
+				res.indices.insert( res.indices.end(), { v, v + 1, v + n + 1, v + 1, v + n + 2, v + n + 1 } );
+			}
+		return res;
+	}
+
+	occlusion_buffer::occluder make_occluder( const grid_mesh& mesh, float x, float y, float z )
+	{
+		occlusion_buffer::occluder res;
+		res.positions = mesh.positions.data();
+		res.vertex_stride = 3;
+		res.indices = make_span( mesh.indices );
+		make_translation( x, y, z, res.obj2world );
+		return res;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( occlusion_buffer_tests )
+
+BOOST_AUTO_TEST_CASE( occludes_boxes_behind )
+{
+	matrix view_proj;
+	make_view_proj( view_proj );
+
+	// 10x10 wall at z = 10, covers |x| / z <= 0.5 on screen
+	const grid_mesh wall = make_grid( 5, 1 );
+	const occlusion_buffer::occluder occluders[] = { make_occluder( wall, 0, 0, 10 ) };
+
+	occlusion_buffer buffer;
+	buffer.resize( 96, 64 );
+	BOOST_TEST( buffer.rasterize( view_proj, make_span( occluders ) ) == 2 );
+
+	BOOST_TEST( buffer.is_occluded( aabb{ { -1, -1, 20 }, { 1, 1, 21 } } ) );
+	BOOST_TEST( buffer.is_occluded( aabb{ { 3, 3, 30 }, { 5, 5, 40 } } ) );
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { -1, -1, 5 }, { 1, 1, 6 } } ) ); // in front
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { -1, -1, 9 }, { 1, 1, 11 } } ) ); // pierces the wall
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { 12, -1, 20 }, { 14, 1, 21 } } ) ); // beside
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { 8, -1, 20 }, { 12, 1, 21 } } ) ); // partially behind
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { -1, -1, -1 }, { 1, 1, 1 } } ) ); // crosses the near plane
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { -1, -1, -30 }, { 1, 1, -20 } } ) ); // behind the camera
+
+	// nothing is occluded by an empty buffer
+	buffer.rasterize( view_proj, span<const occlusion_buffer::occluder>() );
+	BOOST_TEST( ! buffer.is_occluded( aabb{ { -1, -1, 20 }, { 1, 1, 21 } } ) );
+}
+
+BOOST_AUTO_TEST_CASE( pyramid_holds_max_depth )
+{
+	matrix view_proj;
+	make_view_proj( view_proj );
+
+	const grid_mesh wall = make_grid( 5, 4 );
+	const occlusion_buffer::occluder occluders[] = { make_occluder( wall, -3, 1, 10 ), make_occluder( wall, 4, -2, 25 ) };
+
+	// odd sizes, so the last texel of a row has a single child
+	occlusion_buffer buffer;
+	buffer.resize( 75, 41 );
+	buffer.rasterize( view_proj, make_span( occluders ) );
+
+	BOOST_TEST( buffer.level_width( buffer.level_count() - 1 ) == 1 );
+	BOOST_TEST( buffer.level_height( buffer.level_count() - 1 ) == 1 );
+
+	size_t nmismatches = 0;
+	for ( uint32_t k = 1; k < buffer.level_count(); ++k )
+		for ( uint32_t y = 0; y < buffer.level_height( k ); ++y )
+			for ( uint32_t x = 0; x < buffer.level_width( k ); ++x )
+			{
+				float expected = 0;
+				for ( uint32_t sy = 2 * y; sy <= std::min( 2 * y + 1, buffer.level_height( k - 1 ) - 1 ); ++sy )
+					for ( uint32_t sx = 2 * x; sx <= std::min( 2 * x + 1, buffer.level_width( k - 1 ) - 1 ); ++sx )
+						expected = std::max( expected, buffer.depth( k - 1, sx, sy ) );
+				nmismatches += buffer.depth( k, x, y ) != expected;
+			}
+	BOOST_TEST( nmismatches == 0 );
+
+	// the center is covered, the screen corners are not
+	BOOST_TEST( buffer.depth( 0, 37, 20 ) < 1.0f );
+	BOOST_TEST( buffer.depth( 0, 0, 0 ) == 1.0f );
+	BOOST_TEST( buffer.depth( buffer.level_count() - 1, 0, 0 ) == 1.0f );
+}
+
+BOOST_AUTO_TEST_CASE( same_result_for_any_thread_count )
+{
+	matrix view_proj;
+	make_view_proj( view_proj );
+
+	std::mt19937 rng( 5 );
+	std::uniform_real_distribution<float> pos( -20.0f, 20.0f );
+	std::uniform_real_distribution<float> depth( 5.0f, 60.0f );
+
+	const grid_mesh wall = make_grid( 3, 3 );
+	std::vector<occlusion_buffer::occluder> occluders;
+	for ( int i = 0; i < 40; ++i )
+		occluders.push_back( make_occluder( wall, pos( rng ), pos( rng ), depth( rng ) ) );
+
+	occlusion_buffer reference;
+	reference.resize( 128, 80 );
+	worker_pool inline_pool( 0 );
+	reference.rasterize( view_proj, make_span( std::as_const( occluders ) ), inline_pool );
+
+	occlusion_buffer buffer;
+	buffer.resize( 128, 80 );
+	worker_pool pool( 3 );
+	buffer.rasterize( view_proj, make_span( std::as_const( occluders ) ), pool );
+
+	size_t nmismatches = 0;
+	size_t ncovered = 0;
+	for ( uint32_t y = 0; y < buffer.height(); ++y )
+		for ( uint32_t x = 0; x < buffer.width(); ++x )
+		{
+			nmismatches += buffer.depth( 0, x, y ) != reference.depth( 0, x, y );
+			ncovered += buffer.depth( 0, x, y ) < 1.0f;
+		}
+	BOOST_TEST( nmismatches == 0 );
+	BOOST_TEST( ncovered > 0 );
+}
+
+BOOST_AUTO_TEST_CASE( benchmark, *boost::unit_test::disabled() )
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+	matrix view_proj;
+	make_view_proj( view_proj );
+
+	std::mt19937 rng( 1 );
+	std::uniform_real_distribution<float> spread( -40.0f, 40.0f );
+	std::uniform_real_distribution<float> occluder_depth( 10.0f, 50.0f );
+	std::uniform_real_distribution<float> box_depth( 5.0f, 200.0f );
+	std::uniform_real_distribution<float> extent( 0.2f, 2.0f );
+
+	// 64 walls of 2k triangles each
+	const grid_mesh wall = make_grid( 6, 32 );
+	std::vector<occlusion_buffer::occluder> occluders;
+	for ( int i = 0; i < 64; ++i )
+		occluders.push_back( make_occluder( wall, spread( rng ), spread( rng ) * 0.5f, occluder_depth( rng ) ) );
+
+	std::vector<aabb> boxes( 100'000 );
+	for ( aabb& box : boxes )
+	{
+		const float z = box_depth( rng );
+		box = aabb::from_center_extents( { spread( rng ) * z / 40.0f, spread( rng ) * z / 80.0f, z }, { extent( rng ), extent( rng ), extent( rng ) } );
+	}
+
+	occlusion_buffer buffer;
+	buffer.resize( 256, 128 );
+
+	constexpr int nruns = 10;
+	auto start = clock::now();
+	size_t ntriangles = 0;
+	for ( int run = 0; run < nruns; ++run )
+		ntriangles = buffer.rasterize( view_proj, make_span( std::as_const( occluders ) ) );
+	const double rasterize_ms = ms_since( start ) / nruns;
+
+	start = clock::now();
+	size_t noccluded = 0;
+	for ( int run = 0; run < nruns; ++run )
+		for ( const aabb& box : boxes )
+			noccluded += buffer.is_occluded( box );
+	const double test_ms = ms_since( start ) / nruns;
+
+	BOOST_TEST_MESSAGE( ntriangles << " occluder triangles rasterized in " << rasterize_ms << " ms, " << boxes.size() << " boxes tested in "
+	                    << test_ms << " ms, " << noccluded / nruns << " occluded" );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
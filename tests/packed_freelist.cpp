@@ -50,6 +50,11 @@ BOOST_AUTO_TEST_CASE( lookup_and_modification )
 
 	lst[id4] = 10;
 	BOOST_TEST( lst.get( id4 ) == 10 );
+
+	// erase of the first element moves the last one into its place
+	lst.erase( id3 );
+	BOOST_TEST( lst.get( id4 ) == 10 );
+	BOOST_TEST( lst.get( id5 ) == 5 );
 }
 
 BOOST_AUTO_TEST_CASE( clear )
@@ -118,5 +123,93 @@ BOOST_AUTO_TEST_CASE( spans )
 	BOOST_TEST( span_copy[1] == 3 );
 }
 
+BOOST_AUTO_TEST_CASE( ranges )
+{
+	packed_freelist<std::string> lst;
+
+	using id = decltype( lst )::id;
+
+	id single_id = lst.insert( "single" );
+
+	std::string elems[] = { "a", "b", "c" };
+	id ids_storage[4];
+	span<id> ids = lst.insert_range( make_span( elems ), make_span( ids_storage ) );
+	BOOST_TEST( ids.size() == 3 );
+	BOOST_TEST( lst[ids[0]] == "a" );
+	BOOST_TEST( lst[ids[2]] == "c" );
+
+	const id erased[] = { ids[0], single_id };
+	lst.erase_range( make_span( erased ) );
+	BOOST_TEST( lst.size() == 2 );
+	BOOST_TEST( !lst.has( single_id ) );
+	BOOST_TEST( lst[ids[1]] == "b" );
+	BOOST_TEST( lst[ids[2]] == "c" );
+
+	// freed slots are reused
+	id copies_storage[4];
+	span<id> copies = lst.emplace_n( 4, make_span( copies_storage ), 2, 'x' );
+	BOOST_TEST( copies.size() == 4 );
+	for ( id copy_id : copies )
+		BOOST_TEST( lst[copy_id] == "xx" );
+	BOOST_TEST( lst.size() == 6 );
+	BOOST_TEST( lst[ids[2]] == "c" );
+}
+
+BOOST_AUTO_TEST_CASE( layout_restore )
+{
+	packed_freelist<std::string> lst;
+
+	using id = decltype( lst )::id;
+
+	id id1 = lst.insert( "one" );
+	id id2 = lst.insert( "two" );
+	id id3 = lst.insert( "three" );
+	lst.erase( id1 );
+
+	std::vector<std::string> elems( lst.begin(), lst.end() );
+	packed_freelist<std::string> restored;
+	BOOST_TEST( restored.restore( lst.get_layout(), make_span( elems ) ) );
+	BOOST_TEST( !restored.has( id1 ) );
+	BOOST_TEST( restored[id2] == "two" );
+	BOOST_TEST( restored[id3] == "three" );
+	BOOST_TEST( ( restored.insert( "four" ) == lst.insert( "four" ) ) );
+
+	// layout must match the elements
+	std::vector<std::string> too_few = { "two" };
+	BOOST_TEST( !restored.restore( lst.get_layout(), make_span( too_few ) ) );
+	BOOST_TEST( restored.size() == 3 );
+}
+
+BOOST_AUTO_TEST_CASE( reordering )
+{
+	packed_freelist<int> lst;
+
+	using id = decltype( lst )::id;
+
+	id id5 = lst.insert( 5 );
+	id id3 = lst.insert( 3 );
+	id id9 = lst.insert( 9 );
+	id id1 = lst.insert( 1 );
+	lst.erase( id9 );
+
+	lst.sort_packed( []( int elem ) { return elem; } );
+	const auto elems = lst.get_elems();
+	BOOST_TEST( elems.size() == 3 );
+	BOOST_TEST( elems[0] == 1 );
+	BOOST_TEST( elems[1] == 3 );
+	BOOST_TEST( elems[2] == 5 );
+	BOOST_TEST( lst[id5] == 5 );
+	BOOST_TEST( lst[id1] == 1 );
+
+	const uint32_t reversed[] = { 2, 1, 0 };
+	lst.reorder( make_span( reversed ) );
+	BOOST_TEST( lst.get_elems()[0] == 5 );
+	BOOST_TEST( lst[id3] == 3 );
+
+	// erase after reordering patches the right slot
+	lst.erase( id5 );
+	BOOST_TEST( lst[id1] == 1 );
+	BOOST_TEST( lst[id3] == 3 );
+}
 
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
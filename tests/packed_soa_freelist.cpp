@@ -0,0 +1,180 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/packed_soa_freelist.h"
+
+BOOST_AUTO_TEST_SUITE( packed_soa_freelist_tests )
+
+BOOST_AUTO_TEST_CASE( creation )
+{
+	packed_soa_freelist<int, float> lst;
+
+	using id = decltype( lst )::id;
+
+	id elem_id = lst.insert( 3, 0.5f );
+	id elem2_id = lst.insert( 2, 1.5f );
+
+	BOOST_TEST( lst.get<0>( elem_id ) == 3 );
+	BOOST_TEST( lst.get<float>( elem_id ) == 0.5f );
+	BOOST_TEST( lst.get<int>( elem2_id ) == 2 );
+	BOOST_TEST( lst.get<1>( elem2_id ) == 1.5f );
+}
+
+BOOST_AUTO_TEST_CASE( lookup_and_modification )
+{
+	packed_soa_freelist<int, std::string> lst;
+
+	using id = decltype( lst )::id;
+
+	id id3 = lst.insert( 3, "three" );
+	id id2 = lst.insert( 2, "two" );
+	id id4 = lst.insert( 4, "four" );
+
+	// erasing an element from the middle moves the last one, all other ids must stay valid
+	lst.erase( id3 );
+	BOOST_TEST( !lst.has( id3 ) );
+	BOOST_TEST( lst.has( id2 ) );
+	BOOST_TEST( lst.has( id4 ) );
+	BOOST_TEST( lst.get<int>( id4 ) == 4 );
+	BOOST_TEST( lst.get<std::string>( id4 ) == "four" );
+	BOOST_TEST( lst.get<int>( id2 ) == 2 );
+	BOOST_TEST( lst.get<std::string>( id2 ) == "two" );
+
+	id id5 = lst.insert( 5, "five" );
+	BOOST_TEST( lst.has( id5 ) );
+	BOOST_TEST( !lst.has( id3 ) );
+
+	BOOST_TEST( ! lst.try_get<int>( id3 ) );
+	const std::string* elem5 = lst.try_get<1>( id5 );
+	BOOST_TEST( ( elem5 && ( *elem5 == "five" ) ) );
+
+	lst.get<int>( id4 ) = 10;
+	BOOST_TEST( lst.get<0>( id4 ) == 10 );
+	BOOST_TEST( lst.size() == 3 );
+}
+
+BOOST_AUTO_TEST_CASE( clear )
+{
+	packed_soa_freelist<int, double> lst;
+
+	using id = decltype( lst )::id;
+
+	id id3 = lst.insert( 3, 3.0 );
+	id id2 = lst.insert( 2, 2.0 );
+
+	lst.clear();
+	BOOST_TEST( !lst.has( id2 ) );
+	BOOST_TEST( !lst.has( id3 ) );
+	BOOST_TEST( lst.get_column<int>().size() == 0 );
+
+	id id5 = lst.insert( 5, 5.0 );
+	BOOST_TEST( lst.has( id5 ) );
+	BOOST_TEST( !lst.has( id2 ) );
+	BOOST_TEST( !lst.has( id3 ) );
+}
+
+BOOST_AUTO_TEST_CASE( columns )
+{
+	packed_soa_freelist<int, float> lst;
+
+	using id = decltype( lst )::id;
+
+	id id1 = lst.insert( 1, 10.0f );
+	id id2 = lst.insert( 2, 20.0f );
+	id id3 = lst.insert( 3, 30.0f );
+	lst.erase( id1 );
+
+	auto ints = lst.get_column<int>();
+	auto floats = lst.get_column<1>();
+	BOOST_TEST( ints.size() == 2 );
+	BOOST_TEST( floats.size() == 2 );
+
+	// columns stay aligned after erase
+	for ( size_t i = 0; i < ints.size(); ++i )
+		BOOST_TEST( floats[i] == float( ints[i] * 10 ) );
+
+	for ( auto& elem : ints )
+		elem = 7;
+
+	BOOST_TEST( lst.get<int>( id2 ) == 7 );
+	BOOST_TEST( lst.get<int>( id3 ) == 7 );
+}
+
+BOOST_AUTO_TEST_CASE( stable_sort )
+{
+	packed_soa_freelist<int, std::string> lst;
+
+	using id = decltype( lst )::id;
+
+	id id2 = lst.insert( 2, "two" );
+	id id1 = lst.insert( 1, "one" );
+	id id3 = lst.insert( 3, "three" );
+	id id1b = lst.insert( 1, "another one" );
+	lst.erase( id3 );
+
+	lst.stable_sort<int>( []( int lhs, int rhs ) { return lhs < rhs; } );
+
+	auto ints = lst.get_column<int>();
+	auto strings = lst.get_column<std::string>();
+	BOOST_TEST( ints.size() == 3 );
+	BOOST_TEST( ints[0] == 1 );
+	BOOST_TEST( strings[0] == "one" );
+	BOOST_TEST( ints[1] == 1 );
+	BOOST_TEST( strings[1] == "another one" );
+	BOOST_TEST( ints[2] == 2 );
+
+	// ids survive reordering
+	BOOST_TEST( lst.get<std::string>( id1 ) == "one" );
+	BOOST_TEST( lst.get<std::string>( id1b ) == "another one" );
+	BOOST_TEST( lst.get<std::string>( id2 ) == "two" );
+	BOOST_TEST( !lst.has( id3 ) );
+
+	lst.erase( id1 );
+	BOOST_TEST( lst.get<int>( id2 ) == 2 );
+	BOOST_TEST( lst.get<std::string>( id1b ) == "another one" );
+}
+
+BOOST_AUTO_TEST_CASE( ranges )
+{
+	packed_soa_freelist<int, std::string> lst;
+
+	using id = decltype( lst )::id;
+
+	id single_id = lst.insert( 0, "zero" );
+
+	int ints[] = { 1, 2, 3 };
+	std::string strings[] = { "one", "two", "three" };
+	id ids_storage[3];
+	span<id> ids = lst.insert_range( make_span( ints ), make_span( strings ), make_span( ids_storage ) );
+	BOOST_TEST( ids.size() == 3 );
+	BOOST_TEST( lst.get<int>( ids[1] ) == 2 );
+	BOOST_TEST( lst.get<std::string>( ids[2] ) == "three" );
+
+	const id erased[] = { single_id, ids[1] };
+	lst.erase_range( make_span( erased ) );
+	BOOST_TEST( lst.size() == 2 );
+	BOOST_TEST( lst.get<std::string>( ids[0] ) == "one" );
+	BOOST_TEST( lst.get<int>( ids[2] ) == 3 );
+}
+
+BOOST_AUTO_TEST_CASE( copy_column )
+{
+	packed_soa_freelist<int, std::string> lst;
+
+	using id = decltype( lst )::id;
+
+	id id1 = lst.insert( 1, "one" );
+	id id2 = lst.insert( 2, "two" );
+
+	auto copy = lst;
+	lst.get<int>( id1 ) = 10;
+	lst.get<std::string>( id2 ) = "twenty";
+
+	copy.copy_column<int>( lst );
+	BOOST_TEST( copy.get<int>( id1 ) == 10 );
+	BOOST_TEST( copy.get<std::string>( id2 ) == "two" );
+
+	copy.copy_column<1>( lst );
+	BOOST_TEST( copy.get<std::string>( id2 ) == "twenty" );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/radix_sort.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	std::vector<keyed_index> make_items( size_t n, uint64_t key_mask, std::mt19937_64& rng )
+	{
+		std::vector<keyed_index> items( n );
+		for ( uint32_t i = 0; i < n; ++i )
+			items[i] = keyed_index{ rng() & key_mask, i };
+		return items;
+	}
+
+	std::vector<keyed_index> sorted_by_std( std::vector<keyed_index> items )
+	{
+		std::stable_sort( items.begin(), items.end(), []( const keyed_index& lhs, const keyed_index& rhs ) { return lhs.key < rhs.key; } );
+		return items;
+	}
+
+	bool same_order( const std::vector<keyed_index>& lhs, const std::vector<keyed_index>& rhs )
+	{
+		return std::equal( lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+		                   []( const keyed_index& l, const keyed_index& r ) { return l.key == r.key && l.idx == r.idx; } );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( radix_sort_tests )
+
+BOOST_AUTO_TEST_CASE( matches_stable_sort )
+{
+	std::mt19937_64 rng( 1 );
+
+	// full keys, few distinct keys to check stability, keys with constant bytes in the middle and on top
+	for ( uint64_t key_mask : { ~0ull, 0x7ull, 0x0000ff0000ffffffull, 0xffffull } )
+		for ( size_t n : { 0, 1, 2, 17, 1000, 65537 } )
+		{
+			std::vector<keyed_index> items = make_items( n, key_mask, rng );
+			const std::vector<keyed_index> expected = sorted_by_std( items );
+
+			std::vector<keyed_index> scratch( n + 3 );
+			radix_sort( make_span( items ), make_span( scratch ) );
+			BOOST_TEST( same_order( items, expected ) );
+		}
+}
+
+BOOST_AUTO_TEST_CASE( equal_keys_keep_order )
+{
+	std::vector<keyed_index> items = { { 5, 0 }, { 5, 1 }, { 5, 2 } };
+	std::vector<keyed_index> scratch( items.size() );
+	radix_sort( make_span( items ), make_span( scratch ) );
+	BOOST_TEST( ( items[0].idx == 0 && items[1].idx == 1 && items[2].idx == 2 ) );
+}
+
+// render item sized elements sorted by a comparison sort against sorting keys and gathering afterwards
+BOOST_AUTO_TEST_CASE( benchmark, *boost::unit_test::disabled() )
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+	struct element
+	{
+		uint64_t key;
+		uint64_t payload[8];
+	};
+
+	for ( size_t n : { 10'000, 100'000 } )
+	{
+		constexpr int nruns = 20;
+		std::mt19937_64 rng( 1 );
+		std::vector<element> elements( n );
+		for ( auto& elem : elements )
+			elem.key = rng() & 0x0fffffffffffffffull;
+
+		auto start = clock::now();
+		uint64_t checksum_std = 0;
+		for ( int run = 0; run < nruns; ++run )
+		{
+			std::vector<element> sorted = elements;
+			std::sort( sorted.begin(), sorted.end(), []( const element& lhs, const element& rhs ) { return lhs.key < rhs.key; } );
+			checksum_std += sorted[n / 2].key;
+		}
+		const double std_ms = ms_since( start ) / nruns;
+
+		start = clock::now();
+		uint64_t checksum_radix = 0;
+		for ( int run = 0; run < nruns; ++run )
+		{
+			std::vector<keyed_index> keys( n );
+			for ( uint32_t i = 0; i < n; ++i )
+				keys[i] = keyed_index{ elements[i].key, i };
+			std::vector<keyed_index> scratch( n );
+			radix_sort( make_span( keys ), make_span( scratch ) );
+
+			std::vector<element> sorted( n );
+			for ( size_t i = 0; i < n; ++i )
+				sorted[i] = elements[keys[i].idx];
+			checksum_radix += sorted[n / 2].key;
+		}
+		const double radix_ms = ms_since( start ) / nruns;
+
+		BOOST_TEST( checksum_std == checksum_radix );
+		BOOST_TEST_MESSAGE( n << " elements: std::sort " << std_ms << " ms, radix sort and gather " << radix_ms << " ms" );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
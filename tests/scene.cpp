@@ -1,6 +1,12 @@
 #include <boost/test/unit_test.hpp>
 
 #include "../src/Scene.h"
+#include "../src/SceneSnapshots.h"
+#include "../src/SceneCommandBuffer.h"
+#include "../src/UVScreenDensityCalculator.h"
+
+#include <atomic>
+#include <thread>
 
 BOOST_AUTO_TEST_SUITE( scene )
 
@@ -21,7 +27,7 @@ BOOST_AUTO_TEST_CASE( creation )
 
 	MeshInstanceID instance_id = scene.AddStaticMeshInstance( tf, submesh, material );
 
-	const StaticMeshInstance* instance = scene.AllStaticMeshInstances().try_get( instance_id );
+	const StaticMeshInstance* instance = scene.AllStaticMeshInstances().try_get<StaticMeshInstance>( instance_id );
 
 	BOOST_TEST( instance != nullptr );
 	BOOST_TEST( ( instance->Material() == material ) );
@@ -61,6 +67,26 @@ struct Fixture
 	}
 };
 
+namespace
+{
+	// perspective camera at pos looking along +z
+	CameraID AddTestCamera( Scene& scene, const DirectX::XMFLOAT3& pos )
+	{
+		Camera::Data camera_data = {};
+		camera_data.pos = pos;
+		camera_data.dir = DirectX::XMFLOAT3( 0, 0, 1 );
+		camera_data.up = DirectX::XMFLOAT3( 0, 1, 0 );
+		camera_data.aspect_ratio = 1.0f;
+		camera_data.fov_y = 1.0f;
+		camera_data.near_plane = 0.1f;
+		camera_data.far_plane = 100.0f;
+		camera_data.type = Camera::Type::Perspective;
+		CameraID camera = scene.AddCamera();
+		scene.TryModifyCamera( camera )->ModifyData() = camera_data;
+		return camera;
+	}
+}
+
 BOOST_FIXTURE_TEST_CASE( deletion, Fixture )
 {
 	// try to remove referenced material
@@ -76,4 +102,797 @@ BOOST_FIXTURE_TEST_CASE( deletion, Fixture )
 	BOOST_TEST( ! scene.AllMaterials().has( material ) );
 }
 
+BOOST_FIXTURE_TEST_CASE( change_journals, Fixture )
+{
+	BOOST_TEST( scene.ModifiedTransforms().size() == 0 );
+
+	// repeated modifications are journaled once
+	scene.TryModifyTransform( tf )->ModifyMat();
+	scene.TryModifyTransform( tf )->ModifyMat();
+	scene.TryModifyMaterial( material )->Modify();
+	BOOST_TEST( scene.ModifiedTransforms().size() == 1 );
+	BOOST_TEST( ( scene.ModifiedTransforms()[0] == tf ) );
+	BOOST_TEST( scene.ModifiedMaterials().size() == 1 );
+	BOOST_TEST( scene.ModifiedTextures().size() == 0 );
+
+	scene.ClearChangeJournals();
+	BOOST_TEST( scene.ModifiedTransforms().size() == 0 );
+	BOOST_TEST( scene.ModifiedMaterials().size() == 0 );
+	BOOST_TEST( ! scene.AllTransforms().get<ObjectTransform>( tf ).IsDirty() );
+
+	scene.TryModifyTexture( texture2 )->ModifyStagingSRV();
+	BOOST_TEST( scene.ModifiedTextures().size() == 1 );
+	BOOST_TEST( ( scene.ModifiedTextures()[0] == texture2 ) );
+
+	// removals are journaled only when they succeed
+	BOOST_TEST( ! scene.RemoveMaterial( material ) );
+	BOOST_TEST( scene.RemovedMaterials().size() == 0 );
+	BOOST_TEST( scene.RemoveStaticMeshInstance( instance_id ) );
+	BOOST_TEST( scene.RemoveMaterial( material ) );
+	BOOST_TEST( scene.RemoveTransform( tf ) );
+	BOOST_TEST( scene.RemovedMaterials().size() == 1 );
+	BOOST_TEST( ( scene.RemovedMaterials()[0] == material ) );
+	BOOST_TEST( scene.RemovedTransforms().size() == 1 );
+	BOOST_TEST( ( scene.RemovedTransforms()[0] == tf ) );
+
+	scene.ClearChangeJournals();
+	BOOST_TEST( scene.RemovedMaterials().size() == 0 );
+	BOOST_TEST( scene.RemovedTransforms().size() == 0 );
+}
+
+BOOST_FIXTURE_TEST_CASE( bulk_instances, Fixture )
+{
+	TransformID tf_storage[2];
+	span<TransformID> tfs = scene.AddTransforms( 2, make_span( tf_storage ) );
+	BOOST_TEST( tfs.size() == 2 );
+
+	const Scene::StaticMeshInstanceDesc descs[] = { { tfs[0], submesh, material },
+	                                                { tfs[1], submesh, material },
+	                                                { tfs[1], submesh, material } };
+	MeshInstanceID instance_storage[3];
+	span<MeshInstanceID> instances = scene.AddStaticMeshInstances( make_span( descs ), make_span( instance_storage ) );
+	BOOST_TEST( instances.size() == 3 );
+	BOOST_TEST( ( scene.AllStaticMeshInstances().get<StaticMeshInstance>( instances[2] ).GetTransform() == tfs[1] ) );
+	BOOST_TEST( scene.AllMaterials()[material].GetRefCount() == 4 );
+	BOOST_TEST( scene.AllTransforms().get<RefCounter>( tfs[1] ).GetRefCount() == 2 );
+
+	// nothing is added if any reference is invalid
+	const Scene::StaticMeshInstanceDesc invalid_descs[] = { { tfs[0], submesh, material },
+	                                                        { TransformID::nullid, submesh, material } };
+	BOOST_CHECK_THROW( scene.AddStaticMeshInstances( make_span( invalid_descs ), make_span( instance_storage ) ), SnowEngineException );
+	BOOST_TEST( scene.AllMaterials()[material].GetRefCount() == 4 );
+
+	// repeated ids release their references once
+	const MeshInstanceID repeated_ids[] = { instances[0], instances[1], instances[0], instances[2], instances[1] };
+	scene.RemoveStaticMeshInstances( make_span( repeated_ids ) );
+	BOOST_TEST( ! scene.AllStaticMeshInstances().has( instances[0] ) );
+	BOOST_TEST( scene.AllStaticMeshInstances().size() == 1 );
+	BOOST_TEST( scene.AllMaterials()[material].GetRefCount() == 1 );
+	BOOST_TEST( scene.AllTransforms().get<RefCounter>( tfs[0] ).GetRefCount() == 0 );
+	BOOST_TEST( scene.AllStaticSubmeshes()[submesh].GetRefCount() == 1 );
+	BOOST_TEST( scene.RemoveTransform( tfs[1] ) );
+}
+
+BOOST_AUTO_TEST_CASE( transform_hierarchy )
+{
+	Scene scene;
+
+	// children are created before their parents to check reordering
+	TransformID grandchild = scene.AddTransform();
+	TransformID child = scene.AddTransform();
+	TransformID root = scene.AddTransform();
+	scene.SetTransformParent( grandchild, child );
+	scene.SetTransformParent( child, root );
+
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( root )->ModifyMat(), DirectX::XMMatrixTranslation( 1, 0, 0 ) );
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( child )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 2, 0 ) );
+	scene.UpdateTransformHierarchy();
+
+	const auto& grandchild_world = scene.AllTransforms().get<ObjectTransform>( grandchild ).Obj2World();
+	BOOST_TEST( grandchild_world.m[3][0] == 1.0f );
+	BOOST_TEST( grandchild_world.m[3][1] == 2.0f );
+	BOOST_TEST( scene.AllTransforms().get<TransformHierarchyNode>( grandchild ).Depth() == 2 );
+
+	const auto nodes = scene.TransformHierarchySpan();
+	for ( size_t i = 1; i < nodes.size(); ++i )
+		BOOST_TEST( nodes[i - 1].Depth() <= nodes[i].Depth() );
+
+	// moving the root moves and journals the whole subtree
+	scene.ClearChangeJournals();
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( root )->ModifyMat(), DirectX::XMMatrixTranslation( 5, 0, 0 ) );
+	scene.UpdateTransformHierarchy();
+	BOOST_TEST( scene.AllTransforms().get<ObjectTransform>( grandchild ).Obj2World().m[3][0] == 5.0f );
+	BOOST_TEST( scene.ModifiedTransforms().size() == 3 );
+
+	// parents are referenced by their children
+	BOOST_TEST( ! scene.RemoveTransform( child ) );
+	BOOST_CHECK_THROW( scene.SetTransformParent( root, grandchild ), SnowEngineException );
+}
+
+BOOST_FIXTURE_TEST_CASE( snapshot_sync, Fixture )
+{
+	Scene snapshot;
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.AllStaticMeshInstances().has( instance_id ) );
+	BOOST_TEST( snapshot.AllMaterials().has( material ) );
+
+	// in-place modifications copy only modified columns, new items copy the whole storage
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( tf )->ModifyMat(), DirectX::XMMatrixTranslation( 3, 0, 0 ) );
+	scene.UpdateTransformHierarchy();
+	TransformID new_tf = scene.AddTransform();
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.AllTransforms().get<ObjectTransform>( tf ).Obj2World().m[3][0] == 3.0f );
+	BOOST_TEST( snapshot.AllTransforms().has( new_tf ) );
+
+	scene.TryModifyStaticMeshInstanceFlags( instance_id )->HasShadow() = false;
+	snapshot.SyncWith( scene );
+	BOOST_TEST( ! snapshot.AllStaticMeshInstances().get<StaticMeshInstanceFlags>( instance_id ).HasShadow() );
+
+	BOOST_TEST( scene.RemoveStaticMeshInstance( instance_id ) );
+	snapshot.SyncWith( scene );
+	BOOST_TEST( ! snapshot.AllStaticMeshInstances().has( instance_id ) );
+}
+
+BOOST_FIXTURE_TEST_CASE( idle_frame_sync, Fixture )
+{
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = DirectX::XMFLOAT3( 1, 1, 1 );
+	const CameraID camera = AddTestCamera( scene, DirectX::XMFLOAT3( 0, 0, -10 ) );
+	D3D12_VIEWPORT viewport = {};
+	viewport.Width = 512;
+	viewport.Height = 512;
+	UVScreenDensityCalculator uv_density_calculator( &scene );
+
+	// scene side of SceneManager::UpdateFramegraphBindings where nothing changes
+	// gpu managers are left out, they only check that their items still exist. DynamicSceneBuffers writes to the scene
+	// only when its buffers are rebuilt, and submesh processing only runs for journaled submeshes
+	auto run_frame = [&]()
+	{
+		scene.UpdateTransformHierarchy();
+		scene.GroupStaticMeshInstances();
+		scene.UpdateStaticMeshInstanceMasks();
+		scene.UpdateStaticMeshInstanceBounds();
+		uv_density_calculator.Update( camera, viewport );
+		BOOST_TEST( scene.AllStaticMeshes().try_get( mesh ) != nullptr );
+		BOOST_TEST( scene.AllMaterials().try_get( material ) != nullptr );
+		BOOST_TEST( scene.AllTransforms().try_get<ObjectTransform>( tf ) != nullptr );
+		scene.ClearChangeJournals();
+	};
+
+	Scene snapshot;
+	run_frame();
+	BOOST_TEST( snapshot.SyncWith( scene ) > 0 );
+
+	run_frame();
+	BOOST_TEST( snapshot.SyncWith( scene ) == 0 );
+	run_frame();
+	BOOST_TEST( snapshot.SyncWith( scene ) == 0 );
+
+	// a write copies only what it touched
+	scene.TryModifyStaticMesh( mesh );
+	run_frame();
+	BOOST_TEST( snapshot.SyncWith( scene ) == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( concurrent_snapshots )
+{
+	constexpr int nframes = 1000;
+	constexpr size_t ntfs = 64;
+
+	Scene scene;
+	TransformID tf_storage[ntfs];
+	span<TransformID> tfs = scene.AddTransforms( ntfs, make_span( tf_storage ) );
+
+	SceneSnapshots snapshots;
+	std::atomic<bool> is_writing = true;
+	std::atomic<bool> reader_failed = false;
+
+	// every frame moves all transforms by the same offset, so a torn snapshot would have different offsets
+	std::thread reader( [&]()
+	{
+		float last_offset = 0;
+		while ( is_writing )
+		{
+			if ( const Scene* snapshot = snapshots.Acquire() )
+			{
+				const auto transforms = snapshot->TransformSpan();
+				const float offset = transforms.size() == 0 ? 0 : transforms[0].Obj2World().m[3][0];
+				for ( const auto& tf : transforms )
+					if ( tf.Obj2World().m[3][0] != offset )
+						reader_failed = true;
+				if ( transforms.size() != ntfs || offset < last_offset )
+					reader_failed = true;
+				last_offset = offset;
+			}
+			snapshots.Release();
+		}
+	} );
+
+	for ( int frame = 1; frame <= nframes; ++frame )
+	{
+		for ( TransformID tf : tfs )
+			DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( tf )->ModifyMat(), DirectX::XMMatrixTranslation( float( frame ), 0, 0 ) );
+		scene.UpdateTransformHierarchy();
+		scene.ClearChangeJournals();
+
+		snapshots.Publish( scene );
+	}
+	is_writing = false;
+	reader.join();
+
+	BOOST_TEST( ! reader_failed );
+	const Scene* last_snapshot = snapshots.Acquire();
+	BOOST_TEST( last_snapshot->AllTransforms().get<ObjectTransform>( tfs[0] ).Obj2World().m[3][0] == float( nframes ) );
+	snapshots.Release();
+}
+
+BOOST_FIXTURE_TEST_CASE( command_buffers, Fixture )
+{
+	SceneCommandBuffer buffers[2];
+
+	// every worker records into its own buffer
+	std::thread worker( [&]()
+	{
+		TransformID parent = buffers[0].AddTransform( Identity4x4 );
+		TransformID child = buffers[0].AddTransform( Identity4x4, parent );
+		buffers[0].ModifyTransform( parent, Identity4x4 );
+		buffers[0].AddMeshInstance( submesh, child, material );
+	} );
+	buffers[1].RemoveMeshInstance( instance_id );
+	TransformID provisional_tf = buffers[1].AddTransform();
+	MeshInstanceID provisional_instance = buffers[1].AddMeshInstance( submesh, provisional_tf, material );
+	worker.join();
+
+	BOOST_TEST( SceneCommandBuffer::IsProvisional( provisional_tf ) );
+	BOOST_TEST( ! SceneCommandBuffer::IsProvisional( tf ) );
+
+	scene.Apply( make_span( buffers ) );
+
+	BOOST_TEST( buffers[0].AddedTransforms().size() == 2 );
+	const TransformID parent = buffers[0].AddedTransforms()[0];
+	const TransformID child = buffers[0].AddedTransforms()[1];
+	BOOST_TEST( ( scene.AllTransforms().get<TransformHierarchyNode>( child ).GetParent() == parent ) );
+
+	const TransformID real_tf = buffers[1].Resolve( provisional_tf );
+	const MeshInstanceID real_instance = buffers[1].Resolve( provisional_instance );
+	BOOST_TEST( scene.AllTransforms().has( real_tf ) );
+	BOOST_TEST( ( scene.AllStaticMeshInstances().get<StaticMeshInstance>( real_instance ).GetTransform() == real_tf ) );
+	BOOST_TEST( ! scene.AllStaticMeshInstances().has( instance_id ) );
+	BOOST_TEST( scene.AllMaterials()[material].GetRefCount() == 2 );
+
+	// ids depend only on the order of buffers
+	Fixture other;
+	other.scene.Apply( make_span( buffers ) );
+	BOOST_TEST( ( buffers[1].Resolve( provisional_tf ) == real_tf ) );
+	BOOST_TEST( ( buffers[1].Resolve( provisional_instance ) == real_instance ) );
+
+	buffers[0].Clear();
+	BOOST_TEST( buffers[0].IsEmpty() );
+}
+
+BOOST_FIXTURE_TEST_CASE( binary_snapshot, Fixture )
+{
+	TransformID child = scene.AddTransform();
+	scene.SetTransformParent( child, tf );
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( tf )->ModifyMat(), DirectX::XMMatrixTranslation( 4, 0, 0 ) );
+	scene.UpdateTransformHierarchy();
+
+	StaticMesh* mesh_data = scene.TryModifyStaticMesh( mesh );
+	mesh_data->Vertices().resize( 3 );
+	mesh_data->Vertices()[2].pos = DirectX::XMFLOAT3( 1, 2, 3 );
+	mesh_data->Indices() = { 0, 1, 2 };
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = DirectX::XMFLOAT3( 5, 5, 5 );
+
+	// freed slots must survive the round trip too
+	TextureID removed_texture = scene.AddTexture();
+	BOOST_TEST( scene.RemoveTexture( removed_texture ) );
+
+	LightID light = scene.AddLight();
+	scene.TryModifyLight( light )->ModifyData().falloff_end = 7.0f;
+
+	BOOST_TEST( scene.AllMaterials()[material].IsAlphaTested() );
+	scene.TryModifyMaterial( material )->IsAlphaTested() = false;
+
+	std::vector<uint8_t> blob;
+	scene.SaveBinary( blob );
+
+	Scene loaded;
+	BOOST_TEST( loaded.LoadBinary( make_span( blob ) ) );
+
+	BOOST_TEST( ( loaded.AllStaticMeshInstances().get<StaticMeshInstance>( instance_id ).Material() == material ) );
+	BOOST_TEST( loaded.AllMaterials()[material].GetRefCount() == 1 );
+	BOOST_TEST( ! loaded.AllMaterials()[material].IsAlphaTested() );
+	BOOST_TEST( ( loaded.AllTransforms().get<TransformHierarchyNode>( child ).GetParent() == tf ) );
+	BOOST_TEST( loaded.AllTransforms().get<ObjectTransform>( child ).Obj2World().m[3][0] == 4.0f );
+	BOOST_TEST( loaded.AllStaticMeshes()[mesh].Vertices()[2].pos.z == 3.0f );
+	BOOST_TEST( loaded.AllStaticMeshes()[mesh].Indices().size() == 3 );
+	BOOST_TEST( loaded.AllStaticSubmeshes()[submesh].Box().Extents.x == 5.0f );
+	BOOST_TEST( loaded.AllLights()[light].GetData().falloff_end == 7.0f );
+	BOOST_TEST( ! loaded.AllTextures().has( removed_texture ) );
+	BOOST_TEST( ! loaded.AllTextures()[texture1].IsLoaded() );
+
+	// the next ids are the same as in the saved scene
+	BOOST_TEST( ( loaded.AddTexture() == scene.AddTexture() ) );
+
+	// restored items report to the journals of the new scene
+	loaded.TryModifyMaterial( material )->Modify();
+	BOOST_TEST( loaded.ModifiedMaterials().size() == 1 );
+	BOOST_TEST( scene.ModifiedMaterials().size() == 0 );
+
+	// malformed blobs are rejected without touching the scene
+	std::vector<uint8_t> truncated( blob.begin(), blob.begin() + blob.size() / 2 );
+	BOOST_TEST( ! loaded.LoadBinary( make_span( truncated ) ) );
+	blob[4]++; // version
+	BOOST_TEST( ! loaded.LoadBinary( make_span( blob ) ) );
+	BOOST_TEST( loaded.AllStaticMeshInstances().has( instance_id ) );
+}
+
+BOOST_FIXTURE_TEST_CASE( instance_grouping, Fixture )
+{
+	MaterialID other_material = scene.AddMaterial( MaterialPBR::TextureIds{ texture1, texture2, texture3 } );
+	MeshInstanceID other_instance = scene.AddStaticMeshInstance( tf, submesh, other_material );
+	MeshInstanceID same_instance = scene.AddStaticMeshInstance( tf, submesh, material );
+
+	scene.GroupStaticMeshInstances();
+
+	const auto instances = scene.StaticMeshInstanceSpan();
+	BOOST_TEST( instances.size() == 3 );
+	BOOST_TEST( ( instances[0].Material() == instances[1].Material() ) );
+	BOOST_TEST( ( instances[1].Material() != instances[2].Material() ) );
+	BOOST_TEST( ( scene.AllStaticMeshInstances().get<StaticMeshInstance>( other_instance ).Material() == other_material ) );
+	BOOST_TEST( ( scene.AllStaticMeshInstances().get<StaticMeshInstance>( same_instance ).Material() == material ) );
+}
+
+BOOST_FIXTURE_TEST_CASE( reverse_references, Fixture )
+{
+	auto contains = []( const auto& ids, auto id ) { return std::find( ids.begin(), ids.end(), id ) != ids.end(); };
+
+	TextureID texture4 = scene.AddTexture();
+	MaterialID other_material = scene.AddMaterial( MaterialPBR::TextureIds{ texture1, texture4, texture4, texture4 } );
+
+	// a texture used in several slots of one material is listed once
+	BOOST_TEST( scene.MaterialsUsingTexture( texture4 ).size() == 1 );
+	BOOST_TEST( scene.MaterialsUsingTexture( texture1 ).size() == 2 );
+	BOOST_TEST( scene.MaterialsUsingTexture( texture2 ).size() == 1 );
+
+	TransformID other_tf = scene.AddTransform();
+	const Scene::StaticMeshInstanceDesc descs[] = { { tf, submesh, other_material }, { other_tf, submesh, other_material } };
+	MeshInstanceID ids[2];
+	scene.AddStaticMeshInstances( make_span( descs ), make_span( ids ) );
+
+	BOOST_TEST( scene.InstancesUsingSubmesh( submesh ).size() == 3 );
+	BOOST_TEST( scene.InstancesUsingMaterial( material ).size() == 1 );
+	BOOST_TEST( contains( scene.InstancesUsingMaterial( other_material ), ids[1] ) );
+	BOOST_TEST( scene.InstancesUsingTransform( tf ).size() == 2 );
+	BOOST_TEST( contains( scene.InstancesUsingTransform( other_tf ), ids[1] ) );
+
+	scene.RemoveStaticMeshInstance( instance_id );
+	BOOST_TEST( scene.InstancesUsingMaterial( material ).size() == 0 );
+	BOOST_TEST( scene.InstancesUsingTransform( tf ).size() == 1 );
+	BOOST_TEST( contains( scene.InstancesUsingTransform( tf ), ids[0] ) );
+
+	// a material still used by instances is not removed and keeps its links
+	BOOST_TEST( ! scene.RemoveMaterial( other_material ) );
+	BOOST_TEST( scene.MaterialsUsingTexture( texture4 ).size() == 1 );
+	BOOST_TEST( scene.AllTextures()[texture4].GetRefCount() == 3 );
+
+	BOOST_TEST( scene.RemoveMaterial( material ) );
+	BOOST_TEST( scene.MaterialsUsingTexture( texture2 ).size() == 0 );
+	BOOST_TEST( ( scene.MaterialsUsingTexture( texture1 )[0] == other_material ) );
+	BOOST_TEST( scene.InstancesUsingMaterial( material ).size() == 0 );
+
+	// references are rebuilt on load and copied to snapshots
+	std::vector<uint8_t> blob;
+	scene.SaveBinary( blob );
+	Scene loaded;
+	BOOST_TEST( loaded.LoadBinary( make_span( blob ) ) );
+	BOOST_TEST( loaded.InstancesUsingSubmesh( submesh ).size() == 2 );
+	BOOST_TEST( loaded.MaterialsUsingTexture( texture4 ).size() == 1 );
+
+	Scene snapshot;
+	snapshot.SyncWith( scene );
+	scene.RemoveStaticMeshInstances( make_span( std::as_const( ids ) ) );
+	BOOST_TEST( scene.InstancesUsingSubmesh( submesh ).size() == 0 );
+	BOOST_TEST( snapshot.InstancesUsingSubmesh( submesh ).size() == 2 );
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.InstancesUsingSubmesh( submesh ).size() == 0 );
+}
+
+BOOST_FIXTURE_TEST_CASE( instance_masks, Fixture )
+{
+	MaterialID other_material = scene.AddMaterial( MaterialPBR::TextureIds{ texture1, texture2, texture3 } );
+	MeshInstanceID other_instance = scene.AddStaticMeshInstance( tf, submesh, other_material );
+	MeshInstanceID same_instance = scene.AddStaticMeshInstance( tf, submesh, material );
+
+	StaticMeshInstanceFlags& other_flags = *scene.TryModifyStaticMeshInstanceFlags( other_instance );
+	other_flags.IsEnabled() = false;
+	other_flags.LayerMask() = 0b110;
+	scene.TryModifyStaticMeshInstanceFlags( same_instance )->HasShadow() = false;
+
+	scene.GroupStaticMeshInstances();
+	scene.UpdateStaticMeshInstanceMasks();
+
+	// masks follow the packed order after grouping
+	const auto& masks = scene.GetStaticMeshInstanceMasks();
+	const auto instances = scene.StaticMeshInstanceSpan();
+	BOOST_TEST( masks.enabled.size() == 3 );
+	for ( size_t i = 0; i < instances.size(); ++i )
+	{
+		const bool is_other = instances[i].Material() == other_material;
+		BOOST_TEST( masks.enabled.test( i ) == ! is_other );
+		BOOST_TEST( masks.layers[0].test( i ) == ! is_other );
+		BOOST_TEST( masks.layers[1].test( i ) == is_other );
+		BOOST_TEST( masks.layers[2].test( i ) == is_other );
+	}
+	BOOST_TEST( masks.casts_shadow.count() == 2 );
+	BOOST_TEST( masks.dynamic.count() == 0 );
+
+	Scene snapshot;
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.GetStaticMeshInstanceMasks().enabled.count() == 2 );
+
+	scene.RemoveStaticMeshInstance( same_instance );
+	scene.TryModifyStaticMeshInstanceFlags( other_instance )->IsEnabled() = true;
+	scene.GroupStaticMeshInstances();
+	scene.UpdateStaticMeshInstanceMasks();
+	BOOST_TEST( scene.GetStaticMeshInstanceMasks().enabled.size() == 2 );
+	BOOST_TEST( scene.GetStaticMeshInstanceMasks().enabled.count() == 2 );
+
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.GetStaticMeshInstanceMasks().enabled.count() == 2 );
+}
+
+BOOST_AUTO_TEST_CASE( instance_bvh )
+{
+	Scene scene;
+
+	TransformID near_tf = scene.AddTransform();
+	TransformID far_tf = scene.AddTransform();
+	StaticMeshID mesh = scene.AddStaticMesh();
+	StaticSubmeshID submesh = scene.AddStaticSubmesh( mesh );
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = { 1, 1, 1 };
+	MaterialID material = scene.AddMaterial( MaterialPBR::TextureIds{ scene.AddTexture(), scene.AddTexture(), scene.AddTexture() } );
+
+	MeshInstanceID near_instance = scene.AddStaticMeshInstance( near_tf, submesh, material );
+	scene.AddStaticMeshInstance( far_tf, submesh, material );
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( near_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 0, 10 ) );
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( far_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 0, -10 ) );
+
+	auto update = [&scene]()
+	{
+		scene.UpdateTransformHierarchy();
+		scene.GroupStaticMeshInstances();
+		scene.UpdateStaticMeshInstanceBounds();
+		scene.ClearChangeJournals();
+	};
+	update();
+
+	// every plane is z >= 0
+	frustum front_half;
+	front_half.planes.fill( { 0, 0, 1, 0 } );
+	auto visible_instances = [&front_half]( const Scene& scene )
+	{
+		std::vector<MeshInstanceID> res;
+		scene.StaticMeshInstanceBVH().cull( front_half, [&]( uint32_t idx ) { res.push_back( scene.AllStaticMeshInstances().get_id( idx ) ); } );
+		return res;
+	};
+
+	BOOST_TEST( scene.StaticMeshInstanceBVH().size() == 2 );
+	auto visible = visible_instances( scene );
+	BOOST_TEST( visible.size() == 1 );
+	BOOST_TEST( ( visible[0] == near_instance ) );
+
+	Scene snapshot;
+	snapshot.SyncWith( scene );
+
+	// moved transforms are refitted
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( far_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 0, 5 ) );
+	update();
+	BOOST_TEST( visible_instances( scene ).size() == 2 );
+	BOOST_TEST( visible_instances( snapshot ).size() == 1 );
+	snapshot.SyncWith( scene );
+	BOOST_TEST( visible_instances( snapshot ).size() == 2 );
+
+	// removed instances are gone after a rebuild
+	scene.RemoveStaticMeshInstance( near_instance );
+	update();
+	BOOST_TEST( scene.StaticMeshInstanceBVH().size() == 1 );
+	BOOST_TEST( visible_instances( scene ).size() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( dynamic_instances )
+{
+	Scene scene;
+
+	StaticMeshID mesh = scene.AddStaticMesh();
+	StaticSubmeshID submesh = scene.AddStaticSubmesh( mesh );
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = { 1, 1, 1 };
+	MaterialID material = scene.AddMaterial( MaterialPBR::TextureIds{ scene.AddTexture(), scene.AddTexture(), scene.AddTexture() } );
+
+	TransformID static_tf = scene.AddTransform();
+	TransformID vehicle_tf = scene.AddTransform();
+	MeshInstanceID static_instance = scene.AddStaticMeshInstance( static_tf, submesh, material );
+	MeshInstanceID vehicle = scene.AddStaticMeshInstance( vehicle_tf, submesh, material );
+	scene.TryModifyStaticMeshInstanceFlags( vehicle )->IsDynamic() = true;
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( static_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 0, 10 ) );
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( vehicle_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 0, -10 ) );
+
+	auto update = [&scene]()
+	{
+		scene.UpdateTransformHierarchy();
+		scene.GroupStaticMeshInstances();
+		scene.UpdateStaticMeshInstanceBounds();
+		scene.ClearChangeJournals();
+	};
+	update();
+
+	auto query = [&scene]( const auto& volume )
+	{
+		std::vector<MeshInstanceID> res;
+		scene.QueryStaticMeshInstances( volume, [&]( uint32_t idx ) { res.push_back( scene.AllStaticMeshInstances().get_id( idx ) ); } );
+		return res;
+	};
+
+	// the vehicle is only in the grid
+	BOOST_TEST( scene.StaticMeshInstanceBVH().size() == 1 );
+	BOOST_TEST( scene.DynamicMeshInstanceGrid().size() == 1 );
+	BOOST_TEST( ( query( aabb{ { -1, -1, -11 }, { 1, 1, -9 } } ) == std::vector<MeshInstanceID>{ vehicle } ) );
+
+	// moving it changes neither the bvh nor the list of changed static boxes
+	const auto& changes = scene.LastStaticMeshInstanceBoundsChanges();
+	const uint64_t rebuild_version = changes.version;
+	const aabb bvh_bounds = scene.StaticMeshInstanceBVH().bounds();
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( vehicle_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 0, 30 ) );
+	update();
+	BOOST_TEST( changes.version == rebuild_version );
+	BOOST_TEST( scene.StaticMeshInstanceBVH().bounds().max[2] == bvh_bounds.max[2] );
+	BOOST_TEST( query( sphere{ { 0, 0, -10 }, 2.0f } ).empty() );
+	BOOST_TEST( ( query( sphere{ { 0, 0, 30 }, 2.0f } ) == std::vector<MeshInstanceID>{ vehicle } ) );
+
+	// every plane is z >= 0, both instances are in front
+	frustum front_half;
+	front_half.planes.fill( { 0, 0, 1, 0 } );
+	BOOST_TEST( query( front_half ).size() == 2 );
+
+	std::vector<uint8_t> masks( 2, 0 );
+	scene.QueryStaticMeshInstances( make_span( &front_half, &front_half + 1 ), make_span( masks ) );
+	BOOST_TEST( masks[0] == 1 );
+	BOOST_TEST( masks[1] == 1 );
+
+	Scene snapshot;
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.DynamicMeshInstanceGrid().size() == 1 );
+
+	// other flags keep the structures, a changed dynamic flag rebuilds them
+	scene.TryModifyStaticMeshInstanceFlags( static_instance )->HasShadow() = false;
+	update();
+	BOOST_TEST( changes.version == rebuild_version );
+
+	scene.TryModifyStaticMeshInstanceFlags( vehicle )->IsDynamic() = false;
+	update();
+	BOOST_TEST( changes.version == rebuild_version + 1 );
+	BOOST_TEST( changes.all );
+	BOOST_TEST( scene.StaticMeshInstanceBVH().size() == 2 );
+	BOOST_TEST( scene.DynamicMeshInstanceGrid().size() == 0 );
+	BOOST_TEST( query( front_half ).size() == 2 );
+}
+
+BOOST_AUTO_TEST_CASE( surface_queries )
+{
+	Scene scene;
+
+	// a quad in the z = 0 plane, its submesh box is flat as well
+	StaticMeshID quad_mesh = scene.AddStaticMesh();
+	{
+		StaticMesh* mesh = scene.TryModifyStaticMesh( quad_mesh );
+		for ( const auto& pos : { DirectX::XMFLOAT3{ -1, -1, 0 }, DirectX::XMFLOAT3{ 1, -1, 0 }, DirectX::XMFLOAT3{ 1, 1, 0 }, DirectX::XMFLOAT3{ -1, 1, 0 } } )
+			mesh->Vertices().push_back( Vertex{ pos, { 0, 0, -1 }, { 0, 0 } } );
+		mesh->Indices() = { 0, 1, 2, 0, 2, 3 };
+	}
+	StaticSubmeshID quad = scene.AddStaticSubmesh( quad_mesh );
+	scene.TryModifyStaticSubmesh( quad )->Modify() = StaticSubmesh::Data{ 6, 0, 0 };
+	scene.TryModifyStaticSubmesh( quad )->Box().Extents = { 1, 1, 0 };
+
+	// a mesh without cpu-side geometry
+	StaticSubmeshID gpu_only = scene.AddStaticSubmesh( scene.AddStaticMesh() );
+	scene.TryModifyStaticSubmesh( gpu_only )->Box().Extents = { 1, 1, 1 };
+
+	MaterialID material = scene.AddMaterial( MaterialPBR::TextureIds{ scene.AddTexture(), scene.AddTexture(), scene.AddTexture() } );
+
+	auto add_instance = [&]( StaticSubmeshID submesh, float x, float z )
+	{
+		TransformID tf = scene.AddTransform();
+		DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( tf )->ModifyMat(), DirectX::XMMatrixTranslation( x, 0, z ) );
+		return scene.AddStaticMeshInstance( tf, submesh, material );
+	};
+	MeshInstanceID near_quad = add_instance( quad, 0, 5 );
+	MeshInstanceID far_quad = add_instance( quad, 0, 10 );
+	MeshInstanceID side_box = add_instance( gpu_only, 20, 5 );
+
+	// the far quad moves every frame
+	scene.TryModifyStaticMeshInstanceFlags( far_quad )->IsDynamic() = true;
+
+	scene.UpdateTransformHierarchy();
+	scene.GroupStaticMeshInstances();
+	scene.UpdateStaticMeshInstanceBounds();
+	scene.ClearChangeJournals();
+
+	// nearest hit, through the hole between the triangles' boxes and the surface, and past a shortened ray
+	auto hit = scene.RaycastStaticMeshInstances( ray{ { 0.5f, 0.5f, 0 }, { 0, 0, 1 } } );
+	BOOST_TEST( hit.has_value() );
+	BOOST_TEST( ( hit->instance == near_quad ) );
+	BOOST_TEST( hit->t == 5.0f );
+
+	hit = scene.RaycastStaticMeshInstances( ray{ { 0.5f, 0.5f, 7 }, { 0, 0, 1 } } );
+	BOOST_TEST( ( hit.has_value() && hit->instance == far_quad && hit->t == 3.0f ) );
+	BOOST_TEST( ! scene.RaycastStaticMeshInstances( ray{ { 0.5f, 0.5f, 0 }, { 0, 0, 1 }, 4.0f } ).has_value() );
+	BOOST_TEST( ! scene.RaycastAnyStaticMeshInstance( ray{ { 1.5f, 0.5f, 0 }, { 0, 0, 1 } } ) );
+	BOOST_TEST( scene.RaycastAnyStaticMeshInstance( ray{ { 0.5f, 0.5f, 0 }, { 0, 0, 1 } } ) );
+
+	// instances without geometry are hit at their boxes
+	hit = scene.RaycastStaticMeshInstances( ray{ { 20, 0, 0 }, { 0, 0, 1 } } );
+	BOOST_TEST( ( hit.has_value() && hit->instance == side_box && hit->t == 4.0f ) );
+
+	// a box between the quads overlaps no triangle, one through a quad does
+	BOOST_TEST( scene.OverlapStaticMeshInstances( aabb{ { -1, -1, 6 }, { 1, 1, 9 } } ).empty() );
+	const auto overlapping = scene.OverlapStaticMeshInstances( aabb{ { -0.1f, -0.1f, 9 }, { 0.1f, 0.1f, 11 } } );
+	BOOST_TEST( ( overlapping == std::vector<MeshInstanceID>{ far_quad } ) );
+
+	// disabled instances and other layers don't take part
+	scene.TryModifyStaticMeshInstanceFlags( near_quad )->IsEnabled() = false;
+	hit = scene.RaycastStaticMeshInstances( ray{ { 0.5f, 0.5f, 0 }, { 0, 0, 1 } } );
+	BOOST_TEST( ( hit.has_value() && hit->instance == far_quad ) );
+	BOOST_TEST( ! scene.RaycastAnyStaticMeshInstance( ray{ { 0.5f, 0.5f, 0 }, { 0, 0, 1 } }, 2 ) );
+
+	// trees are cached, changed draw args rebuild them
+	const auto tree = scene.SubmeshTriangleBVH( quad );
+	BOOST_TEST( tree->triangle_count() == 2 );
+	BOOST_TEST( scene.SubmeshTriangleBVH( quad ) == tree );
+	BOOST_TEST( scene.SubmeshTriangleBVH( gpu_only ) == nullptr );
+
+	// modifying another mesh keeps the tree, modifying its own mesh rebuilds it
+	scene.TryModifyStaticMesh( scene.AllStaticSubmeshes()[gpu_only].GetMesh() );
+	BOOST_TEST( scene.SubmeshTriangleBVH( quad ) == tree );
+	scene.TryModifyStaticMesh( quad_mesh )->Indices() = { 0, 1, 2, 0, 2, 3, 0, 1, 2 };
+	BOOST_TEST( scene.SubmeshTriangleBVH( quad ) != tree );
+	BOOST_TEST( scene.SubmeshTriangleBVH( quad )->triangle_count() == 2 );
+
+	scene.TryModifyStaticSubmesh( quad )->Modify().idx_cnt = 3;
+	BOOST_TEST( scene.SubmeshTriangleBVH( quad )->triangle_count() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( instance_world_boxes )
+{
+	Scene scene;
+
+	TransformID tf = scene.AddTransform();
+	TransformID other_tf = scene.AddTransform();
+	StaticMeshID mesh = scene.AddStaticMesh();
+	StaticSubmeshID submesh = scene.AddStaticSubmesh( mesh );
+	StaticSubmeshID other_submesh = scene.AddStaticSubmesh( mesh );
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = { 1, 1, 1 };
+	scene.TryModifyStaticSubmesh( other_submesh )->Box().Extents = { 1, 1, 1 };
+	MaterialID material = scene.AddMaterial( MaterialPBR::TextureIds{ scene.AddTexture(), scene.AddTexture(), scene.AddTexture() } );
+
+	MeshInstanceID instance = scene.AddStaticMeshInstance( tf, submesh, material );
+	MeshInstanceID other_instance = scene.AddStaticMeshInstance( other_tf, other_submesh, material );
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( tf )->ModifyMat(), DirectX::XMMatrixTranslation( 10, 0, 0 ) );
+
+	auto update = [&scene]()
+	{
+		scene.UpdateTransformHierarchy();
+		scene.GroupStaticMeshInstances();
+		scene.UpdateStaticMeshInstanceBounds();
+		scene.ClearChangeJournals();
+	};
+	auto world_box = [&scene]( MeshInstanceID id )
+	{
+		const auto& instances = scene.AllStaticMeshInstances();
+		return scene.StaticMeshInstanceWorldBoxSpan()[&instances.get<StaticMeshInstance>( id ) - instances.get_column<StaticMeshInstance>().begin()];
+	};
+	update();
+
+	BOOST_TEST( scene.StaticMeshInstanceWorldBoxSpan().size() == 2 );
+	BOOST_TEST( world_box( instance ).min[0] == 9.0f );
+	BOOST_TEST( world_box( instance ).max[0] == 11.0f );
+	BOOST_TEST( world_box( other_instance ).max[0] == 1.0f );
+
+	const auto& changes = scene.LastStaticMeshInstanceBoundsChanges();
+	const uint64_t rebuild_version = changes.version;
+	BOOST_TEST( changes.all );
+
+	// a box edited behind the journal's back is not picked up, only journaled changes are
+	scene.TryModifyStaticSubmesh( other_submesh )->Box().Extents = { 3, 3, 3 };
+	update();
+	BOOST_TEST( world_box( other_instance ).max[0] == 1.0f );
+	BOOST_TEST( changes.version == rebuild_version );
+
+	scene.TryModifyStaticSubmesh( submesh )->Modify();
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = { 2, 2, 2 };
+	update();
+	BOOST_TEST( world_box( instance ).min[0] == 8.0f );
+	BOOST_TEST( world_box( instance ).max[0] == 12.0f );
+	BOOST_TEST( world_box( other_instance ).max[0] == 1.0f );
+
+	BOOST_TEST( changes.version == rebuild_version + 1 );
+	BOOST_TEST( ! changes.all );
+	BOOST_TEST( changes.instances.size() == 1 );
+
+	DirectX::XMStoreFloat4x4( &scene.TryModifyTransform( other_tf )->ModifyMat(), DirectX::XMMatrixTranslation( 0, 5, 0 ) );
+	update();
+	BOOST_TEST( world_box( other_instance ).max[0] == 3.0f );
+	BOOST_TEST( world_box( other_instance ).min[1] == 2.0f );
+	BOOST_TEST( world_box( instance ).max[0] == 12.0f );
+
+	// the list holds packed indices
+	BOOST_TEST( changes.version == rebuild_version + 2 );
+	BOOST_TEST( changes.instances.size() == 1 );
+	BOOST_TEST( scene.StaticMeshInstanceWorldBoxSpan()[changes.instances[0]].max[0] == 3.0f );
+
+	// nothing changed, the last list stays
+	update();
+	BOOST_TEST( changes.version == rebuild_version + 2 );
+	BOOST_TEST( changes.instances.size() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( instance_screen_sizes )
+{
+	Scene scene;
+
+	StaticSubmeshID submesh = scene.AddStaticSubmesh( scene.AddStaticMesh() );
+	MaterialID material = scene.AddMaterial( MaterialPBR::TextureIds{ scene.AddTexture(), scene.AddTexture(), scene.AddTexture() } );
+	scene.AddStaticMeshInstance( scene.AddTransform(), submesh, material );
+	scene.AddStaticMeshInstance( scene.AddTransform(), submesh, material );
+
+	BOOST_TEST( scene.StaticMeshInstanceScreenSizeSpan().size() == 0 );
+
+	// sized by the number of instances, copied to snapshots like other derived instance data
+	span<float> screen_sizes = scene.ModifyStaticMeshInstanceScreenSizes();
+	BOOST_TEST( screen_sizes.size() == 2 );
+	screen_sizes[0] = 0.5f;
+	screen_sizes[1] = 40.0f;
+
+	Scene snapshot;
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.StaticMeshInstanceScreenSizeSpan().size() == 2 );
+	BOOST_TEST( snapshot.StaticMeshInstanceScreenSizeSpan()[1] == 40.0f );
+
+	scene.ModifyStaticMeshInstanceScreenSizes()[1] = 3.0f;
+	snapshot.SyncWith( scene );
+	BOOST_TEST( snapshot.StaticMeshInstanceScreenSizeSpan()[1] == 3.0f );
+}
+
+BOOST_FIXTURE_TEST_CASE( screen_size_updates, Fixture )
+{
+	scene.TryModifyStaticSubmesh( submesh )->Box().Extents = DirectX::XMFLOAT3( 1, 1, 1 );
+	const CameraID camera = AddTestCamera( scene, DirectX::XMFLOAT3( 0, 0, -10 ) );
+
+	D3D12_VIEWPORT viewport = {};
+	viewport.Width = 512;
+	viewport.Height = 512;
+
+	UVScreenDensityCalculator calculator( &scene );
+	Scene snapshot;
+	auto run_frame = [&]()
+	{
+		scene.UpdateTransformHierarchy();
+		scene.UpdateStaticMeshInstanceMasks();
+		scene.UpdateStaticMeshInstanceBounds();
+		calculator.Update( camera, viewport );
+		scene.ClearChangeJournals();
+		return snapshot.SyncWith( scene );
+	};
+
+	BOOST_TEST( run_frame() > 0 );
+	const float screen_size = snapshot.StaticMeshInstanceScreenSizeSpan()[0];
+	BOOST_TEST( screen_size > 0.0f );
+
+	// same camera, same sizes, the column stays as it is
+	BOOST_TEST( run_frame() == 0 );
+
+	// only the camera and the sizes are copied after the camera moves
+	scene.TryModifyCamera( camera )->ModifyData().pos = DirectX::XMFLOAT3( 0, 0, -20 );
+	BOOST_TEST( run_frame() == 2 );
+	BOOST_TEST( snapshot.StaticMeshInstanceScreenSizeSpan()[0] < screen_size );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/triangle_bvh.h"
+
+#include <chrono>
+#include <random>
+
+namespace
+{
+	using matrix = float[4][4];
+	using vec3 = std::array<float, 3>;
+
+	struct mesh
+	{
+		std::vector<float> positions; // x, y, z and 2 floats of padding per vertex, like a vertex with more attributes
+		std::vector<uint32_t> indices;
+	};
+
+	constexpr size_t Stride = 5;
+
+	vec3 vertex( const mesh& m, uint32_t idx ) { return { m.positions[idx * Stride], m.positions[idx * Stride + 1], m.positions[idx * Stride + 2] }; }
+
+	// triangles scattered around the origin
+	mesh make_triangle_soup( size_t ntriangles, float world_size, std::mt19937& rng )
+	{
+		std::uniform_real_distribution<float> pos( -world_size, world_size );
+		std::uniform_real_distribution<float> offset( -1.0f, 1.0f );
+		mesh res;
+		for ( size_t i = 0; i < ntriangles; ++i )
+		{
+			const vec3 center = { pos( rng ), pos( rng ), pos( rng ) };
+			for ( size_t corner = 0; corner < 3; ++corner )
+			{
+				res.indices.push_back( uint32_t( res.positions.size() / Stride ) );
+				for ( size_t axis = 0; axis < 3; ++axis )
+					res.positions.push_back( center[axis] + offset( rng ) );
+				res.positions.push_back( 0 );
+				res.positions.push_back( 0 );
+			}
+		}
+		return res;
+	}
+
+	// closed unit cube [-1, 1]^3 with shared vertices
+	mesh make_cube()
+	{
+		mesh res;
+		for ( uint32_t i = 0; i < 8; ++i )
+			res.positions.insert( res.positions.end(), { i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f, 0, 0 } );
+		res.indices = { 0, 1, 3, 0, 3, 2,   4, 6, 7, 4, 7, 5,   0, 4, 5, 0, 5, 1,
+		                2, 3, 7, 2, 7, 6,   0, 2, 6, 0, 6, 4,   1, 5, 7, 1, 7, 3 };
+		return res;
+	}
+
+	vec3 transform_point( const vec3& p, const matrix& m )
+	{
+		vec3 res;
+		for ( size_t j = 0; j < 3; ++j )
+			res[j] = p[0] * m[0][j] + p[1] * m[1][j] + p[2] * m[2][j] + m[3][j];
+		return res;
+	}
+
+	// nearest hit of the world-space ray with the world-space triangles, by solving for t directly
+	float raycast_linear( const ray& r, const mesh& m, const matrix& obj2world, uint32_t& hit_triangle )
+	{
+		float best_t = -1;
+		for ( uint32_t tri = 0; tri < m.indices.size() / 3; ++tri )
+		{
+			const vec3 v0 = transform_point( vertex( m, m.indices[tri * 3] ), obj2world );
+			const vec3 v1 = transform_point( vertex( m, m.indices[tri * 3 + 1] ), obj2world );
+			const vec3 v2 = transform_point( vertex( m, m.indices[tri * 3 + 2] ), obj2world );
+			const vec3 e1 = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+			const vec3 e2 = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+			const vec3 n = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			const float denom = n[0] * r.dir[0] + n[1] * r.dir[1] + n[2] * r.dir[2];
+			if ( denom == 0 )
+				continue;
+
+			const float t = ( n[0] * ( v0[0] - r.origin[0] ) + n[1] * ( v0[1] - r.origin[1] ) + n[2] * ( v0[2] - r.origin[2] ) ) / denom;
+			if ( t < 0 || t > r.t_max || ( best_t >= 0 && t >= best_t ) )
+				continue;
+
+			// inside if the point is on the same side of every edge as the normal
+			const vec3 p = { r.origin[0] + r.dir[0] * t, r.origin[1] + r.dir[1] * t, r.origin[2] + r.dir[2] * t };
+			bool is_inside = true;
+			for ( const auto& [a, b] : { std::pair{ v0, v1 }, std::pair{ v1, v2 }, std::pair{ v2, v0 } } )
+			{
+				const vec3 edge = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+				const vec3 to_p = { p[0] - a[0], p[1] - a[1], p[2] - a[2] };
+				const vec3 c = { edge[1] * to_p[2] - edge[2] * to_p[1], edge[2] * to_p[0] - edge[0] * to_p[2], edge[0] * to_p[1] - edge[1] * to_p[0] };
+				is_inside &= c[0] * n[0] + c[1] * n[1] + c[2] * n[2] >= 0;
+			}
+			if ( is_inside )
+			{
+				best_t = t;
+				hit_triangle = tri;
+			}
+		}
+		return best_t;
+	}
+
+	// rotation around y by 0.5 rad, scale 2 along x, then a translation
+	void make_placement( matrix& res )
+	{
+		const float c = std::cos( 0.5f );
+		const float s = std::sin( 0.5f );
+		const matrix m = { { 2 * c, 0, -2 * s, 0 }, { 0, 1, 0, 0 }, { s, 0, c, 0 }, { 10, -5, 3, 1 } };
+		std::copy( &m[0][0], &m[0][0] + 16, &res[0][0] );
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( triangle_bvh_tests )
+
+BOOST_AUTO_TEST_CASE( raycast_matches_linear )
+{
+	std::mt19937 rng( 17 );
+	const mesh soup = make_triangle_soup( 2000, 20.0f, rng );
+
+	triangle_bvh tree;
+	tree.build( soup.positions.data(), Stride, make_span( std::as_const( soup.indices ) ) );
+	BOOST_TEST( tree.triangle_count() == 2000 );
+
+	matrix obj2world;
+	make_placement( obj2world );
+
+	std::uniform_real_distribution<float> pos( -30.0f, 30.0f );
+	size_t nhits = 0;
+	size_t nmismatches = 0;
+	for ( int i = 0; i < 500; ++i )
+	{
+		// rays from outside towards random points near the mesh, some of them short
+		const vec3 target = transform_point( { pos( rng ), pos( rng ), pos( rng ) }, obj2world );
+		ray r;
+		r.origin = { 100.0f, pos( rng ), pos( rng ) };
+		r.dir = { ( target[0] - r.origin[0] ) * 0.1f, ( target[1] - r.origin[1] ) * 0.1f, ( target[2] - r.origin[2] ) * 0.1f };
+		r.t_max = i % 4 == 0 ? 8.0f : std::numeric_limits<float>::infinity();
+
+		uint32_t expected_triangle = 0;
+		const float expected_t = raycast_linear( r, soup, obj2world, expected_triangle );
+
+		triangle_bvh::hit hit;
+		const bool is_hit = tree.raycast( r, obj2world, hit );
+		nhits += is_hit;
+		nmismatches += is_hit != ( expected_t >= 0 ) || tree.raycast_any( r, obj2world ) != is_hit;
+		if ( is_hit && expected_t >= 0 )
+			nmismatches += std::abs( hit.t - expected_t ) > 1.e-3f * expected_t || hit.triangle != expected_triangle;
+	}
+	BOOST_TEST( nhits > 50 );
+	BOOST_TEST( nmismatches == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( cube_surface )
+{
+	const mesh cube = make_cube();
+	triangle_bvh tree;
+	tree.build( cube.positions.data(), Stride, make_span( std::as_const( cube.indices ) ) );
+
+	const matrix identity = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+
+	// from outside, from inside, and stopping short of the surface
+	triangle_bvh::hit hit;
+	BOOST_TEST( tree.raycast( ray{ { -5, 0.5f, 0.25f }, { 1, 0, 0 } }, identity, hit ) );
+	BOOST_TEST( hit.t == 4.0f );
+	BOOST_TEST( tree.raycast( ray{ { 0, 0, 0 }, { 0, 0, 2 } }, identity, hit ) );
+	BOOST_TEST( hit.t == 0.5f );
+	BOOST_TEST( ! tree.raycast_any( ray{ { -5, 0, 0 }, { 1, 0, 0 }, 3.9f }, identity ) );
+	BOOST_TEST( ! tree.raycast_any( ray{ { -5, 3, 0 }, { 1, 0, 0 } }, identity ) );
+
+	// only the surface counts, a box inside the cube doesn't touch any triangle
+	BOOST_TEST( ! tree.overlaps( aabb{ { -0.5f, -0.5f, -0.5f }, { 0.5f, 0.5f, 0.5f } }, identity ) );
+	BOOST_TEST( tree.overlaps( aabb{ { 0.5f, -0.1f, -0.1f }, { 1.5f, 0.1f, 0.1f } }, identity ) );
+	BOOST_TEST( tree.overlaps( aabb{ { -3, -3, -3 }, { 3, 3, 3 } }, identity ) );
+	BOOST_TEST( ! tree.overlaps( aabb{ { 1.1f, 1.1f, 1.1f }, { 2, 2, 2 } }, identity ) );
+
+	// rotated by 45 degrees, the first box touches a corner, the second one only the object space box of the cube
+	const float c = std::cos( 0.785398f );
+	const matrix rotated = { { c, c, 0, 0 }, { -c, c, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+	BOOST_TEST( tree.overlaps( aabb{ { 1.3f, -0.05f, -0.05f }, { 1.5f, 0.05f, 0.05f } }, rotated ) );
+	BOOST_TEST( ! tree.overlaps( aabb{ { 0.9f, 0.9f, -0.05f }, { 1.0f, 1.0f, 0.05f } }, rotated ) );
+	BOOST_TEST( tree.raycast( ray{ { -5, -5, 0 }, { 1, 1, 0 } }, rotated, hit ) );
+	BOOST_TEST( std::abs( hit.t - ( 5.0f - c ) ) < 1.e-4f );
+
+	tree.clear();
+	BOOST_TEST( tree.triangle_count() == 0 );
+	BOOST_TEST( ! tree.raycast_any( ray{ { -5, 0, 0 }, { 1, 0, 0 } }, identity ) );
+}
+
+// picks against a dense mesh, the linear path is what a tool would do without the tree
+BOOST_AUTO_TEST_CASE( benchmark, *boost::unit_test::disabled() )
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+	std::mt19937 rng( 1 );
+	const mesh soup = make_triangle_soup( 200'000, 100.0f, rng );
+	matrix obj2world;
+	make_placement( obj2world );
+
+	auto start = clock::now();
+	triangle_bvh tree;
+	tree.build( soup.positions.data(), Stride, make_span( std::as_const( soup.indices ) ) );
+	const double build_ms = ms_since( start );
+
+	std::uniform_real_distribution<float> pos( -100.0f, 100.0f );
+	std::vector<ray> rays( 1000 );
+	for ( ray& r : rays )
+	{
+		r.origin = { 500.0f, pos( rng ), pos( rng ) };
+		const vec3 target = transform_point( { pos( rng ), pos( rng ), pos( rng ) }, obj2world );
+		r.dir = { target[0] - r.origin[0], target[1] - r.origin[1], target[2] - r.origin[2] };
+	}
+
+	start = clock::now();
+	size_t nhits_tree = 0;
+	for ( const ray& r : rays )
+	{
+		triangle_bvh::hit hit;
+		nhits_tree += tree.raycast( r, obj2world, hit );
+	}
+	const double tree_us = ms_since( start ) * 1000.0 / rays.size();
+
+	constexpr size_t nlinear = 20;
+	start = clock::now();
+	size_t nhits_linear = 0;
+	for ( size_t i = 0; i < nlinear; ++i )
+	{
+		uint32_t triangle;
+		nhits_linear += raycast_linear( rays[i], soup, obj2world, triangle ) >= 0;
+	}
+	const double linear_us = ms_since( start ) * 1000.0 / nlinear;
+
+	BOOST_TEST( nhits_tree > 0 );
+	BOOST_TEST_MESSAGE( soup.indices.size() / 3 << " triangles: build " << build_ms << " ms, raycast " << tree_us
+	                    << " us with the tree, " << linear_us << " us linear (" << nhits_linear << " of " << nlinear << " hit)" );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,209 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/visibility_cache.h"
+
+#include <random>
+
+namespace
+{
+	using matrix = float[4][4];
+
+	// DirectX-style left-handed perspective, aspect = 1.5, near = 0.1, far = 200
+	void make_proj( float fov_y, matrix& res )
+	{
+		const float ys = 1.0f / std::tan( fov_y * 0.5f );
+		const float zs = 200.0f / ( 200.0f - 0.1f );
+		const matrix proj = { { ys / 1.5f, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zs, 1 }, { 0, 0, -0.1f * zs, 0 } };
+		std::copy( &proj[0][0], &proj[0][0] + 16, &res[0][0] );
+	}
+
+	// camera at pos looking along ( sin( yaw ), 0, cos( yaw ) ), the view basis is stored in columns
+	void make_view( const std::array<float, 3>& pos, float yaw, matrix& res )
+	{
+		const std::array<float, 3> right = { std::cos( yaw ), 0, -std::sin( yaw ) };
+		const std::array<float, 3> up = { 0, 1, 0 };
+		const std::array<float, 3> forward = { std::sin( yaw ), 0, std::cos( yaw ) };
+		const std::array<float, 3>* basis[3] = { &right, &up, &forward };
+		for ( size_t j = 0; j < 3; ++j )
+		{
+			for ( size_t i = 0; i < 3; ++i )
+				res[i][j] = ( *basis[j] )[i];
+			res[3][j] = -( pos[0] * ( *basis[j] )[0] + pos[1] * ( *basis[j] )[1] + pos[2] * ( *basis[j] )[2] );
+			res[j][3] = 0;
+		}
+		res[3][3] = 1;
+	}
+
+	frustum make_view_frustum( const visibility_cache::view& v )
+	{
+		matrix view_proj;
+		for ( size_t i = 0; i < 4; ++i )
+			for ( size_t j = 0; j < 4; ++j )
+			{
+				view_proj[i][j] = 0;
+				for ( size_t k = 0; k < 4; ++k )
+					view_proj[i][j] += v.view[i][k] * v.proj[k][j];
+			}
+		return make_frustum( view_proj );
+	}
+
+	struct camera_key
+	{
+		std::array<float, 3> pos;
+		float yaw;
+		float fov_y;
+	};
+
+	struct replay_result
+	{
+		size_t nmismatches = 0;
+		size_t nfull_culls = 0;
+	};
+
+	// moves the camera through the keys in nsteps frames each, every frame some boxes may be moved.
+	// Every frame the cached result is compared to testing every box
+	replay_result replay( const std::vector<camera_key>& keys, uint32_t nsteps, std::vector<aabb>& boxes, size_t nmoved_per_frame,
+	                      visibility_cache& cache )
+	{
+		bvh tree;
+		tree.build( make_span( std::as_const( boxes ) ) );
+
+		std::mt19937 rng( 11 );
+		std::uniform_int_distribution<uint32_t> box_idx( 0, uint32_t( boxes.size() - 1 ) );
+		std::uniform_real_distribution<float> shift( -0.5f, 0.5f );
+
+		replay_result res;
+		std::vector<uint32_t> moved;
+		for ( size_t key_idx = 0; key_idx + 1 < keys.size(); ++key_idx )
+			for ( uint32_t step = 0; step < nsteps; ++step )
+			{
+				const camera_key& from = keys[key_idx];
+				const camera_key& to = keys[key_idx + 1];
+				const float t = float( step ) / nsteps;
+				auto lerp = [t]( float a, float b ) { return a + ( b - a ) * t; };
+
+				visibility_cache::view v;
+				make_view( { lerp( from.pos[0], to.pos[0] ), lerp( from.pos[1], to.pos[1] ), lerp( from.pos[2], to.pos[2] ) },
+				           lerp( from.yaw, to.yaw ), v.view );
+				make_proj( t < 0.5f ? from.fov_y : to.fov_y, v.proj );
+
+				moved.clear();
+				for ( size_t i = 0; i < nmoved_per_frame; ++i )
+				{
+					const uint32_t idx = box_idx( rng );
+					const float offset[3] = { shift( rng ), shift( rng ), shift( rng ) };
+					for ( size_t axis = 0; axis < 3; ++axis )
+					{
+						boxes[idx].min[axis] += offset[axis];
+						boxes[idx].max[axis] += offset[axis];
+					}
+					moved.push_back( idx );
+				}
+				if ( ! moved.empty() )
+					tree.refit( make_span( std::as_const( boxes ) ) );
+
+				res.nfull_culls += cache.update( v, tree, make_span( std::as_const( boxes ) ), make_span( std::as_const( moved ) ) );
+
+				const frustum f = make_view_frustum( v );
+				for ( size_t i = 0; i < boxes.size(); ++i )
+					res.nmismatches += cache.visible().test( i ) != intersects( f, boxes[i] );
+			}
+		return res;
+	}
+
+	std::vector<aabb> make_random_boxes( size_t n, std::mt19937& rng )
+	{
+		std::uniform_real_distribution<float> pos( -100.0f, 100.0f );
+		std::uniform_real_distribution<float> extent( 0.1f, 2.0f );
+		std::vector<aabb> boxes( n );
+		for ( auto& box : boxes )
+			box = aabb::from_center_extents( { pos( rng ), pos( rng ), pos( rng ) }, { extent( rng ), extent( rng ), extent( rng ) } );
+		return boxes;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE( visibility_cache_tests )
+
+BOOST_AUTO_TEST_CASE( slow_walk_reuses_results )
+{
+	std::mt19937 rng( 1 );
+	std::vector<aabb> boxes = make_random_boxes( 5000, rng );
+
+	visibility_cache cache;
+	cache.set_margin( 2.0f );
+	cache.set_max_age( 16 );
+
+	// 0.02 units per frame along a straight line
+	const std::vector<camera_key> keys = { { { 0, 0, -120 }, 0, 1.0f }, { { 0, 0, -100 }, 0, 1.0f } };
+	const replay_result res = replay( keys, 1000, boxes, 0, cache );
+
+	BOOST_TEST( res.nmismatches == 0 );
+	BOOST_TEST( res.nfull_culls < 1000 / 16 + 2 );
+	BOOST_TEST( cache.retested_count() < boxes.size() / 4 );
+}
+
+BOOST_AUTO_TEST_CASE( camera_paths_never_drop_visible_boxes )
+{
+	std::mt19937 rng( 2 );
+	std::vector<aabb> boxes = make_random_boxes( 5000, rng );
+
+	// slow pans, a fast turn, a jump and a zoom, while boxes keep moving
+	const std::vector<camera_key> keys = {
+		{ { 0, 0, -120 }, 0, 1.0f },
+		{ { 5, 0, -110 }, 0.05f, 1.0f },
+		{ { 5, 2, -100 }, 0.1f, 1.0f },
+		{ { 10, 2, -90 }, 1.5f, 1.0f },
+		{ { -50, 0, 0 }, 1.5f, 1.0f },
+		{ { -48, 0, 1 }, 1.4f, 0.6f },
+		{ { -48, 0, 1 }, 1.4f, 0.6f } };
+
+	for ( size_t nmoved_per_frame : { size_t( 0 ), size_t( 3 ) } )
+		for ( float margin : { 0.5f, 4.0f } )
+		{
+			visibility_cache cache;
+			cache.set_margin( margin );
+			cache.set_max_age( 30 );
+
+			std::vector<aabb> moving_boxes = boxes;
+			const replay_result res = replay( keys, 40, moving_boxes, nmoved_per_frame, cache );
+			BOOST_TEST( res.nmismatches == 0 );
+			BOOST_TEST( res.nfull_culls < ( keys.size() - 1 ) * 40 );
+		}
+
+	// no reuse at all
+	visibility_cache cache;
+	cache.set_max_age( 0 );
+	const replay_result res = replay( keys, 10, boxes, 0, cache );
+	BOOST_TEST( res.nmismatches == 0 );
+	BOOST_TEST( res.nfull_culls == ( keys.size() - 1 ) * 10 );
+}
+
+BOOST_AUTO_TEST_CASE( invalidation )
+{
+	std::mt19937 rng( 3 );
+	std::vector<aabb> boxes = make_random_boxes( 500, rng );
+	bvh tree;
+	tree.build( make_span( std::as_const( boxes ) ) );
+
+	visibility_cache::view v;
+	make_view( { 0, 0, -120 }, 0, v.view );
+	make_proj( 1.0f, v.proj );
+
+	visibility_cache cache;
+	BOOST_TEST( cache.update( v, tree, make_span( std::as_const( boxes ) ), span<const uint32_t>() ) );
+	BOOST_TEST( ! cache.update( v, tree, make_span( std::as_const( boxes ) ), span<const uint32_t>() ) );
+
+	cache.invalidate();
+	BOOST_TEST( cache.update( v, tree, make_span( std::as_const( boxes ) ), span<const uint32_t>() ) );
+
+	// a different set of boxes
+	boxes.pop_back();
+	tree.build( make_span( std::as_const( boxes ) ) );
+	BOOST_TEST( cache.update( v, tree, make_span( std::as_const( boxes ) ), span<const uint32_t>() ) );
+
+	// a different projection
+	make_proj( 1.1f, v.proj );
+	BOOST_TEST( cache.update( v, tree, make_span( std::as_const( boxes ) ), span<const uint32_t>() ) );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
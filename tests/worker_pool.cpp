@@ -0,0 +1,189 @@
+#include <boost/test/unit_test.hpp>
+
+#include "../src/utils/worker_pool.h"
+
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+BOOST_AUTO_TEST_SUITE( worker_pool_tests )
+
+BOOST_AUTO_TEST_CASE( for_each )
+{
+    worker_pool pool( 3 );
+
+    std::vector<int> elems( 10007 );
+    std::iota( elems.begin(), elems.end(), 0 );
+
+    parallel_for_each( make_span( elems ), 64, []( int& elem ) { elem *= 2; }, pool );
+    bool all_processed_once = true;
+    for ( size_t i = 0; i < elems.size(); ++i )
+        all_processed_once &= elems[i] == int( i * 2 );
+    BOOST_TEST( all_processed_once );
+
+    // the pool is reusable, and a pool without workers runs everything on the calling thread
+    worker_pool inline_pool( 0 );
+    for ( worker_pool* p : { &pool, &inline_pool } )
+    {
+        std::atomic<size_t> counter = 0;
+        parallel_for_each( make_span( elems ), 100, [&counter]( const int& ) { counter++; }, *p );
+        BOOST_TEST( counter == elems.size() );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( reduce )
+{
+    worker_pool pool( 3 );
+
+    std::vector<uint64_t> elems( 5000 );
+    std::iota( elems.begin(), elems.end(), 1 );
+
+    auto sum_chunk = []( span<const uint64_t> chunk ) { return std::accumulate( chunk.begin(), chunk.end(), uint64_t( 0 ) ); };
+    auto add = []( uint64_t lhs, uint64_t rhs ) { return lhs + rhs; };
+
+    const uint64_t sum = parallel_reduce( make_span( std::as_const( elems ) ), 128, uint64_t( 7 ), sum_chunk, add, pool );
+    BOOST_TEST( sum == 7 + 5000 * 5001 / 2 );
+
+    // chunk results are folded in order
+    std::vector<char> letters = { 'a', 'b', 'c', 'd', 'e', 'f', 'g' };
+    auto concat = []( std::string lhs, std::string rhs ) { return lhs + rhs; };
+    auto to_string = []( span<const char> chunk ) { return std::string( chunk.begin(), chunk.end() ); };
+    BOOST_TEST( parallel_reduce( make_span( std::as_const( letters ) ), 2, std::string( ">" ), to_string, concat, pool ) == ">abcdefg" );
+}
+
+BOOST_AUTO_TEST_CASE( nesting_and_errors )
+{
+    worker_pool pool( 2 );
+
+    std::vector<std::vector<int>> rows( 16, std::vector<int>( 100, 1 ) );
+    parallel_for_each( make_span( rows ), 1, [&pool]( std::vector<int>& row )
+    {
+        parallel_for_each( make_span( row ), 10, []( int& elem ) { elem++; }, pool );
+    }, pool );
+
+    int total = 0;
+    for ( const auto& row : rows )
+        total += std::accumulate( row.begin(), row.end(), 0 );
+    BOOST_TEST( total == 16 * 100 * 2 );
+
+    std::vector<int> elems( 1000, 0 );
+    BOOST_CHECK_THROW( parallel_for_each( make_span( elems ), 10, [&elems]( int& elem )
+    {
+        if ( &elem - elems.data() == 500 )
+            throw std::runtime_error( "task failed" );
+    }, pool ), std::runtime_error );
+
+    // the pool is still usable after an exception
+    std::atomic<int> counter = 0;
+    pool.run( 50, [&counter]( size_t ) { counter++; } );
+    BOOST_TEST( counter == 50 );
+}
+
+BOOST_AUTO_TEST_CASE( gather )
+{
+    std::mt19937 rng( 3 );
+    std::bernoulli_distribution coin( 0.7 );
+
+    dense_bitset bits;
+    bits.resize( 10000 );
+    for ( size_t i = 0; i < bits.size(); ++i )
+        bits.set( i, coin( rng ) );
+
+    // odd indices are rejected, accepted outputs must come out in index order for any number of threads
+    auto make = []( size_t idx, size_t& out ) { out = idx; return idx % 2 == 0; };
+
+    std::vector<size_t> expected;
+    bits.for_each_set( [&expected]( size_t idx ) { if ( idx % 2 == 0 ) expected.push_back( idx ); } );
+
+    for ( uint32_t nworkers : { 0, 1, 3, 7 } )
+    {
+        worker_pool pool( nworkers );
+        for ( size_t words_per_task : { 1, 3, 1000 } )
+        {
+            std::vector<size_t> out( bits.size(), 0 );
+            const size_t nout = parallel_gather( bits.words(), words_per_task, make_span( out ), make, pool );
+            out.resize( nout );
+            BOOST_TEST( out == expected, boost::test_tools::per_element() );
+        }
+    }
+
+    std::vector<size_t> out;
+    BOOST_TEST( parallel_gather( dense_bitset().words(), 4, make_span( out ), make ) == 0 );
+}
+
+// mimics SceneRenderer::CreateRenderitems: a few indirections per instance, residency checks, 2/3 of instances visible
+BOOST_AUTO_TEST_CASE( gather_scaling_benchmark, *boost::unit_test::disabled() )
+{
+    using clock = std::chrono::high_resolution_clock;
+    auto ms_since = []( clock::time_point start ) { return std::chrono::duration<double, std::milli>( clock::now() - start ).count(); };
+
+    struct instance { uint32_t submesh, material, transform; };
+    struct item { uint64_t geometry, material, transform; uint32_t index_count; };
+
+    constexpr size_t ninstances = 1'000'000;
+    constexpr uint32_t nsubmeshes = 20'000;
+    constexpr uint32_t nmaterials = 2'000;
+    constexpr uint32_t ntextures = 6'000;
+
+    std::mt19937 rng( 1 );
+    std::vector<instance> instances( ninstances );
+    for ( size_t i = 0; i < ninstances; ++i )
+        instances[i] = instance{ uint32_t( rng() % nsubmeshes ), uint32_t( rng() % nmaterials ), uint32_t( i ) };
+    std::vector<uint32_t> submesh_mesh( nsubmeshes );
+    for ( uint32_t& mesh : submesh_mesh )
+        mesh = rng() % ( nsubmeshes / 4 );
+    std::vector<std::array<uint32_t, 4>> material_textures( nmaterials );
+    for ( auto& textures : material_textures )
+        for ( uint32_t& tex : textures )
+            tex = rng() % ntextures;
+    std::vector<uint8_t> texture_loaded( ntextures );
+    for ( uint8_t& loaded : texture_loaded )
+        loaded = rng() % 50 != 0;
+    std::vector<uint64_t> transform_addr( ninstances );
+    std::iota( transform_addr.begin(), transform_addr.end(), uint64_t( 0x10000 ) );
+
+    dense_bitset visible;
+    visible.resize( ninstances );
+    for ( size_t i = 0; i < ninstances; ++i )
+        visible.set( i, rng() % 3 != 0 );
+
+    auto make = [&]( size_t i, item& out )
+    {
+        const instance& inst = instances[i];
+        for ( uint32_t tex : material_textures[inst.material] )
+            if ( ! texture_loaded[tex] )
+                return false;
+        out = item{ submesh_mesh[inst.submesh], inst.material, transform_addr[inst.transform], inst.submesh };
+        return true;
+    };
+
+    std::vector<item> reference;
+    double single_thread_ms = 0;
+    constexpr int nruns = 10;
+    for ( uint32_t nthreads = 1; nthreads <= 16; ++nthreads )
+    {
+        worker_pool pool( nthreads - 1 );
+        std::vector<item> items( ninstances );
+        size_t nitems = 0;
+
+        const auto start = clock::now();
+        for ( int run = 0; run < nruns; ++run )
+            nitems = parallel_gather( visible.words(), 4, make_span( items ), make, pool );
+        const double ms = ms_since( start ) / nruns;
+
+        items.resize( nitems );
+        if ( nthreads == 1 )
+        {
+            reference = items;
+            single_thread_ms = ms;
+        }
+        BOOST_TEST( std::equal( items.begin(), items.end(), reference.begin(), reference.end(), []( const item& lhs, const item& rhs )
+        {
+            return lhs.geometry == rhs.geometry && lhs.material == rhs.material && lhs.transform == rhs.transform;
+        } ) );
+        BOOST_TEST_MESSAGE( nthreads << " threads: " << ms << " ms, speedup " << single_thread_ms / ms << ", " << nitems << " items" );
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()